@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "arena.h"
+#include "common.h"
+#include "compiler.h"
+#include "global_pool.h"
+#include "object.h"
+#include "scheduler.h"
+#include "string_pool.h"
+#include "utils.h"
+#include "vm.h"
+
+#if defined(ROC_DISPATCH_SWITCH)
+#define DISPATCH_NAME "switch"
+#elif defined(ROC_DISPATCH_GOTO)
+#define DISPATCH_NAME "goto"
+#elif defined(ROC_DISPATCH_TAILCALL)
+#define DISPATCH_NAME "tailcall"
+#elif defined(ROC_DISPATCH_CACHED)
+#define DISPATCH_NAME "cached"
+#endif
+
+#define DEFAULT_ITERATIONS 20
+#define PROFILE_TOP_PAIRS 24
+#define TIER_TOP_FUNCTIONS 16
+
+// these are pretty big, keep them off the stack like main.cpp does
+static VirtualMachine VIRTUAL_MACHINE;
+static Compiler COMPILER;
+
+// compiles and runs the script once, returning how long Interpret took. with a
+// budget that's every Resume it took to get to the end as well
+auto static RunOnce(const char* src, bool registers, bool jit, bool tiers, bool gc, u64 budget, Value* result)
+    -> f64 {
+  StringPool string_pool;
+  Arena<Object> string_object_pool;
+  Arena<Object> object_pool;
+  GlobalPool global_pool;
+  string_pool.Init(&string_object_pool);
+  global_pool.Init(&object_pool);
+
+  COMPILER.Init(src, &string_pool, &global_pool);
+  const CompileResult compile_res = COMPILER.Compile();
+  if (compile_res.IsError()) {
+    fprintf(stderr, "Failed to compile benchmark script\n");
+    exit(1);
+  }
+
+  VIRTUAL_MACHINE.Init();
+#if defined(ROC_JIT)
+  VIRTUAL_MACHINE.EnableJit(jit);
+#else
+  (void)jit;
+#endif
+  VIRTUAL_MACHINE.ConfigureBudget({budget, BudgetAction::Yield});
+
+  const auto start = std::chrono::steady_clock::now();
+  auto status = registers ? VIRTUAL_MACHINE.InterpretRegisters(compile_res.Get(), &string_pool, &object_pool)
+                          : VIRTUAL_MACHINE.Interpret(compile_res.Get(), &string_pool, &object_pool);
+  while (status.IsError() && status.Err() == InterpretError::Suspended) {
+    status = VIRTUAL_MACHINE.Resume();
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  if (status.IsError()) {
+    fprintf(stderr, "Benchmark script failed: %s\n", ErrorToString(status.Err()));
+    exit(1);
+  }
+
+  *result = status.Get();
+  if (tiers) {
+    VIRTUAL_MACHINE.PrintTierReport(TIER_TOP_FUNCTIONS);
+  }
+  if (gc) {
+    const GcStats stats = VIRTUAL_MACHINE.GcReport();
+    printf("gc: %llu minor (max %.3f ms total %.3f ms), %llu promoted\n",
+           static_cast<unsigned long long>(stats.minor_collections), stats.max_minor_pause_ms,
+           stats.total_minor_pause_ms, static_cast<unsigned long long>(stats.promoted));
+    printf("gc: %llu full (max %.3f ms total %.3f ms), %llu freed, %llu live (%llu bytes)\n",
+           static_cast<unsigned long long>(stats.collections), stats.max_pause_ms, stats.total_pause_ms,
+           static_cast<unsigned long long>(stats.freed), static_cast<unsigned long long>(stats.live),
+           static_cast<unsigned long long>(stats.live_bytes));
+  }
+  VIRTUAL_MACHINE.Deinit();
+
+  return std::chrono::duration<f64, std::milli>(end - start).count();
+}
+
+// spawns copies of the script onto a Scheduler with a worker per core, and
+// returns how long it took until every one of them was done
+auto static RunBatch(const char* src, u32 copies, bool jit, Value* result) -> f64 {
+  TierConfig tiers;
+  tiers.native = jit;
+  Scheduler scheduler;
+  scheduler.Init(0, tiers);
+  defer(scheduler.Deinit());
+
+  DynamicArray<TaskId> tasks;
+  tasks.Init();
+  defer(tasks.Deinit());
+
+  const auto start = std::chrono::steady_clock::now();
+  for (u32 i = 0; i < copies; i++) {
+    tasks.Append(scheduler.Spawn(src));
+  }
+  for (u32 i = 0; i < copies; i++) {
+    const auto status = scheduler.Join(tasks[i]);
+    if (status.IsError()) {
+      fprintf(stderr, "Benchmark script failed: %s\n", ErrorToString(status.Err()));
+      exit(1);
+    }
+    *result = status.Get();
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<f64, std::milli>(end - start).count();
+}
+
+auto main(int argc, char** argv) -> int {
+  u32 iterations = DEFAULT_ITERATIONS;
+  bool registers = false;
+  bool jit = true;
+  bool tiers = false;
+  bool gc = false;
+  u32 copies = 0;
+  u64 budget = 0;
+  int first_script = 1;
+
+  while (first_script < argc) {
+    if (argc > first_script + 1 && strcmp(argv[first_script], "-n") == 0) {
+      iterations = static_cast<u32>(atoi(argv[first_script + 1]));
+      first_script += 2;
+    } else if (argc > first_script + 1 && strcmp(argv[first_script], "-j") == 0) {
+      copies = static_cast<u32>(atoi(argv[first_script + 1]));
+      first_script += 2;
+    } else if (argc > first_script + 1 && strcmp(argv[first_script], "-b") == 0) {
+      budget = strtoull(argv[first_script + 1], nullptr, 10);
+      first_script += 2;
+    } else if (strcmp(argv[first_script], "-r") == 0) {
+      registers = true;
+      first_script++;
+    } else if (strcmp(argv[first_script], "-i") == 0) {
+      jit = false;
+      first_script++;
+    } else if (strcmp(argv[first_script], "-t") == 0) {
+      tiers = true;
+      first_script++;
+    } else if (strcmp(argv[first_script], "-g") == 0) {
+      gc = true;
+      first_script++;
+    } else {
+      break;
+    }
+  }
+
+  if (first_script >= argc || iterations == 0 || (copies > 0 && (registers || budget > 0))) {
+    printf("Usage: roc_bench [-n iterations] [-r] [-i] [-t] [-g] [-j copies] [-b safepoints] script...\n");
+    printf("  -r  run the register code instead of the stack code\n");
+    printf("  -i  interpreter only, don't compile hot functions to native code\n");
+    printf("  -t  print what every function ended up running as after the last run\n");
+    printf("  -g  print what the collector did and how long it paused for in the last run\n");
+    printf("  -j  time that many copies running at once on a worker per core, not with -r\n");
+    printf("  -b  yield every that many safepoints and resume straight away, not with -j\n");
+    return 1;
+  }
+
+#if !defined(ROC_JIT)
+  jit = false;
+#endif
+  const char* mode = registers ? "register" : jit ? "jit" : "stack";
+  if (copies > 0) {
+    mode = jit ? "jit-j" : "stack-j";
+  }
+
+  for (int i = first_script; i < argc; i++) {
+    char* src = Utils::ReadFile(argv[i]);
+    defer(free(src));
+
+    Value result;
+    f64 total = 0;
+    f64 best = 0;
+
+    for (u32 j = 0; j < iterations; j++) {
+      const f64 elapsed = copies > 0 ? RunBatch(src, copies, jit, &result)
+                                     : RunOnce(src, registers, jit, tiers && j == iterations - 1,
+                                               gc && j == iterations - 1, budget, &result);
+      total += elapsed;
+      best = j == 0 ? elapsed : std::min(best, elapsed);
+    }
+
+    printf("%-10s %-8s %-40s min %10.3f ms  mean %10.3f ms  result ", DISPATCH_NAME, mode, argv[i], best,
+           total / iterations);
+    result.Print();
+    printf("\n");
+  }
+
+#if defined(ROC_PROFILE_OPCODES)
+  // stack code only, and summed over every script that was run
+  VIRTUAL_MACHINE.PrintOpcodeProfile(PROFILE_TOP_PAIRS);
+#endif
+
+  return 0;
+}
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <new>
 
 #include "common.h"
 #include "memory.h"
@@ -11,6 +13,16 @@
 template <typename T>
 concept Nodeable = requires { T::next; };
 
+// Handed out to every arena, and again whenever one is cleared. Anything that
+// holds on to a pointer from Nth can compare generations to know if that slot
+// might mean something else now. Growing never invalidates anything, a full
+// arena chains on another one and existing slots never move.
+//
+// Free puts a slot on a free list threaded through T::next, and Alloc hands
+// those back out before growing. Every slot comes out of Alloc freshly
+// constructed.
+inline std::atomic<u64> ARENA_GENERATIONS = 1;
+
 template <Nodeable T>
 class Arena {
  public:
@@ -39,6 +51,14 @@ class Arena {
   auto Clear() -> void;
   auto AllocatedBytes() const -> u64;
   auto Nth(u64 idx) -> T*;
+  auto IndexOf(const T* entry) const -> u64;
+  auto Generation() const -> u64 { return this->generation; }
+  // slots handed out so far, the ones sitting on the free list included
+  auto Slots() const -> u64;
+  auto Live() const -> u64 { return this->Slots() - this->freed; }
+  // every slot Slots counts, in index order
+  template <typename F>
+  auto ForEach(F visit) -> void;
 
  private:
   auto Push() -> u64;
@@ -49,6 +69,9 @@ class Arena {
   T* data;
   Arena<T>* next = nullptr;
   T* first_free = nullptr;
+  // how long the free list is, only the first arena in the chain keeps one
+  u64 freed = 0;
+  u64 generation = ARENA_GENERATIONS++;
 };
 
 template <Nodeable T>
@@ -69,25 +92,39 @@ auto Arena<T>::Push() -> u64 {
 
 template <Nodeable T>
 auto Arena<T>::AllocatedBytes() const -> u64 {
-  return this->count * sizeof(T);
+  return this->Live() * sizeof(T);
+}
+
+template <Nodeable T>
+auto Arena<T>::Slots() const -> u64 {
+  return this->count + (this->next != nullptr ? this->next->Slots() : 0);
 }
 
 template <Nodeable T>
 auto Arena<T>::Clear() -> void {
   this->count = 0;
+  this->first_free = nullptr;
+  this->freed = 0;
+  if (this->next != nullptr) {
+    this->next->Clear();
+  }
+  this->generation = ARENA_GENERATIONS++;
 }
 
 template <Nodeable T>
 auto Arena<T>::Alloc() -> u64 {
   T* result = this->first_free;
   if (result != nullptr) {
-    this->first_free = this->first_free->next;
-    this->first_free->next = nullptr;
+    this->first_free = result->next;
+    this->freed--;
+    new (result) T();
 
-    return result - this->data;
+    return this->IndexOf(result);
   }
 
-  return this->Push();
+  const u64 idx = this->Push();
+  new (this->Nth(idx)) T();
+  return idx;
 }
 
 template <Nodeable T>
@@ -95,12 +132,29 @@ auto Arena<T>::Free(T* entry) -> void {
   entry->next = this->first_free;
   this->first_free = entry;
 
-  this->count--;
+  this->freed++;
+}
+
+template <Nodeable T>
+template <typename F>
+auto Arena<T>::ForEach(F visit) -> void {
+  for (Arena<T>* arena = this; arena != nullptr; arena = arena->next) {
+    for (u64 i = 0; i < arena->count; i++) {
+      visit(&arena->data[i]);
+    }
+  }
+}
+
+template <Nodeable T>
+auto Arena<T>::IndexOf(const T* entry) const -> u64 {
+  if (entry < this->data || entry >= this->data + this->capacity) return this->capacity + this->next->IndexOf(entry);
+
+  return entry - this->data;
 }
 
 template <Nodeable T>
 auto Arena<T>::Nth(u64 idx) -> T* {
-  if (idx > this->capacity) return this->next->Nth(idx - this->capacity);
+  if (idx >= this->capacity) return this->next->Nth(idx - this->capacity);
 
   return &this->data[idx];
 }
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "value.h"
+
+// Shared by the baseline JIT and the trace compiler.
+
+enum Reg : u8 {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RSI = 6,
+  RDI = 7,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15,
+};
+
+// Only the handful of x86-64 instructions the templates need. Memory operands
+// are always [base + disp32], which keeps the encoding to one form.
+class Assembler {
+ public:
+  Assembler() { this->code.Init(); }
+  ~Assembler() { this->code.Deinit(); }
+
+  auto Bytes(std::initializer_list<u8> bytes) -> void {
+    for (u8 byte : bytes) this->code.Append(byte);
+  }
+
+  auto Imm32(u32 num) -> void { this->code.Append(reinterpret_cast<u8*>(&num), sizeof(u32)); }
+  auto Imm64(u64 num) -> void { this->code.Append(reinterpret_cast<u8*>(&num), sizeof(u64)); }
+
+  auto Push(Reg reg) -> void {
+    if (reg >= 8) this->Bytes({0x41});
+    this->Bytes({static_cast<u8>(0x50 + (reg & 7))});
+  }
+
+  auto Pop(Reg reg) -> void {
+    if (reg >= 8) this->Bytes({0x41});
+    this->Bytes({static_cast<u8>(0x58 + (reg & 7))});
+  }
+
+  // mov dst, src
+  auto Mov(Reg dst, Reg src) -> void { this->RegReg(0x89, src, dst); }
+  // mov dst, imm64
+  auto Mov(Reg dst, u64 imm) -> void {
+    this->Rex(true, 0, dst);
+    this->Bytes({static_cast<u8>(0xB8 + (dst & 7))});
+    this->Imm64(imm);
+  }
+  // mov dst, [base + disp]
+  auto Load(Reg dst, Reg base, int disp) -> void { this->Mem(true, {0x8B}, dst, base, disp); }
+  // mov [base + disp], src
+  auto Store(Reg base, int disp, Reg src) -> void { this->Mem(true, {0x89}, src, base, disp); }
+  // mov byte [base + disp], al
+  auto StoreAl(Reg base, int disp) -> void { this->Mem(false, {0x88}, RAX, base, disp); }
+  // mov dword [base + disp], imm32
+  auto Store32(Reg base, int disp, u32 imm) -> void {
+    this->Mem(false, {0xC7}, 0, base, disp);
+    this->Imm32(imm);
+  }
+  // add qword [base + disp], imm32
+  auto AddImm(Reg base, int disp, int imm) -> void {
+    this->Mem(true, {0x81}, 0, base, disp);
+    this->Imm32(static_cast<u32>(imm));
+  }
+  // cmp dword [base + disp], imm8
+  auto Cmp32(Reg base, int disp, u8 imm) -> void {
+    this->Mem(false, {0x83}, 7, base, disp);
+    this->Bytes({imm});
+  }
+  // cmp byte [base + disp], imm8
+  auto Cmp8(Reg base, int disp, u8 imm) -> void {
+    this->Mem(false, {0x80}, 7, base, disp);
+    this->Bytes({imm});
+  }
+  // cmp qword [base + disp], imm8
+  auto Cmp64(Reg base, int disp, u8 imm) -> void {
+    this->Mem(true, {0x83}, 7, base, disp);
+    this->Bytes({imm});
+  }
+  auto Cmp(Reg lhs, Reg rhs) -> void { this->RegReg(0x39, rhs, lhs); }
+  // cmp reg, imm32
+  auto Cmp(Reg lhs, int imm) -> void {
+    this->RegReg(0x81, 7, lhs);
+    this->Imm32(static_cast<u32>(imm));
+  }
+  // add reg, imm32
+  auto AddImm(Reg dst, int imm) -> void {
+    this->RegReg(0x81, 0, dst);
+    this->Imm32(static_cast<u32>(imm));
+  }
+  auto Add(Reg dst, Reg src) -> void { this->RegReg(0x01, src, dst); }
+  auto Sub(Reg dst, Reg src) -> void { this->RegReg(0x29, src, dst); }
+  // imul dst, src
+  auto Imul(Reg dst, Reg src) -> void {
+    this->Rex(true, dst, src);
+    this->Bytes({0x0F, 0xAF, static_cast<u8>(0xC0 | ((dst & 7) << 3) | (src & 7))});
+  }
+  // shl/shr/sar reg, imm8
+  auto Shl(Reg dst, u8 imm) -> void {
+    this->RegReg(0xC1, 4, dst);
+    this->Bytes({imm});
+  }
+  auto Shr(Reg dst, u8 imm) -> void {
+    this->RegReg(0xC1, 5, dst);
+    this->Bytes({imm});
+  }
+  auto Sar(Reg dst, u8 imm) -> void {
+    this->RegReg(0xC1, 7, dst);
+    this->Bytes({imm});
+  }
+  auto And(Reg dst, Reg src) -> void { this->RegReg(0x21, src, dst); }
+  auto Or(Reg dst, Reg src) -> void { this->RegReg(0x09, src, dst); }
+  auto Xor(Reg dst, Reg src) -> void { this->RegReg(0x31, src, dst); }
+
+  // scalar double ops, F2 0F op is movsd/addsd/etc, 66 0F 2E is ucomisd
+  auto Sse(u8 prefix, u8 op, Reg base, int disp, u8 xmm = 0) -> void {
+    this->Bytes({prefix});
+    this->Mem(false, {0x0F, op}, xmm, base, disp);
+  }
+  auto Sse(u8 prefix, u8 op, u8 dst, u8 src) -> void {
+    this->Bytes({prefix, 0x0F, op, static_cast<u8>(0xC0 | (dst << 3) | src)});
+  }
+  // movq xmm, reg
+  auto Movq(u8 xmm, Reg src) -> void {
+    this->Bytes({0x66});
+    this->Rex(true, xmm, src);
+    this->Bytes({0x0F, 0x6E, static_cast<u8>(0xC0 | (xmm << 3) | (src & 7))});
+  }
+
+  // seta al; movzx eax, al
+  auto SetAbove() -> void { this->Bytes({0x0F, 0x97, 0xC0, 0x0F, 0xB6, 0xC0}); }
+  // sete al; setnp cl; and al, cl; movzx eax, al, NaNs aren't equal to anything
+  auto SetEqual() -> void { this->Bytes({0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8, 0x0F, 0xB6, 0xC0}); }
+  // setg al; movzx eax, al, after a cmp of two integers
+  auto SetGreater() -> void { this->Bytes({0x0F, 0x9F, 0xC0, 0x0F, 0xB6, 0xC0}); }
+  // sete al; movzx eax, al, same
+  auto SetEqualInteger() -> void { this->Bytes({0x0F, 0x94, 0xC0, 0x0F, 0xB6, 0xC0}); }
+  // xor eax, eax
+  auto ZeroEax() -> void { this->Bytes({0x31, 0xC0}); }
+  auto TestAl() -> void { this->Bytes({0x84, 0xC0}); }
+  auto CallRax() -> void { this->Bytes({0xFF, 0xD0}); }
+  auto JmpRax() -> void { this->Bytes({0xFF, 0xE0}); }
+  auto Ret() -> void { this->Bytes({0xC3}); }
+
+  // these all return the offset of the rel32 to patch
+  auto Jmp() -> u64 { return this->Rel32({0xE9}); }
+  auto Je() -> u64 { return this->Rel32({0x0F, 0x84}); }
+  auto Jne() -> u64 { return this->Rel32({0x0F, 0x85}); }
+  auto Jae() -> u64 { return this->Rel32({0x0F, 0x83}); }
+  auto Jo() -> u64 { return this->Rel32({0x0F, 0x80}); }
+
+  auto Patch(u64 at, u64 target) -> void {
+    const u32 rel = static_cast<u32>(target - (at + sizeof(u32)));
+    std::memcpy(this->code.data + at, &rel, sizeof(u32));
+  }
+
+  auto PatchHere(u64 at) -> void { this->Patch(at, this->Here()); }
+
+  auto Here() const -> u64 { return this->code.count; }
+
+ public:
+  DynamicArray<u8> code;
+
+ private:
+  auto Rex(bool wide, u8 reg, u8 base) -> void {
+    const u8 rex = 0x40 | (wide ? 0x08 : 0) | ((reg >> 3) << 2) | (base >> 3);
+    if (rex != 0x40) this->Bytes({rex});
+  }
+
+  auto RegReg(u8 op, u8 reg, u8 rm) -> void {
+    this->Rex(true, reg, rm);
+    this->Bytes({op, static_cast<u8>(0xC0 | ((reg & 7) << 3) | (rm & 7))});
+  }
+
+  auto Mem(bool wide, std::initializer_list<u8> op, u8 reg, Reg base, int disp) -> void {
+    this->Rex(wide, reg, base);
+    this->Bytes(op);
+    this->Bytes({static_cast<u8>(0x80 | ((reg & 7) << 3) | (base & 7))});
+    // rsp and r12 as a base need a SIB byte
+    if ((base & 7) == 4) this->Bytes({0x24});
+    this->Imm32(static_cast<u32>(disp));
+  }
+
+  auto Rel32(std::initializer_list<u8> bytes) -> u64 {
+    this->Bytes(bytes);
+    const u64 at = this->Here();
+    this->Imm32(0);
+    return at;
+  }
+};
+
+// where things live inside a Value, the templates work with either layout
+constexpr int VALUE_SIZE = sizeof(Value);
+#if defined(ROC_NAN_BOXING)
+constexpr int VALUE_NUMBER = 0;
+#else
+constexpr int VALUE_TYPE = offsetof(Value, type);
+constexpr int VALUE_NUMBER = offsetof(Value, as);
+#endif
+static_assert(VALUE_SIZE % sizeof(u64) == 0, "Values get copied a word at a time");
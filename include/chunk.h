@@ -6,43 +6,327 @@
 #include "range_search.h"
 #include "value.h"
 
+// Superinstructions, S(ID, FIRST, SECOND). Each one is just FIRST and SECOND
+// back to back with their operands unchanged, run off a single dispatch.
+// Chunk::FuseSuperinstructions rewrites the pairs in table order, so an entry
+// can be built out of earlier ones. FIRST must never jump, return or call.
+// It may fail, SECOND only runs when FIRST comes back with Continue, since a
+// failed FIRST has already unwound the stack out from under it.
+// Quickened opcodes only get rewritten when they stand alone, so anything
+// quickenable should only show up as FIRST where it still gets its checks.
+//
+// Picked from ROC_PROFILE_OPCODES runs of test/scripts, the opcode pairs that
+// execute the most. Compare and branch pairs are left alone, those want real
+// fused opcodes rather than two handlers glued together.
+#define VM_SUPERINSTRUCTIONS(S)             \
+  S(SetLocalPop, SetLocal, Pop)             \
+  S(GetLocalGetLocal, GetLocal, GetLocal)   \
+  S(GetLocalConstant, GetLocal, Constant)   \
+  S(AddSetLocalPop, Add, SetLocalPop)
+
+#define VM_SUPERINSTRUCTION_OPCODE(ID, FIRST, SECOND) X(ID)
+
+// Fused compare and branch, C(ID, COMPARE, WHEN). Pops both operands,
+// compares them the way COMPARE would and jumps forward by the u32 operand if
+// that came out WHEN. The compiler emits these for the conditions of ifs and
+// whiles, so the boolean never makes it onto the stack, see
+// CompilerEngine::ConditionJump. The Not forms are for <=, >= and !=.
+#define VM_COMPARE_JUMPS(C)          \
+  C(JumpLess, Less, true)            \
+  C(JumpNotLess, Less, false)        \
+  C(JumpGreater, Greater, true)      \
+  C(JumpNotGreater, Greater, false)  \
+  C(JumpEqual, Equality, true)       \
+  C(JumpNotEqual, Equality, false)
+
+#define VM_COMPARE_JUMP_OPCODE(ID, COMPARE, WHEN) X(ID)
+
+// Type specialized forms the VM rewrites generic instructions into once it has
+// seen their operand types, the compiler never emits these. See QUICKEN in
+// vm.cpp.
+#define VM_QUICKENED_OPCODES \
+  X(AddNumNum)               \
+  X(SubtractNumNum)          \
+  X(MultiplyNumNum)          \
+  X(DivideNumNum)            \
+  X(GreaterNumNum)           \
+  X(LessNumNum)              \
+  X(NegateNum)               \
+  X(AddIntInt)               \
+  X(SubtractIntInt)          \
+  X(MultiplyIntInt)          \
+  X(GreaterIntInt)           \
+  X(LessIntInt)
+
+// order matters, the dispatch tables in the VM are generated from this list
+#define VM_OPCODES \
+  X(Constant)      \
+  X(ConstantLong)  \
+  X(Add)           \
+  X(Subtract)      \
+  X(Multiply)      \
+  X(Divide)        \
+  X(Negate)        \
+  X(Return)        \
+  X(ReturnVoid)    \
+  X(True)          \
+  X(False)         \
+  X(Not)           \
+  X(Equality)      \
+  X(Greater)       \
+  X(Less)          \
+  X(String)        \
+  X(Pop)           \
+  X(SetGlobal)     \
+  X(GetGlobal)     \
+  X(SetLocal)      \
+  X(GetLocal)      \
+  X(SetUpvalue)    \
+  X(GetUpvalue)    \
+  X(Jump)          \
+  X(JumpFalse)     \
+  X(JumpTrue)      \
+  X(Loop)          \
+  X(Invoke)        \
+  X(TailInvoke)    \
+  X(Closure)       \
+  X(CloseUpvalue)  \
+  X(Generator)     \
+  X(Yield)         \
+  X(GeneratorEnd)  \
+  X(Iterate)       \
+  X(ForRange)      \
+  X(Spawn)         \
+  X(Join)          \
+  X(MatchDense)    \
+  X(MatchHash)     \
+  VM_COMPARE_JUMPS(VM_COMPARE_JUMP_OPCODE) \
+  VM_QUICKENED_OPCODES \
+  VM_SUPERINSTRUCTIONS(VM_SUPERINSTRUCTION_OPCODE)
+
 enum class OpCode : u8 {
-  Constant,  // 0
-  ConstantLong,
-  Add,
-  Subtract,
-  Multiply,
-  Divide,
-  Negate,
-  Return,
-  ReturnVoid,
-  True,
-  False,
-  Not,  // 10
-  Equality,
-  Greater,
-  Less,
-  String,
-  Pop,
-  SetGlobal,
-  GetGlobal,
-  SetLocal,
-  GetLocal,
-  SetUpvalue,  // 20
-  GetUpvalue,
-  Jump,
-  JumpFalse,
-  JumpTrue,
-  Loop,
-  Invoke,
-  Closure,
-  CloseUpvalue,
+#define X(ID) ID,
+  VM_OPCODES
+#undef X
+};
+
+constexpr u32 OPCODE_COUNT = 0
+#define X(ID) +1
+    VM_OPCODES
+#undef X
+    ;
+
+// Three address code for the register interpreter. Registers are the slots of
+// the frame's window into the VM stack, so locals are just registers and calls
+// work the same way they do in the stack machine.
+//
+// Operands: A/B/C are u8 registers, K is a u8 index into the constant pool and
+// everything else (globals, strings, jumps) is a u32 like the stack machine.
+//   Move A B             R[A] = R[B]
+//   LoadK A K            R[A] = K
+//   LoadKLong A u32      R[A] = K
+//   True/False A
+//   String A u32
+//   Add A B C            R[A] = R[B] + R[C]
+//   AddK A B K           R[A] = R[B] + K, same for the other binary ops
+//   Negate/Not A B       R[A] = op R[B]
+//   Get/SetGlobal A u32
+//   Get/SetUpvalue A u32
+//   Jump/Loop u32
+//   JumpFalse/True A u32
+//   ForRange A u32       R[A + 2] = R[A]++ while R[A] < R[A + 1], jumps once it
+//                        isn't. Counter, bound and loop variable, see OpForRange
+//   MatchDense/MatchHash A u32  jumps to the arm R[A] picks out of the JumpTable
+//   Invoke A argc u32    callee in R[A], args right above it, result in R[A].
+//                        The u32 is the stack instruction's CallCache
+//   TailInvoke A argc u32  same, but the callee takes over the current frame
+//   Return A
+//   ReturnVoid A         A is REG_NONE if there is nothing to return
+//   Closure              same layout as OpCode::Closure
+//   CloseUpvalue A
+#define VM_REG_OPCODES \
+  X(Move)              \
+  X(LoadK)             \
+  X(LoadKLong)         \
+  X(True)              \
+  X(False)             \
+  X(String)            \
+  X(Add)               \
+  X(AddK)              \
+  X(Subtract)          \
+  X(SubtractK)         \
+  X(Multiply)          \
+  X(MultiplyK)         \
+  X(Divide)            \
+  X(DivideK)           \
+  X(Equality)          \
+  X(EqualityK)         \
+  X(Greater)           \
+  X(GreaterK)          \
+  X(Less)              \
+  X(LessK)             \
+  X(Negate)            \
+  X(Not)               \
+  X(GetGlobal)         \
+  X(SetGlobal)         \
+  X(GetUpvalue)        \
+  X(SetUpvalue)        \
+  X(Jump)              \
+  X(JumpFalse)         \
+  X(JumpTrue)          \
+  X(Loop)              \
+  X(ForRange)          \
+  X(MatchDense)        \
+  X(MatchHash)         \
+  X(Invoke)            \
+  X(TailInvoke)        \
+  X(Return)            \
+  X(ReturnVoid)        \
+  X(Closure)           \
+  X(CloseUpvalue)
+
+#define REG_NONE 0xFF
+
+enum class RegOpCode : u8 {
+#define X(ID) ID,
+  VM_REG_OPCODES
+#undef X
 };
 
+constexpr u32 REG_OPCODE_COUNT = 0
+#define X(ID) +1
+    VM_REG_OPCODES
+#undef X
+    ;
+
 using Bytecode = DynamicArray<u8>;
 using LocalVariables = DynamicArray<Value>;
+
+// One per GetGlobal/SetGlobal instruction, the instruction's operand indexes
+// these instead of the object pool. Filled in the first time the instruction
+// runs, so after that a global is one load instead of walking the arena chain.
+struct GlobalCache {
+  // index into the object pool, what the compiler resolved the name to
+  u32 index;
+  // VirtualMachine::globals_generation when slot was looked up, 0 if never
+  u64 generation;
+  Object* slot;
+};
+
+// One per Invoke/TailInvoke/Spawn, the instruction's second operand indexes
+// these. Remembers the last Function or Closure the call site called, argc is
+// fixed per call site so its arity was already checked against it, and a call
+// that hits is just the guard and a frame push. Spawn doesn't use its own, the
+// compiler turns calls into spawns in place so it just has the same layout.
+//
+// Only ever monomorphic, a call site that keeps switching callees just keeps
+// missing and refilling it
+struct CallCache {
+  Object* callee;
+  // VirtualMachine::call_generation when callee was checked, 0 if never
+  u64 generation;
+};
+
+// One per MatchDense/MatchHash, the instruction's operand indexes these. The
+// value being matched picks an arm, and arm 0 is the `_` one, or just past the
+// match if there isn't one. Which arm is the same for every tier, where it
+// lands isn't, so each one keeps its own targets.
+struct JumpTable {
+  struct Slot {
+    Value key;
+    // 0 is an empty slot
+    u32 arm;
+  };
+
+  // MatchDense, dense[n - low] is the arm for the integer n, holes are 0
+  f64 low;
+  DynamicArray<u32> dense;
+  // MatchHash, open addressed and a power of two long. Strings are interned,
+  // so the pointer is as good as the characters
+  DynamicArray<Slot> slots;
+  // per arm, from the end of the stack instruction like any other jump
+  DynamicArray<u32> targets;
+  // per arm, offsets into the register code
+  DynamicArray<u32> reg_targets;
+
+  auto Init() -> void;
+  auto Deinit() -> void;
+  // dense if every key is an integer and there aren't too many holes, hashed
+  // otherwise. Returns whichever opcode goes with that
+  auto Build(const DynamicArray<Slot>& keys) -> OpCode;
+
+  auto DenseArm(Value key) const -> u32 {
+    if (key.IsInteger()) {
+      // below low wraps around to something past the end
+      const u64 idx = static_cast<u64>(key.AsInteger()) - static_cast<u64>(static_cast<i64>(this->low));
+      return idx < this->dense.count ? this->dense[idx] : 0;
+    }
+    if (!key.IsNumber()) return 0;
+    // NaN and anything out of range fail the compare
+    const f64 index = key.AsNumber() - this->low;
+    if (!(index >= 0 && index < static_cast<f64>(this->dense.count))) return 0;
+
+    const u64 idx = static_cast<u64>(index);
+    return static_cast<f64>(idx) == index ? this->dense[idx] : 0;
+  }
+
+  auto HashArm(Value key) const -> u32 {
+    const u64 mask = this->slots.count - 1;
+    for (u64 i = Hash(key) & mask;; i = (i + 1) & mask) {
+      const Slot& slot = this->slots[i];
+      if (slot.arm == 0 || slot.key == key) return slot.arm;
+    }
+  }
+
+  auto static Hash(Value key) -> u64 {
+    u64 bits;
+    if (key.IsNumeric()) {
+      // -0 and 0 are the same key, and so are 1 and 1.0
+      const f64 num = key.ToNumber() + 0.0;
+      std::memcpy(&bits, &num, sizeof(f64));
+    } else if (key.IsObject()) {
+      bits = reinterpret_cast<uintptr_t>(key.AsObject());
+    } else {
+      bits = key.AsBoolean();
+    }
+
+    return (bits ^ (bits >> 32)) * 0x9E3779B97F4A7C15ULL >> 16;
+  }
+};
+
+// What a function or a loop is running as, see tiering.h
+#define VM_TIERS \
+  X(Interpreted) \
+  X(Native)      \
+  X(Blacklisted)
+
+enum class Tier : u8 {
+#define X(ID) ID,
+  VM_TIERS
+#undef X
+};
+
+// hotness and native code for one loop, keyed by the offset of its header
+struct LoopTrace {
+  u32 header;
+  // back edges taken while it was interpreted
+  u32 hits;
+  // since its trace was installed, see trace.h
+  u32 side_exits;
+  // how many times it's been recorded again after a demotion
+  u32 retraces;
+  void* native;
+  Tier tier;
+  // where the function's native code picks up from this loop's header, for
+  // frames that were already running when it got compiled
+  void* osr;
+  // times a running frame moved over to native code through osr
+  u32 osr_entries;
+};
+
 class Compiler;
 class CompilerEngine;
+class RegisterCompiler;
 class VirtualMachine;
 
 class Chunk {
@@ -53,41 +337,93 @@ class Chunk {
 
   friend Compiler;
   friend CompilerEngine;
+  friend RegisterCompiler;
   friend VirtualMachine;
+  friend class Jit;
+  friend class JitCompiler;
+  friend class TraceCompiler;
+  friend class TierManager;
 
   auto Init() -> void;
   auto Deinit() -> void;
   auto Disassemble() const -> void;
+  auto DisassembleRegisters() const -> void;
   auto AddInstruction(u8 byte, u64 line) -> u64;
   auto AddInstruction(u8* bytes, u64 count, u64 line) -> u64;
   auto AddLine(u64 line) -> void;
   auto AddLocal(Value val, u64 line) -> u64;
+  auto AddGlobalCache(u32 index) -> u32;
+  auto AddCallCache() -> u32;
+  auto AddJumpTable() -> u32;
   auto Count() const -> u64;
   auto BaseInstructionPointer() const -> u8*;
+  // length in bytes of the stack instruction at offset, operands included
+  auto InstructionLength(u64 offset) const -> u32;
+  // JumpFalse, JumpTrue, ForRange and the VM_COMPARE_JUMPS, anything that
+  // might not take its jump
+  auto static IsConditionalJump(OpCode op) -> bool;
+  // peephole pass rewriting VM_SUPERINSTRUCTIONS pairs into one instruction
+  auto FuseSuperinstructions() -> void;
+  // for functions that yield, see OpGenerator in vm.cpp. Puts a Generator in
+  // front, turns returns into GeneratorEnds and tail calls back into plain
+  // calls, the generator's frame has to stay around
+  auto MakeGenerator() -> void;
+  // drops every instruction from offset on, so the compiler can take back the
+  // tail end of what it emitted
+  auto Rewind(u64 offset) -> void;
+  auto IsGenerator() const -> bool {
+    return this->bytecode.count > 0 && static_cast<OpCode>(this->bytecode[0]) == OpCode::Generator;
+  }
 
  private:
   auto PrintAtOffset(int offset) const -> int;
+  auto PrintInstruction(OpCode instruction, int offset) const -> int;
+  auto FuseSuperinstruction(OpCode fused, OpCode first, OpCode second) -> void;
+  auto static OperandLength(OpCode op) -> u32;
   auto SimpleInstruction(const char* name, int offset) const -> int;
   auto ConstantInstruction(int offset) const -> int;
   auto ConstantLongInstruction(int offset) const -> int;
   auto ByteInstruction(const char* name, int offset) const -> int;
   auto JumpInstruction(const char* name, int sign, int offset) const -> int;
   auto GlobalInstruction(const char* name, int offset) const -> int;
+  auto CallInstruction(const char* name, int offset) const -> int;
+  auto MatchInstruction(const char* name, int offset) const -> int;
+  auto PrintRegistersAtOffset(int offset) const -> int;
 
  private:
   Bytecode bytecode;
   LocalVariables locals;
   RangeArray<u64> lines;
+  DynamicArray<GlobalCache> global_caches;
+  DynamicArray<CallCache> call_caches;
+  DynamicArray<JumpTable> jump_tables;
+
+  // empty if the function couldn't be lowered to register code
+  Bytecode registers;
+  u32 register_count = 0;
+
+  // owned by whichever TierManager has tier_generation, stale otherwise
+  u64 invocations = 0;
+  Tier tier = Tier::Interpreted;
+  void* native = nullptr;
+  u64 tier_generation = 0;
+  DynamicArray<LoopTrace> loop_traces;
+  // bumped whenever native code gets thrown away for assuming something that
+  // stopped being true, see deopt.h
+  u64 code_epoch = 0;
+  u32 invalidations = 0;
 };
 
 class ChunkManager {
  public:
   auto Alloc() -> Chunk*;
+  // frees every chunk Alloc handed out, the functions holding them included
+  auto Clear() -> void;
 
  private:
   u64 count = 0;
   u64 capacity = 0;
   // @TODO(eddie) - investigate using Arena for this
   // Chunk needs a next field in that case
-  Chunk* chunks = nullptr;
+  Chunk** chunks = nullptr;
 };
@@ -7,6 +7,7 @@
 #define u8 uint8_t
 #define u32 uint32_t
 #define u64 uint64_t
+#define i64 int64_t
 
 #define f64 double
 
@@ -15,3 +16,41 @@
 // you fucking donkeys
 // so it formats into a stupid format
 #define fnc auto
+
+#if defined(_MSC_VER)
+#define force_inline __forceinline
+#else
+#define force_inline inline __attribute__((always_inline))
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Integer arithmetic that says whether it overflowed, result is whatever it
+// wrapped around to when it did. Everything that folds or runs integer
+// arithmetic goes through these, so they can't disagree about where it stops.
+#if defined(__GNUC__) || defined(__clang__)
+force_inline auto CheckedAdd(i64 lhs, i64 rhs, i64* result) -> bool { return __builtin_add_overflow(lhs, rhs, result); }
+force_inline auto CheckedSubtract(i64 lhs, i64 rhs, i64* result) -> bool {
+  return __builtin_sub_overflow(lhs, rhs, result);
+}
+force_inline auto CheckedMultiply(i64 lhs, i64 rhs, i64* result) -> bool {
+  return __builtin_mul_overflow(lhs, rhs, result);
+}
+#else
+force_inline auto CheckedAdd(i64 lhs, i64 rhs, i64* result) -> bool {
+  *result = static_cast<i64>(static_cast<u64>(lhs) + static_cast<u64>(rhs));
+  return rhs > 0 ? lhs > INT64_MAX - rhs : lhs < INT64_MIN - rhs;
+}
+force_inline auto CheckedSubtract(i64 lhs, i64 rhs, i64* result) -> bool {
+  *result = static_cast<i64>(static_cast<u64>(lhs) - static_cast<u64>(rhs));
+  return rhs < 0 ? lhs > INT64_MAX + rhs : lhs < INT64_MIN + rhs;
+}
+// the high half is just the sign of the low one unless it overflowed
+force_inline auto CheckedMultiply(i64 lhs, i64 rhs, i64* result) -> bool {
+  i64 high;
+  *result = _mul128(lhs, rhs, &high);
+  return high != (*result >> 63);
+}
+#endif
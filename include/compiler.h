@@ -20,6 +20,7 @@
   X(RightBrace)        \
   X(Comma)             \
   X(Dot)               \
+  X(DotDot)            \
   X(Minus)             \
   X(Plus)              \
   X(Semicolon)         \
@@ -30,6 +31,7 @@
   X(BangEqual)         \
   X(Equal)             \
   X(EqualEqual)        \
+  X(FatArrow)          \
   X(Greater)           \
   X(GreaterEqual)      \
   X(Less)              \
@@ -37,6 +39,7 @@
   X(Identifier)        \
   X(String)            \
   X(Number)            \
+  X(Integer)           \
   X(And)               \
   X(Else)              \
   X(False)             \
@@ -49,7 +52,11 @@
   X(True)              \
   X(Var)               \
   X(While)             \
-  X(In)
+  X(In)                \
+  X(Yield)             \
+  X(Spawn)             \
+  X(Join)              \
+  X(Match)
 
 struct Token {
   enum class Lexeme {
@@ -145,6 +152,7 @@ struct ParseRule {
 // to member autotions to build the parser table
 namespace Grammar {
 auto static Number(CompilerEngine* compiler, bool assign) -> void;
+auto static Integer(CompilerEngine* compiler, bool assign) -> void;
 auto static Parenthesis(CompilerEngine* compiler, bool assign) -> void;
 auto static Unary(CompilerEngine* compiler, bool assign) -> void;
 auto static Binary(CompilerEngine* compiler, bool assign) -> void;
@@ -154,6 +162,8 @@ auto static Variable(CompilerEngine* compiler, bool assign) -> void;
 auto static AndOp(CompilerEngine* compiler, bool assign) -> void;
 auto static OrOp(CompilerEngine* compiler, bool assign) -> void;
 auto static InvokeOp(CompilerEngine* compiler, bool assign) -> void;
+auto static SpawnOp(CompilerEngine* compiler, bool assign) -> void;
+auto static JoinOp(CompilerEngine* compiler, bool assign) -> void;
 }  // namespace Grammar
 
 enum class CompileError {
@@ -169,6 +179,7 @@ struct CompilerState {
       u64 error : 1;
       u64 panic : 1;
       u64 has_captures : 1;
+      u64 is_generator : 1;
     };
     u64 value = 0;
   };
@@ -183,6 +194,14 @@ class Compiler {
   Compiler() noexcept;
   auto Init(const char* src, StringPool* string_pool, GlobalPool* global_pool) -> void;
   auto Compile() -> CompileResult;
+  // frees the chunks of everything compiled so far, for once nothing can be
+  // running them anymore
+  auto Clear() -> void;
+
+ private:
+  // every VM_NATIVES name the global pool doesn't have yet, so a script can
+  // still define a function of the same name
+  auto DefineNatives() -> void;
 
  private:
   constexpr static const char* GLOBAL_FUNCTION_NAME = "GLOBAL_FUNCTION";
@@ -228,6 +247,8 @@ class CompilerEngine {
   auto BeginScope() -> void;
   auto EndScope() -> void;
   auto CodeBlock() -> void;
+  auto MatchExpression() -> void;
+  auto MatchPattern(Value* key) -> bool;
   auto AddString(u32 length, const char* start) -> u32;
   auto AddGlobal(Token id) -> u64;
   auto AddLocal(Token id) -> void;
@@ -238,14 +259,22 @@ class CompilerEngine {
   auto FindGlobal(Token id) -> Option<u64>;
 
   auto Jump(OpCode opcode) -> u32;
+  // jumps if the condition that was just compiled is false. A comparison gets
+  // fused into the jump, and then there's no condition left on the stack to
+  // pop on either side, see VM_COMPARE_JUMPS
+  auto ConditionJump(bool* fused) -> u32;
   auto PatchJump(u64 jump_idx) -> void;
   auto Loop(u64 loop_idx) -> void;
+  // turns the call that was just emitted into op, false if the last thing
+  // emitted wasn't a call
+  auto RewriteInvoke(OpCode op) -> bool;
 
   auto Emit(u8 byte) -> void;
   auto Emit(u8* bytes, u32 count) -> void;
   auto Emit(OpCode opcode) -> void;
 
   auto friend Grammar::Number(CompilerEngine* compiler, bool assign) -> void;
+  auto friend Grammar::Integer(CompilerEngine* compiler, bool assign) -> void;
   auto friend Grammar::Parenthesis(CompilerEngine* compiler, bool assign) -> void;
   auto friend Grammar::Unary(CompilerEngine* compiler, bool assign) -> void;
   auto friend Grammar::Binary(CompilerEngine* compiler, bool assign) -> void;
@@ -255,6 +284,8 @@ class CompilerEngine {
   auto friend Grammar::AndOp(CompilerEngine* compiler, bool assign) -> void;
   auto friend Grammar::OrOp(CompilerEngine* compiler, bool assign) -> void;
   auto friend Grammar::InvokeOp(CompilerEngine* compiler, bool assign) -> void;
+  auto friend Grammar::SpawnOp(CompilerEngine* compiler, bool assign) -> void;
+  auto friend Grammar::JoinOp(CompilerEngine* compiler, bool assign) -> void;
 
  private:
   Token curr;
@@ -266,6 +297,13 @@ class CompilerEngine {
   CompilerState state;
   u32 curr_func_idx = 0;
   Object::Function* curr_func = nullptr;
+  // where the last Invoke was emitted, so `return f()` can become a tail call
+  // and `spawn f()` a Spawn
+  u64 last_invoke = ~0ULL;
+  // same for the last Less, Greater or Equality, and where the last forward
+  // jump landed. Nothing can be fused across that
+  u64 last_compare = ~0ULL;
+  u64 last_label = 0;
 
   u32 scope_depth = 0;
   u32 locals_count = 0;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "value.h"
+
+// Deoptimization, how native code that can't go on hands its frame back to the
+// interpreter.
+//
+// Every guard in native code gets a DeoptPoint describing the interpreter
+// state at that guard. The frame is always the one the code was entered with,
+// so that's the instruction to resume at and whatever stack slots don't hold
+// the right Value yet. A failed guard jumps to a small stub that calls
+// DeoptTable::Deoptimize with its point, so none of the code that rebuilds the
+// state gets emitted.
+//
+// Two kinds of native code speculate:
+//   traces - on the types of locals and on which way every branch goes, see
+//            trace.h. Values live unboxed in the trace's scratch area.
+//   baseline - on globals keeping the value they had when the function was
+//              compiled. The VM's stack is always up to date there, so the
+//              point is only where to resume. The TierManager keeps track of
+//              what each function assumed and throws its code away when a
+//              SetGlobal breaks that, and any frame still running the old code
+//              deopts at its next check, see tiering.h.
+
+// the stack already holds the right values, leave stack_top alone
+#define DEOPT_KEEP_STACK 0xFFFFFFFF
+
+// where a slot's value comes from when deoptimizing
+enum class DeoptSource : u8 {
+  // unboxed in the scratch area, bits is the byte offset
+  Scratch,
+  // folded away while compiling, bits is the unboxed value
+  Constant,
+};
+
+struct DeoptValue {
+  // written to frame->locals[slot]
+  u32 slot;
+  DeoptSource source;
+  ValueType type;
+  u64 bits;
+};
+
+struct DeoptPoint {
+  // offset into the chunk's bytecode
+  u32 resume;
+  // stack slots above frame->locals, or DEOPT_KEEP_STACK
+  u32 height;
+  // range in DeoptTable::values
+  u32 first;
+  u32 count;
+  // whatever the native code should return once the frame is handed back
+  u64 result;
+};
+
+struct StackFrame;
+
+// every point of one piece of native code, lives as long as the code does
+class DeoptTable {
+ public:
+  auto Init(u8* bytecode, Value** stack_top) -> void;
+  auto Deinit() -> void;
+
+  // starts a new point, values added after this belong to it
+  auto Point(u32 resume, u32 height, u64 result) -> u32;
+  auto Add(u32 slot, DeoptSource source, ValueType type, u64 bits) -> void;
+
+  // what the stubs call, scratch is the native code's rsp
+  auto static Deoptimize(DeoptTable* table, u32 point, StackFrame* frame, const u8* scratch) -> u64;
+
+ public:
+  DynamicArray<DeoptPoint> points;
+  DynamicArray<DeoptValue> values;
+
+ private:
+  u8* bytecode;
+  Value** stack_top;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
+#include <cstdint>
+
+#include "common.h"
+#include "dynamic_array.h"
+
+// Reads, writes and timers that run while the fiber that started them is
+// suspended, see VirtualMachine::CallNative.
+//
+// On Linux it's io_uring, set up with raw syscalls so there's nothing extra to
+// link. Everything submitted between two Reaps goes to the kernel in one
+// io_uring_enter, and checking for completions is just reading the ring.
+//
+// Kernels that don't have it, or won't hand it out, get poll instead. poll
+// only says an fd is ready, so that backend does the read or write itself once
+// it is. Regular files are always ready, so for those it's a plain blocking
+// pread, the fiber just doesn't notice. Timers become poll's timeout.
+//
+// Windows has neither, the CRT's fds can't be waited on. There every read and
+// write just happens on the next Reap, and blocking on timers is a sleep.
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ROC_IO_URING 1
+struct io_uring_sqe;
+#endif
+
+#define EVENT_LOOP_ENTRIES 256
+// IoOp::offset for fds that can't seek, pipes and sockets go from wherever
+// they are
+#define IO_NO_OFFSET UINT64_MAX
+
+enum class IoBackend : u8 {
+  Uring,
+  Poll,
+};
+
+enum class IoKind : u8 {
+  Read,
+  Write,
+  Timer,
+};
+
+// owned by whoever submits it, and it has to stay put until Reap or Cancel
+// hands it back
+struct IoOp {
+  IoKind kind;
+  int fd;
+  u8* buffer;
+  u64 length;
+  u64 offset;
+  // Timers only, counted from when it's submitted
+  u64 nanoseconds;
+  void* user;
+  // bytes read or written, or -errno. Timers that went off are 0
+  int64_t result;
+
+  // the backends' own, where it is in pending and when a poll timer is due
+  u64 slot;
+  u64 deadline;
+  // a __kernel_timespec the kernel reads an io_uring timer from
+  int64_t timeout[2];
+};
+
+class EventLoop {
+ public:
+  // doesn't go near the kernel until the first Submit. Asking for io_uring
+  // still ends up with poll if it's not there
+  auto Init(IoBackend backend = IoBackend::Uring) -> void;
+  // Cancel first, anything still in flight is just forgotten about
+  auto Deinit() -> void;
+
+  auto Submit(IoOp* op) -> void;
+  // ops that finished since the last Reap go on the end of done. With block
+  // it waits for at least one, unless nothing is in flight
+  auto Reap(DynamicArray<IoOp*>* done, bool block) -> void;
+  // everything still in flight comes back through done once the kernel is
+  // done with its buffer, whatever didn't finish first with -ECANCELED
+  auto Cancel(DynamicArray<IoOp*>* done) -> void;
+
+  auto InFlight() const -> u64 { return this->pending.count; }
+  auto Backend() const -> IoBackend { return this->backend; }
+
+ private:
+  auto Start() -> void;
+  auto Finish(IoOp* op, int64_t result, DynamicArray<IoOp*>* done) -> void;
+  auto ReapPoll(DynamicArray<IoOp*>* done, bool block) -> void;
+
+#if defined(ROC_IO_URING)
+  auto StartUring() -> bool;
+  auto StopUring() -> void;
+  auto NextSqe() -> io_uring_sqe*;
+  auto Push(IoOp* op) -> void;
+  auto Enter(u32 wait) -> void;
+  auto Harvest(DynamicArray<IoOp*>* done) -> void;
+  auto ReapUring(DynamicArray<IoOp*>* done, bool block) -> void;
+#endif
+
+ private:
+  IoBackend backend = IoBackend::Poll;
+  bool started = false;
+  // every op in flight, IoOp::slot is where
+  DynamicArray<IoOp*> pending;
+
+  // rebuilt on every Reap, poll_ops[i] is the op waiting on poll_fds[i]
+#if !defined(_WIN32)
+  DynamicArray<pollfd> poll_fds;
+#endif
+  DynamicArray<IoOp*> poll_ops;
+
+  // io_uring, ops only go to the kernel while there's room for their
+  // completion in the ring, so it can never overflow. The rest wait in
+  // backlog
+  int ring_fd = -1;
+  u8* ring = nullptr;
+  u64 ring_size = 0;
+  void* sqes = nullptr;
+  u64 sqes_size = 0;
+  u32* sq_head = nullptr;
+  u32* sq_tail = nullptr;
+  u32* sq_array = nullptr;
+  u32 sq_mask = 0;
+  u32 sq_entries = 0;
+  u32* cq_head = nullptr;
+  u32* cq_tail = nullptr;
+  void* cqes = nullptr;
+  u32 cq_mask = 0;
+  u32 cq_entries = 0;
+  // in the ring but not io_uring_enter'd yet
+  u32 unsubmitted = 0;
+  // submitted, cancels included, whose completion hasn't been read yet
+  u32 in_kernel = 0;
+  DynamicArray<IoOp*> backlog;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <new>
+
+#include "arena.h"
+#include "common.h"
+#include "dynamic_array.h"
+#include "object.h"
+#include "string_pool.h"
+#include "value.h"
+
+// Precise and generational, over the objects the VirtualMachine allocates
+// while it runs: upvalues, generators, fiber handles and the strings natives
+// make. Those are the only ones with collectable set. Whatever the compiler put
+// in the pools never goes anywhere, but a Closure can still hold on to
+// upvalues, so the VirtualMachine traces through those as roots.
+//
+// New objects get bumped out of the nursery, a block of Objects the collector
+// owns. When it fills up a minor collection copies whatever the roots and the
+// remembered set can still reach into the object pool, leaves a forwarding
+// pointer behind in next and fixes up every reference on the way. Then the
+// whole nursery is free again. Most of what a script makes is dead by then, so
+// that's the common case and it only costs as much as what survived.
+//
+// The old space is the object pool, and it gets the mark and sweep: the
+// VirtualMachine marks its roots, Trace marks whatever they reach, and Sweep
+// frees the rest back onto the arena's free list. That only happens once
+// enough has been promoted, and it always empties the nursery first.
+//
+// A minor collection doesn't look at the old space, so anything old that
+// points into the nursery has to be remembered. Every store that could do that
+// goes through Barrier: closing and setting upvalues, OpClosure filling in a
+// closure, a generator saving its frame and assigning a global.
+//
+// A collection only ever starts from an allocation, and only from the
+// interpreters. Native code and traces never allocate themselves, anything
+// that does goes through a helper that hands the stack back first.
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+#define GC_GROW_FACTOR 2
+#define GC_NURSERY_OBJECTS 4096
+
+struct GcConfig {
+  // bytes allocated before the first collection
+  u64 initial_threshold = GC_INITIAL_THRESHOLD;
+  // the next collection is once there's this many times what survived the last
+  u32 grow_factor = GC_GROW_FACTOR;
+  // how many objects fit in the nursery, a bigger one means fewer minor
+  // collections but more to scan when it does fill up
+  u32 nursery_objects = GC_NURSERY_OBJECTS;
+  // collects before every allocation, shakes out anything that isn't rooted
+  bool stress = false;
+};
+
+struct GcStats {
+  // full ones, the mark and sweep over the old space
+  u64 collections;
+  u64 minor_collections;
+  // objects freed over every collection, the ones that died in the nursery too
+  u64 freed;
+  // survived a minor collection and got copied out of the nursery
+  u64 promoted;
+  // objects in the old space and roughly how many bytes, as of the last one
+  u64 live;
+  u64 live_bytes;
+  f64 last_pause_ms;
+  f64 max_pause_ms;
+  f64 total_pause_ms;
+  f64 last_minor_pause_ms;
+  f64 max_minor_pause_ms;
+  f64 total_minor_pause_ms;
+};
+
+class GarbageCollector {
+ public:
+  auto Init() -> void;
+  // frees everything it still tracks back into the pools it came from, null
+  // when those have been cleared already
+  auto Deinit(Arena<Object>* object_pool, StringPool* string_pool) -> void;
+  // a new nursery size waits until the nursery is empty
+  auto Configure(GcConfig config) -> void;
+  // forgets everything it tracks without freeing it, the pools it came from
+  // have been cleared out from under it
+  auto Reset() -> void;
+
+  // time for a full collection
+  auto ShouldCollect() const -> bool { return this->config.stress || this->allocated >= this->threshold; }
+  // time for a minor collection, always under stress
+  auto NurseryFull() const -> bool { return this->config.stress || this->nursery_top == this->nursery_capacity; }
+  // bumps the next slot off the nursery, there has to be one
+  auto NurseryAlloc() -> Object* {
+    Object* object = new (&this->nursery[this->nursery_top++]) Object();
+    object->collectable = true;
+    return object;
+  }
+  auto NurseryEmpty() const -> bool { return this->nursery_top == 0; }
+  auto IsYoung(const Object* object) const -> bool {
+    return object >= this->nursery && object < this->nursery + this->nursery_capacity;
+  }
+  // an object that goes straight into the old space, from now on Sweep owns it
+  auto Track(Object* object, u64 bytes) -> void;
+
+  // owner just got value stored into it
+  auto Barrier(Object* owner, Object* value) -> void {
+    if (this->IsYoung(value)) this->Remember(owner);
+  }
+  auto Barrier(Object* owner, Value value) -> void {
+    if (value.IsObject()) this->Barrier(owner, value.AsObject());
+  }
+  // for stores of more than one value at once, cheaper to rescan the owner
+  // than to look through what went in
+  auto Remember(Object* owner) -> void {
+    if (this->IsYoung(owner) || owner->remembered) return;
+    owner->remembered = true;
+    this->remembered.Append(owner);
+  }
+  auto BarrierGlobal(u32 index, Object* value) -> void {
+    if (this->IsYoung(value)) this->remembered_globals.Append(index);
+  }
+  // globals that might point into the nursery, the VirtualMachine owns those
+  auto RememberedGlobals() const -> const DynamicArray<u32>& { return this->remembered_globals; }
+
+  // where object lives once the minor collection is over, copying it out of
+  // the nursery the first time. Everything the copy points at gets forwarded
+  // by FinishMinor
+  auto Forward(Object* object) -> Object*;
+  auto Forward(Value* slot) -> void {
+    if (slot->IsObject()) *slot = Value(this->Forward(slot->AsObject()));
+  }
+  // the roots have all been forwarded, forwards everything else that's still
+  // reachable and empties the nursery. Returns how many died in it
+  auto FinishMinor() -> u64;
+  auto BeginMinor(Arena<Object>* old_space) -> void { this->old_space = old_space; }
+
+  auto Mark(Value value) -> void {
+    if (value.IsObject()) this->Mark(value.AsObject());
+  }
+  auto Mark(Object* object) -> void;
+  // marks everything reachable from whatever has been marked so far
+  auto Trace() -> void;
+  // frees everything still unmarked and unmarks the rest, returns how many
+  // went
+  auto Sweep(Arena<Object>* object_pool, StringPool* string_pool) -> u64;
+  auto Record(f64 pause_ms, bool minor) -> void;
+  // marks everything object points at, for roots that aren't tracked
+  // themselves
+  auto Blacken(Object* object) -> void;
+
+  auto Stats() const -> GcStats { return this->stats; }
+
+ public:
+  GcConfig config;
+
+ private:
+  // forwards everything object points at
+  auto Scan(Object* object) -> void;
+  auto ResizeNursery(u32 capacity) -> void;
+  // frees what the dead ones own and empties it
+  auto ReleaseNursery() -> u64;
+
+  // everything in the old space
+  DynamicArray<Object*> objects;
+  // marked but not traced through yet
+  DynamicArray<Object*> gray;
+
+  Object* nursery = nullptr;
+  u32 nursery_top = 0;
+  u32 nursery_capacity = 0;
+  // promoted during this minor collection but not scanned yet
+  DynamicArray<Object*> promoted;
+  // old objects that might point into the nursery
+  DynamicArray<Object*> remembered;
+  DynamicArray<u32> remembered_globals;
+  Arena<Object>* old_space = nullptr;
+  // roughly how big everything tracked is, survivors of the last collection
+  // plus everything since. Getting to threshold is what starts the next one
+  u64 allocated = 0;
+  u64 threshold = GC_INITIAL_THRESHOLD;
+  GcStats stats = {};
+};
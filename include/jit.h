@@ -0,0 +1,90 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+#include "deopt.h"
+#include "dynamic_array.h"
+#include "roc_config.h"
+#include "trace.h"
+
+// Baseline JIT for the stack code, x86-64 System V only.
+//
+// Every opcode is turned into a fixed template, there is no dispatch and jumps
+// and loops are real native branches. Locals, constants, pops and number
+// arithmetic and comparisons are done inline. Everything else, and the slow
+// paths of the inline templates, point frame->inst_ptr at the operands and
+// call the interpreter's handler, so none of the semantics are implemented
+// twice. A callee that has native code gets called straight away, otherwise
+// the native code returns ExecStatus::Exit and the interpreter carries on from
+// the frame's inst_ptr. Going the other way, every loop header gets an entry
+// of its own, so a frame that the interpreter is already running can move
+// over to native code at a back edge.
+//
+// Back edges count down the VM's budget the same as OpLoop does. Once it's
+// gone the code returns ExecStatus::Exit sitting on the Loop, and the
+// interpreter's own safepoint does the stopping.
+//
+// Globals are read once while compiling and baked in as constants. After
+// every call and SetGlobal the code checks it hasn't been invalidated since,
+// and deopts back to the interpreter if it has, see deopt.h. One that's still
+// in the collector's nursery is read through the helper instead, it can move
+// without anything checking.
+//
+// When anything gets compiled is up to the TierManager, see tiering.h.
+
+class VirtualMachine;
+struct StackFrame;
+enum class ExecStatus : u8;
+
+// native code runs one frame until it returns, exits or fails
+using NativeCode = ExecStatus (*)(VirtualMachine* vm, StackFrame** frame);
+
+// traces run until they leave the loop, and return whether that was through a
+// side exit, see trace.h
+using TraceCode = bool (*)(VirtualMachine* vm, StackFrame** frame);
+
+// runs a frame that's already in the middle of the function from a loop
+// header on, on-stack replacement
+struct OsrEntry {
+  u32 header;
+  NativeCode code;
+};
+
+class Jit {
+ public:
+  auto Init(VirtualMachine* vm) -> void;
+  auto Deinit() -> void;
+
+  // both return nullptr if there's something in there they can't compile.
+  // Compile also hands back an entry for every loop in the function, and the
+  // object pool index of every global it assumed won't change. Without
+  // globals it doesn't assume anything
+  auto Compile(Chunk* chunk, DynamicArray<OsrEntry>* osr_entries, DynamicArray<u32>* globals) -> NativeCode;
+  auto CompileTrace(Chunk* chunk, const TraceRecording* recording) -> TraceCode;
+
+ private:
+  // where the code ended up, for the caller to call however it was compiled
+  auto Install(const DynamicArray<u8>& code) -> u8*;
+  auto AllocTable(Chunk* chunk) -> DeoptTable*;
+
+ private:
+  struct Region {
+    void* base;
+    u64 size;
+  };
+
+  // where the arms of every compiled match start, see JitCompiler::Link
+  struct MatchTargets {
+    void** native;
+    u64 count;
+  };
+
+  DynamicArray<Region> regions;
+  DynamicArray<DeoptTable*> tables;
+  DynamicArray<MatchTargets> match_targets;
+  VirtualMachine* vm = nullptr;
+  // native code keeps pushing and popping through the VM's stack_top
+  Value** stack_top = nullptr;
+  // and counts down its budget_left at every back edge
+  u64* budget = nullptr;
+};
@@ -10,6 +10,5 @@
 #define FREE_ARRAY(type, ptr, count) Reallocate(ptr, sizeof(type) * (count), 0)
 #define ALLOCATE(type, count) (type*)Reallocate(nullptr, 0, sizeof(type) * (count))
 
+// the collector is in gc.h, this is just the allocator under it
 auto Reallocate(void* ptr, size_t old_size, size_t new_size) -> void*;
-auto Collect() -> void;
-auto static MarkRoots() -> void;
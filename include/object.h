@@ -7,11 +7,31 @@
 #include "common.h"
 #include "utils.h"
 
+// lives in the VirtualMachine, see vm.h
+struct Fiber;
+
+// builtins every script can call like any other global function, the
+// VirtualMachine implements them, see VirtualMachine::CallNative
+// ID, name scripts call it by, arity
+#define VM_NATIVES           \
+  X(ReadFile, readFile, 1)   \
+  X(WriteFile, writeFile, 2) \
+  X(Sleep, sleep, 1)
+
+enum class NativeId : u8 {
+#define X(ID, NAME, ARITY) ID,
+  VM_NATIVES
+#undef X
+};
+
 enum class ObjectType {
   String,
   Function,
   Closure,
   Upvalue,
+  Generator,
+  Fiber,
+  Native,
 };
 
 class Object {
@@ -38,6 +58,32 @@ class Object {
     Object::Upvalue** upvalues;
   };
 
+  class Generator;
+  struct GeneratorData {
+    // the Function or Closure that was called
+    Object* callee;
+    // where the frame picks back up, nullptr once it's done or while it runs
+    u8* inst_ptr;
+    // the frame's slice of the VM stack while it's suspended, locals and all
+    Value* slots;
+    u32 slot_count;
+    u32 slot_capacity;
+  };
+
+  class Fiber;
+  struct FiberData {
+    // owned by the VM that spawned it, and only good for as long as that run
+    ::Fiber* fiber;
+    // VirtualMachine::fiber_generation when it was spawned
+    u64 generation;
+  };
+
+  class Native;
+  struct NativeData {
+    NativeId id;
+    u32 arity;
+  };
+
   auto operator==(const Object* o) const -> bool { return this->type == o->type; }
 
   auto Print() const -> void;
@@ -47,6 +93,13 @@ class Object {
   Object() = default;
 
   ObjectType type;
+  // the VirtualMachine allocated it while running, so the collector owns it.
+  // Everything the compiler makes lives for as long as its pool does, see gc.h
+  bool collectable = false;
+  // marked during a full collection, forwarded to next during a minor one
+  bool marked = false;
+  // in the collector's remembered set, see gc.h
+  bool remembered = false;
 
   // used for free lists in GlobalPools to find the next free memory slot
   Object* next = nullptr;
@@ -59,6 +112,9 @@ class Object {
     FunctionData function;
     ClosureData closure;
     UpvalueData upvalue;
+    GeneratorData generator;
+    FiberData fiber;
+    NativeData native;
 
     Data() { string = {}; }
     ~Data() {}
@@ -149,3 +205,39 @@ class Object::Upvalue : public Object {
   auto Init(Value* location) -> void;
   auto Print() const -> void;
 };
+
+class Object::Generator : public Object {
+ public:
+  Generator() noexcept;
+
+  auto operator==(const Object* o) const -> bool { return this == o; }
+
+  auto Init(Object* callee) -> void;
+  auto Deinit() -> void;
+  // suspends it at inst_ptr with a copy of the frame's slots
+  auto Save(const Value* slots, u32 count, u8* inst_ptr) -> void;
+  auto Print() const -> void;
+};
+
+// what spawn hands back to the script, join waits on it
+class Object::Fiber : public Object {
+ public:
+  Fiber() noexcept;
+
+  auto operator==(const Object* o) const -> bool { return this == o; }
+
+  auto Init(::Fiber* fiber, u64 generation, const Object* callee) -> void;
+  auto Print() const -> void;
+};
+
+// the compiler puts one of these in the global pool for every VM_NATIVES name
+// the script doesn't define itself
+class Object::Native : public Object {
+ public:
+  Native() noexcept;
+
+  auto operator==(const Object* o) const -> bool { return this == o; }
+
+  auto Init(NativeId id) -> void;
+  auto Print() const -> void;
+};
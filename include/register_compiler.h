@@ -0,0 +1,90 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+#include "dynamic_array.h"
+
+// Lowers the stack code of a single function into three address register code
+// (see VM_REG_OPCODES). The stack machine's operand stack is simulated at
+// compile time, every stack slot becomes a register, and loads of locals and
+// constants are deferred until something actually needs them in their slot.
+// So `a + b` is a single Add instead of GetLocal, GetLocal, Add.
+class RegisterCompiler {
+ public:
+  // arity + 1 slots are live on entry, the callee and its arguments
+  auto Compile(Chunk* chunk, u32 arity) -> bool;
+
+ private:
+  enum class SlotKind : u8 {
+    // the value really is in the register for this stack slot
+    Register,
+    // the value is whatever is in another register right now
+    Alias,
+    // the value is a constant that hasn't been loaded yet
+    Constant,
+  };
+
+  struct Slot {
+    SlotKind kind;
+    u32 index;
+  };
+
+  constexpr static u32 MAX_REGISTERS = REG_NONE;
+  constexpr static u32 NO_LABEL = 0xFFFFFFFF;
+
+  auto FindLabels() -> void;
+  auto Lower(u32 offset) -> u32;
+  auto Label(u32 offset) -> void;
+  auto Push(Slot slot) -> void;
+  auto Pop() -> Slot;
+  auto Materialize(u32 idx) -> void;
+  auto MaterializeAliasesOf(u32 reg) -> void;
+  auto Flush() -> void;
+  auto OperandRegister(u32 idx) -> u8;
+  auto BinaryOp(RegOpCode op, RegOpCode op_constant) -> void;
+  auto UnaryOp(RegOpCode op) -> void;
+  // pop_condition is for the fused compare and branches, whose condition is
+  // gone on both sides of the jump
+  auto JumpOp(RegOpCode op, u32 offset, bool has_condition, bool pop_condition = false) -> void;
+  auto MatchOp(RegOpCode op, u32 offset) -> void;
+
+  auto Emit(RegOpCode op) -> void;
+  auto Emit(u8 byte) -> void;
+  auto EmitInt(u32 num) -> void;
+  auto ReadInt(u32 offset) const -> u32;
+
+ private:
+  Chunk* chunk = nullptr;
+  bool failed = false;
+  bool reachable = true;
+
+  Slot slots[MAX_REGISTERS];
+  u32 depth = 0;
+  u32 max_depth = 0;
+
+  // offset of the destination register of the last instruction, so a
+  // following SetLocal can write straight into the local instead of copying
+  u32 last_dest = NO_LABEL;
+
+  struct LabelInfo {
+    bool is_label;
+    // stack depth coming in from a forward jump
+    u32 depth;
+    // offset in the register code
+    u32 target;
+  };
+
+  // indexed by stack code offset
+  DynamicArray<LabelInfo> labels;
+
+  struct Fixup {
+    u32 operand;
+    u32 target;
+    bool backwards;
+  };
+  DynamicArray<Fixup> fixups;
+
+  // stack code offsets of the MatchDense/MatchHash instructions, their
+  // JumpTables get register targets once every label has one
+  DynamicArray<u32> matches;
+};
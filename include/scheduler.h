@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "compiler.h"
+#include "dynamic_array.h"
+#include "tiering.h"
+#include "vm.h"
+
+// Runs independent scripts on a pool of OS threads. Every worker has a deque
+// of tasks, it takes the newest one off its own and once that's empty steals
+// the oldest one off somebody else's, so a worker that got handed a pile of
+// long tasks gets helped out by the idle ones.
+//
+// Tasks don't share anything, each one gets compiled into pools of its own and
+// runs in a fresh VirtualMachine, so none of the VM has to be thread safe.
+// Fibers a task spawns stay on whichever worker is running it, see Fiber in
+// vm.h.
+//
+// The deques are just a mutex each. A lock-free Chase-Lev deque would only be
+// worth it if stealing ever shows up in a profile.
+
+#define SCHEDULER_MAX_WORKERS 64
+
+using TaskId = u64;
+
+class Scheduler {
+ public:
+  // 0 workers is one per core, every task runs with tiers
+  auto Init(u32 workers, TierConfig tiers = {}) -> void;
+  // waits for everything that was spawned to finish first
+  auto Deinit() -> void;
+
+  // copies source, it runs as soon as a worker gets to it
+  auto Spawn(const char* source) -> TaskId;
+  // blocks until the task is done. Objects live in the task's pools, which
+  // are gone by then, so a script that returns one comes back as an
+  // ObjectResult error instead
+  auto Join(TaskId id) -> InterpretResult;
+
+  auto WorkerCount() const -> u32 { return this->worker_count; }
+  // tasks that ran on some other worker than the one they were spawned to
+  auto Steals() const -> u64;
+
+ private:
+  struct Task {
+    char* source;
+    u64 length;
+    InterpretResult result;
+    bool done;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::mutex lock;
+    // the owner takes from the back, everybody else steals from head
+    DynamicArray<Task*> tasks;
+    u64 head;
+    std::atomic<u64> steals;
+
+    VirtualMachine vm;
+    Compiler compiler;
+  };
+
+  auto Work(u32 idx) -> void;
+  auto Take(u32 idx) -> Task*;
+  auto Run(Worker* worker, Task* task) -> void;
+
+ private:
+  Worker* workers = nullptr;
+  u32 worker_count = 0;
+  TierConfig tiers;
+
+  // guards tasks, next_worker and every Task's result and done
+  std::mutex tasks_lock;
+  std::condition_variable finished;
+  DynamicArray<Task*> tasks;
+  u32 next_worker = 0;
+
+  // guards queued and stopping, idle workers sleep on it
+  std::mutex idle_lock;
+  std::condition_variable idle;
+  // tasks sitting in some deque
+  u64 queued = 0;
+  bool stopping = false;
+};
@@ -14,11 +14,35 @@ class StringPool {
  public:
   auto Init(Arena<Object>* object_pool) -> void;
   auto Deinit() -> void;
+  // copies the characters, start doesn't have to outlive the call
   auto Alloc(u64 length, const char* start) -> u64;
+  // the same, for strings the VM makes while running. Their characters get an
+  // allocation of their own instead of going in a block, so Free can give
+  // them back
+  auto AllocCollectable(u64 length, const char* start) -> u64;
+  auto Find(u64 length, const char* start) -> Option<u64>;
   auto Nth(u64 idx) -> Object*;
+  // un-interns a string nothing points at anymore and gives its slot back,
+  // along with its characters if AllocCollectable made it
+  auto Free(Object* string) -> void;
 
  private:
-  DynamicArray<char>* char_data = new DynamicArray<char>();
+  auto Intern(u64 length, const char* start, bool collectable) -> u64;
+  auto Store(u64 length, const char* start) -> char*;
+
+ private:
+  struct Block {
+    char* data;
+    u64 size;
+  };
+
+  // characters never move once they're in, the strings and the intern table
+  // both point straight at them. Strings made at runtime, like whatever
+  // readFile reads, keep coming in after the compiler's are handed out
+  DynamicArray<Block> blocks;
+  u64 block_used = 0;
+  // characters AllocCollectable made that haven't been freed yet, and how many
+  absl::flat_hash_map<char*, u64> loose;
   Arena<Object>* object_pool = nullptr;
   absl::flat_hash_map<std::string_view, u64> intern_table;
 };
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+
+#include "chunk.h"
+#include "common.h"
+#include "dynamic_array.h"
+#include "jit.h"
+#include "roc_config.h"
+#include "trace.h"
+
+// Decides what every function and loop runs as. Calls and loop back edges in
+// the stack interpreter bump counters on the chunk, and once one gets past its
+// threshold the code is promoted:
+//   functions - Interpreted -> Native, the baseline JIT in jit.h
+//   loops     - Interpreted -> Native, a trace, see trace.h
+// A hot loop that can't be traced compiles its whole function instead, and
+// the frame moves over to the native code right there at the back edge. That
+// is the only way a loop in a function that's only called once, like the top
+// level, gets to leave the interpreter.
+// A trace that keeps taking side exits is running down the wrong path, so it
+// gets demoted back to Interpreted and recorded again once the loop is hot on
+// whatever path it takes by then. Anything that fails to compile ends up
+// Blacklisted and stays in the interpreter.
+//
+// Compiled functions assume the globals they read never change. Each one is
+// registered as a dependency on those globals, and a SetGlobal to any of them
+// demotes the function back to Interpreted, see deopt.h. It gets compiled
+// again once it's hot again, without assuming anything after a few of those.
+//
+// Quickening isn't a tier of its own, every instruction quickens itself the
+// first time it runs. Without ROC_JIT nothing ever gets promoted, but the
+// counters still run so TierReport can show what's hot.
+
+#define TIER_CALL_THRESHOLD 64
+#define TIER_LOOP_THRESHOLD 128
+#define TIER_SIDE_EXIT_LIMIT 64
+#define TIER_RETRACE_LIMIT 2
+#define TIER_INVALIDATION_LIMIT 4
+// longest function name kept in a FunctionTier, the rest is cut off
+#define TIER_NAME_MAX 32
+
+struct TierConfig {
+  // calls before a function gets compiled
+  u32 call_threshold = TIER_CALL_THRESHOLD;
+  // back edges before a loop gets traced
+  u32 loop_threshold = TIER_LOOP_THRESHOLD;
+  // side exits before a trace is thrown away
+  u32 side_exit_limit = TIER_SIDE_EXIT_LIMIT;
+  // after this many demotions a loop keeps whatever trace it has for good
+  u32 retrace_limit = TIER_RETRACE_LIMIT;
+  // after this many invalidations a function gets compiled without speculating
+  u32 invalidation_limit = TIER_INVALIDATION_LIMIT;
+  // false keeps everything interpreted, the counters still run
+  bool native = true;
+};
+
+// one function's row in TierManager::Report
+struct FunctionTier {
+  char name[TIER_NAME_MAX];
+  Tier tier;
+  u64 calls;
+  u32 loops;
+  // loops running as traces right now
+  u32 traced_loops;
+  // times a running frame moved over to native code at a loop
+  u64 osr_entries;
+  // instructions the interpreter has rewritten into type specialized ones
+  u32 quickened;
+  // times its native code was thrown away because a global changed
+  u32 invalidations;
+};
+
+auto TierName(Tier tier) -> const char*;
+
+// handed out to every TierManager, chunks remember which one their counters
+// and native code belong to
+inline std::atomic<u64> TIER_GENERATIONS = 1;
+
+class VirtualMachine;
+
+class TierManager {
+ public:
+  auto Init(VirtualMachine* vm) -> void;
+  auto Deinit() -> void;
+
+  // counts a call to the frame that was just pushed, and returns native code
+  // to run it with once it has some
+  auto Call(StackFrame* frame) -> NativeCode;
+  // counts a back edge to header, and hands back the loop once it has a trace
+  // or is hot enough to record one
+  auto Loop(StackFrame* frame, u32 header) -> LoopTrace*;
+
+  // the global at that object pool index was just assigned to
+  auto WriteGlobal(u32 global) -> void {
+    if (global < this->watched.count && this->watched[global]) [[unlikely]] {
+      this->Invalidate(global);
+    }
+  }
+
+#if defined(ROC_JIT)
+  // installs a finished recording, or blacklists the loop if it won't compile
+  auto Promote(Chunk* chunk, LoopTrace* trace, const TraceRecording* recording) -> void;
+  auto SideExit(LoopTrace* trace) -> void;
+#endif
+
+  // every function that has run since Init, hottest first
+  auto Report(DynamicArray<FunctionTier>* report) const -> void;
+
+ public:
+  TierConfig config;
+
+ private:
+  auto Claim(StackFrame* frame) -> void;
+  auto FindLoop(Chunk* chunk, u32 header) -> LoopTrace*;
+  auto Invalidate(u32 global) -> void;
+#if defined(ROC_JIT)
+  auto Compile(Chunk* chunk) -> void;
+#endif
+
+ private:
+  struct Function {
+    Chunk* chunk;
+    char name[TIER_NAME_MAX];
+  };
+
+  // native code compiled as chunk's code_epoch assumed global never changes
+  struct Dependency {
+    u32 global;
+    Chunk* chunk;
+    u64 epoch;
+  };
+
+  DynamicArray<Function> functions;
+  u64 generation = 0;
+
+  DynamicArray<Dependency> dependencies;
+  // by object pool index, whether anything depends on that global
+  DynamicArray<bool> watched;
+
+#if defined(ROC_JIT)
+  Jit jit;
+#endif
+};
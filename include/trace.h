@@ -0,0 +1,45 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+#include "dynamic_array.h"
+#include "value.h"
+
+// Tracing for hot loops, on top of the baseline JIT.
+//
+// Once the TierManager decides a loop is hot, the next iteration gets run one
+// instruction at a time and recorded, along with the types it saw and which
+// way every branch went. The recording is compiled into a native loop that
+// keeps the locals unboxed, type checks them once on entry and turns every
+// branch into a guard. A guard that fails writes the state back and returns
+// to the interpreter at the instruction it would have gone to. Leaving from
+// inside the loop body is a side exit, and a trace taking too many of those
+// gets thrown away and recorded again.
+//
+// Only number, integer and boolean code gets traced, anything else (calls,
+// globals, upvalues, strings) blacklists the loop.
+
+// longest recording worth compiling
+#define JIT_TRACE_MAX 256
+
+// one instruction as it ran while recording
+struct TraceStep {
+  u32 offset;
+  OpCode op;
+  // what the locals read by GetLocal and its superinstructions held
+  ValueType locals[2];
+  // conditional jumps, see Chunk::IsConditionalJump
+  bool taken;
+};
+
+struct TraceRecording {
+  // offset of the loop header, where the trace starts and loops back to
+  u32 header;
+  // stack slots in use above frame->locals at the header
+  u32 depth;
+  DynamicArray<TraceStep> steps;
+};
+
+// whether the trace compiler knows what to do with op, recording stops short
+// of anything it doesn't
+auto IsTraceable(OpCode op) -> bool;
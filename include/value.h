@@ -1,9 +1,11 @@
 #pragma once
 
 #include <cstdio>
+#include <cstring>
 
 #include "common.h"
 #include "dynamic_array.h"
+#include "roc_config.h"
 
 // hurr durr circular imports
 // "heap" allocated data
@@ -13,14 +15,102 @@ enum class ValueType {
   Number,
   Boolean,
   Object,
+  Integer,
 };
 
+// Integers are 49 bits whichever way Values are laid out, that's all a NaN box
+// has room for and a build flag shouldn't change what a program computes.
+// Anything wider has to be a double. Shifted up by VALUE_INTEGER_SHIFT their
+// sign is the sign bit, so native code sees them leave the range as overflow.
+#define VALUE_INTEGER_SHIFT 15
+#define VALUE_INTEGER_MIN (-(1LL << 48))
+#define VALUE_INTEGER_MAX ((1LL << 48) - 1)
+
+#if defined(ROC_NAN_BOXING)
+// Every Value is a single double. Anything that isn't a number lives inside
+// the payload of a quiet NaN. Object pointers set the sign bit on top of that,
+// and booleans are tagged in the low bits. Integers set the bit just below the
+// quiet NaN ones and keep the low 49 bits of themselves.
+#define VALUE_QNAN 0x7ffc000000000000ULL
+#define VALUE_SIGN_BIT 0x8000000000000000ULL
+#define VALUE_TAG_FALSE 2ULL
+#define VALUE_TAG_TRUE 3ULL
+#define VALUE_TAG_INTEGER 0x0002000000000000ULL
+#define VALUE_OBJECT_MASK (VALUE_SIGN_BIT | VALUE_QNAN)
+#define VALUE_INTEGER_MASK (VALUE_SIGN_BIT | VALUE_QNAN | VALUE_TAG_INTEGER)
+
+struct Value {
+  u64 bits;
+
+  Value() noexcept {
+    // @FIXME(eddie) - maybe make this a sentinel
+    this->bits = 0;
+  }
+
+  Value(f64 num) noexcept { std::memcpy(&this->bits, &num, sizeof(f64)); }
+
+  Value(bool boolean) noexcept { this->bits = VALUE_QNAN | (boolean ? VALUE_TAG_TRUE : VALUE_TAG_FALSE); }
+
+  Value(Object* object) noexcept { this->bits = VALUE_OBJECT_MASK | reinterpret_cast<uintptr_t>(object); }
+
+  // only for integers that FitsInteger
+  Value(i64 integer) noexcept {
+    this->bits = (VALUE_QNAN | VALUE_TAG_INTEGER) | (static_cast<u64>(integer) & ~VALUE_INTEGER_MASK);
+  }
+
+  auto operator==(const Value other) const -> const bool {
+    // NaN != NaN still has to hold
+    if (this->IsNumber() && other.IsNumber()) return this->AsNumber() == other.AsNumber();
+    if (this->bits == other.bits) return true;
+
+    // 1 == 1.0
+    return this->IsNumeric() && other.IsNumeric() && this->IsInteger() != other.IsInteger() &&
+           this->ToNumber() == other.ToNumber();
+  }
+
+  auto IsNumber() const -> bool { return (this->bits & VALUE_QNAN) != VALUE_QNAN; }
+  auto IsBoolean() const -> bool { return (this->bits | 1) == (VALUE_QNAN | VALUE_TAG_TRUE); }
+  auto IsObject() const -> bool { return (this->bits & VALUE_OBJECT_MASK) == VALUE_OBJECT_MASK; }
+  auto IsInteger() const -> bool { return (this->bits & VALUE_INTEGER_MASK) == (VALUE_QNAN | VALUE_TAG_INTEGER); }
+
+  auto Type() const -> ValueType {
+    if (this->IsNumber()) return ValueType::Number;
+    if (this->IsObject()) return ValueType::Object;
+    if (this->IsInteger()) return ValueType::Integer;
+    return ValueType::Boolean;
+  }
+
+  auto AsNumber() const -> f64 {
+    f64 num;
+    std::memcpy(&num, &this->bits, sizeof(f64));
+    return num;
+  }
+
+  auto AsBoolean() const -> bool { return this->bits == (VALUE_QNAN | VALUE_TAG_TRUE); }
+  auto AsObject() const -> Object* { return reinterpret_cast<Object*>(this->bits & ~VALUE_OBJECT_MASK); }
+  auto AsInteger() const -> i64 { return static_cast<i64>(this->bits << VALUE_INTEGER_SHIFT) >> VALUE_INTEGER_SHIFT; }
+
+  auto IsNumeric() const -> bool { return this->IsNumber() || this->IsInteger(); }
+  // either kind of number as a double
+  auto ToNumber() const -> f64 { return this->IsInteger() ? static_cast<f64>(this->AsInteger()) : this->AsNumber(); }
+
+  auto static FitsInteger(i64 integer) -> bool {
+    return integer >= VALUE_INTEGER_MIN && integer <= VALUE_INTEGER_MAX;
+  }
+
+  auto Print() const -> const void;
+  auto IsTruthy() const -> bool;
+};
+
+static_assert(sizeof(Value) == sizeof(u64), "NaN boxed Values should be 8 bytes");
+#else
 struct Value {
   ValueType type;
   union {
     bool boolean;
     f64 number;
     Object* object;
+    i64 integer;
   } as;
 
   Value() noexcept {
@@ -44,9 +134,16 @@ struct Value {
     this->as.object = object;
   }
 
+  Value(i64 integer) noexcept {
+    this->type = ValueType::Integer;
+    this->as.integer = integer;
+  }
+
   auto operator==(const Value other) const -> const bool {
-    // @TODO(eddie) - type deduction
-    if (this->type != other.type) return false;
+    // 1 == 1.0
+    if (this->type != other.type) {
+      return this->IsNumeric() && other.IsNumeric() && this->ToNumber() == other.ToNumber();
+    }
 
     switch (this->type) {
       default:
@@ -60,10 +157,31 @@ struct Value {
       case ValueType::Object: {
         return this->as.object == other.as.object;
       }
+      case ValueType::Integer: {
+        return this->as.integer == other.as.integer;
+      }
     }
   }
 
-  auto IsObject() const -> bool;
+  auto IsNumber() const -> bool { return this->type == ValueType::Number; }
+  auto IsBoolean() const -> bool { return this->type == ValueType::Boolean; }
+  auto IsObject() const -> bool { return this->type == ValueType::Object; }
+  auto IsInteger() const -> bool { return this->type == ValueType::Integer; }
+  auto Type() const -> ValueType { return this->type; }
+  auto AsNumber() const -> f64 { return this->as.number; }
+  auto AsBoolean() const -> bool { return this->as.boolean; }
+  auto AsObject() const -> Object* { return this->as.object; }
+  auto AsInteger() const -> i64 { return this->as.integer; }
+
+  auto IsNumeric() const -> bool { return this->IsNumber() || this->IsInteger(); }
+  // either kind of number as a double
+  auto ToNumber() const -> f64 { return this->IsInteger() ? static_cast<f64>(this->AsInteger()) : this->AsNumber(); }
+
+  auto static FitsInteger(i64 integer) -> bool {
+    return integer >= VALUE_INTEGER_MIN && integer <= VALUE_INTEGER_MAX;
+  }
+
   auto Print() const -> const void;
   auto IsTruthy() const -> bool;
 };
+#endif
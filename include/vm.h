@@ -8,14 +8,21 @@
 #include "chunk.h"
 #include "common.h"
 #include "dynamic_array.h"
+#include "event_loop.h"
+#include "gc.h"
+#include "jit.h"
 #include "object.h"
 #include "string_pool.h"
+#include "tiering.h"
 #include "utils.h"
 #include "value.h"
 
 #define VM_INTERPRET_ERRORS \
   X(CompileError)           \
-  X(RuntimeError)
+  X(RuntimeError)           \
+  X(Suspended)              \
+  X(BudgetExhausted)        \
+  X(ObjectResult)
 
 enum class InterpretError {
 #define X(ID) ID,
@@ -37,8 +44,72 @@ auto static ErrorToString(InterpretError err) -> const char* {
   }
 }
 
-#define VM_STACK_MAX 128
-#define VM_LOCAL_MAX (VM_STACK_MAX * 4)
+// selected by the ROC_DISPATCH cmake option
+// SWITCH   - one big switch, portable but every op shares one indirect branch
+// GOTO     - computed goto direct threading, each handler jumps to the next
+// TAILCALL - every handler is its own function and tail calls the next one
+// CACHED   - GOTO with the top of the stack kept in a register
+#if !defined(ROC_DISPATCH_SWITCH) && !defined(ROC_DISPATCH_GOTO) && !defined(ROC_DISPATCH_TAILCALL) && \
+    !defined(ROC_DISPATCH_CACHED)
+#define ROC_DISPATCH_SWITCH 1
+#endif
+
+#if defined(ROC_DISPATCH_TAILCALL)
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(clang::musttail)
+#define ROC_MUSTTAIL [[clang::musttail]]
+#else
+#error "ROC_DISPATCH=TAILCALL requires [[clang::musttail]]"
+#endif
+#endif
+
+// The value stack is one block that starts out small and gets moved somewhere
+// twice as big whenever it fills up, GrowStack fixes up every pointer into it.
+// Frames live in fixed size segments that are never moved, so a StackFrame*,
+// like the one native code keeps in rbx, stays good for as long as the call.
+//
+// Pushes only check against stack_limit, which stops VM_STACK_HEADROOM values
+// short of the end. Traces write their stack slots back on exit without
+// checking anything, see trace.h, so they never get to use more than that.
+//
+// stack_limit also only ever goes VM_STACK_STEP values past what's been asked
+// for, GrowStack moves it up when there's room and only moves the stack when
+// there isn't. Nothing past stack_limit + VM_STACK_HEADROOM gets written
+// without going through there, so that's as far as ClearStack has to look.
+#define VM_STACK_INITIAL 256
+#define VM_STACK_HEADROOM 64
+#define VM_STACK_STEP 1024
+#define VM_FRAME_SEGMENT 64
+// default hard ceilings, see StackConfig
+#define VM_MAX_FRAMES (1 << 14)
+#define VM_MAX_VALUES (1 << 20)
+// innermost frames a runtime error prints
+#define VM_BACKTRACE_MAX 32
+
+static_assert((VM_FRAME_SEGMENT & (VM_FRAME_SEGMENT - 1)) == 0, "frame segments must be a power of two");
+
+struct StackConfig {
+  // calls nested deeper than this are a stack overflow
+  u32 max_frames = VM_MAX_FRAMES;
+  // a call that starts with this many Values on the stack is too
+  u32 max_values = VM_MAX_VALUES;
+};
+
+// what a run does once it has used up its budget
+enum class BudgetAction : u8 {
+  // stops where it is, VirtualMachine::Resume picks it back up
+  Yield,
+  // unwinds everything, same as a runtime error
+  Abort,
+};
+
+// A run only looks at its budget at safepoints, loop back edges and calls, so
+// straight line code never pays for it. Every safepoint costs one, native code
+// and traces included.
+struct BudgetConfig {
+  // 0 is no limit
+  u64 safepoints = 0;
+  BudgetAction action = BudgetAction::Yield;
+};
 
 enum class FrameType {
   Closure,
@@ -60,36 +131,311 @@ struct StackFrame {
   Value* locals;
 };
 
+enum class FiberState : u8 {
+  Ready,
+  Running,
+  // waiting for some other fiber to finish, see OpJoin, or on a native's I/O
+  Blocked,
+  Done,
+};
+
+// A stack and call frames of its own. Only the running fiber's are in the
+// VirtualMachine itself, SwitchTo parks them in here and moves the next one's
+// in, so nothing that runs code has to know fibers exist, native code
+// included. They're cooperative, a fiber runs until it finishes or joins one
+// that hasn't yet, or calls a native that has to wait on I/O.
+struct Fiber {
+  DynamicArray<StackFrame*> frame_segments;
+  u32 frame_count;
+  u32 frame_capacity;
+  Value* stack;
+  Value* stack_top;
+  Value* stack_limit;
+  Value* stack_ceiling;
+  u64 stack_capacity;
+  Object::Upvalue* open_upvalues;
+
+  FiberState state;
+  // whatever its function returned, once it's Done
+  Value result;
+  // fibers Blocked on this one, linked through next_waiter
+  Fiber* waiters;
+  Fiber* next_waiter;
+};
+
+// a native waiting on the EventLoop, the fiber that called it stays Blocked
+// until it's done
+struct IoRequest {
+  IoOp op;
+  Fiber* fiber;
+  NativeId native;
+  // the whole buffer, op.buffer and op.length move along it when a read or
+  // write comes back short
+  u8* data;
+  u64 size;
+};
+
 using InterpretResult = Result<Value, InterpretError>;
 
+// what an opcode handler tells the dispatch loop to do next
+enum class ExecStatus : u8 {
+  Continue,
+  Done,
+  Error,
+  // native code gave up, keep interpreting wherever the frame is now
+  Exit,
+  // out of budget, inst_ptr is back on the safepoint's opcode
+  Suspend,
+};
+
+class VirtualMachine;
+using OpHandler = InterpretResult (*)(VirtualMachine*, StackFrame*);
+
 class VirtualMachine {
  public:
   auto Init() -> void;
   auto Deinit() -> void;
   auto Interpret(Object* func, StringPool* string_pool, Arena<Object>* object_pool) -> InterpretResult;
+  // same thing, but runs the register code of every function instead
+  auto InterpretRegisters(Object* func, StringPool* string_pool, Arena<Object>* object_pool) -> InterpretResult;
 
   auto RuntimeError(const char* msg, ...) -> InterpretError;
   auto Peek() const -> Value;
   auto Peek(int dist) const -> Value;
 
+#if defined(ROC_PROFILE_OPCODES)
+  // most frequent opcode pairs executed so far, what the superinstructions in
+  // chunk.h were picked from
+  auto PrintOpcodeProfile(u32 top) const -> void;
+  auto RecordOpcode(OpCode op) -> void;
+#endif
+
+#if defined(ROC_JIT)
+  // on by default, the stack interpreter compiles hot functions to native code
+  auto EnableJit(bool enabled) -> void;
+#endif
+
+  // hard ceilings on how far the stacks can grow, takes effect on the next call
+  auto ConfigureStack(StackConfig config) -> void;
+
+  // which EventLoop backend the natives use, between runs
+  auto ConfigureIo(IoBackend backend) -> void;
+  auto IoBackendInUse() const -> IoBackend { return this->io.Backend(); }
+
+  // takes effect on the next Interpret or Resume
+  auto ConfigureBudget(BudgetConfig config) -> void;
+  // carries on with a run that came back Suspended, with a fresh budget. A new
+  // Interpret drops whatever was suspended instead
+  auto Resume() -> InterpretResult;
+  auto Suspended() const -> bool { return this->suspended; }
+
+  // when the collector runs, see gc.h. Takes effect on the next allocation
+  auto ConfigureGc(GcConfig config) -> void { this->gc.Configure(config); }
+  // collections, what they freed and how long they took since Init
+  auto GcReport() const -> GcStats { return this->gc.Stats(); }
+
+  // thresholds for promoting functions and loops, see tiering.h
+  auto ConfigureTiers(TierConfig config) -> void;
+  // every function the stack interpreter has run since Init, hottest first
+  auto TierReport(DynamicArray<FunctionTier>* report) const -> void;
+  auto PrintTierReport(u32 top) const -> void;
+
  private:
   auto Push(Value value) -> void;
   auto Pop() -> Value;
-  auto Invoke(Object::Closure* closure, u32 argc) -> Result<size_t, InterpretError>;
-  auto Invoke(Object::Function* closure, u32 argc) -> Result<size_t, InterpretError>;
+  // makes room for at least values more above stack_top
+  auto GrowStack(u64 values) -> void;
+  // zeroes everything from from up, and brings stack_limit back down to a
+  // step past it
+  auto ClearStack(Value* from) -> void;
+  // false if the call about to be pushed would go over a ceiling
+  auto ReserveFrame() -> bool;
+  auto Frame(u32 idx) -> StackFrame* {
+    return &this->frame_segments[idx / VM_FRAME_SEGMENT][idx % VM_FRAME_SEGMENT];
+  }
+  // a fresh stack and no frames, for Init and every spawned fiber
+  auto InitStack() -> void;
+  // parks the running fiber and moves next's stack and frames in
+  auto SwitchTo(Fiber* next) -> void;
+  // the top level becomes a fiber the first time anything needs one
+  auto AdoptTopLevel() -> void;
+  // moves the next Ready fiber in, waiting on I/O if that's all there is. It's
+  // a deadlock if there's nothing to wait on either
+  auto Schedule(StackFrame*& frame) -> ExecStatus;
+  // a Blocked fiber gets result as whatever it's blocked in evaluates to
+  auto Wake(Fiber* waiter, Value result) -> void;
+  // the running fiber's bottom frame just returned result
+  auto FinishFiber(StackFrame*& frame, Value result) -> ExecStatus;
+  // frees every fiber left over once Interpret is done, the top level's stack
+  // is the one left in the VM
+  auto ReleaseFibers() -> void;
+  // Functions and Closures both, nullptr once it's reported a runtime error
+  auto Invoke(Object* callee, u32 argc) -> StackFrame*;
+  // same minus the arity check, for callees a CallCache already vouched for
+  auto PushFrame(Object* callee, u32 argc) -> StackFrame*;
+  auto InvokeValue(Value callee, u32 argc, StackFrame*& frame) -> ExecStatus;
+  // InvokeValue through the call site's CallCache, see chunk.h
+  auto InvokeCached(CallCache* cache, Value callee, u32 argc, StackFrame*& frame) -> ExecStatus;
+  auto InvokeInPlace(StackFrame*& frame) -> ExecStatus;
+  // whether the call at frame->inst_ptr is to a native, without reading it
+  auto NativeCallee(const StackFrame* frame) const -> bool;
+  // natives live in natives.cpp. They either push their result straight away
+  // or park the fiber until the EventLoop is done with them
+  auto CallNative(Object::Native* native, u32 argc, StackFrame*& frame) -> ExecStatus;
+#define X(ID, NAME, ARITY) auto Native##ID(Value* args, StackFrame*& frame) -> ExecStatus;
+  VM_NATIVES
+#undef X
+  // args and the callee under them make way for result
+  auto ReturnNative(Value* args, Value result) -> ExecStatus;
+  auto Suspend(IoRequest* request, Value* args, StackFrame*& frame) -> ExecStatus;
+  auto ReapIo(bool block) -> void;
+  auto CompleteIo(IoRequest* request) -> void;
+  // cancels everything in flight, nothing is left to wake up
+  auto ReleaseIo() -> void;
+  auto GlobalSlot(Chunk* chunk, u32 cache_idx) -> Object*;
+  auto AssignGlobal(Chunk* chunk, u32 cache_idx, Value value) -> bool;
+  // the pools the next run allocates from
+  auto AdoptPools(StringPool* string_pool, Arena<Object>* object_pool) -> void;
+  // everything the VM allocates while running comes from these, the
+  // collector runs first if it's time. Those live in gc.cpp
+  auto AllocObject() -> Object*;
+  // interned the same as the compiler's, only a new string is collectable
+  auto AllocString(u64 length, const char* start) -> Object*;
+  // a full collection, the nursery and then the old space
+  auto Collect() -> void;
+  auto CollectMinor() -> void;
+  // the top of what the collector looks at on the running stack, everything
+  // above gets zeroed
+  auto StackRoots() -> Value*;
+  auto MarkRoots() -> void;
+  auto ForwardRoots() -> void;
   auto CaptureUpvalue(Value* local) -> Object::Upvalue*;
   auto CloseUpvalues(Value* local) -> void;
+  auto Run(StackFrame* frame) -> InterpretResult;
+  auto Finish(ExecStatus status) -> InterpretResult;
+  // true once the budget is gone, with inst_ptr put back on the opcode so the
+  // safepoint runs again on Resume
+  auto Safepoint(StackFrame* frame) -> bool;
+  // parks or unwinds the run, whichever the BudgetAction says
+  auto OutOfBudget() -> InterpretError;
+  // a fresh budget for the next run
+  auto Refuel() -> void;
+  // throws away a run that's still suspended
+  auto DropSuspended() -> void;
+  auto RunRegisters(StackFrame* frame) -> InterpretResult;
+
+#define X(ID) auto Op##ID(StackFrame*& frame) -> ExecStatus;
+  VM_OPCODES
+#undef X
+  auto CompareOperands(OpCode compare, bool* result) -> bool;
+
+#if defined(ROC_DISPATCH_TAILCALL)
+#define X(ID) auto static Tail##ID(VirtualMachine* vm, StackFrame* frame) -> InterpretResult;
+  VM_OPCODES
+#undef X
+
+  const static OpHandler TAIL_DISPATCH[OPCODE_COUNT];
+#endif
+
+  auto EnterNative(StackFrame*& frame) -> ExecStatus;
+  auto EnterTrace(StackFrame*& frame) -> ExecStatus;
+
+#if defined(ROC_JIT)
+  friend class Jit;
+  friend class JitCompiler;
+
+  auto RecordTrace(StackFrame*& frame, LoopTrace* trace) -> ExecStatus;
+  auto static TraceLocals(OpCode op, const u8* operands, const Value* locals, ValueType* types) -> ValueType*;
+
+  // what native code calls back into, see jit.h
+#define X(ID) auto static JitOp##ID(VirtualMachine* vm, StackFrame** frame) -> ExecStatus;
+  VM_OPCODES
+#undef X
+  auto static JitInvoke(VirtualMachine* vm, StackFrame** frame) -> ExecStatus;
+  auto static JitTailInvoke(VirtualMachine* vm, StackFrame** frame) -> NativeCode;
+  auto static JitIterate(VirtualMachine* vm, StackFrame** frame) -> ExecStatus;
+  auto static JitJoin(VirtualMachine* vm, StackFrame** frame) -> ExecStatus;
+  auto static JitIsTruthy(VirtualMachine* vm) -> bool;
+  auto static JitGrowStack(VirtualMachine* vm) -> void;
+  // pops the value being matched, and returns where its arm is in native code
+  auto static JitMatchDense(VirtualMachine* vm, const JumpTable* table, void** native) -> void*;
+  auto static JitMatchHash(VirtualMachine* vm, const JumpTable* table, void** native) -> void*;
+  // what a global holds right now, for the JIT to bake in
+  auto JitGlobal(Chunk* chunk, u32 cache_idx) -> Object*;
+
+  const static NativeCode JIT_HELPERS[OPCODE_COUNT];
+#endif
 
  private:
-  StackFrame frames[VM_STACK_MAX];
+  DynamicArray<StackFrame*> frame_segments;
   u32 frame_count = 0;
+  // frames that can be pushed before ReserveFrame has to step in
+  u32 frame_capacity = 0;
 
-  Value stack[VM_LOCAL_MAX];
-  Value* stack_top;
+  Value* stack = nullptr;
+  Value* stack_top = nullptr;
+  // pushing at or past this grows the stack
+  Value* stack_limit = nullptr;
+  // a call starting at or past this is a stack overflow
+  Value* stack_ceiling = nullptr;
+  u64 stack_capacity = 0;
+
+  StackConfig stack_config;
+
+  BudgetConfig budget_config;
+  // safepoints left, native code counts it down too. Without a budget it
+  // starts out too big to ever run out
+  u64 budget_left = UINT64_MAX;
+  // a run is parked at a safepoint, and whether it was running register code
+  bool suspended = false;
+  bool suspended_registers = false;
+  // the run in progress is register code, its registers are roots too
+  bool running_registers = false;
 
   Object::Upvalue* open_upvalues = nullptr;
 
+  // every fiber of this run, the top level first. Empty until something gets
+  // spawned
+  DynamicArray<Fiber*> fibers;
+  // the one whose stack and frames are in here right now
+  Fiber* fiber = nullptr;
+  // Ready fibers in the order they get to run, from ready_head on
+  DynamicArray<Fiber*> ready;
+  u64 ready_head = 0;
+  // Object::Fibers from an earlier Interpret point at fibers that are gone
+  u64 fiber_generation = 0;
+
+  // what the natives wait on, and whatever it's finished with each Reap
+  EventLoop io;
+  DynamicArray<IoOp*> io_done;
+
+  TierManager tiering;
+
+  // globals that have been assigned to, by object pool index. nullptr if it
+  // still holds what the compiler put in the pool
+  DynamicArray<Object*> globals;
+  // Arena::Generation of the pool globals belongs to
+  u64 globals_pool = 0;
+  // what every GlobalCache is checked against, changes on every assignment
+  u64 globals_generation = 0;
+  // what every CallCache is checked against, the Arena::Generation of the
+  // object pool the callees it remembers live in
+  u64 call_generation = 0;
+
   // @NOTE(eddie) - the string_pool manages its own Objects for strings
   StringPool* string_pool = nullptr;
   Arena<Object>* object_pool = nullptr;
+
+  GarbageCollector gc;
+  // Arena::Generation of the pool what gc tracks came from
+  u64 gc_pool = 0;
+
+#ifdef DEBUG_PRINT_CODE
+  absl::flat_hash_set<std::string_view> disassembled;
+#endif
+
+#if defined(ROC_PROFILE_OPCODES)
+  u64 opcode_pairs[OPCODE_COUNT][OPCODE_COUNT] = {};
+  u8 prev_opcode = static_cast<u8>(OpCode::Invoke);
+#endif
 };
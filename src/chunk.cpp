@@ -1,6 +1,9 @@
 #include "chunk.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 
 #include "common.h"
 #include "memory.h"
@@ -12,18 +15,260 @@ auto Chunk::Init() -> void {
   this->bytecode.Init();
   this->locals.Init();
   this->lines.Init();
+  this->global_caches.Init();
+  this->call_caches.Init();
+  this->jump_tables.Init();
+  this->registers.Init();
+  this->register_count = 0;
+  this->invocations = 0;
+  this->tier = Tier::Interpreted;
+  this->native = nullptr;
+  this->tier_generation = 0;
+  this->loop_traces.Init();
+  this->code_epoch = 0;
+  this->invalidations = 0;
 }
 
 auto Chunk::Deinit() -> void {
   this->bytecode.Deinit();
   this->locals.Deinit();
   this->lines.Deinit();
+  this->global_caches.Deinit();
+  this->call_caches.Deinit();
+  for (u64 i = 0; i < this->jump_tables.count; i++) {
+    this->jump_tables[i].Deinit();
+  }
+  this->jump_tables.Deinit();
+  this->registers.Deinit();
+  this->register_count = 0;
+  this->loop_traces.Deinit();
 }
 
 auto Chunk::Count() const -> u64 { return this->bytecode.count; }
 
 auto Chunk::BaseInstructionPointer() const -> u8* { return this->bytecode.data; }
 
+auto Chunk::OperandLength(OpCode op) -> u32 {
+  switch (op) {
+    default:
+      return 0;
+    case OpCode::Constant:
+      return 1;
+    case OpCode::ConstantLong:
+    case OpCode::String:
+    case OpCode::SetGlobal:
+    case OpCode::GetGlobal:
+    case OpCode::SetLocal:
+    case OpCode::GetLocal:
+    case OpCode::SetUpvalue:
+    case OpCode::GetUpvalue:
+    case OpCode::Jump:
+    case OpCode::JumpFalse:
+    case OpCode::JumpTrue:
+    case OpCode::Loop:
+    case OpCode::Iterate:
+    case OpCode::MatchDense:
+    case OpCode::MatchHash:
+#define C(ID, COMPARE, WHEN) case OpCode::ID:
+      VM_COMPARE_JUMPS(C)
+#undef C
+      return sizeof(u32);
+    // argc and the CallCache
+    case OpCode::Invoke:
+    case OpCode::TailInvoke:
+    case OpCode::Spawn:
+      return 2 * sizeof(u32);
+    // the jump comes first like every other jump's, then the counter's slot
+    case OpCode::ForRange:
+      return 2 * sizeof(u32);
+#define X(ID, FIRST, SECOND) \
+  case OpCode::ID:           \
+    return OperandLength(OpCode::FIRST) + OperandLength(OpCode::SECOND);
+      VM_SUPERINSTRUCTIONS(X)
+#undef X
+  }
+}
+
+auto Chunk::InstructionLength(u64 offset) const -> u32 {
+  const auto op = static_cast<OpCode>(this->bytecode[offset]);
+  if (op == OpCode::Closure) {
+    const u8 upvalue_count = this->bytecode[offset + 1 + sizeof(u32)];
+    return 1 + sizeof(u32) + 1 + 2 * upvalue_count;
+  }
+
+  return 1 + OperandLength(op);
+}
+
+auto Chunk::FuseSuperinstructions() -> void {
+#define X(ID, FIRST, SECOND) this->FuseSuperinstruction(OpCode::ID, OpCode::FIRST, OpCode::SECOND);
+  VM_SUPERINSTRUCTIONS(X)
+#undef X
+}
+
+auto Chunk::IsConditionalJump(OpCode op) -> bool {
+  switch (op) {
+    case OpCode::JumpFalse:
+    case OpCode::JumpTrue:
+    case OpCode::ForRange:
+#define C(ID, COMPARE, WHEN) case OpCode::ID:
+      VM_COMPARE_JUMPS(C)
+#undef C
+      return true;
+    default:
+      return false;
+  }
+}
+
+auto static IsMatch(OpCode op) -> bool { return op == OpCode::MatchDense || op == OpCode::MatchHash; }
+
+auto static IsJump(OpCode op) -> bool {
+  return op == OpCode::Jump || op == OpCode::Loop || Chunk::IsConditionalJump(op);
+}
+
+auto static JumpTarget(const u8* code, u64 offset) -> u64 {
+  u32 jump;
+  std::memcpy(&jump, code + offset + 1, sizeof(u32));
+
+  const u64 after = offset + 1 + sizeof(u32);
+  return static_cast<OpCode>(code[offset]) == OpCode::Loop ? after - jump : after + jump;
+}
+
+// Rewrites every FIRST SECOND pair into a single fused instruction, then fixes
+// up the jumps and line info for everything that moved.
+auto Chunk::FuseSuperinstruction(OpCode fused, OpCode first, OpCode second) -> void {
+  const u64 old_count = this->bytecode.count;
+  const u8* old_code = this->bytecode.data;
+
+  // nothing can be fused across a jump target
+  DynamicArray<bool> labels;
+  labels.Init();
+  defer(labels.Deinit());
+  for (u64 i = 0; i <= old_count; i++) {
+    labels.Append(false);
+  }
+  for (u64 offset = 0; offset < old_count; offset += this->InstructionLength(offset)) {
+    if (!IsJump(static_cast<OpCode>(old_code[offset]))) continue;
+
+    const u64 target = JumpTarget(old_code, offset);
+    if (target <= old_count) labels[target] = true;
+  }
+  for (u64 offset = 0; offset < old_count; offset += this->InstructionLength(offset)) {
+    if (!IsMatch(static_cast<OpCode>(old_code[offset]))) continue;
+
+    u32 index;
+    std::memcpy(&index, old_code + offset + 1, sizeof(u32));
+    const auto& targets = this->jump_tables[index].targets;
+    for (u64 i = 0; i < targets.count; i++) {
+      labels[offset + 1 + sizeof(u32) + targets[i]] = true;
+    }
+  }
+
+  // old byte offset -> new byte offset
+  DynamicArray<u64> moved;
+  moved.Init();
+  defer(moved.Deinit());
+
+  Bytecode code;
+  code.Init();
+  bool changed = false;
+
+  for (u64 offset = 0; offset < old_count;) {
+    const u32 length = this->InstructionLength(offset);
+    const u64 next = offset + length;
+
+    if (static_cast<OpCode>(old_code[offset]) == first && next < old_count &&
+        static_cast<OpCode>(old_code[next]) == second && !labels[next]) {
+      const u32 next_length = this->InstructionLength(next);
+
+      // the second opcode byte just goes away
+      for (u64 i = 0; i < length; i++) moved.Append(code.count + i);
+      for (u64 i = 0; i < next_length; i++) moved.Append(code.count + length - 1 + i);
+
+      code.Append(static_cast<u8>(fused));
+      code.Append(const_cast<u8*>(old_code) + offset + 1, length - 1);
+      code.Append(const_cast<u8*>(old_code) + next + 1, next_length - 1);
+
+      offset = next + next_length;
+      changed = true;
+      continue;
+    }
+
+    for (u64 i = 0; i < length; i++) moved.Append(code.count + i);
+    code.Append(const_cast<u8*>(old_code) + offset, length);
+    offset = next;
+  }
+  moved.Append(code.count);
+
+  if (!changed) {
+    code.Deinit();
+    return;
+  }
+
+  for (u64 offset = 0; offset < old_count; offset += this->InstructionLength(offset)) {
+    const auto op = static_cast<OpCode>(old_code[offset]);
+    if (IsMatch(op)) {
+      u32 index;
+      std::memcpy(&index, old_code + offset + 1, sizeof(u32));
+      auto& targets = this->jump_tables[index].targets;
+
+      const u64 old_after = offset + 1 + sizeof(u32);
+      const u64 after = moved[offset] + 1 + sizeof(u32);
+      for (u64 i = 0; i < targets.count; i++) {
+        targets[i] = static_cast<u32>(moved[old_after + targets[i]] - after);
+      }
+    }
+    if (!IsJump(op)) continue;
+
+    const u64 from = moved[offset];
+    const u64 after = from + 1 + sizeof(u32);
+    const u64 target = moved[JumpTarget(old_code, offset)];
+    const u32 jump = static_cast<u32>(op == OpCode::Loop ? after - target : target - after);
+    std::memcpy(code.data + from + 1, &jump, sizeof(u32));
+  }
+
+  for (u64 i = 0; i < this->lines.count; i++) {
+    this->lines[i].min = moved[this->lines[i].min];
+  }
+
+  this->bytecode.Deinit();
+  this->bytecode = code;
+}
+
+auto Chunk::MakeGenerator() -> void {
+  if (this->IsGenerator()) return;
+
+  for (u64 offset = 0; offset < this->bytecode.count; offset += this->InstructionLength(offset)) {
+    switch (static_cast<OpCode>(this->bytecode[offset])) {
+      default:
+        break;
+      case OpCode::Return:
+      case OpCode::ReturnVoid: {
+        this->bytecode[offset] = static_cast<u8>(OpCode::GeneratorEnd);
+        break;
+      }
+      case OpCode::TailInvoke: {
+        this->bytecode[offset] = static_cast<u8>(OpCode::Invoke);
+        break;
+      }
+    }
+  }
+
+  // jumps are relative, so only the line info cares that everything moved up
+  this->bytecode.Append(0);
+  std::memmove(this->bytecode.data + 1, this->bytecode.data, this->bytecode.count - 1);
+  this->bytecode[0] = static_cast<u8>(OpCode::Generator);
+  for (u64 i = 1; i < this->lines.count; i++) {
+    this->lines[i].min++;
+  }
+}
+
+auto Chunk::Rewind(u64 offset) -> void {
+  this->bytecode.count = offset;
+  while (this->lines.count > 0 && this->lines[this->lines.count - 1].min >= offset) {
+    this->lines.count--;
+  }
+}
+
 auto Chunk::AddLine(u64 line) -> void {
   auto count = this->bytecode.count;
 
@@ -68,6 +313,79 @@ auto Chunk::AddLocal(Value val, u64 line) -> u64 {
   return this->locals.Append(val);
 }
 
+auto Chunk::AddGlobalCache(u32 index) -> u32 {
+  return static_cast<u32>(this->global_caches.Append({index, 0, nullptr}));
+}
+
+auto Chunk::AddCallCache() -> u32 { return static_cast<u32>(this->call_caches.Append({nullptr, 0})); }
+
+auto Chunk::AddJumpTable() -> u32 {
+  JumpTable table;
+  table.Init();
+  return static_cast<u32>(this->jump_tables.Append(table));
+}
+
+auto JumpTable::Init() -> void {
+  this->low = 0;
+  this->dense.Init();
+  this->slots.Init();
+  this->targets.Init();
+  this->reg_targets.Init();
+}
+
+auto JumpTable::Deinit() -> void {
+  this->dense.Deinit();
+  this->slots.Deinit();
+  this->targets.Deinit();
+  this->reg_targets.Deinit();
+}
+
+// a dense table can have up to about as many holes as it has arms before
+// hashing is the better deal
+#define MATCH_DENSE_SLACK 8
+auto JumpTable::Build(const DynamicArray<Slot>& keys) -> OpCode {
+  bool integers = keys.count > 0;
+  f64 low = 0;
+  f64 high = 0;
+  for (u64 i = 0; i < keys.count && integers; i++) {
+    const Value key = keys[i].key;
+    // low has to make it through an i64 for DenseArm
+    const f64 num = key.ToNumber();
+    integers = key.IsNumeric() && std::trunc(num) == num && std::fabs(num) < 0x1p53;
+    if (!integers) break;
+
+    low = i == 0 ? num : std::min(low, num);
+    high = i == 0 ? num : std::max(high, num);
+  }
+
+  if (integers && high - low < static_cast<f64>(2 * keys.count + MATCH_DENSE_SLACK)) {
+    this->low = low;
+    for (f64 n = low; n <= high; n++) {
+      this->dense.Append(0);
+    }
+    for (u64 i = 0; i < keys.count; i++) {
+      this->dense[static_cast<u64>(keys[i].key.ToNumber() - low)] = keys[i].arm;
+    }
+    return OpCode::MatchDense;
+  }
+
+  // at most half full, so there's always an empty slot to stop at
+  u64 capacity = 1;
+  while (capacity < 2 * keys.count) capacity *= 2;
+  for (u64 i = 0; i < capacity; i++) {
+    this->slots.Append({Value(), 0});
+  }
+
+  const u64 mask = capacity - 1;
+  for (u64 i = 0; i < keys.count; i++) {
+    u64 slot = Hash(keys[i].key) & mask;
+    while (this->slots[slot].arm != 0) slot = (slot + 1) & mask;
+    this->slots[slot] = keys[i];
+  }
+  return OpCode::MatchHash;
+}
+#undef MATCH_DENSE_SLACK
+
 auto Chunk::SimpleInstruction(const char* name, int offset) const -> int {
   printf("%s\n", name);
   return offset + 1;
@@ -106,21 +424,43 @@ auto Chunk::ByteInstruction(const char* name, int offset) const -> int {
 }
 
 auto Chunk::JumpInstruction(const char* name, int sign, int offset) const -> int {
-  auto* location = this->bytecode.data + 1;
-  // auto *as_int = reinterpret_cast<u32*>(location);
-  const u32 jmp = *location;
+  u32 jmp;
+  std::memcpy(&jmp, this->bytecode.data + offset + 1, sizeof(u32));
 
-  printf("%-16s %4d -> %d\n", name, offset, offset + 5 + sign + jmp);
+  printf("%-16s %4d -> %d\n", name, offset, offset + 5 + sign * static_cast<int>(jmp));
   return offset + 5;
 }
 
 auto Chunk::GlobalInstruction(const char* name, int offset) const -> int {
-  const u8 one = this->bytecode[offset + 1];
-  const u8 two = this->bytecode[offset + 2];
-  const u8 thr = this->bytecode[offset + 3];
-  const u8 fou = this->bytecode[offset + 4];
+  u32 cache;
+  std::memcpy(&cache, this->bytecode.data + offset + 1, sizeof(u32));
 
-  printf("%-16s %04d %04d %04d %04d ' \n", name, one, two, thr, fou);
+  printf("%-16s %4d -> global %d\n", name, cache, this->global_caches[cache].index);
+
+  return offset + 5;
+}
+
+auto Chunk::CallInstruction(const char* name, int offset) const -> int {
+  u32 argc;
+  u32 cache;
+  std::memcpy(&argc, this->bytecode.data + offset + 1, sizeof(u32));
+  std::memcpy(&cache, this->bytecode.data + offset + 1 + sizeof(u32), sizeof(u32));
+
+  printf("%-16s %4d cache %d\n", name, argc, cache);
+
+  return offset + 1 + 2 * sizeof(u32);
+}
+
+auto Chunk::MatchInstruction(const char* name, int offset) const -> int {
+  u32 index;
+  std::memcpy(&index, this->bytecode.data + offset + 1, sizeof(u32));
+
+  const auto& targets = this->jump_tables[index].targets;
+  printf("%-16s %4d ->", name, index);
+  for (u64 i = 0; i < targets.count; i++) {
+    printf(" %d", offset + 5 + static_cast<int>(targets[i]));
+  }
+  printf("\n");
 
   return offset + 5;
 }
@@ -134,9 +474,12 @@ auto Chunk::PrintAtOffset(int offset) const -> int {
   const u32 line = this->lines[line_idx].val;
   printf("%4d ", line);
 
-  const u8 byte = this->bytecode[offset];
-  auto instruction = static_cast<OpCode>(byte);
+  return this->PrintInstruction(static_cast<OpCode>(this->bytecode[offset]), offset);
+}
 
+// offset is where the opcode byte would be, superinstructions print each of
+// their parts with the operands that follow
+auto Chunk::PrintInstruction(OpCode instruction, int offset) const -> int {
   switch (instruction) {
     case OpCode::Constant: {
       return this->ConstantInstruction(offset);
@@ -216,11 +559,32 @@ auto Chunk::PrintAtOffset(int offset) const -> int {
     case OpCode::JumpTrue: {
       return this->JumpInstruction("OP_JTRUE", 1, offset);
     }
+    case OpCode::JumpLess: {
+      return this->JumpInstruction("OP_JLESS", 1, offset);
+    }
+    case OpCode::JumpNotLess: {
+      return this->JumpInstruction("OP_JNOT_LESS", 1, offset);
+    }
+    case OpCode::JumpGreater: {
+      return this->JumpInstruction("OP_JGREATER", 1, offset);
+    }
+    case OpCode::JumpNotGreater: {
+      return this->JumpInstruction("OP_JNOT_GREATER", 1, offset);
+    }
+    case OpCode::JumpEqual: {
+      return this->JumpInstruction("OP_JEQUAL", 1, offset);
+    }
+    case OpCode::JumpNotEqual: {
+      return this->JumpInstruction("OP_JNOT_EQUAL", 1, offset);
+    }
     case OpCode::Loop: {
       return this->JumpInstruction("OP_LOOP", -1, offset);
     }
     case OpCode::Invoke: {
-      return this->ByteInstruction("OP_INVOKE", offset) + 3;
+      return this->CallInstruction("OP_INVOKE", offset);
+    }
+    case OpCode::TailInvoke: {
+      return this->CallInstruction("OP_TAIL_INVOKE", offset);
     }
     case OpCode::Closure: {
       auto* location = this->bytecode.data + offset + 1;
@@ -245,8 +609,86 @@ auto Chunk::PrintAtOffset(int offset) const -> int {
     case OpCode::CloseUpvalue: {
       return this->SimpleInstruction("OP_CLOSE_UPVALUE", offset);
     }
+    case OpCode::Generator: {
+      return this->SimpleInstruction("OP_GENERATOR", offset);
+    }
+    case OpCode::Yield: {
+      return this->SimpleInstruction("OP_YIELD", offset);
+    }
+    case OpCode::GeneratorEnd: {
+      return this->SimpleInstruction("OP_GENERATOR_END", offset);
+    }
+    case OpCode::Iterate: {
+      return this->GlobalInstruction("OP_ITERATE", offset);
+    }
+    case OpCode::ForRange: {
+      u32 jmp;
+      u32 slot;
+      std::memcpy(&jmp, this->bytecode.data + offset + 1, sizeof(u32));
+      std::memcpy(&slot, this->bytecode.data + offset + 1 + sizeof(u32), sizeof(u32));
+      printf("%-16s %4d -> %d\n", "OP_FOR_RANGE", slot, offset + 5 + static_cast<int>(jmp));
+      return offset + 9;
+    }
+    case OpCode::Spawn: {
+      return this->CallInstruction("OP_SPAWN", offset);
+    }
+    case OpCode::MatchDense: {
+      return this->MatchInstruction("OP_MATCH_DENSE", offset);
+    }
+    case OpCode::MatchHash: {
+      return this->MatchInstruction("OP_MATCH_HASH", offset);
+    }
+    case OpCode::Join: {
+      return this->SimpleInstruction("OP_JOIN", offset);
+    }
+    case OpCode::AddNumNum: {
+      return this->SimpleInstruction("OP_ADD_NUM_NUM", offset);
+    }
+    case OpCode::SubtractNumNum: {
+      return this->SimpleInstruction("OP_SUBTRACT_NUM_NUM", offset);
+    }
+    case OpCode::MultiplyNumNum: {
+      return this->SimpleInstruction("OP_MULTIPLY_NUM_NUM", offset);
+    }
+    case OpCode::DivideNumNum: {
+      return this->SimpleInstruction("OP_DIVIDE_NUM_NUM", offset);
+    }
+    case OpCode::GreaterNumNum: {
+      return this->SimpleInstruction("OP_GREATER_NUM_NUM", offset);
+    }
+    case OpCode::LessNumNum: {
+      return this->SimpleInstruction("OP_LESS_NUM_NUM", offset);
+    }
+    case OpCode::NegateNum: {
+      return this->SimpleInstruction("OP_NEGATE_NUM", offset);
+    }
+    case OpCode::AddIntInt: {
+      return this->SimpleInstruction("OP_ADD_INT_INT", offset);
+    }
+    case OpCode::SubtractIntInt: {
+      return this->SimpleInstruction("OP_SUBTRACT_INT_INT", offset);
+    }
+    case OpCode::MultiplyIntInt: {
+      return this->SimpleInstruction("OP_MULTIPLY_INT_INT", offset);
+    }
+    case OpCode::GreaterIntInt: {
+      return this->SimpleInstruction("OP_GREATER_INT_INT", offset);
+    }
+    case OpCode::LessIntInt: {
+      return this->SimpleInstruction("OP_LESS_INT_INT", offset);
+    }
+#define X(ID, FIRST, SECOND)                                                \
+  case OpCode::ID: {                                                       \
+    printf("%s\n", "OP_" #ID);                                             \
+    printf("          | ");                                                \
+    const int second = this->PrintInstruction(OpCode::FIRST, offset) - 1; \
+    printf("          | ");                                                \
+    return this->PrintInstruction(OpCode::SECOND, second);                 \
+  }
+      VM_SUPERINSTRUCTIONS(X)
+#undef X
     default: {
-      printf("Unknown opcode %d\n", byte);
+      printf("Unknown opcode %d\n", static_cast<u8>(instruction));
       return offset + 1;
     }
   }
@@ -259,15 +701,183 @@ auto Chunk::Disassemble() const -> void {
   }
 }
 
+auto Chunk::PrintRegistersAtOffset(int offset) const -> int {
+  printf("%04d ", offset);
+
+  const u8* code = this->registers.data + offset;
+  const auto read_int = [code](int at) {
+    u32 num;
+    std::memcpy(&num, code + at, sizeof(u32));
+    return num;
+  };
+
+  switch (static_cast<RegOpCode>(code[0])) {
+    case RegOpCode::Move: {
+      printf("%-16s r%d r%d\n", "R_MOVE", code[1], code[2]);
+      return offset + 3;
+    }
+    case RegOpCode::LoadK: {
+      printf("%-16s r%d k%d ' ", "R_LOADK", code[1], code[2]);
+      this->locals[code[2]].Print();
+      printf("\n");
+      return offset + 3;
+    }
+    case RegOpCode::LoadKLong: {
+      const u32 idx = read_int(2);
+      printf("%-16s r%d k%d ' ", "R_LOADK_LONG", code[1], idx);
+      this->locals[idx].Print();
+      printf("\n");
+      return offset + 6;
+    }
+    case RegOpCode::True: {
+      printf("%-16s r%d\n", "R_TRUE", code[1]);
+      return offset + 2;
+    }
+    case RegOpCode::False: {
+      printf("%-16s r%d\n", "R_FALSE", code[1]);
+      return offset + 2;
+    }
+#define BINARY(ID, NAME)                                                           \
+  case RegOpCode::ID: {                                                            \
+    printf("%-16s r%d r%d r%d\n", NAME, code[1], code[2], code[3]);                \
+    return offset + 4;                                                             \
+  }                                                                                \
+  case RegOpCode::ID##K: {                                                         \
+    printf("%-16s r%d r%d k%d ' ", NAME "_K", code[1], code[2], code[3]);          \
+    this->locals[code[3]].Print();                                                 \
+    printf("\n");                                                                  \
+    return offset + 4;                                                             \
+  }
+      BINARY(Add, "R_ADD")
+      BINARY(Subtract, "R_SUBTRACT")
+      BINARY(Multiply, "R_MULTIPLY")
+      BINARY(Divide, "R_DIVIDE")
+      BINARY(Equality, "R_EQUALITY")
+      BINARY(Greater, "R_GREATER")
+      BINARY(Less, "R_LESS")
+#undef BINARY
+    case RegOpCode::Negate: {
+      printf("%-16s r%d r%d\n", "R_NEGATE", code[1], code[2]);
+      return offset + 3;
+    }
+    case RegOpCode::Not: {
+      printf("%-16s r%d r%d\n", "R_NOT", code[1], code[2]);
+      return offset + 3;
+    }
+    case RegOpCode::String: {
+      printf("%-16s r%d %d\n", "R_STRING", code[1], read_int(2));
+      return offset + 6;
+    }
+    case RegOpCode::GetGlobal: {
+      printf("%-16s r%d %d -> global %d\n", "R_GET_GLOBAL", code[1], read_int(2),
+             this->global_caches[read_int(2)].index);
+      return offset + 6;
+    }
+    case RegOpCode::SetGlobal: {
+      printf("%-16s r%d %d -> global %d\n", "R_SET_GLOBAL", code[1], read_int(2),
+             this->global_caches[read_int(2)].index);
+      return offset + 6;
+    }
+    case RegOpCode::GetUpvalue: {
+      printf("%-16s r%d %d\n", "R_GET_UPVALUE", code[1], read_int(2));
+      return offset + 6;
+    }
+    case RegOpCode::SetUpvalue: {
+      printf("%-16s r%d %d\n", "R_SET_UPVALUE", code[1], read_int(2));
+      return offset + 6;
+    }
+    case RegOpCode::Jump: {
+      printf("%-16s -> %d\n", "R_JUMP", offset + 5 + read_int(1));
+      return offset + 5;
+    }
+    case RegOpCode::Loop: {
+      printf("%-16s -> %d\n", "R_LOOP", offset + 5 - read_int(1));
+      return offset + 5;
+    }
+    case RegOpCode::JumpFalse: {
+      printf("%-16s r%d -> %d\n", "R_JFALSE", code[1], offset + 6 + read_int(2));
+      return offset + 6;
+    }
+    case RegOpCode::JumpTrue: {
+      printf("%-16s r%d -> %d\n", "R_JTRUE", code[1], offset + 6 + read_int(2));
+      return offset + 6;
+    }
+    case RegOpCode::ForRange: {
+      printf("%-16s r%d -> %d\n", "R_FOR_RANGE", code[1], offset + 6 + read_int(2));
+      return offset + 6;
+    }
+    case RegOpCode::MatchDense:
+    case RegOpCode::MatchHash: {
+      const char* name = static_cast<RegOpCode>(code[0]) == RegOpCode::MatchDense ? "R_MATCH_DENSE" : "R_MATCH_HASH";
+      const auto& targets = this->jump_tables[read_int(2)].reg_targets;
+      printf("%-16s r%d %d ->", name, code[1], read_int(2));
+      for (u64 i = 0; i < targets.count; i++) {
+        printf(" %d", targets[i]);
+      }
+      printf("\n");
+      return offset + 6;
+    }
+    case RegOpCode::Invoke: {
+      printf("%-16s r%d %d cache %d\n", "R_INVOKE", code[1], code[2], read_int(3));
+      return offset + 7;
+    }
+    case RegOpCode::TailInvoke: {
+      printf("%-16s r%d %d cache %d\n", "R_TAIL_INVOKE", code[1], code[2], read_int(3));
+      return offset + 7;
+    }
+    case RegOpCode::Return: {
+      printf("%-16s r%d\n", "R_RETURN", code[1]);
+      return offset + 2;
+    }
+    case RegOpCode::ReturnVoid: {
+      printf("%-16s r%d\n", "R_RETURN_VOID", code[1]);
+      return offset + 2;
+    }
+    case RegOpCode::Closure: {
+      const u8 upvalue_count = code[1 + sizeof(u32)];
+      printf("%-16s %d %d\n", "R_CLOSURE", read_int(1), upvalue_count);
+      return offset + 1 + sizeof(u32) + 1 + 2 * upvalue_count;
+    }
+    case RegOpCode::CloseUpvalue: {
+      printf("%-16s r%d\n", "R_CLOSE_UPVALUE", code[1]);
+      return offset + 2;
+    }
+    default: {
+      printf("Unknown opcode %d\n", code[0]);
+      return offset + 1;
+    }
+  }
+}
+
+auto Chunk::DisassembleRegisters() const -> void {
+  printf("========== %d registers\n", this->register_count);
+  for (u32 offset = 0; offset < this->registers.count;) {
+    offset = this->PrintRegistersAtOffset(offset);
+  }
+}
+
 auto ChunkManager::Alloc() -> Chunk* {
   if (this->capacity < this->count + 1) {
     auto old_cap = this->capacity;
     this->capacity = GROW_CAPACITY(old_cap);
-    this->chunks = GROW_ARRAY(Chunk, this->chunks, old_cap, this->capacity);
+    this->chunks = GROW_ARRAY(Chunk*, this->chunks, old_cap, this->capacity);
   }
 
-  Chunk* chunk = &this->chunks[this->count++];
+  // functions hold on to their Chunk*, so chunks can't move when this grows
+  Chunk* chunk = ALLOCATE(Chunk, 1);
   chunk->Init();
+  this->chunks[this->count++] = chunk;
 
   return chunk;
 }
+
+auto ChunkManager::Clear() -> void {
+  for (u64 i = 0; i < this->count; i++) {
+    this->chunks[i]->Deinit();
+    FREE_ARRAY(Chunk, this->chunks[i], 1);
+  }
+  FREE_ARRAY(Chunk*, this->chunks, this->capacity);
+  this->chunks = nullptr;
+  this->count = 0;
+  this->capacity = 0;
+}
@@ -7,6 +7,7 @@
 #include "common.h"
 #include "global_pool.h"
 #include "object.h"
+#include "register_compiler.h"
 #include "string_pool.h"
 #include "utils.h"
 #include "value.h"
@@ -44,6 +45,23 @@ auto static IsWhitespace(const char c) -> const bool { return c == ' ' || c == '
 // @STDLIB
 auto static IsIdentifier(const char c) -> const bool { return !ispunct(c) && !isspace(c); }
 
+// integer literals too big to be a Value's integer are doubles instead, same
+// as if the arithmetic had gotten there
+auto static NumberLiteral(const Token& token, bool negative) -> Value {
+  if (token.type == Token::Lexeme::Integer) {
+    i64 value = 0;
+    bool fits = true;
+    for (u64 i = 0; i < token.len && fits; i++) {
+      fits = !CheckedMultiply(value, 10, &value) && !CheckedAdd(value, token.start[i] - '0', &value);
+    }
+
+    if (fits && Value::FitsInteger(negative ? -value : value)) return Value(negative ? -value : value);
+  }
+
+  const f64 value = strtod(token.start, nullptr);
+  return Value(negative ? -value : value);
+}
+
 Scanner::Scanner() noexcept {
   this->start = nullptr;
   this->curr = nullptr;
@@ -122,14 +140,15 @@ auto Scanner::StringToken() -> const Token {
 auto Scanner::NumberToken() -> const Token {
   while (IsDigit(this->Peek())) this->Pop();
 
-  // you get one .
+  // you get one ., and without it it's an integer
   if (this->Peek() == '.' && IsDigit(this->PeekNext())) {
     this->Pop();
 
     while (IsDigit(this->Peek())) this->Pop();
+    return this->MakeToken(Token::Lexeme::Number);
   }
 
-  return this->MakeToken(Token::Lexeme::Number);
+  return this->MakeToken(Token::Lexeme::Integer);
 }
 
 // @STDLIB
@@ -174,18 +193,32 @@ auto Scanner::IdentifierType() -> Token::Lexeme {
             return this->CheckKeyword(2, 0, "", Token::Lexeme::In);
         }
       }
+    case 'm':
+      return this->CheckKeyword(1, 4, "atch", Token::Lexeme::Match);
     case 'o':
       return this->CheckKeyword(1, 1, "r", Token::Lexeme::Or);
     case 'r':
       return this->CheckKeyword(1, 5, "eturn", Token::Lexeme::Return);
+    case 'j':
+      return this->CheckKeyword(1, 3, "oin", Token::Lexeme::Join);
     case 's':
-      return this->CheckKeyword(1, 5, "truct", Token::Lexeme::Struct);
+      if (this->curr - this->start > 1) {
+        switch (this->start[1]) {
+          case 'p':
+            return this->CheckKeyword(2, 3, "awn", Token::Lexeme::Spawn);
+          case 't':
+            return this->CheckKeyword(2, 4, "ruct", Token::Lexeme::Struct);
+        }
+      }
+      break;
     case 't':
       return this->CheckKeyword(1, 3, "rue", Token::Lexeme::True);
     case 'v':
       return this->CheckKeyword(1, 2, "ar", Token::Lexeme::Var);
     case 'w':
       return this->CheckKeyword(1, 4, "hile", Token::Lexeme::While);
+    case 'y':
+      return this->CheckKeyword(1, 4, "ield", Token::Lexeme::Yield);
   }
 
   return Token::Lexeme::Identifier;
@@ -221,7 +254,7 @@ auto Scanner::ScanToken() -> Token {
     case ',':
       return this->MakeToken(Token::Lexeme::Comma);
     case '.':
-      return this->MakeToken(Token::Lexeme::Dot);
+      return this->MakeToken(this->Match('.') ? Token::Lexeme::DotDot : Token::Lexeme::Dot);
     case '-':
       return this->MakeToken(Token::Lexeme::Minus);
     case '+':
@@ -231,6 +264,7 @@ auto Scanner::ScanToken() -> Token {
     case '!':
       return this->MakeToken(this->Match('=') ? Token::Lexeme::BangEqual : Token::Lexeme::Bang);
     case '=':
+      if (this->Match('>')) return this->MakeToken(Token::Lexeme::FatArrow);
       return this->MakeToken(this->Match('=') ? Token::Lexeme::EqualEqual : Token::Lexeme::Equal);
     case '<':
       return this->MakeToken(this->Match('=') ? Token::Lexeme::LessEqual : Token::Lexeme::Less);
@@ -286,6 +320,7 @@ const ParseRuleMap Compiler::PARSE_RULES = {
     {Token::Lexeme::EqualEqual, ParseRule(nullptr, &Grammar::Binary, Precedence::Equality)},
 
     {Token::Lexeme::Number, ParseRule(&Grammar::Number, nullptr, Precedence::None)},
+    {Token::Lexeme::Integer, ParseRule(&Grammar::Integer, nullptr, Precedence::None)},
 
     {Token::Lexeme::False, ParseRule(&Grammar::Literal, nullptr, Precedence::None)},
     {Token::Lexeme::True, ParseRule(&Grammar::Literal, nullptr, Precedence::None)},
@@ -297,15 +332,19 @@ const ParseRuleMap Compiler::PARSE_RULES = {
     {Token::Lexeme::RightBrace, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Eof, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Identifier, ParseRule(&Grammar::Variable, nullptr, Precedence::None)},
+    {Token::Lexeme::Spawn, ParseRule(&Grammar::SpawnOp, nullptr, Precedence::None)},
+    {Token::Lexeme::Join, ParseRule(&Grammar::JoinOp, nullptr, Precedence::None)},
 
     // @TODO(eddie)
     {Token::Lexeme::Error, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Comment, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Comma, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Dot, ParseRule(nullptr, nullptr, Precedence::None)},
+    {Token::Lexeme::DotDot, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Semicolon, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Colon, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Equal, ParseRule(nullptr, nullptr, Precedence::None)},
+    {Token::Lexeme::FatArrow, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Else, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::For, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Function, ParseRule(nullptr, nullptr, Precedence::None)},
@@ -314,6 +353,8 @@ const ParseRuleMap Compiler::PARSE_RULES = {
     {Token::Lexeme::Struct, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::Var, ParseRule(nullptr, nullptr, Precedence::None)},
     {Token::Lexeme::While, ParseRule(nullptr, nullptr, Precedence::None)},
+    {Token::Lexeme::Yield, ParseRule(nullptr, nullptr, Precedence::None)},
+    {Token::Lexeme::Match, ParseRule(nullptr, nullptr, Precedence::None)},
 
 };
 
@@ -324,12 +365,26 @@ auto Compiler::Init(const char* src, StringPool* string_pool, GlobalPool* global
 }
 
 auto Compiler::Compile() -> Result<Object*, CompileError> {
+  this->DefineNatives();
+
   CompilerEngine engine = {};
   engine.Init(this);
 
   return engine.Compile();
 }
 
+auto Compiler::Clear() -> void { this->chunk_manager.Clear(); }
+
+auto Compiler::DefineNatives() -> void {
+#define X(ID, NAME, ARITY)                                                         \
+  if (this->global_pool->Find(strlen(#NAME), #NAME).IsNone()) {                    \
+    const auto idx = this->global_pool->Alloc(strlen(#NAME), #NAME);               \
+    static_cast<Object::Native*>(this->global_pool->Nth(idx))->Init(NativeId::ID); \
+  }
+  VM_NATIVES
+#undef X
+}
+
 auto inline CompilerEngine::Init(Compiler* compiler) -> void {
   this->Init(compiler, Compiler::GLOBAL_FUNCTION_NAME_LEN, Compiler::GLOBAL_FUNCTION_NAME);
 }
@@ -414,14 +469,35 @@ auto CompilerEngine::Statement() -> void {
       this->Emit(OpCode::ReturnVoid);
     } else {
       this->Expression();
+
+      // the call is the last thing the expression does, so nothing in this
+      // frame is needed once it starts
+      this->RewriteInvoke(OpCode::TailInvoke);
       this->Emit(OpCode::Return);
     }
 
+  } else if (this->curr.type == Token::Lexeme::Yield) {
+    this->Advance();
+
+    if (this->parent == nullptr) {
+      this->ErrorAtCurr("Can not yield outside of a function");
+    }
+
+    // makes the whole function a generator, see EndCompilation
+    this->state.is_generator = 1;
+    this->Expression();
+    this->Emit(OpCode::Yield);
   } else {
     // technically, expressions without a corresponding assignment or the above
     // are called "expression statements" basically just calling a function and
     // discarding the return value
+    const bool block_expression = this->curr.type == Token::Lexeme::If || this->curr.type == Token::Lexeme::While ||
+                                  this->curr.type == Token::Lexeme::For || this->curr.type == Token::Lexeme::LeftBrace ||
+                                  this->curr.type == Token::Lexeme::Match;
     this->Expression();
+
+    // the top level keeps its last value around, that's what a script returns
+    if (!block_expression && this->scope_depth > 0) this->Emit(OpCode::Pop);
   }
 }
 
@@ -433,17 +509,18 @@ auto CompilerEngine::Expression(const bool nested) -> void {
       // uhm, does this mean nested if expressions work?
       this->Expression(true);
 
-      const u32 if_jump_idx = this->Jump(OpCode::JumpFalse);
-      this->Emit(OpCode::Pop);
+      bool fused;
+      const u32 if_jump_idx = this->ConditionJump(&fused);
+      if (!fused) this->Emit(OpCode::Pop);
 
       // this is the block after
       this->Statement();
 
       const u32 else_jump_idx = this->Jump(OpCode::Jump);
       this->PatchJump(if_jump_idx);
-      this->Emit(OpCode::Pop);
+      if (!fused) this->Emit(OpCode::Pop);
 
-      if (this->curr.type == Token::Lexeme::Else) {
+      if (this->MatchAndAdvance(Token::Lexeme::Else)) {
         this->Statement();
       }
 
@@ -456,27 +533,76 @@ auto CompilerEngine::Expression(const bool nested) -> void {
 
       this->Expression(true);
 
-      const u32 exit_jump = this->Jump(OpCode::JumpFalse);
-      this->Emit(OpCode::Pop);
+      bool fused;
+      const u32 exit_jump = this->ConditionJump(&fused);
+      if (!fused) this->Emit(OpCode::Pop);
 
       this->Statement();
 
       this->Loop(loop_start);
 
       this->PatchJump(exit_jump);
-      this->Emit(OpCode::Pop);
+      if (!fused) this->Emit(OpCode::Pop);
       break;
     }
     case Token::Lexeme::For: {
       this->Advance();
-      // @TODO(eddie) - we need range generators and iterators
       // @TODO(eddie) - continue and break statements
       this->BeginScope();
 
-      this->VariableDeclaration();
+      this->Consume(Token::Lexeme::Identifier, "Expected loop variable name");
+      const Token variable = this->prev;
+      this->Consume(Token::Lexeme::In, "Expected 'in' after loop variable");
 
-      // the block
+      // the generator gets a local of its own, named after a keyword so
+      // nothing can refer to it
       this->Expression(true);
+      Token iterator = variable;
+      iterator.start = "for";
+      iterator.len = 3;
+      this->AddLocal(iterator);
+      u32 slot = this->locals_count - 1;
+
+      // a range is just two numbers, the counter and the bound both get a
+      // hidden local and there's no iterator object at all
+      if (this->MatchAndAdvance(Token::Lexeme::DotDot)) {
+        this->Expression(true);
+        this->AddLocal(iterator);
+
+        const u64 loop_start = this->CurrentChunk()->Count();
+        const u32 exit_jump = this->Jump(OpCode::ForRange);
+        this->Emit(IntToBytes(&slot), 4);
+
+        this->BeginScope();
+        this->AddLocal(variable);
+        this->Expression(true);
+        this->EndScope();
+
+        this->Loop(loop_start);
+        this->PatchJump(exit_jump);
+
+        this->EndScope();
+        break;
+      }
+
+      const u64 loop_start = this->CurrentChunk()->Count();
+      this->Emit(OpCode::Iterate);
+      this->Emit(IntToBytes(&slot), 4);
+
+      const u32 exit_jump = this->Jump(OpCode::JumpFalse);
+      this->Emit(OpCode::Pop);
+
+      // what's left under the condition is the loop variable
+      this->BeginScope();
+      this->AddLocal(variable);
+      this->Expression(true);
+      this->EndScope();
+
+      this->Loop(loop_start);
+
+      this->PatchJump(exit_jump);
+      this->Emit(OpCode::Pop);
+      this->Emit(OpCode::Pop);
 
       this->EndScope();
       break;
@@ -488,6 +614,11 @@ auto CompilerEngine::Expression(const bool nested) -> void {
       this->EndScope();
       break;
     }
+    case Token::Lexeme::Match: {
+      this->Advance();
+      this->MatchExpression();
+      break;
+    }
     default: {
       this->GetPrecedence(Precedence::Assignment);
 
@@ -507,8 +638,47 @@ auto CompilerEngine::Jump(OpCode opcode) -> u32 {
   return this->CurrentChunk()->Count() - 4;
 }
 
+auto CompilerEngine::ConditionJump(bool* fused) -> u32 {
+  auto* chunk = this->CurrentChunk();
+  const u64 end = chunk->Count();
+  *fused = false;
+
+  // the compare, or the compare and a Not, has to be the last thing emitted
+  // and nothing can jump in after the compare, or whatever jumped there would
+  // be branching on one value where the fused jump pops two
+  if (this->last_compare == ~0ULL || this->last_label > this->last_compare) {
+    return this->Jump(OpCode::JumpFalse);
+  }
+  const bool negated =
+      end == this->last_compare + 2 && static_cast<OpCode>(chunk->bytecode[end - 1]) == OpCode::Not;
+  if (end != this->last_compare + 1 && !negated) {
+    return this->Jump(OpCode::JumpFalse);
+  }
+
+  OpCode op;
+  switch (static_cast<OpCode>(chunk->bytecode[this->last_compare])) {
+    default:
+      return this->Jump(OpCode::JumpFalse);
+    case OpCode::Less:
+      op = negated ? OpCode::JumpLess : OpCode::JumpNotLess;
+      break;
+    case OpCode::Greater:
+      op = negated ? OpCode::JumpGreater : OpCode::JumpNotGreater;
+      break;
+    case OpCode::Equality:
+      op = negated ? OpCode::JumpEqual : OpCode::JumpNotEqual;
+      break;
+  }
+
+  chunk->Rewind(this->last_compare);
+  this->last_compare = ~0ULL;
+  *fused = true;
+  return this->Jump(op);
+}
+
 auto CompilerEngine::PatchJump(u64 jump_idx) -> void {
   const u32 jump = this->CurrentChunk()->Count() - jump_idx - 4;
+  this->last_label = this->CurrentChunk()->Count();
 
   // I HAVE NO FUCKING CLUE WHICH ENDIAN IS WHICH
   // so! we just ignore it by doing disgusting bit reinterpreting
@@ -519,11 +689,25 @@ auto CompilerEngine::PatchJump(u64 jump_idx) -> void {
 
 auto CompilerEngine::Loop(u64 loop_idx) -> void {
   this->Emit(OpCode::Loop);
-  u32 offset = this->CurrentChunk()->Count() - loop_idx + 2;
+  // +4 for the operand the VM will have already read when it jumps back
+  u32 offset = this->CurrentChunk()->Count() - loop_idx + 4;
 
   this->Emit(IntToBytes(&offset), 4);
 }
 
+auto CompilerEngine::RewriteInvoke(OpCode op) -> bool {
+  auto* chunk = this->CurrentChunk();
+  // ~0 wraps around, so that has to be ruled out by hand
+  if (this->last_invoke == ~0ULL || this->last_invoke + 1 + 2 * sizeof(u32) != chunk->Count()) {
+    return false;
+  }
+
+  chunk->bytecode[this->last_invoke] = static_cast<u8>(op);
+  // it's not a call anymore, so return spawn f() stays a Spawn
+  this->last_invoke = ~0ULL;
+  return true;
+}
+
 auto CompilerEngine::SyncOnError() -> void {
   this->state.panic = 0;
 
@@ -539,7 +723,9 @@ auto CompilerEngine::SyncOnError() -> void {
       case Token::Lexeme::For:
       case Token::Lexeme::If:
       case Token::Lexeme::While:
+      case Token::Lexeme::Match:
       case Token::Lexeme::Return:
+      case Token::Lexeme::Yield:
         return;
     }
 
@@ -562,6 +748,101 @@ auto CompilerEngine::EndScope() -> void {
   }
 }
 
+// `match (value) { 0 => ... "a" => ... _ => ... }`, every arm is a statement
+// like the blocks of an if. There's no chain of compares, the value picks its
+// arm out of a JumpTable in one go, see JumpTable::Build for which kind
+auto CompilerEngine::MatchExpression() -> void {
+  this->Expression(true);
+  this->Consume(Token::Lexeme::LeftBrace, "Expected '{' after match value");
+
+  auto* chunk = this->CurrentChunk();
+  u32 index = chunk->AddJumpTable();
+  const u64 dispatch = chunk->Count();
+  this->Emit(OpCode::MatchHash);
+  this->Emit(IntToBytes(&index), 4);
+  const u64 after = chunk->Count();
+
+  DynamicArray<JumpTable::Slot> keys;
+  keys.Init();
+  defer(keys.Deinit());
+  DynamicArray<u32> exits;
+  exits.Init();
+  defer(exits.Deinit());
+
+  // arm 0 is `_`, and just falls out the bottom until there is one
+  chunk->jump_tables[index].targets.Append(0);
+  bool fallback = false;
+
+  while (this->curr.type != Token::Lexeme::RightBrace && this->curr.type != Token::Lexeme::Eof) {
+    u32 arm = 0;
+    if (this->curr.type == Token::Lexeme::Identifier && this->curr.len == 1 && this->curr.start[0] == '_') {
+      if (fallback) this->ErrorAtCurr("Match can only have one '_' arm");
+      this->Advance();
+      fallback = true;
+    } else {
+      Value key;
+      if (!this->MatchPattern(&key)) break;
+      for (u64 i = 0; i < keys.count; i++) {
+        if (keys[i].key == key) this->ErrorAtToken("Match arm is already covered", this->prev);
+      }
+
+      arm = static_cast<u32>(chunk->jump_tables[index].targets.Append(0));
+      keys.Append({key, arm});
+    }
+
+    this->Consume(Token::Lexeme::FatArrow, "Expected '=>' after match pattern");
+    chunk->jump_tables[index].targets[arm] = static_cast<u32>(chunk->Count() - after);
+    // every arm is a jump target, nothing gets fused into one
+    this->last_label = chunk->Count();
+    this->Statement();
+    exits.Append(this->Jump(OpCode::Jump));
+  }
+  this->Consume(Token::Lexeme::RightBrace, "Expected '}' to end match");
+
+  for (u64 i = 0; i < exits.count; i++) {
+    this->PatchJump(exits[i]);
+  }
+  if (!fallback) {
+    chunk->jump_tables[index].targets[0] = static_cast<u32>(chunk->Count() - after);
+  }
+
+  chunk->bytecode[dispatch] = static_cast<u8>(chunk->jump_tables[index].Build(keys));
+}
+
+// the patterns are literals, which is what lets them go in a JumpTable
+auto CompilerEngine::MatchPattern(Value* key) -> bool {
+  const bool negative = this->MatchAndAdvance(Token::Lexeme::Minus);
+
+  switch (this->curr.type) {
+    default:
+      break;
+    case Token::Lexeme::Number:
+    case Token::Lexeme::Integer: {
+      this->Advance();
+      *key = NumberLiteral(this->prev, negative);
+      return true;
+    }
+    case Token::Lexeme::String: {
+      if (negative) break;
+      this->Advance();
+      // the same interned string OpCode::String would push
+      const u32 index = this->AddString(this->prev.len - 2, this->prev.start + 1);
+      *key = Value(this->compiler->string_pool->Nth(index));
+      return true;
+    }
+    case Token::Lexeme::True:
+    case Token::Lexeme::False: {
+      if (negative) break;
+      this->Advance();
+      *key = Value(this->prev.type == Token::Lexeme::True);
+      return true;
+    }
+  }
+
+  this->ErrorAtCurr("Expected a number, string, true, false or '_' for a match arm");
+  return false;
+}
+
 auto CompilerEngine::CodeBlock() -> void {
   while (this->curr.type != Token::Lexeme::RightBrace && this->curr.type != Token::Lexeme::Eof) {
     this->Declaration();
@@ -618,8 +899,6 @@ auto inline CompilerEngine::ErrorAtToken(const char* message, Token id) -> void
 auto inline CompilerEngine::ErrorAtCurr(const char* message) -> void { this->ErrorAtToken(message, this->curr); }
 
 auto CompilerEngine::VariableDeclaration() -> void {
-  const bool in_for_loop = this->curr.type == Token::Lexeme::For;
-
   this->Consume(Token::Lexeme::Identifier, "Expected variable name");
   if (this->scope_depth == 0) {
     this->AddGlobal(this->prev);
@@ -627,10 +906,7 @@ auto CompilerEngine::VariableDeclaration() -> void {
     this->AddLocal(this->prev);
   }
 
-  if (in_for_loop && this->curr.type == Token::Lexeme::In) {
-    this->Advance();
-    this->Expression();
-  } else if (this->curr.type == Token::Lexeme::Equal) {
+  if (this->curr.type == Token::Lexeme::Equal) {
     this->Advance();
     this->Expression();
   }
@@ -653,8 +929,8 @@ auto CompilerEngine::FunctionDeclaration() -> void {
 
   this->curr = new_engine.curr;
   this->prev = new_engine.prev;
-  // is this necessary?
-  // new_engine.EndCompilation();
+  this->state.error |= new_engine.state.error;
+  new_engine.EndCompilation();
   auto* const func = new_engine.curr_func;
 
   /*
@@ -799,14 +1075,18 @@ auto CompilerEngine::LoadVariable(bool assignment) -> void {
 
   if (this->curr.type == Token::Lexeme::Equal && assignment) {
     this->Advance();
-    this->Expression();
+    this->Expression(true);
 
     this->Emit(set);
   } else {
     this->Emit(get);
   }
 
-  auto unwrapped = idx.Get();
+  u32 unwrapped = idx.Get();
+  // globals go through a cache of their own, see GlobalCache
+  if (get == OpCode::GetGlobal) {
+    unwrapped = this->CurrentChunk()->AddGlobalCache(unwrapped);
+  }
   // @FIXME(eddie) - this is 8 bytes
   this->Emit(IntToBytes(&unwrapped), 4);
 }
@@ -832,7 +1112,24 @@ auto CompilerEngine::Consume(Token::Lexeme type, const char* message) -> void {
   this->ErrorAtCurr(message);
 }
 
-auto CompilerEngine::EndCompilation() -> void { this->Emit(OpCode::ReturnVoid); }
+auto CompilerEngine::EndCompilation() -> void {
+  this->Emit(OpCode::ReturnVoid);
+
+  // before the register code, generators only run on the stack machine
+  if (this->state.is_generator) {
+    this->CurrentChunk()->MakeGenerator();
+  }
+
+  // functions that can't be lowered just don't get register code, the VM
+  // refuses to run those in register mode
+  RegisterCompiler register_compiler;
+  register_compiler.Compile(this->CurrentChunk(), this->curr_func->as.function.arity);
+
+#if defined(ROC_SUPERINSTRUCTIONS)
+  // after the register code, that only knows about the plain opcodes
+  this->CurrentChunk()->FuseSuperinstructions();
+#endif
+}
 
 auto inline CompilerEngine::GetParseRule(Token::Lexeme lexeme) -> const ParseRule* {
   return &this->compiler->PARSE_RULES.at(lexeme);
@@ -871,6 +1168,10 @@ auto static Grammar::Number(CompilerEngine* compiler, bool assign) -> void {
   compiler->CurrentChunk()->AddLocal(Value(value), compiler->prev.line);
 }
 
+auto static Grammar::Integer(CompilerEngine* compiler, bool assign) -> void {
+  compiler->CurrentChunk()->AddLocal(NumberLiteral(compiler->prev, false), compiler->prev.line);
+}
+
 auto static Grammar::Parenthesis(CompilerEngine* compiler, bool assign) -> void {
   compiler->Expression(true);
   compiler->Consume(Token::Lexeme::RightParens, "Expect ')' after expression");
@@ -921,29 +1222,36 @@ auto static Grammar::Binary(CompilerEngine* compiler, bool assign) -> void {
       break;
     }
     case Token::Lexeme::BangEqual: {
+      compiler->last_compare = compiler->CurrentChunk()->Count();
       compiler->Emit(OpCode::Equality);
       compiler->Emit(OpCode::Not);
       break;
     }
     case Token::Lexeme::EqualEqual: {
+      compiler->last_compare = compiler->CurrentChunk()->Count();
       compiler->Emit(OpCode::Equality);
       break;
     }
     case Token::Lexeme::Greater: {
+      compiler->last_compare = compiler->CurrentChunk()->Count();
       compiler->Emit(OpCode::Greater);
       break;
     }
     case Token::Lexeme::GreaterEqual: {
-      compiler->Emit(OpCode::Greater);
+      // a >= b is !(a < b)
+      compiler->last_compare = compiler->CurrentChunk()->Count();
+      compiler->Emit(OpCode::Less);
       compiler->Emit(OpCode::Not);
       break;
     }
     case Token::Lexeme::Less: {
+      compiler->last_compare = compiler->CurrentChunk()->Count();
       compiler->Emit(OpCode::Less);
       break;
     }
     case Token::Lexeme::LessEqual: {
-      compiler->Emit(OpCode::Less);
+      compiler->last_compare = compiler->CurrentChunk()->Count();
+      compiler->Emit(OpCode::Greater);
       compiler->Emit(OpCode::Not);
       break;
     }
@@ -1003,6 +1311,23 @@ auto static Grammar::InvokeOp(CompilerEngine* compiler, bool assign) -> void {
 
   compiler->Consume(Token::Lexeme::RightParens, "Expected closing parenthesis ')' after arguments");
 
+  compiler->last_invoke = compiler->CurrentChunk()->Count();
+  u32 cache = compiler->CurrentChunk()->AddCallCache();
   compiler->Emit(OpCode::Invoke);
   compiler->Emit(IntToBytes(&arg_count), 4);
+  compiler->Emit(IntToBytes(&cache), 4);
+}
+
+// spawn f(x) compiles the call like any other, and then turns it into a Spawn
+auto static Grammar::SpawnOp(CompilerEngine* compiler, bool assign) -> void {
+  compiler->GetPrecedence(Precedence::Unary);
+
+  if (!compiler->RewriteInvoke(OpCode::Spawn)) {
+    compiler->ErrorAtCurr("Expected a call after spawn");
+  }
+}
+
+auto static Grammar::JoinOp(CompilerEngine* compiler, bool assign) -> void {
+  compiler->GetPrecedence(Precedence::Unary);
+  compiler->Emit(OpCode::Join);
 }
@@ -0,0 +1,62 @@
+#include "deopt.h"
+
+#include "roc_config.h"
+
+#if defined(ROC_JIT)
+
+#include <cstring>
+
+#include "vm.h"
+
+auto DeoptTable::Init(u8* bytecode, Value** stack_top) -> void {
+  this->points.Init();
+  this->values.Init();
+  this->bytecode = bytecode;
+  this->stack_top = stack_top;
+}
+
+auto DeoptTable::Deinit() -> void {
+  this->points.Deinit();
+  this->values.Deinit();
+}
+
+auto DeoptTable::Point(u32 resume, u32 height, u64 result) -> u32 {
+  const auto first = static_cast<u32>(this->values.count);
+  return static_cast<u32>(this->points.Append({resume, height, first, 0, result}));
+}
+
+auto DeoptTable::Add(u32 slot, DeoptSource source, ValueType type, u64 bits) -> void {
+  this->values.Append({slot, source, type, bits});
+  this->points[this->points.count - 1].count++;
+}
+
+auto DeoptTable::Deoptimize(DeoptTable* table, u32 point, StackFrame* frame, const u8* scratch) -> u64 {
+  const DeoptPoint& deopt = table->points[point];
+
+  for (u32 i = deopt.first; i < deopt.first + deopt.count; i++) {
+    const DeoptValue& value = table->values[i];
+    u64 bits = value.bits;
+    if (value.source == DeoptSource::Scratch) {
+      std::memcpy(&bits, scratch + value.bits, sizeof(u64));
+    }
+
+    if (value.type == ValueType::Boolean) {
+      frame->locals[value.slot] = Value(bits != 0);
+    } else if (value.type == ValueType::Integer) {
+      frame->locals[value.slot] = Value(static_cast<i64>(bits));
+    } else {
+      f64 num;
+      std::memcpy(&num, &bits, sizeof(f64));
+      frame->locals[value.slot] = Value(num);
+    }
+  }
+
+  if (deopt.height != DEOPT_KEEP_STACK) {
+    *table->stack_top = frame->locals + deopt.height;
+  }
+  frame->inst_ptr = table->bytecode + deopt.resume;
+
+  return deopt.result;
+}
+
+#endif
@@ -0,0 +1,424 @@
+#include "event_loop.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "common.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#include <stdio.h>
+
+#include <climits>
+#include <thread>
+#else
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(ROC_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static_assert(sizeof(IoOp::timeout) == sizeof(__kernel_timespec), "IoOp::timeout has to fit a __kernel_timespec");
+#endif
+
+#define NANOSECONDS 1000000000ull
+
+auto static Now() -> u64 {
+  const auto since = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(since).count());
+}
+
+auto EventLoop::Init(IoBackend backend) -> void {
+  this->backend = backend;
+  this->started = false;
+  this->pending.Init();
+#if !defined(_WIN32)
+  this->poll_fds.Init();
+#endif
+  this->poll_ops.Init();
+  this->backlog.Init();
+}
+
+auto EventLoop::Deinit() -> void {
+#if defined(ROC_IO_URING)
+  if (this->started && this->backend == IoBackend::Uring) {
+    this->StopUring();
+  }
+#endif
+  this->started = false;
+  this->pending.Deinit();
+#if !defined(_WIN32)
+  this->poll_fds.Deinit();
+#endif
+  this->poll_ops.Deinit();
+  this->backlog.Deinit();
+}
+
+// plenty of scripts never touch a file, no point setting up a ring for them
+auto EventLoop::Start() -> void {
+  if (this->started) [[likely]] {
+    return;
+  }
+
+  this->started = true;
+#if defined(ROC_IO_URING)
+  if (this->backend == IoBackend::Uring && this->StartUring()) {
+    return;
+  }
+#endif
+  this->backend = IoBackend::Poll;
+}
+
+auto EventLoop::Submit(IoOp* op) -> void {
+  this->Start();
+  op->slot = this->pending.Append(op);
+
+#if defined(ROC_IO_URING)
+  if (this->backend == IoBackend::Uring) {
+    if (this->in_kernel < this->cq_entries) {
+      this->Push(op);
+    } else {
+      this->backlog.Append(op);
+    }
+    return;
+  }
+#endif
+
+  if (op->kind == IoKind::Timer) {
+    op->deadline = Now() + op->nanoseconds;
+  }
+}
+
+auto EventLoop::Finish(IoOp* op, int64_t result, DynamicArray<IoOp*>* done) -> void {
+  IoOp* last = this->pending[--this->pending.count];
+  this->pending[op->slot] = last;
+  last->slot = op->slot;
+
+  op->result = result;
+  done->Append(op);
+}
+
+auto EventLoop::Reap(DynamicArray<IoOp*>* done, bool block) -> void {
+  if (this->pending.count == 0) {
+    return;
+  }
+
+#if defined(ROC_IO_URING)
+  if (this->backend == IoBackend::Uring) {
+    this->ReapUring(done, block);
+    return;
+  }
+#endif
+
+  this->ReapPoll(done, block);
+}
+
+auto EventLoop::Cancel(DynamicArray<IoOp*>* done) -> void {
+  if (this->pending.count == 0) {
+    return;
+  }
+
+#if defined(ROC_IO_URING)
+  if (this->backend == IoBackend::Uring) {
+    for (u64 i = 0; i < this->backlog.count; i++) {
+      this->Finish(this->backlog[i], -ECANCELED, done);
+    }
+    this->backlog.count = 0;
+
+    // Finish shuffles pending around
+    this->poll_ops.count = 0;
+    this->poll_ops.Append(this->pending.data, this->pending.count);
+    for (u64 i = 0; i < this->poll_ops.count; i++) {
+      while (this->in_kernel >= this->cq_entries) {
+        this->Enter(1);
+        this->Harvest(done);
+      }
+
+      // the cancel's own completion is the one with no op, see Harvest
+      io_uring_sqe* sqe = this->NextSqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = reinterpret_cast<u64>(this->poll_ops[i]);
+      sqe->user_data = 0;
+    }
+
+    while (this->in_kernel > 0) {
+      this->Enter(1);
+      this->Harvest(done);
+    }
+    return;
+  }
+#endif
+
+  // poll does everything itself, nothing is using the buffers
+  while (this->pending.count > 0) {
+    this->Finish(this->pending[this->pending.count - 1], -ECANCELED, done);
+  }
+}
+
+#if defined(_WIN32)
+auto EventLoop::ReapPoll(DynamicArray<IoOp*>* done, bool block) -> void {
+  // backwards, Finish moves the last one into the hole
+  const u64 finished = done->count;
+  u64 due = UINT64_MAX;
+  for (u64 i = this->pending.count; i-- > 0;) {
+    IoOp* op = this->pending[i];
+    if (op->kind == IoKind::Timer) {
+      due = std::min(due, op->deadline);
+      continue;
+    }
+
+    if (op->offset != IO_NO_OFFSET && _lseeki64(op->fd, static_cast<__int64>(op->offset), SEEK_SET) < 0) {
+      this->Finish(op, -errno, done);
+      continue;
+    }
+    // anything bigger just comes back short
+    const auto length = static_cast<unsigned int>(std::min(op->length, static_cast<u64>(INT_MAX)));
+    const int moved = op->kind == IoKind::Read ? _read(op->fd, op->buffer, length) : _write(op->fd, op->buffer, length);
+    this->Finish(op, moved < 0 ? -errno : moved, done);
+  }
+
+  if (due == UINT64_MAX) return;
+
+  // only timers left, and nothing came back yet
+  u64 now = Now();
+  if (block && done->count == finished && due > now) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+    now = Now();
+  }
+
+  for (u64 i = this->pending.count; i-- > 0;) {
+    IoOp* op = this->pending[i];
+    if (op->kind == IoKind::Timer && op->deadline <= now) {
+      this->Finish(op, 0, done);
+    }
+  }
+}
+#else
+auto EventLoop::ReapPoll(DynamicArray<IoOp*>* done, bool block) -> void {
+  this->poll_fds.count = 0;
+  this->poll_ops.count = 0;
+
+  u64 due = UINT64_MAX;
+  for (u64 i = 0; i < this->pending.count; i++) {
+    IoOp* op = this->pending[i];
+    if (op->kind == IoKind::Timer) {
+      due = std::min(due, op->deadline);
+      continue;
+    }
+
+    const short events = op->kind == IoKind::Read ? POLLIN : POLLOUT;
+    this->poll_fds.Append({op->fd, events, 0});
+    this->poll_ops.Append(op);
+  }
+
+  // no timers means waiting for as long as it takes
+  timespec timeout = {};
+  const timespec* wait = &timeout;
+  if (block && due == UINT64_MAX) {
+    wait = nullptr;
+  } else if (block) {
+    const u64 now = Now();
+    const u64 left = due > now ? due - now : 0;
+    timeout.tv_sec = static_cast<time_t>(left / NANOSECONDS);
+    timeout.tv_nsec = static_cast<long>(left % NANOSECONDS);
+  }
+
+  // EINTR just means going round again
+  if (ppoll(this->poll_fds.data, this->poll_fds.count, wait, nullptr) > 0) {
+    for (u64 i = 0; i < this->poll_fds.count; i++) {
+      if (this->poll_fds[i].revents == 0) continue;
+
+      // POLLNVAL and friends turn into an error from the read or write
+      IoOp* op = this->poll_ops[i];
+      ssize_t moved;
+      if (op->offset == IO_NO_OFFSET) {
+        moved = op->kind == IoKind::Read ? read(op->fd, op->buffer, op->length) : write(op->fd, op->buffer, op->length);
+      } else {
+        moved = op->kind == IoKind::Read ? pread(op->fd, op->buffer, op->length, op->offset)
+                                         : pwrite(op->fd, op->buffer, op->length, op->offset);
+      }
+      this->Finish(op, moved < 0 ? -errno : moved, done);
+    }
+  }
+
+  if (due == UINT64_MAX) return;
+
+  // backwards, Finish moves the last one into the hole
+  const u64 now = Now();
+  for (u64 i = this->pending.count; i-- > 0;) {
+    IoOp* op = this->pending[i];
+    if (op->kind == IoKind::Timer && op->deadline <= now) {
+      this->Finish(op, 0, done);
+    }
+  }
+}
+#endif
+
+#if defined(ROC_IO_URING)
+// SINGLE_MMAP and RW_CUR_POS came in 5.4 and 5.6, and IORING_OP_READ and WRITE
+// with the latter, anything older gets poll
+auto EventLoop::StartUring() -> bool {
+  io_uring_params params = {};
+  const int fd = static_cast<int>(syscall(__NR_io_uring_setup, EVENT_LOOP_ENTRIES, &params));
+  if (fd < 0) {
+    return false;
+  }
+
+  const u32 needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS;
+  if ((params.features & needed) != needed) {
+    close(fd);
+    return false;
+  }
+
+  const u64 sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+  const u64 cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const u64 ring_size = std::max(sq_size, cq_size);
+  void* ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  const u64 sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    munmap(ring, ring_size);
+    close(fd);
+    return false;
+  }
+
+  this->ring_fd = fd;
+  this->ring = static_cast<u8*>(ring);
+  this->ring_size = ring_size;
+  this->sqes = sqes;
+  this->sqes_size = sqes_size;
+
+  this->sq_head = reinterpret_cast<u32*>(this->ring + params.sq_off.head);
+  this->sq_tail = reinterpret_cast<u32*>(this->ring + params.sq_off.tail);
+  this->sq_array = reinterpret_cast<u32*>(this->ring + params.sq_off.array);
+  this->sq_mask = *reinterpret_cast<u32*>(this->ring + params.sq_off.ring_mask);
+  this->sq_entries = params.sq_entries;
+
+  this->cq_head = reinterpret_cast<u32*>(this->ring + params.cq_off.head);
+  this->cq_tail = reinterpret_cast<u32*>(this->ring + params.cq_off.tail);
+  this->cqes = this->ring + params.cq_off.cqes;
+  this->cq_mask = *reinterpret_cast<u32*>(this->ring + params.cq_off.ring_mask);
+  this->cq_entries = params.cq_entries;
+
+  this->unsubmitted = 0;
+  this->in_kernel = 0;
+  return true;
+}
+
+auto EventLoop::StopUring() -> void {
+  munmap(this->sqes, this->sqes_size);
+  munmap(this->ring, this->ring_size);
+  close(this->ring_fd);
+  this->ring_fd = -1;
+  this->ring = nullptr;
+  this->sqes = nullptr;
+}
+
+// the kernel only looks at the ring on io_uring_enter, so an entry can be
+// counted before it's filled in
+auto EventLoop::NextSqe() -> io_uring_sqe* {
+  const u32 tail = *this->sq_tail;
+  if (tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) == this->sq_entries) {
+    this->Enter(0);
+  }
+
+  const u32 idx = tail & this->sq_mask;
+  io_uring_sqe* sqe = &static_cast<io_uring_sqe*>(this->sqes)[idx];
+  std::memset(sqe, 0, sizeof(io_uring_sqe));
+  this->sq_array[idx] = idx;
+  __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  this->unsubmitted++;
+  this->in_kernel++;
+  return sqe;
+}
+
+auto EventLoop::Push(IoOp* op) -> void {
+  io_uring_sqe* sqe = this->NextSqe();
+  sqe->user_data = reinterpret_cast<u64>(op);
+
+  switch (op->kind) {
+    case IoKind::Read:
+    case IoKind::Write: {
+      sqe->opcode = op->kind == IoKind::Read ? IORING_OP_READ : IORING_OP_WRITE;
+      sqe->fd = op->fd;
+      sqe->addr = reinterpret_cast<u64>(op->buffer);
+      // anything bigger just comes back short
+      sqe->len = static_cast<u32>(std::min(op->length, static_cast<u64>(UINT32_MAX)));
+      sqe->off = op->offset;
+      break;
+    }
+    case IoKind::Timer: {
+      auto* timeout = reinterpret_cast<__kernel_timespec*>(op->timeout);
+      timeout->tv_sec = static_cast<int64_t>(op->nanoseconds / NANOSECONDS);
+      timeout->tv_nsec = static_cast<long long>(op->nanoseconds % NANOSECONDS);
+      sqe->opcode = IORING_OP_TIMEOUT;
+      sqe->addr = reinterpret_cast<u64>(timeout);
+      sqe->len = 1;
+      break;
+    }
+  }
+}
+
+auto EventLoop::Enter(u32 wait) -> void {
+  const u32 flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (true) {
+    const long submitted = syscall(__NR_io_uring_enter, this->ring_fd, this->unsubmitted, wait, flags, nullptr, 0);
+    if (submitted >= 0) {
+      this->unsubmitted -= static_cast<u32>(submitted);
+      return;
+    }
+    if (errno != EINTR) {
+      return;
+    }
+  }
+}
+
+auto EventLoop::Harvest(DynamicArray<IoOp*>* done) -> void {
+  const auto* cqes = static_cast<const io_uring_cqe*>(this->cqes);
+  const u32 tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+  u32 head = *this->cq_head;
+  for (; head != tail; head++) {
+    const io_uring_cqe& cqe = cqes[head & this->cq_mask];
+    this->in_kernel--;
+    // a cancel, whatever it cancelled comes back on its own
+    if (cqe.user_data == 0) continue;
+
+    auto* op = reinterpret_cast<IoOp*>(cqe.user_data);
+    // as far as io_uring is concerned a timer going off is an error
+    this->Finish(op, op->kind == IoKind::Timer && cqe.res == -ETIME ? 0 : cqe.res, done);
+  }
+  __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+}
+
+auto EventLoop::ReapUring(DynamicArray<IoOp*>* done, bool block) -> void {
+  const bool completed = *this->cq_head != __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+  const u32 wait = block && !completed && this->in_kernel > 0 ? 1 : 0;
+  if (this->unsubmitted > 0 || wait > 0) {
+    this->Enter(wait);
+  }
+  this->Harvest(done);
+
+  // whatever finished made room for the backlog, it goes in with the next Reap
+  u64 moved = 0;
+  while (moved < this->backlog.count && this->in_kernel < this->cq_entries) {
+    this->Push(this->backlog[moved++]);
+  }
+  if (moved == 0) return;
+
+  this->backlog.count -= moved;
+  std::memmove(this->backlog.data, this->backlog.data + moved, this->backlog.count * sizeof(IoOp*));
+}
+#endif
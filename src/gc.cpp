@@ -0,0 +1,473 @@
+#include "gc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// roughly, the characters of a string are in the StringPool's blocks
+auto static ObjectSize(const Object* object) -> u64 {
+  switch (object->type) {
+    default:
+      return sizeof(Object);
+    case ObjectType::String:
+      return sizeof(Object) + object->name_len + 1;
+    case ObjectType::Generator:
+      return sizeof(Object) + object->as.generator.slot_capacity * sizeof(Value);
+  }
+}
+
+// gives object's slot back along with whatever it owns
+auto static FreeObject(Object* object, Arena<Object>* object_pool, StringPool* string_pool) -> void {
+  switch (object->type) {
+    default: {
+      object_pool->Free(object);
+      break;
+    }
+    case ObjectType::Closure: {
+      static_cast<Object::Closure*>(object)->Deinit();
+      object_pool->Free(object);
+      break;
+    }
+    case ObjectType::Generator: {
+      static_cast<Object::Generator*>(object)->Deinit();
+      object_pool->Free(object);
+      break;
+    }
+    case ObjectType::String: {
+      string_pool->Free(object);
+      break;
+    }
+  }
+}
+
+auto GarbageCollector::Init() -> void {
+  this->objects.Init();
+  this->gray.Init();
+  this->promoted.Init();
+  this->remembered.Init();
+  this->remembered_globals.Init();
+  this->allocated = 0;
+  this->threshold = this->config.initial_threshold;
+  this->stats = {};
+  this->ResizeNursery(this->config.nursery_objects);
+}
+
+auto GarbageCollector::Deinit(Arena<Object>* object_pool, StringPool* string_pool) -> void {
+  this->ReleaseNursery();
+  this->ResizeNursery(0);
+  if (object_pool != nullptr) {
+    // whatever's still alive owns things the pools don't know about
+    for (u64 i = 0; i < this->objects.count; i++) {
+      if (this->objects[i]->collectable) FreeObject(this->objects[i], object_pool, string_pool);
+    }
+  }
+  this->objects.Deinit();
+  this->gray.Deinit();
+  this->promoted.Deinit();
+  this->remembered.Deinit();
+  this->remembered_globals.Deinit();
+  this->allocated = 0;
+}
+
+auto GarbageCollector::Configure(GcConfig config) -> void {
+  Assert(config.nursery_objects > 0);
+  this->config = config;
+  this->threshold = config.initial_threshold;
+  if (this->NurseryEmpty()) this->ResizeNursery(config.nursery_objects);
+}
+
+auto GarbageCollector::Reset() -> void {
+  // the old objects are gone, so nothing young can be reachable anymore
+  this->ReleaseNursery();
+  this->objects.count = 0;
+  this->gray.count = 0;
+  this->promoted.count = 0;
+  this->remembered.count = 0;
+  this->remembered_globals.count = 0;
+  this->allocated = 0;
+  this->threshold = this->config.initial_threshold;
+}
+
+auto GarbageCollector::ResizeNursery(u32 capacity) -> void {
+  if (capacity == this->nursery_capacity) return;
+
+  Assert(this->NurseryEmpty());
+  if (this->nursery != nullptr) FREE_ARRAY(Object, this->nursery, this->nursery_capacity);
+  this->nursery = capacity > 0 ? ALLOCATE(Object, capacity) : nullptr;
+  this->nursery_capacity = capacity;
+}
+
+auto GarbageCollector::ReleaseNursery() -> u64 {
+  u64 dead = 0;
+  for (u32 i = 0; i < this->nursery_top; i++) {
+    Object* object = &this->nursery[i];
+    if (object->marked) continue;
+
+#ifdef DEBUG_GC_LOG
+    printf("%p dies young ", static_cast<void*>(object));
+    object->Print();
+    printf("\n");
+#endif
+
+    // the copy owns the slots now if it got promoted
+    if (object->type == ObjectType::Generator) static_cast<Object::Generator*>(object)->Deinit();
+    dead++;
+  }
+  this->nursery_top = 0;
+  return dead;
+}
+
+auto GarbageCollector::Track(Object* object, u64 bytes) -> void {
+  object->collectable = true;
+  object->marked = false;
+  this->objects.Append(object);
+  this->allocated += bytes;
+}
+
+auto GarbageCollector::Forward(Object* object) -> Object* {
+  if (!this->IsYoung(object)) return object;
+  if (object->marked) return object->next;
+
+  Object* promoted = this->old_space->Nth(this->old_space->Alloc());
+  std::memcpy(static_cast<void*>(promoted), static_cast<const void*>(object), sizeof(Object));
+  // a closed upvalue points at itself
+  if (object->type == ObjectType::Upvalue && object->as.upvalue.location == &object->as.upvalue.closed_value) {
+    promoted->as.upvalue.location = &promoted->as.upvalue.closed_value;
+  }
+  promoted->next = nullptr;
+  this->Track(promoted, ObjectSize(promoted));
+  this->promoted.Append(promoted);
+  this->stats.promoted++;
+
+  object->marked = true;
+  object->next = promoted;
+  return promoted;
+}
+
+auto GarbageCollector::Scan(Object* object) -> void {
+  switch (object->type) {
+    default:
+      return;
+    case ObjectType::Upvalue: {
+      // an open one's next is fixed up with the rest of the open list
+      auto& upvalue = object->as.upvalue;
+      if (upvalue.location == &upvalue.closed_value) {
+        this->Forward(&upvalue.closed_value);
+      }
+      return;
+    }
+    case ObjectType::Closure: {
+      auto& closure = object->as.closure;
+      for (u32 i = 0; i < closure.upvalue_count; i++) {
+        if (closure.upvalues[i] == nullptr) continue;
+        closure.upvalues[i] = static_cast<Object::Upvalue*>(this->Forward(closure.upvalues[i]));
+      }
+      return;
+    }
+    case ObjectType::Generator: {
+      auto& generator = object->as.generator;
+      generator.callee = this->Forward(generator.callee);
+      for (u32 i = 0; i < generator.slot_count; i++) {
+        this->Forward(&generator.slots[i]);
+      }
+      return;
+    }
+  }
+}
+
+auto GarbageCollector::FinishMinor() -> u64 {
+  for (u64 i = 0; i < this->remembered.count; i++) {
+    this->remembered[i]->remembered = false;
+    this->Scan(this->remembered[i]);
+  }
+  this->remembered.count = 0;
+  this->remembered_globals.count = 0;
+
+  // whatever got promoted can point at more of the nursery
+  while (this->promoted.count > 0) {
+    this->promoted.count--;
+    this->Scan(this->promoted[this->promoted.count]);
+  }
+
+  const u64 dead = this->ReleaseNursery();
+  if (this->nursery_capacity != this->config.nursery_objects) this->ResizeNursery(this->config.nursery_objects);
+
+  this->stats.freed += dead;
+  this->stats.live = this->objects.count;
+  this->stats.live_bytes = this->allocated;
+  return dead;
+}
+
+auto GarbageCollector::Mark(Object* object) -> void {
+  if (!object->collectable || object->marked) return;
+
+  object->marked = true;
+  this->gray.Append(object);
+}
+
+auto GarbageCollector::Trace() -> void {
+  while (this->gray.count > 0) {
+    this->gray.count--;
+    this->Blacken(this->gray[this->gray.count]);
+  }
+}
+
+auto GarbageCollector::Blacken(Object* object) -> void {
+  switch (object->type) {
+    default:
+      return;
+    case ObjectType::Upvalue: {
+      // an open one points into a stack, and stacks are roots
+      auto& upvalue = object->as.upvalue;
+      if (upvalue.location == &upvalue.closed_value) {
+        this->Mark(upvalue.closed_value);
+      }
+      return;
+    }
+    case ObjectType::Closure: {
+      const auto& closure = object->as.closure;
+      for (u32 i = 0; i < closure.upvalue_count; i++) {
+        if (closure.upvalues[i] != nullptr) this->Mark(closure.upvalues[i]);
+      }
+      return;
+    }
+    case ObjectType::Generator: {
+      const auto& generator = object->as.generator;
+      this->Mark(generator.callee);
+      for (u32 i = 0; i < generator.slot_count; i++) {
+        this->Mark(generator.slots[i]);
+      }
+      return;
+    }
+  }
+}
+
+auto GarbageCollector::Sweep(Arena<Object>* object_pool, StringPool* string_pool) -> u64 {
+  u64 kept = 0;
+  u64 bytes = 0;
+  for (u64 i = 0; i < this->objects.count; i++) {
+    Object* object = this->objects[i];
+    // pinned, see StringPool::Alloc
+    if (!object->collectable) continue;
+    if (object->marked) {
+      object->marked = false;
+      bytes += ObjectSize(object);
+      this->objects[kept++] = object;
+      continue;
+    }
+
+#ifdef DEBUG_GC_LOG
+    printf("%p free ", static_cast<void*>(object));
+    object->Print();
+    printf("\n");
+#endif
+
+    FreeObject(object, object_pool, string_pool);
+  }
+
+  const u64 freed = this->objects.count - kept;
+  this->objects.count = kept;
+  this->allocated = bytes;
+  this->threshold = std::max(this->config.initial_threshold, bytes * this->config.grow_factor);
+
+  this->stats.freed += freed;
+  this->stats.live = kept;
+  this->stats.live_bytes = bytes;
+  return freed;
+}
+
+auto GarbageCollector::Record(f64 pause_ms, bool minor) -> void {
+  if (minor) {
+    this->stats.minor_collections++;
+    this->stats.last_minor_pause_ms = pause_ms;
+    this->stats.max_minor_pause_ms = std::max(this->stats.max_minor_pause_ms, pause_ms);
+    this->stats.total_minor_pause_ms += pause_ms;
+    return;
+  }
+
+  this->stats.collections++;
+  this->stats.last_pause_ms = pause_ms;
+  this->stats.max_pause_ms = std::max(this->stats.max_pause_ms, pause_ms);
+  this->stats.total_pause_ms += pause_ms;
+}
+
+// the VirtualMachine's side of it, everything it can reach without going
+// through another object
+auto VirtualMachine::StackRoots() -> Value* {
+  // register code keeps its registers above stack_top, all of them count.
+  // Whatever's in one that's dead just lives until the frame returns
+  Value* top = this->stack_top;
+  if (this->running_registers && this->frame_count > 0) {
+    const StackFrame* frame = this->Frame(this->frame_count - 1);
+    top = std::max(top, frame->locals + frame->chunk->register_count);
+  }
+  // everything above is dead, and would be garbage the next time something
+  // scans that far up. Only as far as anything could have been written since
+  // the last time, see GrowStack
+  this->ClearStack(top);
+  return top;
+}
+
+auto VirtualMachine::MarkRoots() -> void {
+  Value* top = this->StackRoots();
+  for (Value* slot = this->stack; slot < top; slot++) {
+    this->gc.Mark(*slot);
+  }
+
+  for (u32 i = 0; i < this->frame_count; i++) {
+    const StackFrame* frame = this->Frame(i);
+    this->gc.Mark(frame->closure);
+    // constants are all the compiler's right now, so this never finds
+    // anything
+    for (u64 c = 0; c < frame->chunk->locals.count; c++) {
+      this->gc.Mark(frame->chunk->locals[c]);
+    }
+  }
+
+  for (auto* upvalue = this->open_upvalues; upvalue != nullptr; upvalue = upvalue->as.upvalue.next) {
+    this->gc.Mark(upvalue);
+  }
+
+  // the running one's stack is the one in here, and a finished one's is gone
+  for (u64 i = 0; i < this->fibers.count; i++) {
+    const Fiber* fiber = this->fibers[i];
+    this->gc.Mark(fiber->result);
+    if (fiber == this->fiber || fiber->state == FiberState::Done) continue;
+
+    for (const Value* slot = fiber->stack; slot < fiber->stack_top; slot++) {
+      this->gc.Mark(*slot);
+    }
+    for (auto* upvalue = fiber->open_upvalues; upvalue != nullptr; upvalue = upvalue->as.upvalue.next) {
+      this->gc.Mark(upvalue);
+    }
+  }
+
+  for (u64 i = 0; i < this->globals.count; i++) {
+    if (this->globals[i] != nullptr) this->gc.Mark(this->globals[i]);
+  }
+
+  // nothing the compiler made ever gets collected, but its closures hold on to
+  // upvalues that do
+  this->object_pool->ForEach([this](Object* object) {
+    if (!object->collectable && object->type == ObjectType::Closure) this->gc.Blacken(object);
+  });
+}
+
+// the same roots as MarkRoots, minus anything that can't be young. Frames only
+// ever hold the compiler's closures and the old space is what the remembered
+// set is for
+auto VirtualMachine::ForwardRoots() -> void {
+  Value* top = this->StackRoots();
+  for (Value* slot = this->stack; slot < top; slot++) {
+    this->gc.Forward(slot);
+  }
+
+  // the links are in the upvalues themselves, old ones included
+  auto forward_open = [this](Object::Upvalue** link) {
+    for (; *link != nullptr; link = &(*link)->as.upvalue.next) {
+      *link = static_cast<Object::Upvalue*>(this->gc.Forward(*link));
+    }
+  };
+  forward_open(&this->open_upvalues);
+
+  for (u64 i = 0; i < this->fibers.count; i++) {
+    Fiber* fiber = this->fibers[i];
+    this->gc.Forward(&fiber->result);
+    if (fiber == this->fiber || fiber->state == FiberState::Done) continue;
+
+    for (Value* slot = fiber->stack; slot < fiber->stack_top; slot++) {
+      this->gc.Forward(slot);
+    }
+    forward_open(&fiber->open_upvalues);
+  }
+
+  bool moved = false;
+  const auto& remembered = this->gc.RememberedGlobals();
+  for (u64 i = 0; i < remembered.count; i++) {
+    const u32 index = remembered[i];
+    if (index >= this->globals.count || this->globals[index] == nullptr) continue;
+
+    Object* global = this->gc.Forward(this->globals[index]);
+    if (global == this->globals[index]) continue;
+    this->globals[index] = global;
+    // same as assigning it again
+    this->tiering.WriteGlobal(index);
+    moved = true;
+  }
+  if (moved) this->globals_generation = ARENA_GENERATIONS++;
+}
+
+auto VirtualMachine::CollectMinor() -> void {
+#ifdef DEBUG_GC_LOG
+  printf("-----GC minor begin\n");
+#endif
+
+  const auto start = std::chrono::steady_clock::now();
+  this->gc.BeginMinor(this->object_pool);
+  this->ForwardRoots();
+  const u64 dead = this->gc.FinishMinor();
+  const auto end = std::chrono::steady_clock::now();
+  this->gc.Record(std::chrono::duration<f64, std::milli>(end - start).count(), true);
+
+#ifdef DEBUG_GC_LOG
+  printf("-----GC minor end, %llu died young\n", static_cast<unsigned long long>(dead));
+#else
+  (void)dead;
+#endif
+}
+
+auto VirtualMachine::Collect() -> void {
+  // nothing in the old space is remembered across a full one, so whatever's
+  // young has to go first
+  if (!this->gc.NurseryEmpty()) this->CollectMinor();
+
+#ifdef DEBUG_GC_LOG
+  printf("-----GC begin\n");
+#endif
+
+  const auto start = std::chrono::steady_clock::now();
+  this->MarkRoots();
+  this->gc.Trace();
+  const u64 freed = this->gc.Sweep(this->object_pool, this->string_pool);
+  if (freed > 0) {
+    // a freed slot can come back as something else, at the same address
+    this->call_generation = ARENA_GENERATIONS++;
+  }
+  const auto end = std::chrono::steady_clock::now();
+  this->gc.Record(std::chrono::duration<f64, std::milli>(end - start).count(), false);
+
+#ifdef DEBUG_GC_LOG
+  printf("-----GC end, freed %llu\n", static_cast<unsigned long long>(freed));
+#endif
+}
+
+auto VirtualMachine::AllocObject() -> Object* {
+  if (this->gc.NurseryFull()) [[unlikely]] {
+    this->CollectMinor();
+    // promoting is what fills up the old space
+    if (this->gc.ShouldCollect()) this->Collect();
+  }
+  return this->gc.NurseryAlloc();
+}
+
+auto VirtualMachine::AllocString(u64 length, const char* start) -> Object* {
+  const auto interned = this->string_pool->Find(length, start);
+  if (!interned.IsNone()) {
+    return this->string_pool->Nth(interned.Get());
+  }
+
+  if (this->gc.ShouldCollect()) [[unlikely]] {
+    this->Collect();
+  }
+
+  Object* string = this->string_pool->Nth(this->string_pool->AllocCollectable(length, start));
+  this->gc.Track(string, sizeof(Object) + length + 1);
+  return string;
+}
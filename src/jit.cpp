@@ -0,0 +1,834 @@
+#include "jit.h"
+
+#include "roc_config.h"
+
+#if defined(ROC_JIT)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+
+#include "assembler.h"
+#include "utils.h"
+#include "value.h"
+#include "vm.h"
+
+// Translates one chunk. Registers are fixed for the whole function:
+//   r12 - VirtualMachine*
+//   r13 - StackFrame**, the interpreter's frame variable
+//   rbx - StackFrame*, the frame being run, it never changes under native code
+//   r14 - frame->locals, reloaded after every call since the stack can move
+//   r15 - &VirtualMachine::stack_top
+// all callee saved, so calls into the runtime leave them alone. rax, rcx, rdx
+// and rsi are scratch, rcx is usually the current stack_top.
+// Inline pushes check stack_limit the same as VirtualMachine::Push, a full
+// stack jumps out to a stub that grows it and retries.
+class JitCompiler {
+ public:
+  // speculates on globals when it has a table to put the deopt points in
+  JitCompiler(Chunk* chunk, VirtualMachine* vm, DeoptTable* table)
+      : chunk(chunk), vm(vm), stack_top(&vm->stack_top), budget(&vm->budget_left), table(table) {
+    this->fixups.Init();
+    this->exits.Init();
+    this->safepoints.Init();
+    this->deopts.Init();
+    this->grows.Init();
+    this->osr_entries.Init();
+    this->globals.Init();
+    this->matches.Init();
+    this->native_offsets.Init(chunk->bytecode.count);
+    for (u64 i = 0; i < chunk->bytecode.count; i++) this->native_offsets.Append(NO_OFFSET);
+  }
+
+  ~JitCompiler() {
+    this->fixups.Deinit();
+    this->exits.Deinit();
+    this->safepoints.Deinit();
+    this->deopts.Deinit();
+    this->grows.Deinit();
+    this->osr_entries.Deinit();
+    this->globals.Deinit();
+    // whatever the Jit didn't take, the code using them never got installed
+    for (u64 i = 0; i < this->matches.count; i++) {
+      FREE_ARRAY(void*, this->matches[i].native, this->matches[i].table->targets.count);
+    }
+    this->matches.Deinit();
+    this->native_offsets.Deinit();
+  }
+
+  auto Compile() -> bool;
+  // points every match's native targets into the installed code
+  auto Link(u8* code) -> void;
+
+ public:
+  Assembler as;
+  // code offsets rather than addresses until it's installed
+  DynamicArray<OsrEntry> osr_entries;
+  // object pool indexes of the globals it baked in
+  DynamicArray<u32> globals;
+
+  // one per MatchDense/MatchHash, where each arm of its JumpTable starts in
+  // native code. Filled in by Link, since that needs to know where the code went
+  struct MatchSite {
+    const JumpTable* table;
+    u64 after;
+    void** native;
+  };
+  DynamicArray<MatchSite> matches;
+
+ private:
+  constexpr static u32 NO_OFFSET = 0xFFFFFFFF;
+
+  auto Instruction(OpCode op, u8* operands) -> void;
+  auto Helper(OpCode op, u8* operands) -> void;
+  auto Branch(OpCode op, u64 target, u64 next) -> void;
+  auto CompareBranch(OpCode compare, bool when, u8* operands, u64 target) -> void;
+  auto Arithmetic(OpCode generic, u8 sse_op, u8* operands) -> void;
+  auto Compare(OpCode generic, u8* operands) -> void;
+  auto GuardNumber(int disp, DynamicArray<u64>* slow) -> void;
+  auto LoadIntegers(DynamicArray<u64>* slow) -> void;
+  auto CheckEpoch(u32 resume) -> void;
+  auto Safepoint(u64 offset) -> void;
+  auto Global(u8* operands) -> void;
+  auto Prologue() -> void;
+  auto Restore() -> void;
+
+  auto LoadStackTop() -> void { this->as.Load(RCX, R15, 0); }
+  auto LoadPushTop() -> void;
+  auto MoveStackTop(int values) -> void { this->as.AddImm(R15, 0, values * VALUE_SIZE); }
+  auto CopyValue(Reg dst, int dst_disp, Reg src, int src_disp) -> void {
+    for (int word = 0; word < VALUE_SIZE; word += sizeof(u64)) {
+      this->as.Load(RDX, src, src_disp + word);
+      this->as.Store(dst, dst_disp + word, RDX);
+    }
+  }
+  auto StoreValue(Reg dst, int dst_disp, Value value) -> void {
+    u64 words[VALUE_SIZE / sizeof(u64)];
+    std::memcpy(words, &value, VALUE_SIZE);
+    for (u64 word = 0; word < VALUE_SIZE / sizeof(u64); word++) {
+      this->as.Mov(RDX, words[word]);
+      this->as.Store(dst, dst_disp + static_cast<int>(word * sizeof(u64)), RDX);
+    }
+  }
+
+ private:
+  Chunk* chunk;
+  VirtualMachine* vm;
+  Value** stack_top;
+  u64* budget;
+  DeoptTable* table;
+
+  struct Fixup {
+    u64 at;
+    u64 target;
+  };
+  DynamicArray<Fixup> fixups;
+
+  // rel32s that jump to the epilogue, status already in al
+  DynamicArray<u64> exits;
+
+  // rel32s of back edges that found the budget gone, target is the Loop
+  DynamicArray<Fixup> safepoints;
+
+  struct Deopt {
+    u64 at;
+    u32 point;
+  };
+  DynamicArray<Deopt> deopts;
+
+  // rel32s of pushes that found the stack full, target is where to retry
+  DynamicArray<Fixup> grows;
+
+  // bytecode offset -> native offset, for every instruction start
+  DynamicArray<u32> native_offsets;
+};
+
+auto static ReadInt(const u8* operands) -> u32 {
+  u32 num;
+  std::memcpy(&num, operands, sizeof(u32));
+  return num;
+}
+
+// ops that can't fail and don't read any operands, nothing needs inst_ptr
+auto static NeedsInstPtr(OpCode op) -> bool {
+  switch (op) {
+    case OpCode::Pop:
+    case OpCode::True:
+    case OpCode::False:
+    case OpCode::Not:
+    case OpCode::Equality:
+    case OpCode::Return:
+    case OpCode::ReturnVoid:
+      return false;
+    default:
+      return true;
+  }
+}
+
+auto JitCompiler::Compile() -> bool {
+  const u64 count = this->chunk->bytecode.count;
+  u8* bytecode = this->chunk->bytecode.data;
+
+  this->Prologue();
+
+  for (u64 offset = 0; offset < count;) {
+    const auto op = static_cast<OpCode>(bytecode[offset]);
+    const u32 length = this->chunk->InstructionLength(offset);
+    u8* operands = bytecode + offset + 1;
+    this->native_offsets[offset] = static_cast<u32>(this->as.Here());
+
+    switch (op) {
+      case OpCode::Jump:
+      case OpCode::JumpFalse:
+      case OpCode::JumpTrue:
+      case OpCode::Loop: {
+        const u64 after = offset + length;
+        const u32 jump = ReadInt(operands);
+        if (op == OpCode::Loop) this->Safepoint(offset);
+        this->Branch(op, op == OpCode::Loop ? after - jump : after + jump, after);
+        if (op == OpCode::Loop) {
+          this->osr_entries.Append({static_cast<u32>(after - jump), nullptr});
+        }
+        break;
+      }
+#define C(ID, COMPARE, WHEN)                                      \
+  case OpCode::ID: {                                              \
+    const u64 target = offset + length + ReadInt(operands);       \
+    this->CompareBranch(OpCode::COMPARE, WHEN, operands, target); \
+    break;                                                        \
+  }
+        VM_COMPARE_JUMPS(C)
+#undef C
+      case OpCode::ForRange: {
+        // the handler only moves inst_ptr off the next instruction once the
+        // range is done
+        const u64 after = offset + length;
+        this->Helper(op, operands);
+        this->as.Load(RAX, RBX, offsetof(StackFrame, inst_ptr));
+        this->as.Mov(RDX, reinterpret_cast<u64>(bytecode + after));
+        this->as.Cmp(RAX, RDX);
+        this->fixups.Append({this->as.Jne(), offset + 1 + sizeof(u32) + ReadInt(operands)});
+        break;
+      }
+      case OpCode::MatchDense:
+      case OpCode::MatchHash: {
+        // the helper pops the value and hands back where its arm is, so it's
+        // one indirect jump here too
+        const JumpTable* jump_table = &this->chunk->jump_tables[ReadInt(operands)];
+        void** native = ALLOCATE(void*, jump_table->targets.count);
+        this->matches.Append({jump_table, offset + length, native});
+
+        const auto helper = op == OpCode::MatchDense ? &VirtualMachine::JitMatchDense : &VirtualMachine::JitMatchHash;
+        this->as.Mov(RDI, R12);
+        this->as.Mov(RSI, reinterpret_cast<u64>(jump_table));
+        this->as.Mov(RDX, reinterpret_cast<u64>(native));
+        this->as.Mov(RAX, reinterpret_cast<u64>(helper));
+        this->as.CallRax();
+        this->as.JmpRax();
+        break;
+      }
+      case OpCode::Return:
+      case OpCode::ReturnVoid: {
+        // the frame is gone after this, whatever it says goes back to the caller
+        this->as.Mov(RDI, R12);
+        this->as.Mov(RSI, R13);
+        this->as.Mov(RAX, reinterpret_cast<u64>(VirtualMachine::JIT_HELPERS[static_cast<u8>(op)]));
+        this->as.CallRax();
+        this->exits.Append(this->as.Jmp());
+        break;
+      }
+      case OpCode::TailInvoke: {
+        // jumps to whatever native code takes over the frame, with our own
+        // arguments, so tail calls stay in constant native stack space too
+        this->Helper(op, operands);
+        this->as.Mov(RDI, R12);
+        this->as.Mov(RSI, R13);
+        this->Restore();
+        this->as.JmpRax();
+        break;
+      }
+      default: {
+        this->Instruction(op, operands);
+        // anything that runs user code or assigns a global can invalidate us
+        if (this->table != nullptr && (op == OpCode::Invoke || op == OpCode::SetGlobal)) {
+          this->CheckEpoch(static_cast<u32>(offset + length));
+        }
+        break;
+      }
+    }
+
+    offset += length;
+  }
+
+  const u64 epilogue = this->as.Here();
+  this->Restore();
+  this->as.Ret();
+
+  // the stack is already what the interpreter expects, all a deopt has to do
+  // is point inst_ptr past the instruction that invalidated us
+  for (u64 i = 0; i < this->deopts.count; i++) {
+    this->as.PatchHere(this->deopts[i].at);
+    this->as.Mov(RDI, reinterpret_cast<u64>(this->table));
+    this->as.Mov(RSI, static_cast<u64>(this->deopts[i].point));
+    this->as.Mov(RDX, RBX);
+    this->as.Mov(RCX, RSP);
+    this->as.Mov(RAX, reinterpret_cast<u64>(&DeoptTable::Deoptimize));
+    this->as.CallRax();
+    this->exits.Append(this->as.Jmp());
+  }
+
+  for (u64 i = 0; i < this->safepoints.count; i++) {
+    this->as.PatchHere(this->safepoints[i].at);
+    this->as.Mov(RAX, reinterpret_cast<u64>(this->chunk->bytecode.data + this->safepoints[i].target));
+    this->as.Store(RBX, offsetof(StackFrame, inst_ptr), RAX);
+    this->as.Mov(RAX, static_cast<u64>(ExecStatus::Exit));
+    this->exits.Append(this->as.Jmp());
+  }
+
+  for (u64 i = 0; i < this->grows.count; i++) {
+    this->as.PatchHere(this->grows[i].at);
+    this->as.Mov(RDI, R12);
+    this->as.Mov(RAX, reinterpret_cast<u64>(&VirtualMachine::JitGrowStack));
+    this->as.CallRax();
+    this->as.Load(R14, RBX, offsetof(StackFrame, locals));
+    this->as.Patch(this->as.Jmp(), this->grows[i].target);
+  }
+
+  // Nothing is kept in registers between instructions, so a frame that's
+  // already running can come in at any loop header. Each one gets its own
+  // entry that sets up the registers and jumps straight there.
+  for (u64 i = 0; i < this->osr_entries.count; i++) {
+    OsrEntry& entry = this->osr_entries[i];
+    const u64 at = this->as.Here();
+    this->Prologue();
+    this->fixups.Append({this->as.Jmp(), entry.header});
+    entry.code = reinterpret_cast<NativeCode>(at);
+  }
+
+  for (u64 i = 0; i < this->fixups.count; i++) {
+    const u64 target = this->fixups[i].target;
+    if (target >= count || this->native_offsets[target] == NO_OFFSET) [[unlikely]] {
+      return false;
+    }
+
+    this->as.Patch(this->fixups[i].at, this->native_offsets[target]);
+  }
+
+  for (u64 i = 0; i < this->exits.count; i++) {
+    this->as.Patch(this->exits[i], epilogue);
+  }
+
+  for (u64 i = 0; i < this->matches.count; i++) {
+    const MatchSite& site = this->matches[i];
+    for (u64 arm = 0; arm < site.table->targets.count; arm++) {
+      const u64 target = site.after + site.table->targets[arm];
+      if (target >= count || this->native_offsets[target] == NO_OFFSET) [[unlikely]] {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+auto JitCompiler::Link(u8* code) -> void {
+  for (u64 i = 0; i < this->matches.count; i++) {
+    const MatchSite& site = this->matches[i];
+    for (u64 arm = 0; arm < site.table->targets.count; arm++) {
+      site.native[arm] = code + this->native_offsets[site.after + site.table->targets[arm]];
+    }
+  }
+}
+
+auto JitCompiler::Prologue() -> void {
+  this->as.Push(RBX);
+  this->as.Push(R12);
+  this->as.Push(R13);
+  this->as.Push(R14);
+  // five pushes and the return address leave the stack aligned for calls
+  this->as.Push(R15);
+  this->as.Mov(R12, RDI);
+  this->as.Mov(R13, RSI);
+  this->as.Load(RBX, RSI, 0);
+  this->as.Load(R14, RBX, offsetof(StackFrame, locals));
+  this->as.Mov(R15, reinterpret_cast<u64>(this->stack_top));
+}
+
+auto JitCompiler::Restore() -> void {
+  this->as.Pop(R15);
+  this->as.Pop(R14);
+  this->as.Pop(R13);
+  this->as.Pop(R12);
+  this->as.Pop(RBX);
+}
+
+// everything that can't jump gets a template here, and anything without one
+// just calls the interpreter's handler
+auto JitCompiler::Instruction(OpCode op, u8* operands) -> void {
+  switch (op) {
+    default: {
+      this->Helper(op, operands);
+      break;
+    }
+    case OpCode::Pop: {
+      this->MoveStackTop(-1);
+      break;
+    }
+    case OpCode::GetGlobal: {
+      this->Global(operands);
+      break;
+    }
+    case OpCode::GetLocal: {
+      this->LoadPushTop();
+      this->CopyValue(RCX, 0, R14, ReadInt(operands) * VALUE_SIZE);
+      this->MoveStackTop(1);
+      break;
+    }
+    case OpCode::SetLocal: {
+      this->LoadStackTop();
+      this->CopyValue(R14, ReadInt(operands) * VALUE_SIZE, RCX, -VALUE_SIZE);
+      break;
+    }
+    case OpCode::Constant:
+    case OpCode::ConstantLong: {
+      // constants never move once the chunk is compiled
+      const u32 idx = op == OpCode::Constant ? operands[0] : ReadInt(operands);
+      this->LoadPushTop();
+      this->as.Mov(RAX, reinterpret_cast<u64>(&this->chunk->locals[idx]));
+      this->CopyValue(RCX, 0, RAX, 0);
+      this->MoveStackTop(1);
+      break;
+    }
+    case OpCode::Add:
+    case OpCode::AddNumNum:
+    case OpCode::AddIntInt: {
+      this->Arithmetic(OpCode::Add, 0x58, operands);
+      break;
+    }
+    case OpCode::Subtract:
+    case OpCode::SubtractNumNum:
+    case OpCode::SubtractIntInt: {
+      this->Arithmetic(OpCode::Subtract, 0x5C, operands);
+      break;
+    }
+    case OpCode::Multiply:
+    case OpCode::MultiplyNumNum:
+    case OpCode::MultiplyIntInt: {
+      this->Arithmetic(OpCode::Multiply, 0x59, operands);
+      break;
+    }
+    case OpCode::Divide:
+    case OpCode::DivideNumNum: {
+      this->Arithmetic(OpCode::Divide, 0x5E, operands);
+      break;
+    }
+    case OpCode::Greater:
+    case OpCode::GreaterNumNum:
+    case OpCode::GreaterIntInt: {
+      this->Compare(OpCode::Greater, operands);
+      break;
+    }
+    case OpCode::Less:
+    case OpCode::LessNumNum:
+    case OpCode::LessIntInt: {
+      this->Compare(OpCode::Less, operands);
+      break;
+    }
+
+#define X(ID, FIRST, SECOND)                                                             \
+  case OpCode::ID: {                                                                     \
+    this->Instruction(OpCode::FIRST, operands);                                          \
+    this->Instruction(OpCode::SECOND, operands + Chunk::OperandLength(OpCode::FIRST));   \
+    break;                                                                               \
+  }
+      VM_SUPERINSTRUCTIONS(X)
+#undef X
+  }
+}
+
+// the handler reads its operands from inst_ptr, same as when interpreted
+auto JitCompiler::Helper(OpCode op, u8* operands) -> void {
+  if (NeedsInstPtr(op)) {
+    this->as.Mov(RAX, reinterpret_cast<u64>(operands));
+    this->as.Store(RBX, offsetof(StackFrame, inst_ptr), RAX);
+  }
+
+  // only ever called, JitTailInvoke doesn't even return a status
+  u64 helper = reinterpret_cast<u64>(VirtualMachine::JIT_HELPERS[static_cast<u8>(op)]);
+  if (op == OpCode::Invoke) helper = reinterpret_cast<u64>(&VirtualMachine::JitInvoke);
+  if (op == OpCode::TailInvoke) helper = reinterpret_cast<u64>(&VirtualMachine::JitTailInvoke);
+  if (op == OpCode::Iterate) helper = reinterpret_cast<u64>(&VirtualMachine::JitIterate);
+  if (op == OpCode::Join) helper = reinterpret_cast<u64>(&VirtualMachine::JitJoin);
+
+  this->as.Mov(RDI, R12);
+  this->as.Mov(RSI, R13);
+  this->as.Mov(RAX, helper);
+  this->as.CallRax();
+
+  // TailInvoke hands back code to jump to instead of a status
+  if (op != OpCode::TailInvoke) {
+    this->as.Load(R14, RBX, offsetof(StackFrame, locals));
+    this->as.TestAl();
+    this->exits.Append(this->as.Jne());
+  }
+}
+
+auto JitCompiler::Branch(OpCode op, u64 target, u64 next) -> void {
+  if (op == OpCode::Jump || op == OpCode::Loop) {
+    this->fixups.Append({this->as.Jmp(), target});
+    return;
+  }
+
+  // where to go when the condition is falsey, and when it's truthy
+  const u64 on_false = op == OpCode::JumpFalse ? target : next;
+  const u64 on_true = op == OpCode::JumpFalse ? next : target;
+
+  // booleans are checked inline, anything else asks Value::IsTruthy
+  this->LoadStackTop();
+#if defined(ROC_NAN_BOXING)
+  this->as.Load(RDX, RCX, -VALUE_SIZE);
+  this->as.Mov(RAX, VALUE_QNAN | VALUE_TAG_FALSE);
+  this->as.Cmp(RDX, RAX);
+  this->fixups.Append({this->as.Je(), on_false});
+  this->as.Mov(RAX, VALUE_QNAN | VALUE_TAG_TRUE);
+  this->as.Cmp(RDX, RAX);
+  this->fixups.Append({this->as.Je(), on_true});
+#else
+  this->as.Cmp32(RCX, -VALUE_SIZE + VALUE_TYPE, static_cast<u8>(ValueType::Boolean));
+  const u64 not_boolean = this->as.Jne();
+  this->as.Cmp8(RCX, -VALUE_SIZE + VALUE_NUMBER, 0);
+  this->fixups.Append({this->as.Je(), on_false});
+  this->fixups.Append({this->as.Jmp(), on_true});
+  this->as.PatchHere(not_boolean);
+#endif
+
+  this->as.Mov(RDI, R12);
+  this->as.Mov(RAX, reinterpret_cast<u64>(&VirtualMachine::JitIsTruthy));
+  this->as.CallRax();
+  this->as.TestAl();
+  this->fixups.Append({this->as.Je(), on_false});
+  this->fixups.Append({this->as.Jmp(), on_true});
+}
+
+// the compare on its own, then a branch on the boolean it left behind. That
+// one's always a boolean, so unlike Branch there's no truthiness to ask about
+auto JitCompiler::CompareBranch(OpCode compare, bool when, u8* operands, u64 target) -> void {
+  this->Instruction(compare, operands);
+
+  this->LoadStackTop();
+  this->MoveStackTop(-1);
+#if defined(ROC_NAN_BOXING)
+  this->as.Load(RDX, RCX, -VALUE_SIZE);
+  this->as.Mov(RAX, VALUE_QNAN | VALUE_TAG_TRUE);
+  this->as.Cmp(RDX, RAX);
+  this->fixups.Append({when ? this->as.Je() : this->as.Jne(), target});
+#else
+  this->as.Cmp8(RCX, -VALUE_SIZE + VALUE_NUMBER, 0);
+  this->fixups.Append({when ? this->as.Jne() : this->as.Je(), target});
+#endif
+}
+
+// same check as VirtualMachine::Safepoint, offset is the Loop's own
+auto JitCompiler::Safepoint(u64 offset) -> void {
+  this->as.Mov(RAX, reinterpret_cast<u64>(this->budget));
+  this->as.Cmp64(RAX, 0, 0);
+  this->safepoints.Append({this->as.Je(), offset});
+  this->as.AddImm(RAX, 0, -1);
+}
+
+// bakes in whatever the global holds right now, the TierManager throws this
+// code away if that changes. Not if it's in the nursery though, a minor
+// collection can move it in the middle of a call that never checks the epoch
+auto JitCompiler::Global(u8* operands) -> void {
+  if (this->table == nullptr) {
+    this->Helper(OpCode::GetGlobal, operands);
+    return;
+  }
+
+  const u32 idx = ReadInt(operands);
+  Object* global = this->vm->JitGlobal(this->chunk, idx);
+  if (this->vm->gc.IsYoung(global)) {
+    this->Helper(OpCode::GetGlobal, operands);
+    return;
+  }
+
+  const u32 index = this->chunk->global_caches[idx].index;
+
+  bool known = false;
+  for (u64 i = 0; i < this->globals.count; i++) known |= this->globals[i] == index;
+  if (!known) this->globals.Append(index);
+
+  this->LoadPushTop();
+  this->StoreValue(RCX, 0, Value(global));
+  this->MoveStackTop(1);
+}
+
+// rcx is stack_top with room for one more push after this
+auto JitCompiler::LoadPushTop() -> void {
+  const u64 retry = this->as.Here();
+  this->LoadStackTop();
+  this->as.Mov(RAX, reinterpret_cast<u64>(&this->vm->stack_limit));
+  this->as.Load(RAX, RAX, 0);
+  this->as.Cmp(RCX, RAX);
+  this->grows.Append({this->as.Jae(), retry});
+}
+
+// still the code the chunk is running as, or deopt to resume
+auto JitCompiler::CheckEpoch(u32 resume) -> void {
+  this->as.Mov(RAX, reinterpret_cast<u64>(&this->chunk->code_epoch));
+  this->as.Load(RAX, RAX, 0);
+  this->as.Mov(RDX, this->chunk->code_epoch);
+  this->as.Cmp(RAX, RDX);
+  const u32 point = this->table->Point(resume, DEOPT_KEEP_STACK, static_cast<u64>(ExecStatus::Exit));
+  this->deopts.Append({this->as.Jne(), point});
+}
+
+auto JitCompiler::GuardNumber(int disp, DynamicArray<u64>* slow) -> void {
+#if defined(ROC_NAN_BOXING)
+  this->as.Load(RDX, RCX, disp);
+  this->as.Mov(RAX, VALUE_QNAN);
+  this->as.And(RDX, RAX);
+  this->as.Cmp(RDX, RAX);
+  slow->Append(this->as.Je());
+#else
+  this->as.Cmp32(RCX, disp + VALUE_TYPE, static_cast<u8>(ValueType::Number));
+  slow->Append(this->as.Jne());
+#endif
+}
+
+// rax and rdx are the two operands, if they're both integers. They get shifted
+// up so their sign is the sign bit, then anything that overflows 64 bits went
+// past VALUE_INTEGER_MAX too
+auto JitCompiler::LoadIntegers(DynamicArray<u64>* slow) -> void {
+#if defined(ROC_NAN_BOXING)
+  constexpr u8 tag_shift = 64 - VALUE_INTEGER_SHIFT;
+  constexpr int tag = static_cast<int>((VALUE_QNAN | VALUE_TAG_INTEGER) >> tag_shift);
+  this->as.Load(RAX, RCX, -2 * VALUE_SIZE);
+  this->as.Mov(RSI, RAX);
+  this->as.Shr(RSI, tag_shift);
+  this->as.Cmp(RSI, tag);
+  slow->Append(this->as.Jne());
+  this->as.Load(RDX, RCX, -VALUE_SIZE);
+  this->as.Mov(RSI, RDX);
+  this->as.Shr(RSI, tag_shift);
+  this->as.Cmp(RSI, tag);
+  slow->Append(this->as.Jne());
+#else
+  this->as.Cmp32(RCX, -2 * VALUE_SIZE + VALUE_TYPE, static_cast<u8>(ValueType::Integer));
+  slow->Append(this->as.Jne());
+  this->as.Cmp32(RCX, -VALUE_SIZE + VALUE_TYPE, static_cast<u8>(ValueType::Integer));
+  slow->Append(this->as.Jne());
+  this->as.Load(RAX, RCX, -2 * VALUE_SIZE + VALUE_NUMBER);
+  this->as.Load(RDX, RCX, -VALUE_SIZE + VALUE_NUMBER);
+#endif
+  this->as.Shl(RAX, VALUE_INTEGER_SHIFT);
+  this->as.Shl(RDX, VALUE_INTEGER_SHIFT);
+}
+
+// two integers or two numbers are done inline, anything else goes to the
+// generic handler so type errors and promotions come out the same as when
+// interpreted. So does an integer overflowing, and dividing integers
+auto JitCompiler::Arithmetic(OpCode generic, u8 sse_op, u8* operands) -> void {
+  DynamicArray<u64> slow;
+  slow.Init();
+  defer(slow.Deinit());
+  DynamicArray<u64> numbers;
+  numbers.Init();
+  defer(numbers.Deinit());
+
+  this->LoadStackTop();
+  u64 integer_done = 0;
+  if (generic != OpCode::Divide) {
+    this->LoadIntegers(&numbers);
+    if (generic == OpCode::Add) {
+      this->as.Add(RAX, RDX);
+    } else if (generic == OpCode::Subtract) {
+      this->as.Sub(RAX, RDX);
+    } else {
+      // only one side gets to be shifted
+      this->as.Sar(RDX, VALUE_INTEGER_SHIFT);
+      this->as.Imul(RAX, RDX);
+    }
+    slow.Append(this->as.Jo());
+#if defined(ROC_NAN_BOXING)
+    this->as.Shr(RAX, VALUE_INTEGER_SHIFT);
+    this->as.Mov(RDX, VALUE_QNAN | VALUE_TAG_INTEGER);
+    this->as.Or(RAX, RDX);
+    this->as.Store(RCX, -2 * VALUE_SIZE, RAX);
+#else
+    this->as.Sar(RAX, VALUE_INTEGER_SHIFT);
+    this->as.Store(RCX, -2 * VALUE_SIZE + VALUE_NUMBER, RAX);
+#endif
+    this->MoveStackTop(-1);
+    integer_done = this->as.Jmp();
+  }
+
+  for (u64 i = 0; i < numbers.count; i++) this->as.PatchHere(numbers[i]);
+  this->GuardNumber(-2 * VALUE_SIZE, &slow);
+  this->GuardNumber(-VALUE_SIZE, &slow);
+
+  // movsd xmm0, a; op xmm0, b; movsd a, xmm0
+  this->as.Sse(0xF2, 0x10, RCX, -2 * VALUE_SIZE + VALUE_NUMBER);
+  this->as.Sse(0xF2, sse_op, RCX, -VALUE_SIZE + VALUE_NUMBER);
+  this->as.Sse(0xF2, 0x11, RCX, -2 * VALUE_SIZE + VALUE_NUMBER);
+  this->MoveStackTop(-1);
+
+  const u64 done = this->as.Jmp();
+  for (u64 i = 0; i < slow.count; i++) this->as.PatchHere(slow[i]);
+  this->Helper(generic, operands);
+  this->as.PatchHere(done);
+  if (generic != OpCode::Divide) this->as.PatchHere(integer_done);
+}
+
+auto JitCompiler::Compare(OpCode generic, u8* operands) -> void {
+  DynamicArray<u64> slow;
+  slow.Init();
+  defer(slow.Deinit());
+  DynamicArray<u64> numbers;
+  numbers.Init();
+  defer(numbers.Deinit());
+
+  this->LoadStackTop();
+  this->LoadIntegers(&numbers);
+  // same operand order trick as for numbers below, just signed
+  if (generic == OpCode::Greater) {
+    this->as.Cmp(RAX, RDX);
+  } else {
+    this->as.Cmp(RDX, RAX);
+  }
+  this->as.SetGreater();
+  const u64 integers = this->as.Jmp();
+
+  for (u64 i = 0; i < numbers.count; i++) this->as.PatchHere(numbers[i]);
+  this->GuardNumber(-2 * VALUE_SIZE, &slow);
+  this->GuardNumber(-VALUE_SIZE, &slow);
+
+  // a > b and b < a are both "above" once the operands are in the right order,
+  // and unordered comparisons come out false like they should
+  const int lhs = generic == OpCode::Greater ? -2 * VALUE_SIZE : -VALUE_SIZE;
+  const int rhs = generic == OpCode::Greater ? -VALUE_SIZE : -2 * VALUE_SIZE;
+  this->as.Sse(0xF2, 0x10, RCX, lhs + VALUE_NUMBER);
+  this->as.Sse(0x66, 0x2E, RCX, rhs + VALUE_NUMBER);
+  this->as.SetAbove();
+
+  this->as.PatchHere(integers);
+
+#if defined(ROC_NAN_BOXING)
+  this->as.Mov(RDX, VALUE_QNAN | VALUE_TAG_FALSE);
+  this->as.Or(RDX, RAX);
+  this->as.Store(RCX, -2 * VALUE_SIZE, RDX);
+#else
+  this->as.Store32(RCX, -2 * VALUE_SIZE + VALUE_TYPE, static_cast<u32>(ValueType::Boolean));
+  this->as.StoreAl(RCX, -2 * VALUE_SIZE + VALUE_NUMBER);
+#endif
+  this->MoveStackTop(-1);
+
+  const u64 done = this->as.Jmp();
+  for (u64 i = 0; i < slow.count; i++) this->as.PatchHere(slow[i]);
+  this->Helper(generic, operands);
+  this->as.PatchHere(done);
+}
+
+auto Jit::Init(VirtualMachine* vm) -> void {
+  this->regions.Init();
+  this->tables.Init();
+  this->match_targets.Init();
+  this->vm = vm;
+  this->stack_top = &vm->stack_top;
+  this->budget = &vm->budget_left;
+}
+
+auto Jit::Deinit() -> void {
+  for (u64 i = 0; i < this->regions.count; i++) {
+    munmap(this->regions[i].base, this->regions[i].size);
+  }
+
+  for (u64 i = 0; i < this->tables.count; i++) {
+    this->tables[i]->Deinit();
+    FREE_ARRAY(DeoptTable, this->tables[i], 1);
+  }
+
+  for (u64 i = 0; i < this->match_targets.count; i++) {
+    FREE_ARRAY(void*, this->match_targets[i].native, this->match_targets[i].count);
+  }
+
+  this->regions.Deinit();
+  this->tables.Deinit();
+  this->match_targets.Deinit();
+}
+
+// kept until Deinit, same as the code pointing at it
+auto Jit::AllocTable(Chunk* chunk) -> DeoptTable* {
+  DeoptTable* table = ALLOCATE(DeoptTable, 1);
+  table->Init(chunk->bytecode.data, this->stack_top);
+  this->tables.Append(table);
+  return table;
+}
+
+auto Jit::Compile(Chunk* chunk, DynamicArray<OsrEntry>* osr_entries, DynamicArray<u32>* globals) -> NativeCode {
+  // a generator's frame comes and goes at every yield, those stay interpreted
+  if (chunk->IsGenerator()) {
+    return nullptr;
+  }
+
+  // only code that reads globals has anything to speculate on
+  bool reads_globals = false;
+  for (u64 offset = 0; offset < chunk->bytecode.count; offset += chunk->InstructionLength(offset)) {
+    reads_globals |= static_cast<OpCode>(chunk->bytecode[offset]) == OpCode::GetGlobal;
+  }
+
+  JitCompiler compiler(chunk, this->vm, globals != nullptr && reads_globals ? this->AllocTable(chunk) : nullptr);
+  if (!compiler.Compile()) {
+    return nullptr;
+  }
+
+  u8* base = this->Install(compiler.as.code);
+  if (base == nullptr) [[unlikely]] {
+    return nullptr;
+  }
+
+  for (u64 i = 0; i < compiler.osr_entries.count; i++) {
+    OsrEntry entry = compiler.osr_entries[i];
+    const u64 offset = reinterpret_cast<u64>(entry.code);
+    entry.code = reinterpret_cast<NativeCode>(base + offset);
+    osr_entries->Append(entry);
+  }
+
+  for (u64 i = 0; i < compiler.globals.count; i++) {
+    globals->Append(compiler.globals[i]);
+  }
+
+  // the code points at these now, so they're kept until Deinit like it is
+  compiler.Link(base);
+  for (u64 i = 0; i < compiler.matches.count; i++) {
+    this->match_targets.Append({compiler.matches[i].native, compiler.matches[i].table->targets.count});
+  }
+  compiler.matches.count = 0;
+
+  return reinterpret_cast<NativeCode>(base);
+}
+
+// copies the code into its own pages and flips them to executable, nothing is
+// ever writable and executable at the same time
+auto Jit::Install(const DynamicArray<u8>& code) -> u8* {
+  const u64 page = static_cast<u64>(sysconf(_SC_PAGESIZE));
+  const u64 size = (code.count + page - 1) / page * page;
+
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) [[unlikely]] {
+    return nullptr;
+  }
+
+  std::memcpy(base, code.data, code.count);
+  if (mprotect(base, size, PROT_READ | PROT_EXEC) != 0) [[unlikely]] {
+    munmap(base, size);
+    return nullptr;
+  }
+
+  this->regions.Append({base, size});
+  return static_cast<u8*>(base);
+}
+
+#endif
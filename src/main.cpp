@@ -10,6 +10,7 @@
 #include "global_pool.h"
 #include "object.h"
 #include "roc_config.h"
+#include "scheduler.h"
 #include "utils.h"
 #include "vm.h"
 
@@ -26,6 +27,7 @@ auto static RunFile(const char* path) -> InterpretResult {
   StringPool string_pool;
   Arena<Object> object_pool;
   GlobalPool global_pool;
+  string_pool.Init(&object_pool);
   global_pool.Init(&object_pool);
 
   COMPILER.Init(src, &string_pool, &global_pool);
@@ -36,18 +38,49 @@ auto static RunFile(const char* path) -> InterpretResult {
 
   Assert(compile_res.Get().type == ObjectType::Function);
   auto* function = static_cast<Object::Function*>(compile_res.Get());
+  // the VM frees what's still alive back into the pools, so it has to go
+  // before they do
   VIRTUAL_MACHINE.Init();
+  defer(VIRTUAL_MACHINE.Deinit());
 
   return VIRTUAL_MACHINE.Interpret(function, &string_pool, &object_pool);
 }
 
+// every script is a task of its own, and they all run at once
+auto static RunFiles(int count, char** paths) -> void {
+  Scheduler scheduler;
+  scheduler.Init(0);
+  defer(scheduler.Deinit());
+
+  DynamicArray<TaskId> tasks;
+  tasks.Init();
+  defer(tasks.Deinit());
+
+  for (int i = 0; i < count; i++) {
+    char* src = Utils::ReadFile(paths[i]);
+    tasks.Append(scheduler.Spawn(src));
+    free(src);
+  }
+
+  for (int i = 0; i < count; i++) {
+    const InterpretResult status = scheduler.Join(tasks[i]);
+    // a script that ends on a string or a function still ran fine
+    if (status.IsError() && status.Err() != InterpretError::ObjectResult) {
+      fprintf(stderr, "%s: %s\n", paths[i], ErrorToString(status.Err()));
+    }
+  }
+}
+
 auto static Repl() -> void {
   char line[1024];
   InterpretResult status;
   StringPool string_pool;
   Arena<Object> object_pool;
   GlobalPool global_pool;
+  string_pool.Init(&object_pool);
   global_pool.Init(&object_pool);
+  VIRTUAL_MACHINE.Init();
+  defer(VIRTUAL_MACHINE.Deinit());
 
   while (true) {
     printf("> ");
@@ -74,15 +107,12 @@ auto static Repl() -> void {
 auto main(int argc, char** argv) -> int {
   std::cout << argv[0] << " Version " << Roc_VERSION_MAJOR << "." << Roc_VERSION_MINOR << std::endl;
 
-  VIRTUAL_MACHINE.Init();
-  defer(VIRTUAL_MACHINE.Deinit());
-
   if (argc == 1) {
     Repl();
   } else if (argc == 2) {
     RunFile(argv[1]);
   } else {
-    printf("Usage: roc [path]\n");
+    RunFiles(argc - 1, argv + 1);
   }
 
   return 0;
@@ -19,17 +19,3 @@ auto Reallocate(void* ptr, size_t old_size, size_t new_size) -> void* {
   if (result == nullptr) exit(1);
   return result;
 }
-
-auto Collect() -> void {
-#ifdef DEBUG_GC_LOG
-  printf("-----GC begin\n");
-#endif
-
-  MarkRoots();
-
-#ifdef DEBUG_GC_LOG
-  printf("-----GC end\n");
-#endif
-}
-
-auto static MarkRoots() -> void {}
@@ -0,0 +1,218 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <io.h>
+// binary too, so a read comes back as long as fstat said
+#define O_CLOEXEC (_O_NOINHERIT | _O_BINARY)
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "common.h"
+#include "event_loop.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// The natives, see VM_NATIVES in object.h. Opening and closing files happens
+// right there in the call, the reads, writes and sleeping go through the
+// EventLoop and the fiber that called them is Blocked until they're done, the
+// same way a join is. Everything else keeps running in the meantime, and the
+// VM only sleeps once there's nothing left that can.
+//
+// There's no nil, so reads and writes that fail come back false.
+
+// a year, anything longer gets cut down to that so the deadline can't overflow
+#define NATIVE_MAX_SLEEP_MS (365.0 * 24 * 60 * 60 * 1000)
+
+auto static AsString(Value value) -> const Object::String* {
+  if (!value.IsObject() || value.AsObject()->type != ObjectType::String) return nullptr;
+  return static_cast<const Object::String*>(value.AsObject());
+}
+
+auto static NewRequest(NativeId native, IoKind kind, int fd, u64 size) -> IoRequest* {
+  auto* request = ALLOCATE(IoRequest, 1);
+  *request = {};
+  request->native = native;
+  request->data = size > 0 ? ALLOCATE(u8, size) : nullptr;
+  request->size = size;
+
+  request->op.kind = kind;
+  request->op.fd = fd;
+  request->op.buffer = request->data;
+  request->op.length = size;
+  request->op.user = request;
+  return request;
+}
+
+auto static FreeRequest(IoRequest* request) -> void {
+  if (request->op.kind != IoKind::Timer) {
+    close(request->op.fd);
+  }
+  FREE_ARRAY(u8, request->data, request->size);
+  FREE_ARRAY(IoRequest, request, 1);
+}
+
+auto VirtualMachine::CallNative(Object::Native* native, u32 argc, StackFrame*& frame) -> ExecStatus {
+  if (argc != native->as.native.arity) {
+    this->RuntimeError("Expected %d arguments to %s but got %d", native->as.native.arity, native->name, argc);
+    return ExecStatus::Error;
+  }
+
+  Value* args = this->stack_top - argc;
+  switch (native->as.native.id) {
+#define X(ID, NAME, ARITY) \
+  case NativeId::ID:       \
+    return this->Native##ID(args, frame);
+    VM_NATIVES
+#undef X
+  }
+
+  return ExecStatus::Error;
+}
+
+auto VirtualMachine::ReturnNative(Value* args, Value result) -> ExecStatus {
+  this->stack_top = args - 1;
+  this->Push(result);
+  return ExecStatus::Continue;
+}
+
+// readFile(path), the whole file as a string
+auto VirtualMachine::NativeReadFile(Value* args, StackFrame*& frame) -> ExecStatus {
+  const auto* path = AsString(args[0]);
+  if (path == nullptr) {
+    this->RuntimeError("readFile expects a path");
+    return ExecStatus::Error;
+  }
+
+  // strings in the pool are all null terminated
+  const int fd = open(path->name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return this->ReturnNative(args, Value(false));
+  }
+
+  // as much as there was when it got opened
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return this->ReturnNative(args, Value(false));
+  }
+  if (info.st_size == 0) {
+    close(fd);
+    return this->ReturnNative(args, Value(this->AllocString(0, "")));
+  }
+
+  return this->Suspend(NewRequest(NativeId::ReadFile, IoKind::Read, fd, static_cast<u64>(info.st_size)), args, frame);
+}
+
+// writeFile(path, contents), how many bytes went in
+auto VirtualMachine::NativeWriteFile(Value* args, StackFrame*& frame) -> ExecStatus {
+  const auto* path = AsString(args[0]);
+  const auto* contents = AsString(args[1]);
+  if (path == nullptr || contents == nullptr) {
+    this->RuntimeError("writeFile expects a path and a string");
+    return ExecStatus::Error;
+  }
+
+  const int fd = open(path->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return this->ReturnNative(args, Value(false));
+  }
+  if (contents->name_len == 0) {
+    close(fd);
+    return this->ReturnNative(args, Value(static_cast<i64>(0)));
+  }
+
+  // a copy, nothing has to keep the string around until it's written
+  IoRequest* request = NewRequest(NativeId::WriteFile, IoKind::Write, fd, contents->name_len);
+  std::memcpy(request->data, contents->name, contents->name_len);
+  return this->Suspend(request, args, frame);
+}
+
+// sleep(ms), evaluates to the same nothing a function without a return does
+auto VirtualMachine::NativeSleep(Value* args, StackFrame*& frame) -> ExecStatus {
+  const f64 ms = args[0].IsNumeric() ? args[0].ToNumber() : -1.0;
+  if (!std::isfinite(ms) || ms < 0) {
+    this->RuntimeError("sleep expects a number of milliseconds");
+    return ExecStatus::Error;
+  }
+
+  IoRequest* request = NewRequest(NativeId::Sleep, IoKind::Timer, -1, 0);
+  request->op.nanoseconds = static_cast<u64>(std::min(ms, NATIVE_MAX_SLEEP_MS) * 1000000.0);
+  return this->Suspend(request, args, frame);
+}
+
+auto VirtualMachine::Suspend(IoRequest* request, Value* args, StackFrame*& frame) -> ExecStatus {
+  this->stack_top = args - 1;
+  this->AdoptTopLevel();
+
+  request->fiber = this->fiber;
+  this->io.Submit(&request->op);
+  this->fiber->state = FiberState::Blocked;
+  return this->Schedule(frame);
+}
+
+auto VirtualMachine::ReapIo(bool block) -> void {
+  this->io_done.count = 0;
+  this->io.Reap(&this->io_done, block);
+  for (u64 i = 0; i < this->io_done.count; i++) {
+    this->CompleteIo(static_cast<IoRequest*>(this->io_done[i]->user));
+  }
+}
+
+auto VirtualMachine::CompleteIo(IoRequest* request) -> void {
+  IoOp& op = request->op;
+  // came back short, carry on from wherever it stopped
+  if (op.kind != IoKind::Timer && op.result > 0 && static_cast<u64>(op.result) < op.length) {
+    op.buffer += op.result;
+    op.offset += op.result;
+    op.length -= op.result;
+    this->io.Submit(&op);
+    return;
+  }
+
+  const u64 moved = op.result < 0 ? 0 : op.buffer + op.result - request->data;
+  Value result;
+  switch (request->native) {
+    case NativeId::ReadFile: {
+      if (op.result < 0) {
+        result = Value(false);
+        break;
+      }
+      result = Value(this->AllocString(moved, reinterpret_cast<const char*>(request->data)));
+      break;
+    }
+    case NativeId::WriteFile: {
+      result = op.result < 0 ? Value(false) : Value(static_cast<i64>(moved));
+      break;
+    }
+    case NativeId::Sleep: {
+      break;
+    }
+  }
+
+  this->Wake(request->fiber, result);
+  FreeRequest(request);
+}
+
+auto VirtualMachine::ReleaseIo() -> void {
+  if (this->io.InFlight() == 0) return;
+
+  this->io_done.count = 0;
+  this->io.Cancel(&this->io_done);
+  for (u64 i = 0; i < this->io_done.count; i++) {
+    FreeRequest(static_cast<IoRequest*>(this->io_done[i]->user));
+  }
+}
+
+auto VirtualMachine::ConfigureIo(IoBackend backend) -> void {
+  this->ReleaseIo();
+  this->io.Deinit();
+  this->io.Init(backend);
+}
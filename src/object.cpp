@@ -1,5 +1,6 @@
 #include "object.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <string>
 
@@ -29,6 +30,18 @@ auto Object::Print() const -> void {
       static_cast<const Object::Upvalue*>(this)->Print();
       return;
     }
+    case ObjectType::Generator: {
+      static_cast<const Object::Generator*>(this)->Print();
+      return;
+    }
+    case ObjectType::Fiber: {
+      static_cast<const Object::Fiber*>(this)->Print();
+      return;
+    }
+    case ObjectType::Native: {
+      static_cast<const Object::Native*>(this)->Print();
+      return;
+    }
   }
 }
 
@@ -116,7 +129,11 @@ Object::Closure::Closure() noexcept {
   this->as.closure = {};
 }
 
+// OpClosure turns the Function into a Closure right where it is, every time it
+// runs. Once it's a Closure it keeps the upvalue array it already has, there's
+// only ever the one per function
 auto Object::Closure::Init(const Object::Function* function) -> void {
+  const bool reuse = this->type == ObjectType::Closure;
   this->type = ObjectType::Closure;
   this->name_len = function->name_len;
   this->name = function->name;
@@ -126,7 +143,11 @@ auto Object::Closure::Init(const Object::Function* function) -> void {
 
   auto upvalues_count = function->as.function.upvalue_count;
   this->as.closure.upvalue_count = upvalues_count;
-  this->as.closure.upvalues = reinterpret_cast<Object::Upvalue**>(malloc(sizeof(Object::Upvalue*) * upvalues_count));
+  if (!reuse) {
+    // the collector can look at it before OpClosure has filled it in
+    this->as.closure.upvalues =
+        reinterpret_cast<Object::Upvalue**>(calloc(upvalues_count, sizeof(Object::Upvalue*)));
+  }
 }
 
 auto Object::Closure::Init(const Object* obj) -> void {
@@ -155,3 +176,80 @@ auto Object::Upvalue::Init(Value* value) -> void {
 }
 
 auto Object::Upvalue::Print() const -> void { printf("upvalue"); }
+
+Object::Generator::Generator() noexcept {
+  this->type = ObjectType::Generator;
+  this->name_len = 0;
+  this->name = nullptr;
+  this->as.generator = {};
+}
+
+auto Object::Generator::Init(Object* callee) -> void {
+  this->type = ObjectType::Generator;
+  this->name_len = callee->name_len;
+  this->name = callee->name;
+  this->as.generator = {};
+  this->as.generator.callee = callee;
+}
+
+auto Object::Generator::Deinit() -> void {
+  FREE_ARRAY(Value, this->as.generator.slots, this->as.generator.slot_capacity);
+  this->as.generator = {};
+}
+
+auto Object::Generator::Save(const Value* slots, u32 count, u8* inst_ptr) -> void {
+  auto& data = this->as.generator;
+  if (data.slot_capacity < count) {
+    const u32 capacity = std::max(count, static_cast<u32>(GROW_CAPACITY(data.slot_capacity)));
+    data.slots = GROW_ARRAY(Value, data.slots, data.slot_capacity, capacity);
+    data.slot_capacity = capacity;
+  }
+
+  std::memcpy(data.slots, slots, count * sizeof(Value));
+  data.slot_count = count;
+  data.inst_ptr = inst_ptr;
+}
+
+auto Object::Generator::Print() const -> void { printf("Generator: %s", this->name); }
+
+Object::Fiber::Fiber() noexcept {
+  this->type = ObjectType::Fiber;
+  this->name_len = 0;
+  this->name = nullptr;
+  this->as.fiber = {};
+}
+
+auto Object::Fiber::Init(::Fiber* fiber, u64 generation, const Object* callee) -> void {
+  this->type = ObjectType::Fiber;
+  this->name_len = callee->name_len;
+  this->name = callee->name;
+  this->as.fiber = {fiber, generation};
+}
+
+auto Object::Fiber::Print() const -> void { printf("Fiber: %s", this->name); }
+
+Object::Native::Native() noexcept {
+  this->type = ObjectType::Native;
+  this->name_len = 0;
+  this->name = nullptr;
+  this->as.native = {};
+}
+
+auto Object::Native::Init(NativeId id) -> void {
+  const static struct {
+    const char* name;
+    u32 arity;
+  } NATIVES[] = {
+#define X(ID, NAME, ARITY) {#NAME, ARITY},
+      VM_NATIVES
+#undef X
+  };
+
+  const auto& native = NATIVES[static_cast<u8>(id)];
+  this->type = ObjectType::Native;
+  this->name_len = strlen(native.name);
+  this->name = native.name;
+  this->as.native = {id, native.arity};
+}
+
+auto Object::Native::Print() const -> void { printf("Native: %s", this->name); }
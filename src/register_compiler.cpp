@@ -0,0 +1,599 @@
+#include "register_compiler.h"
+
+#include <cstring>
+
+#include "chunk.h"
+#include "common.h"
+#include "utils.h"
+
+auto RegisterCompiler::Compile(Chunk* chunk, u32 arity) -> bool {
+  this->chunk = chunk;
+  this->failed = false;
+  this->reachable = true;
+  this->depth = 0;
+  this->max_depth = 0;
+  this->last_dest = NO_LABEL;
+
+  chunk->registers.Deinit();
+  chunk->register_count = 0;
+
+  // slot 0 is the function being called, then its arguments
+  for (u32 i = 0; i <= arity; i++) {
+    this->Push({SlotKind::Register, i});
+  }
+
+  this->FindLabels();
+
+  u32 offset = 0;
+  while (offset < chunk->bytecode.count && !this->failed) {
+    if (this->labels[offset].is_label) {
+      this->Label(offset);
+    }
+
+    if (!this->reachable) {
+      offset += chunk->InstructionLength(offset);
+      continue;
+    }
+
+    offset = this->Lower(offset);
+  }
+
+  for (u64 i = 0; i < this->fixups.count && !this->failed; i++) {
+    const auto fixup = this->fixups[i];
+    const u32 target = this->labels[fixup.target].target;
+    if (target == NO_LABEL) {
+      this->failed = true;
+      break;
+    }
+
+    const u32 after_operand = fixup.operand + sizeof(u32);
+    const u32 jump = fixup.backwards ? after_operand - target : target - after_operand;
+    std::memcpy(chunk->registers.data + fixup.operand, &jump, sizeof(u32));
+  }
+
+  for (u64 i = 0; i < this->matches.count && !this->failed; i++) {
+    const u32 offset = this->matches[i];
+    auto& table = chunk->jump_tables[this->ReadInt(offset + 1)];
+    table.reg_targets.count = 0;
+    for (u64 arm = 0; arm < table.targets.count; arm++) {
+      const u32 target = this->labels[offset + 1 + sizeof(u32) + table.targets[arm]].target;
+      if (target == NO_LABEL) {
+        this->failed = true;
+        break;
+      }
+      table.reg_targets.Append(target);
+    }
+  }
+
+  this->labels.Deinit();
+  this->fixups.Deinit();
+  this->matches.Deinit();
+
+  if (this->failed) {
+    chunk->registers.Deinit();
+    return false;
+  }
+
+  chunk->register_count = this->max_depth;
+  return true;
+}
+
+auto RegisterCompiler::FindLabels() -> void {
+  const auto& code = this->chunk->bytecode;
+
+  this->labels.Init();
+  for (u64 i = 0; i <= code.count; i++) {
+    this->labels.Append({false, NO_LABEL, NO_LABEL});
+  }
+
+  this->fixups.Init();
+  this->matches.Init();
+
+  for (u32 offset = 0; offset < code.count; offset += this->chunk->InstructionLength(offset)) {
+    const auto op = static_cast<OpCode>(code[offset]);
+    const u32 after = offset + 1 + sizeof(u32);
+
+    if (op == OpCode::Jump || Chunk::IsConditionalJump(op)) {
+      const u32 target = after + this->ReadInt(offset + 1);
+      if (target <= code.count) this->labels[target].is_label = true;
+    } else if (op == OpCode::Loop) {
+      const u32 target = after - this->ReadInt(offset + 1);
+      if (target <= code.count) this->labels[target].is_label = true;
+    } else if (op == OpCode::MatchDense || op == OpCode::MatchHash) {
+      const auto& targets = this->chunk->jump_tables[this->ReadInt(offset + 1)].targets;
+      for (u64 i = 0; i < targets.count; i++) {
+        if (after + targets[i] <= code.count) this->labels[after + targets[i]].is_label = true;
+      }
+    }
+  }
+}
+
+auto RegisterCompiler::Label(u32 offset) -> void {
+  auto* label = &this->labels[offset];
+
+  if (this->reachable) {
+    this->Flush();
+  } else if (label->depth != NO_LABEL) {
+    // only reachable through a jump, so take the stack shape from there
+    this->depth = label->depth;
+    for (u32 i = 0; i < this->depth; i++) {
+      this->slots[i] = {SlotKind::Register, i};
+    }
+  }
+
+  this->reachable = true;
+  this->last_dest = NO_LABEL;
+  label->target = this->chunk->registers.count;
+}
+
+auto RegisterCompiler::Lower(u32 offset) -> u32 {
+  const auto& code = this->chunk->bytecode;
+  const auto op = static_cast<OpCode>(code[offset]);
+  const u32 next = offset + this->chunk->InstructionLength(offset);
+
+  switch (op) {
+    default: {
+      this->failed = true;
+      break;
+    }
+    case OpCode::Constant: {
+      this->Push({SlotKind::Constant, code[offset + 1]});
+      break;
+    }
+    case OpCode::ConstantLong: {
+      this->Push({SlotKind::Constant, this->ReadInt(offset + 1)});
+      break;
+    }
+    case OpCode::String: {
+      const u32 dest = this->depth;
+      this->Push({SlotKind::Register, dest});
+      this->Emit(RegOpCode::String);
+      this->Emit(static_cast<u8>(dest));
+      this->EmitInt(this->ReadInt(offset + 1));
+      break;
+    }
+    case OpCode::True:
+    case OpCode::False: {
+      const u32 dest = this->depth;
+      this->Push({SlotKind::Register, dest});
+      this->Emit(op == OpCode::True ? RegOpCode::True : RegOpCode::False);
+      this->Emit(static_cast<u8>(dest));
+      break;
+    }
+    case OpCode::Add: {
+      this->BinaryOp(RegOpCode::Add, RegOpCode::AddK);
+      break;
+    }
+    case OpCode::Subtract: {
+      this->BinaryOp(RegOpCode::Subtract, RegOpCode::SubtractK);
+      break;
+    }
+    case OpCode::Multiply: {
+      this->BinaryOp(RegOpCode::Multiply, RegOpCode::MultiplyK);
+      break;
+    }
+    case OpCode::Divide: {
+      this->BinaryOp(RegOpCode::Divide, RegOpCode::DivideK);
+      break;
+    }
+    case OpCode::Equality: {
+      this->BinaryOp(RegOpCode::Equality, RegOpCode::EqualityK);
+      break;
+    }
+    case OpCode::Greater: {
+      this->BinaryOp(RegOpCode::Greater, RegOpCode::GreaterK);
+      break;
+    }
+    case OpCode::Less: {
+      this->BinaryOp(RegOpCode::Less, RegOpCode::LessK);
+      break;
+    }
+    case OpCode::Negate: {
+      this->UnaryOp(RegOpCode::Negate);
+      break;
+    }
+    case OpCode::Not: {
+      this->UnaryOp(RegOpCode::Not);
+      break;
+    }
+    case OpCode::Pop: {
+      this->Pop();
+      break;
+    }
+    case OpCode::GetLocal: {
+      const u32 idx = this->ReadInt(offset + 1);
+      if (idx >= this->depth) {
+        this->failed = true;
+        break;
+      }
+
+      // a pending slot can just be forwarded, aliases always point at a
+      // register that really holds its value
+      const auto local = this->slots[idx];
+      this->Push(local.kind == SlotKind::Register ? Slot{SlotKind::Alias, idx} : local);
+      break;
+    }
+    case OpCode::SetLocal: {
+      const u32 idx = this->ReadInt(offset + 1);
+      const u32 top = this->depth - 1;
+      if (idx >= top) {
+        this->failed = true;
+        break;
+      }
+
+      auto* value = &this->slots[top];
+      bool aliased = false;
+      for (u32 i = 0; i < top; i++) {
+        if (this->slots[i].kind == SlotKind::Alias && this->slots[i].index == idx) aliased = true;
+      }
+
+      if (value->kind == SlotKind::Register && !aliased && this->last_dest != NO_LABEL &&
+          this->chunk->registers[this->last_dest] == top) {
+        // the value was just computed into a temporary, compute it straight
+        // into the local instead
+        this->chunk->registers[this->last_dest] = static_cast<u8>(idx);
+      } else {
+        this->MaterializeAliasesOf(idx);
+
+        if (value->kind == SlotKind::Constant) {
+          const u32 k = value->index;
+          this->Emit(k < 256 ? RegOpCode::LoadK : RegOpCode::LoadKLong);
+          this->Emit(static_cast<u8>(idx));
+          if (k < 256) {
+            this->Emit(static_cast<u8>(k));
+          } else {
+            this->EmitInt(k);
+          }
+        } else {
+          const u32 src = value->kind == SlotKind::Alias ? value->index : top;
+          if (src != idx) {
+            this->Emit(RegOpCode::Move);
+            this->Emit(static_cast<u8>(idx));
+            this->Emit(static_cast<u8>(src));
+          }
+        }
+      }
+
+      this->slots[idx] = {SlotKind::Register, idx};
+      *value = {SlotKind::Alias, idx};
+      this->last_dest = NO_LABEL;
+      break;
+    }
+    case OpCode::GetGlobal:
+    case OpCode::GetUpvalue: {
+      const u32 dest = this->depth;
+      this->Push({SlotKind::Register, dest});
+      this->Emit(op == OpCode::GetGlobal ? RegOpCode::GetGlobal : RegOpCode::GetUpvalue);
+      this->Emit(static_cast<u8>(dest));
+      this->EmitInt(this->ReadInt(offset + 1));
+      break;
+    }
+    case OpCode::SetGlobal: {
+      const u8 src = this->OperandRegister(this->depth - 1);
+      this->Emit(RegOpCode::SetGlobal);
+      this->Emit(src);
+      this->EmitInt(this->ReadInt(offset + 1));
+      break;
+    }
+    case OpCode::SetUpvalue: {
+      const u8 src = this->OperandRegister(this->depth - 1);
+      this->Emit(RegOpCode::SetUpvalue);
+      this->Emit(src);
+      this->EmitInt(this->ReadInt(offset + 1));
+      break;
+    }
+    case OpCode::Jump: {
+      this->JumpOp(RegOpCode::Jump, offset, false);
+      break;
+    }
+    case OpCode::JumpFalse: {
+      this->JumpOp(RegOpCode::JumpFalse, offset, true);
+      break;
+    }
+    case OpCode::JumpTrue: {
+      this->JumpOp(RegOpCode::JumpTrue, offset, true);
+      break;
+    }
+    case OpCode::Loop: {
+      this->JumpOp(RegOpCode::Loop, offset, false);
+      break;
+    }
+    case OpCode::MatchDense: {
+      this->MatchOp(RegOpCode::MatchDense, offset);
+      break;
+    }
+    case OpCode::MatchHash: {
+      this->MatchOp(RegOpCode::MatchHash, offset);
+      break;
+    }
+    case OpCode::ForRange: {
+      // the counter and the bound are the top two locals, the loop variable
+      // lands right above them
+      const u32 slot = this->ReadInt(offset + 1 + sizeof(u32));
+      const u32 target = offset + 1 + sizeof(u32) + this->ReadInt(offset + 1);
+      if (slot + 2 != this->depth || target > this->chunk->bytecode.count) {
+        this->failed = true;
+        break;
+      }
+
+      this->Flush();
+      this->Emit(RegOpCode::ForRange);
+      this->Emit(static_cast<u8>(slot));
+      this->fixups.Append({static_cast<u32>(this->chunk->registers.count), target, false});
+      this->EmitInt(0xFFFFFFFF);
+      this->labels[target].depth = this->depth;
+
+      this->Push({SlotKind::Register, slot + 2});
+      this->last_dest = NO_LABEL;
+      break;
+    }
+    // registers never box the condition in the first place, so these go back
+    // to a compare and a jump
+#define C(ID, COMPARE, WHEN)                                                             \
+  case OpCode::ID: {                                                                     \
+    this->BinaryOp(RegOpCode::COMPARE, RegOpCode::COMPARE##K);                           \
+    this->JumpOp(WHEN ? RegOpCode::JumpTrue : RegOpCode::JumpFalse, offset, true, true); \
+    break;                                                                               \
+  }
+      VM_COMPARE_JUMPS(C)
+#undef C
+    case OpCode::Invoke:
+    case OpCode::TailInvoke: {
+      const u32 argc = this->ReadInt(offset + 1);
+      if (argc + 1 > this->depth || argc >= 256) {
+        this->failed = true;
+        break;
+      }
+
+      this->Flush();
+      const u32 base = this->depth - argc - 1;
+      this->Emit(op == OpCode::Invoke ? RegOpCode::Invoke : RegOpCode::TailInvoke);
+      this->Emit(static_cast<u8>(base));
+      this->Emit(static_cast<u8>(argc));
+      this->EmitInt(this->ReadInt(offset + 1 + sizeof(u32)));
+
+      this->depth = base;
+      this->Push({SlotKind::Register, base});
+      break;
+    }
+    case OpCode::Return: {
+      const u8 src = this->OperandRegister(this->depth - 1);
+      this->Emit(RegOpCode::Return);
+      this->Emit(src);
+      this->reachable = false;
+      break;
+    }
+    case OpCode::ReturnVoid: {
+      // the top level script returns whatever is left on top of the stack
+      const u8 src = this->depth > 0 ? this->OperandRegister(this->depth - 1) : REG_NONE;
+      this->Emit(RegOpCode::ReturnVoid);
+      this->Emit(src);
+      this->reachable = false;
+      break;
+    }
+    case OpCode::Closure: {
+      // captures read the frame's registers directly
+      this->Flush();
+      this->Emit(RegOpCode::Closure);
+      for (u32 i = offset + 1; i < next; i++) {
+        this->Emit(code[i]);
+      }
+      break;
+    }
+    case OpCode::CloseUpvalue: {
+      this->Flush();
+      this->Emit(RegOpCode::CloseUpvalue);
+      this->Emit(static_cast<u8>(this->depth - 1));
+      this->Pop();
+      break;
+    }
+  }
+
+  return next;
+}
+
+auto RegisterCompiler::Push(Slot slot) -> void {
+  if (this->depth >= MAX_REGISTERS) {
+    this->failed = true;
+    return;
+  }
+
+  this->slots[this->depth++] = slot;
+  if (this->depth > this->max_depth) this->max_depth = this->depth;
+}
+
+auto RegisterCompiler::Pop() -> Slot {
+  if (this->depth == 0) {
+    this->failed = true;
+    return {SlotKind::Register, 0};
+  }
+
+  return this->slots[--this->depth];
+}
+
+auto RegisterCompiler::Materialize(u32 idx) -> void {
+  auto* slot = &this->slots[idx];
+
+  switch (slot->kind) {
+    case SlotKind::Register:
+      return;
+    case SlotKind::Alias: {
+      this->Emit(RegOpCode::Move);
+      this->Emit(static_cast<u8>(idx));
+      this->Emit(static_cast<u8>(slot->index));
+      break;
+    }
+    case SlotKind::Constant: {
+      if (slot->index < 256) {
+        this->Emit(RegOpCode::LoadK);
+        this->Emit(static_cast<u8>(idx));
+        this->Emit(static_cast<u8>(slot->index));
+      } else {
+        this->Emit(RegOpCode::LoadKLong);
+        this->Emit(static_cast<u8>(idx));
+        this->EmitInt(slot->index);
+      }
+      break;
+    }
+  }
+
+  *slot = {SlotKind::Register, idx};
+  this->last_dest = NO_LABEL;
+}
+
+auto RegisterCompiler::MaterializeAliasesOf(u32 reg) -> void {
+  for (u32 i = 0; i < this->depth; i++) {
+    if (this->slots[i].kind == SlotKind::Alias && this->slots[i].index == reg) {
+      this->Materialize(i);
+    }
+  }
+}
+
+auto RegisterCompiler::Flush() -> void {
+  for (u32 i = 0; i < this->depth; i++) {
+    this->Materialize(i);
+  }
+
+  this->last_dest = NO_LABEL;
+}
+
+auto RegisterCompiler::OperandRegister(u32 idx) -> u8 {
+  const auto slot = this->slots[idx];
+
+  switch (slot.kind) {
+    default:
+      return static_cast<u8>(idx);
+    case SlotKind::Alias:
+      return static_cast<u8>(slot.index);
+    case SlotKind::Constant: {
+      this->Materialize(idx);
+      return static_cast<u8>(idx);
+    }
+  }
+}
+
+auto RegisterCompiler::BinaryOp(RegOpCode op, RegOpCode op_constant) -> void {
+  if (this->depth < 2) {
+    this->failed = true;
+    return;
+  }
+
+  const u32 dest = this->depth - 2;
+  const auto right = this->slots[dest + 1];
+  const u8 left_reg = this->OperandRegister(dest);
+
+  if (right.kind == SlotKind::Constant && right.index < 256) {
+    this->Emit(op_constant);
+    this->last_dest = this->chunk->registers.count;
+    this->Emit(static_cast<u8>(dest));
+    this->Emit(left_reg);
+    this->Emit(static_cast<u8>(right.index));
+  } else {
+    const u8 right_reg = this->OperandRegister(dest + 1);
+    this->Emit(op);
+    this->last_dest = this->chunk->registers.count;
+    this->Emit(static_cast<u8>(dest));
+    this->Emit(left_reg);
+    this->Emit(right_reg);
+  }
+
+  this->depth = dest;
+  this->slots[this->depth++] = {SlotKind::Register, dest};
+}
+
+auto RegisterCompiler::UnaryOp(RegOpCode op) -> void {
+  if (this->depth < 1) {
+    this->failed = true;
+    return;
+  }
+
+  const u32 dest = this->depth - 1;
+  const u8 src = this->OperandRegister(dest);
+
+  this->Emit(op);
+  this->last_dest = this->chunk->registers.count;
+  this->Emit(static_cast<u8>(dest));
+  this->Emit(src);
+
+  this->slots[dest] = {SlotKind::Register, dest};
+}
+
+auto RegisterCompiler::JumpOp(RegOpCode op, u32 offset, bool has_condition, bool pop_condition) -> void {
+  // everything has to be in its slot wherever control flow meets up
+  this->Flush();
+
+  const u32 after = offset + 1 + sizeof(u32);
+  const bool backwards = op == RegOpCode::Loop;
+  const u32 jump = this->ReadInt(offset + 1);
+  const u32 target = backwards ? after - jump : after + jump;
+
+  if (target > this->chunk->bytecode.count) {
+    this->failed = true;
+    return;
+  }
+
+  this->Emit(op);
+  if (has_condition) {
+    this->Emit(static_cast<u8>(this->depth - 1));
+  }
+  if (pop_condition) {
+    this->Pop();
+  }
+
+  this->fixups.Append({static_cast<u32>(this->chunk->registers.count), target, backwards});
+  this->EmitInt(0xFFFFFFFF);
+
+  if (!backwards) {
+    this->labels[target].depth = this->depth;
+  }
+
+  if (!has_condition) {
+    this->reachable = false;
+  }
+}
+
+// like an unconditional jump with a target per arm, the value being matched is
+// gone in all of them
+auto RegisterCompiler::MatchOp(RegOpCode op, u32 offset) -> void {
+  if (this->depth < 1) {
+    this->failed = true;
+    return;
+  }
+
+  this->Flush();
+  const u32 after = offset + 1 + sizeof(u32);
+  const u32 index = this->ReadInt(offset + 1);
+  const auto& targets = this->chunk->jump_tables[index].targets;
+  for (u64 i = 0; i < targets.count; i++) {
+    if (after + targets[i] > this->chunk->bytecode.count) {
+      this->failed = true;
+      return;
+    }
+  }
+
+  this->Emit(op);
+  this->Emit(static_cast<u8>(this->depth - 1));
+  this->EmitInt(index);
+  this->Pop();
+
+  for (u64 i = 0; i < targets.count; i++) {
+    this->labels[after + targets[i]].depth = this->depth;
+  }
+  this->matches.Append(offset);
+  this->reachable = false;
+}
+
+auto RegisterCompiler::Emit(RegOpCode op) -> void {
+  this->chunk->registers.Append(static_cast<u8>(op));
+  this->last_dest = NO_LABEL;
+}
+
+auto RegisterCompiler::Emit(u8 byte) -> void { this->chunk->registers.Append(byte); }
+
+auto RegisterCompiler::EmitInt(u32 num) -> void { this->chunk->registers.Append(IntToBytes(&num), sizeof(u32)); }
+
+auto RegisterCompiler::ReadInt(u32 offset) const -> u32 {
+  u32 num;
+  std::memcpy(&num, this->chunk->bytecode.data + offset, sizeof(u32));
+  return num;
+}
@@ -0,0 +1,189 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "arena.h"
+#include "global_pool.h"
+#include "memory.h"
+#include "object.h"
+#include "string_pool.h"
+
+auto Scheduler::Init(u32 workers, TierConfig tiers) -> void {
+  if (workers == 0) {
+    workers = std::thread::hardware_concurrency();
+  }
+  this->worker_count = std::clamp(workers, 1u, static_cast<u32>(SCHEDULER_MAX_WORKERS));
+  this->tiers = tiers;
+
+  this->tasks.Init();
+  this->next_worker = 0;
+  this->queued = 0;
+  this->stopping = false;
+
+  this->workers = new Worker[this->worker_count];
+  for (u32 i = 0; i < this->worker_count; i++) {
+    this->workers[i].tasks.Init();
+    this->workers[i].head = 0;
+    this->workers[i].steals = 0;
+  }
+  // only once every deque is there to steal from
+  for (u32 i = 0; i < this->worker_count; i++) {
+    this->workers[i].thread = std::thread(&Scheduler::Work, this, i);
+  }
+}
+
+auto Scheduler::Deinit() -> void {
+  {
+    std::lock_guard guard(this->idle_lock);
+    this->stopping = true;
+  }
+  this->idle.notify_all();
+
+  for (u32 i = 0; i < this->worker_count; i++) {
+    this->workers[i].thread.join();
+  }
+  // the others look through every deque until they're all gone
+  for (u32 i = 0; i < this->worker_count; i++) {
+    this->workers[i].tasks.Deinit();
+  }
+  delete[] this->workers;
+  this->workers = nullptr;
+  this->worker_count = 0;
+
+  for (u64 i = 0; i < this->tasks.count; i++) {
+    FREE_ARRAY(char, this->tasks[i]->source, this->tasks[i]->length + 1);
+    FREE_ARRAY(Task, this->tasks[i], 1);
+  }
+  this->tasks.Deinit();
+}
+
+auto Scheduler::Spawn(const char* source) -> TaskId {
+  auto* task = ALLOCATE(Task, 1);
+  *task = {};
+  task->length = strlen(source);
+  task->source = ALLOCATE(char, task->length + 1);
+  std::memcpy(task->source, source, task->length + 1);
+
+  TaskId id;
+  Worker* worker;
+  {
+    std::lock_guard guard(this->tasks_lock);
+    id = this->tasks.Append(task);
+    worker = &this->workers[this->next_worker++ % this->worker_count];
+  }
+
+  {
+    // counted under the same lock a worker counts it off with, otherwise one
+    // could take it and get there first
+    std::lock_guard idle_guard(this->idle_lock);
+    std::lock_guard guard(worker->lock);
+    worker->tasks.Append(task);
+    this->queued++;
+  }
+  this->idle.notify_one();
+
+  return id;
+}
+
+auto Scheduler::Join(TaskId id) -> InterpretResult {
+  std::unique_lock lock(this->tasks_lock);
+  Task* task = this->tasks[id];
+  this->finished.wait(lock, [task] { return task->done; });
+  return task->result;
+}
+
+auto Scheduler::Steals() const -> u64 {
+  u64 steals = 0;
+  for (u32 i = 0; i < this->worker_count; i++) {
+    steals += this->workers[i].steals;
+  }
+  return steals;
+}
+
+auto Scheduler::Work(u32 idx) -> void {
+  while (true) {
+    Task* task = this->Take(idx);
+    if (task != nullptr) {
+      {
+        std::lock_guard guard(this->idle_lock);
+        this->queued--;
+      }
+      this->Run(&this->workers[idx], task);
+      continue;
+    }
+
+    std::unique_lock lock(this->idle_lock);
+    this->idle.wait(lock, [this] { return this->queued > 0 || this->stopping; });
+    if (this->queued == 0) {
+      return;
+    }
+  }
+}
+
+// the newest task of our own, it's the one most likely to still be in cache,
+// otherwise the oldest task of the next worker over that has any
+auto Scheduler::Take(u32 idx) -> Task* {
+  const auto pop = [](Worker* worker, bool steal) -> Task* {
+    std::lock_guard guard(worker->lock);
+    if (worker->head == worker->tasks.count) {
+      return nullptr;
+    }
+
+    Task* task = steal ? worker->tasks[worker->head++] : worker->tasks[--worker->tasks.count];
+    if (worker->head == worker->tasks.count) {
+      worker->tasks.count = 0;
+      worker->head = 0;
+    }
+    return task;
+  };
+
+  Worker* own = &this->workers[idx];
+  if (Task* task = pop(own, false)) {
+    return task;
+  }
+
+  for (u32 i = 1; i < this->worker_count; i++) {
+    if (Task* task = pop(&this->workers[(idx + i) % this->worker_count], true)) {
+      own->steals++;
+      return task;
+    }
+  }
+
+  return nullptr;
+}
+
+auto Scheduler::Run(Worker* worker, Task* task) -> void {
+  StringPool string_pool;
+  Arena<Object> object_pool;
+  GlobalPool global_pool;
+  string_pool.Init(&object_pool);
+  global_pool.Init(&object_pool);
+
+  InterpretResult result = InterpretError::CompileError;
+  worker->compiler.Init(task->source, &string_pool, &global_pool);
+  const CompileResult compiled = worker->compiler.Compile();
+  if (compiled.IsError()) {
+    object_pool.Clear();
+    string_pool.Deinit();
+  } else {
+    worker->vm.Init();
+    worker->vm.ConfigureTiers(this->tiers);
+    result = worker->vm.Interpret(compiled.Get(), &string_pool, &object_pool);
+    // takes both pools down with it
+    worker->vm.Deinit();
+  }
+  // the worker's compiler outlives every task it runs
+  worker->compiler.Clear();
+
+  if (!result.IsError() && result.Get().IsObject()) {
+    result = InterpretError::ObjectResult;
+  }
+
+  {
+    std::lock_guard guard(this->tasks_lock);
+    task->result = result;
+    task->done = true;
+  }
+  this->finished.notify_all();
+}
@@ -1,38 +1,102 @@
 #include "string_pool.h"
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 
 #include "common.h"
+#include "memory.h"
 #include "object.h"
 
 auto StringPool::Init(Arena<Object>* object_pool) -> void {
   this->object_pool = object_pool;
-  this->char_data->Init(INIT_STR_POOL_SIZE);
+  this->blocks.Init();
+  this->block_used = 0;
 }
 
 auto StringPool::Deinit() -> void {
   this->object_pool = nullptr;
-  this->char_data->Deinit();
+  for (u64 i = 0; i < this->blocks.count; i++) {
+    FREE_ARRAY(char, this->blocks[i].data, this->blocks[i].size);
+  }
+  this->blocks.Deinit();
+  this->block_used = 0;
+  // whatever's still in here got pinned or outlived the last collection
+  for (const auto& [chars, length] : this->loose) {
+    FREE_ARRAY(char, chars, length + 1);
+  }
+  this->loose.clear();
   this->intern_table.clear();
 }
 
-auto StringPool::Alloc(u64 length, const char* start) -> u64 {
+auto StringPool::Alloc(u64 length, const char* start) -> u64 { return this->Intern(length, start, false); }
+
+auto StringPool::AllocCollectable(u64 length, const char* start) -> u64 { return this->Intern(length, start, true); }
+
+auto StringPool::Intern(u64 length, const char* start, bool collectable) -> u64 {
   std::string_view str{start, length};
   auto it = this->intern_table.find(str);
   if (it != this->intern_table.end()) {
+    // whoever asked holds on to it by index from now on, so if the VM made it
+    // it's not the collector's anymore
+    this->object_pool->Nth(it->second)->collectable = false;
     return it->second;
   }
 
   auto obj_idx = this->object_pool->Alloc();
   auto* obj = static_cast<Object::String*>(this->object_pool->Nth(obj_idx));
 
-  u64 data_ptr = this->char_data->Append(const_cast<char*>(start), length);
-  this->char_data->Append(0);
-  obj->Init(length, this->char_data->data + data_ptr);
+  char* chars;
+  if (collectable) {
+    chars = ALLOCATE(char, length + 1);
+    std::memcpy(chars, start, length);
+    chars[length] = '\0';
+    this->loose.emplace(chars, length);
+  } else {
+    chars = this->Store(length, start);
+  }
+  obj->Init(length, chars);
 
-  this->intern_table.emplace(str, obj_idx);
+  this->intern_table.emplace(std::string_view{chars, length}, obj_idx);
 
   return obj_idx;
 }
 
+auto StringPool::Find(u64 length, const char* start) -> Option<u64> {
+  auto it = this->intern_table.find(std::string_view{start, length});
+  if (it != this->intern_table.end()) {
+    return it->second;
+  }
+
+  return OptionType::None;
+}
+
+auto StringPool::Free(Object* string) -> void {
+  const auto chars = static_cast<std::string_view>(*static_cast<Object::String*>(string));
+  this->intern_table.erase(chars);
+
+  auto it = this->loose.find(const_cast<char*>(chars.data()));
+  if (it != this->loose.end()) {
+    FREE_ARRAY(char, it->first, it->second + 1);
+    this->loose.erase(it);
+  }
+  this->object_pool->Free(string);
+}
+
+// null terminated, a string too big for a block gets one of its own
+auto StringPool::Store(u64 length, const char* start) -> char* {
+  const u64 size = length + 1;
+  if (this->blocks.count == 0 || this->block_used + size > this->blocks[this->blocks.count - 1].size) {
+    const u64 block_size = std::max(size, static_cast<u64>(INIT_STR_POOL_SIZE));
+    this->blocks.Append({ALLOCATE(char, block_size), block_size});
+    this->block_used = 0;
+  }
+
+  char* chars = this->blocks[this->blocks.count - 1].data + this->block_used;
+  std::memcpy(chars, start, length);
+  chars[length] = '\0';
+  this->block_used += size;
+  return chars;
+}
+
 auto StringPool::Nth(u64 index) -> Object* { return this->object_pool->Nth(index); }
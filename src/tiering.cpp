@@ -0,0 +1,248 @@
+#include "tiering.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "object.h"
+#include "utils.h"
+#include "vm.h"
+
+auto TierName(Tier tier) -> const char* {
+  const static char* TIER_NAMES[] = {
+#define X(ID) #ID,
+      VM_TIERS
+#undef X
+  };
+
+  return TIER_NAMES[static_cast<u8>(tier)];
+}
+
+auto TierManager::Init(VirtualMachine* vm) -> void {
+  this->functions.Init();
+  this->dependencies.Init();
+  this->watched.Init();
+  this->generation = TIER_GENERATIONS++;
+#if defined(ROC_JIT)
+  this->jit.Init(vm);
+#else
+  (void)vm;
+#endif
+}
+
+auto TierManager::Deinit() -> void {
+#if defined(ROC_JIT)
+  this->jit.Deinit();
+#endif
+  this->functions.Deinit();
+  this->dependencies.Deinit();
+  this->watched.Deinit();
+  this->generation = 0;
+}
+
+// the first time this TierManager sees a chunk, whatever is in there belongs to
+// an old one
+auto TierManager::Claim(StackFrame* frame) -> void {
+  Chunk* chunk = frame->chunk;
+  if (chunk->tier_generation == this->generation) [[likely]] {
+    return;
+  }
+
+  chunk->tier_generation = this->generation;
+  chunk->invocations = 0;
+  chunk->tier = Tier::Interpreted;
+  chunk->native = nullptr;
+  chunk->loop_traces.count = 0;
+  chunk->invalidations = 0;
+
+  // names live in the object pool, which can go away before the report
+  const Object* function = frame->type == FrameType::Closure ? static_cast<Object*>(frame->closure)
+                                                              : static_cast<Object*>(frame->function);
+  Function entry;
+  entry.chunk = chunk;
+  snprintf(entry.name, sizeof(entry.name), "%.*s", static_cast<int>(function->name_len), function->name);
+  this->functions.Append(entry);
+}
+
+auto TierManager::Call(StackFrame* frame) -> NativeCode {
+  Chunk* chunk = frame->chunk;
+  this->Claim(frame);
+  chunk->invocations++;
+
+  if (chunk->tier == Tier::Native) [[likely]] {
+    return reinterpret_cast<NativeCode>(chunk->native);
+  }
+
+#if defined(ROC_JIT)
+  if (chunk->tier == Tier::Interpreted && this->config.native && chunk->invocations > this->config.call_threshold) {
+    this->Compile(chunk);
+    return reinterpret_cast<NativeCode>(chunk->native);
+  }
+#endif
+
+  return nullptr;
+}
+
+// hardly any function has more than a couple of loops
+auto TierManager::FindLoop(Chunk* chunk, u32 header) -> LoopTrace* {
+  for (u64 i = 0; i < chunk->loop_traces.count; i++) {
+    if (chunk->loop_traces[i].header == header) {
+      return &chunk->loop_traces[i];
+    }
+  }
+
+  const u64 idx = chunk->loop_traces.Append({header, 0, 0, 0, nullptr, Tier::Interpreted, nullptr, 0});
+  return &chunk->loop_traces[idx];
+}
+
+auto TierManager::Loop(StackFrame* frame, u32 header) -> LoopTrace* {
+  Chunk* chunk = frame->chunk;
+  this->Claim(frame);
+
+  LoopTrace* trace = this->FindLoop(chunk, header);
+  if (trace->tier == Tier::Native) [[likely]] {
+    return trace;
+  }
+
+  trace->hits++;
+
+#if defined(ROC_JIT)
+  if (!this->config.native || trace->hits < this->config.loop_threshold) {
+    return nullptr;
+  }
+
+  if (trace->tier == Tier::Interpreted || trace->osr != nullptr) {
+    return trace;
+  }
+
+  // tracing gave up on it, so the whole function gets compiled and the frame
+  // carries on natively from the header
+  if (chunk->tier == Tier::Interpreted) {
+    this->Compile(chunk);
+    // compiling fills in every loop of the chunk, which can move this one
+    trace = this->FindLoop(chunk, header);
+    return trace->osr != nullptr ? trace : nullptr;
+  }
+#endif
+
+  return nullptr;
+}
+
+// Throws away the native code of everything that assumed global would never
+// change. Frames still running it notice at their next check and deopt, the
+// code itself stays mapped until Deinit.
+auto TierManager::Invalidate(u32 global) -> void {
+  for (u64 i = 0; i < this->dependencies.count;) {
+    const Dependency dependency = this->dependencies[i];
+    if (dependency.global != global) {
+      i++;
+      continue;
+    }
+
+    this->dependencies[i] = this->dependencies[--this->dependencies.count];
+
+    // recompiled since, or claimed by some other TierManager
+    Chunk* chunk = dependency.chunk;
+    if (chunk->tier_generation != this->generation || chunk->code_epoch != dependency.epoch) continue;
+
+    chunk->code_epoch++;
+    chunk->invalidations++;
+    chunk->invocations = 0;
+    chunk->tier = Tier::Interpreted;
+    chunk->native = nullptr;
+    for (u64 j = 0; j < chunk->loop_traces.count; j++) {
+      LoopTrace& trace = chunk->loop_traces[j];
+      trace.osr = nullptr;
+      if (trace.tier != Tier::Native) trace.hits = 0;
+    }
+  }
+
+  this->watched[global] = false;
+}
+
+#if defined(ROC_JIT)
+auto TierManager::Compile(Chunk* chunk) -> void {
+  DynamicArray<OsrEntry> osr_entries;
+  osr_entries.Init();
+  defer(osr_entries.Deinit());
+
+  DynamicArray<u32> globals;
+  globals.Init();
+  defer(globals.Deinit());
+
+  // something keeps changing the globals it reads, stop betting on them
+  const bool speculate = chunk->invalidations < this->config.invalidation_limit;
+
+  const NativeCode code = this->jit.Compile(chunk, &osr_entries, speculate ? &globals : nullptr);
+  chunk->native = reinterpret_cast<void*>(code);
+  chunk->tier = code != nullptr ? Tier::Native : Tier::Blacklisted;
+  if (code == nullptr) return;
+
+  for (u64 i = 0; i < osr_entries.count; i++) {
+    this->FindLoop(chunk, osr_entries[i].header)->osr = reinterpret_cast<void*>(osr_entries[i].code);
+  }
+
+  for (u64 i = 0; i < globals.count; i++) {
+    const u32 global = globals[i];
+    this->dependencies.Append({global, chunk, chunk->code_epoch});
+    while (this->watched.count <= global) this->watched.Append(false);
+    this->watched[global] = true;
+  }
+}
+
+auto TierManager::Promote(Chunk* chunk, LoopTrace* trace, const TraceRecording* recording) -> void {
+  const TraceCode code = this->jit.CompileTrace(chunk, recording);
+  trace->native = reinterpret_cast<void*>(code);
+  trace->tier = code != nullptr ? Tier::Native : Tier::Blacklisted;
+  trace->side_exits = 0;
+}
+
+auto TierManager::SideExit(LoopTrace* trace) -> void {
+  if (++trace->side_exits < this->config.side_exit_limit || trace->retraces >= this->config.retrace_limit) {
+    return;
+  }
+
+  // the old code stays mapped until Deinit, nothing is running it anymore
+  trace->retraces++;
+  trace->side_exits = 0;
+  trace->hits = 0;
+  trace->native = nullptr;
+  trace->tier = Tier::Interpreted;
+}
+#endif
+
+auto TierManager::Report(DynamicArray<FunctionTier>* report) const -> void {
+  for (u64 i = 0; i < this->functions.count; i++) {
+    const Function& function = this->functions[i];
+    const Chunk* chunk = function.chunk;
+    // claimed by some other TierManager since
+    if (chunk->tier_generation != this->generation) continue;
+
+    FunctionTier row = {};
+    std::copy(function.name, function.name + TIER_NAME_MAX, row.name);
+    row.tier = chunk->tier;
+    row.calls = chunk->invocations;
+    row.loops = static_cast<u32>(chunk->loop_traces.count);
+    row.invalidations = chunk->invalidations;
+    for (u64 j = 0; j < chunk->loop_traces.count; j++) {
+      if (chunk->loop_traces[j].tier == Tier::Native) row.traced_loops++;
+      row.osr_entries += chunk->loop_traces[j].osr_entries;
+    }
+
+    for (u64 offset = 0; offset < chunk->bytecode.count; offset += chunk->InstructionLength(offset)) {
+      switch (static_cast<OpCode>(chunk->bytecode[offset])) {
+        default:
+          break;
+#define X(ID) case OpCode::ID:
+          VM_QUICKENED_OPCODES
+#undef X
+          row.quickened++;
+          break;
+      }
+    }
+
+    report->Append(row);
+  }
+
+  std::stable_sort(report->data, report->data + report->count,
+                   [](const FunctionTier& a, const FunctionTier& b) { return a.calls > b.calls; });
+}
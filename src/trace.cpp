@@ -0,0 +1,856 @@
+#include "trace.h"
+
+#include "roc_config.h"
+
+#if defined(ROC_JIT)
+
+#include <cstddef>
+#include <cstring>
+
+#include "assembler.h"
+#include "common.h"
+#include "jit.h"
+#include "utils.h"
+#include "value.h"
+#include "vm.h"
+
+// Compiles one recording into a native loop. Registers are the same as in the
+// baseline JIT, and rsp points at a scratch area holding unboxed values:
+//   [rsp + h*8]                 - homes, the locals the trace touches
+//   [rsp + (TRACE_HOMES + p)*8] - stack slot p above the recorded depth
+// numbers are raw doubles, integers are sign extended and booleans are 0 or 1.
+// An integer that overflows exits back to the interpreter to be promoted
+// there, the trace only ever has one type per value. Locals declared inside
+// the loop body live on the stack, so they're stack slots here too.
+//
+// The stack is only kept symbolically while compiling. GetLocal just pushes a
+// reference to wherever the local lives and constants are folded, so code only
+// gets emitted for the arithmetic, comparisons and stores that are left. Every
+// guard records where each of those values is in a DeoptPoint, see deopt.h.
+class TraceCompiler {
+ public:
+  TraceCompiler(Chunk* chunk, const TraceRecording* recording, Value** stack_top, u64* budget, DeoptTable* table)
+      : chunk(chunk), recording(recording), stack_top(stack_top), budget(budget), table(table) {
+    this->stack.Init();
+    this->homes.Init();
+    this->exits.Init();
+    this->snapshots.Init();
+  }
+
+  ~TraceCompiler() {
+    this->stack.Deinit();
+    this->homes.Deinit();
+    this->exits.Deinit();
+    this->snapshots.Deinit();
+  }
+
+  auto Compile() -> bool;
+
+ public:
+  Assembler as;
+
+ private:
+  constexpr static u32 TRACE_HOMES = 32;
+  constexpr static u32 NO_HOME = 0xFFFFFFFF;
+  // for integer arithmetic that can't overflow, nowhere to resume
+  constexpr static u32 NO_OVERFLOW = 0xFFFFFFFF;
+
+  enum class Kind : u8 {
+    Home,
+    Temp,
+    Const,
+  };
+
+  struct Operand {
+    Kind kind;
+    ValueType type;
+    // home index for Kind::Home, stack slot for Kind::Temp, which can be
+    // below the operand's own position when it's a copy of a block local
+    u32 idx;
+    // unboxed value for Kind::Const
+    u64 bits;
+  };
+
+  struct Home {
+    u32 slot;
+    ValueType type;
+    bool written;
+  };
+
+  // a guard that failed, and what the interpreter needs to pick up from there
+  struct Exit {
+    u64 at;
+    u32 resume;
+    u64 snapshot;
+    u64 height;
+    // out of budget at the back edge, not the loop going some other way
+    bool safepoint;
+  };
+
+  auto Step(OpCode op, u8* operands, const TraceStep& step, u32* local) -> bool;
+  // resume is where to go back to if integers overflow
+  auto Arithmetic(OpCode op, u8 sse_op, u32 resume) -> bool;
+  auto IntegerArithmetic(OpCode op, u32 resume) -> bool;
+  auto Compare(OpCode op) -> bool;
+  auto Equality() -> bool;
+  auto Not() -> bool;
+  // when is which way the jump goes, pop is for the fused compare and
+  // branches that take their condition with them
+  auto Guard(const TraceStep& step, u8* operands, bool when, bool pop) -> bool;
+  auto ForRange(const TraceStep& step, u8* operands, u32* local) -> bool;
+  auto Exits() -> void;
+  auto Entry(DynamicArray<u64>* fails) -> void;
+
+  auto FindHome(u32 slot, ValueType type) -> u32;
+  auto Materialize(Kind kind, u32 idx) -> void;
+  auto Load(Reg reg, const Operand& operand) -> void;
+  auto LoadXmm(u8 xmm, const Operand& operand) -> void;
+  auto Restore() -> void;
+
+  auto Disp(const Operand& operand) const -> int {
+    return static_cast<int>((operand.kind == Kind::Home ? operand.idx : TRACE_HOMES + operand.idx) * sizeof(u64));
+  }
+
+  auto Pop() -> Operand { return this->stack[--this->stack.count]; }
+
+  // the next free stack slot, once the value has been stored there
+  auto PushTemp(ValueType type) -> void {
+    const u32 slot = static_cast<u32>(this->stack.count);
+    this->stack.Append({Kind::Temp, type, slot, 0});
+    if (this->stack.count > this->height) this->height = static_cast<u32>(this->stack.count);
+  }
+
+  auto TempDisp(u64 slot) const -> int { return static_cast<int>((TRACE_HOMES + slot) * sizeof(u64)); }
+  auto TempDisp() const -> int { return this->TempDisp(this->stack.count); }
+
+  auto static Number(f64 num) -> Operand {
+    Operand operand = {Kind::Const, ValueType::Number, 0, 0};
+    std::memcpy(&operand.bits, &num, sizeof(f64));
+    return operand;
+  }
+
+  auto static Boolean(bool boolean) -> Operand { return {Kind::Const, ValueType::Boolean, 0, boolean ? 1ULL : 0ULL}; }
+
+  auto static Integer(i64 integer) -> Operand {
+    return {Kind::Const, ValueType::Integer, 0, static_cast<u64>(integer)};
+  }
+
+  auto static AsNumber(const Operand& operand) -> f64 {
+    f64 num;
+    std::memcpy(&num, &operand.bits, sizeof(f64));
+    return num;
+  }
+
+ private:
+  Chunk* chunk;
+  const TraceRecording* recording;
+  Value** stack_top;
+  u64* budget;
+  DeoptTable* table;
+
+  DynamicArray<Operand> stack;
+  DynamicArray<Home> homes;
+  DynamicArray<Exit> exits;
+  // the symbolic stack at every exit, back to back
+  DynamicArray<Operand> snapshots;
+
+  u64 loop_top = 0;
+  // offset of the Loop instruction, anything resuming up to it is a side exit
+  u32 loop_end = 0;
+  u32 height = 0;
+  bool closed = false;
+};
+
+auto static ReadInt(const u8* operands) -> u32 {
+  u32 num;
+  std::memcpy(&num, operands, sizeof(u32));
+  return num;
+}
+
+auto IsTraceable(OpCode op) -> bool {
+  switch (op) {
+    case OpCode::Constant:
+    case OpCode::ConstantLong:
+    case OpCode::True:
+    case OpCode::False:
+    case OpCode::Pop:
+    case OpCode::GetLocal:
+    case OpCode::SetLocal:
+    case OpCode::Add:
+    case OpCode::AddNumNum:
+    case OpCode::AddIntInt:
+    case OpCode::Subtract:
+    case OpCode::SubtractNumNum:
+    case OpCode::SubtractIntInt:
+    case OpCode::Multiply:
+    case OpCode::MultiplyNumNum:
+    case OpCode::MultiplyIntInt:
+    case OpCode::Divide:
+    case OpCode::DivideNumNum:
+    case OpCode::Greater:
+    case OpCode::GreaterNumNum:
+    case OpCode::GreaterIntInt:
+    case OpCode::Less:
+    case OpCode::LessNumNum:
+    case OpCode::LessIntInt:
+    case OpCode::Equality:
+    case OpCode::Not:
+    case OpCode::Jump:
+    case OpCode::JumpFalse:
+    case OpCode::JumpTrue:
+    case OpCode::Loop:
+    case OpCode::ForRange:
+#define C(ID, COMPARE, WHEN) case OpCode::ID:
+      VM_COMPARE_JUMPS(C)
+#undef C
+      return true;
+#define X(ID, FIRST, SECOND) \
+  case OpCode::ID:           \
+    return IsTraceable(OpCode::FIRST) && IsTraceable(OpCode::SECOND);
+      VM_SUPERINSTRUCTIONS(X)
+#undef X
+    default:
+      return false;
+  }
+}
+
+auto TraceCompiler::Compile() -> bool {
+  this->as.Push(RBX);
+  this->as.Push(R12);
+  this->as.Push(R13);
+  this->as.Push(R14);
+  this->as.Push(R15);
+  this->as.Mov(R12, RDI);
+  this->as.Mov(R13, RSI);
+  this->as.Load(RBX, RSI, 0);
+  this->as.Load(R14, RBX, offsetof(StackFrame, locals));
+  this->as.Mov(R15, reinterpret_cast<u64>(this->stack_top));
+  // the scratch area's size is only known at the end
+  this->as.AddImm(RSP, 0);
+  const u64 frame_at = this->as.Here() - sizeof(u32);
+  // same for which locals get type checked, so the entry goes at the end too
+  const u64 entry = this->as.Jmp();
+
+  this->loop_top = this->as.Here();
+  for (u64 i = 0; i < this->recording->steps.count; i++) {
+    const TraceStep& step = this->recording->steps[i];
+    if (this->closed) [[unlikely]] {
+      return false;
+    }
+
+    u32 local = 0;
+    if (!this->Step(step.op, this->chunk->bytecode.data + step.offset + 1, step, &local)) {
+      return false;
+    }
+  }
+
+  if (!this->closed) [[unlikely]] {
+    return false;
+  }
+
+  // exits write the stack back without checking for room, see vm.h
+  if (this->height > VM_STACK_HEADROOM) [[unlikely]] {
+    return false;
+  }
+
+  // keeps rsp 16 byte aligned for the calls in the exits
+  const u32 frame = ((TRACE_HOMES + this->height) * sizeof(u64) + 15) & ~15U;
+  const u32 grow = static_cast<u32>(-static_cast<int>(frame));
+  std::memcpy(this->as.code.data + frame_at, &grow, sizeof(u32));
+
+  DynamicArray<u64> fails;
+  fails.Init();
+  defer(fails.Deinit());
+
+  this->Exits();
+  this->as.PatchHere(entry);
+  this->Entry(&fails);
+  this->as.Patch(this->as.Jmp(), this->loop_top);
+
+  // a trace that can't even be entered counts as a side exit, there's nothing
+  // to write back yet
+  for (u64 i = 0; i < fails.count; i++) this->as.PatchHere(fails[i]);
+  this->as.Mov(RAX, 1ULL);
+
+  for (u64 i = 0; i < this->exits.count; i++) this->as.PatchHere(this->exits[i].at);
+  this->as.AddImm(RSP, static_cast<int>(frame));
+  this->Restore();
+  this->as.Ret();
+
+  return true;
+}
+
+auto TraceCompiler::Restore() -> void {
+  this->as.Pop(R15);
+  this->as.Pop(R14);
+  this->as.Pop(R13);
+  this->as.Pop(R12);
+  this->as.Pop(RBX);
+}
+
+auto TraceCompiler::Step(OpCode op, u8* operands, const TraceStep& step, u32* local) -> bool {
+  switch (op) {
+    default: {
+      return false;
+    }
+    case OpCode::Constant:
+    case OpCode::ConstantLong: {
+      const Value val = this->chunk->locals[op == OpCode::Constant ? operands[0] : ReadInt(operands)];
+      if (val.IsNumber()) {
+        this->stack.Append(Number(val.AsNumber()));
+      } else if (val.IsInteger()) {
+        this->stack.Append(Integer(val.AsInteger()));
+      } else if (val.IsBoolean()) {
+        this->stack.Append(Boolean(val.AsBoolean()));
+      } else {
+        return false;
+      }
+      break;
+    }
+    case OpCode::True:
+    case OpCode::False: {
+      this->stack.Append(Boolean(op == OpCode::True));
+      break;
+    }
+    case OpCode::Pop: {
+      if (this->stack.count == 0) return false;
+      this->Pop();
+      break;
+    }
+    case OpCode::GetLocal: {
+      const u32 slot = ReadInt(operands);
+      const ValueType type = step.locals[(*local)++];
+      if (slot >= this->recording->depth) {
+        const u64 pos = slot - this->recording->depth;
+        if (pos >= this->stack.count) return false;
+        const Operand copy = this->stack[pos];
+        this->stack.Append(copy);
+        break;
+      }
+
+      const u32 home = this->FindHome(slot, type);
+      if (home == NO_HOME) return false;
+      this->stack.Append({Kind::Home, type, home, 0});
+      break;
+    }
+    case OpCode::SetLocal: {
+      if (this->stack.count == 0) return false;
+      const u32 slot = ReadInt(operands);
+      const Operand top = this->stack[this->stack.count - 1];
+
+      if (slot >= this->recording->depth) {
+        const u32 pos = slot - this->recording->depth;
+        if (pos >= this->stack.count) return false;
+        if (top.kind == Kind::Temp && top.idx == pos) break;
+
+        // anything still pointing at the old value needs its own copy first
+        this->Materialize(Kind::Temp, pos);
+        this->Load(RAX, top);
+        this->as.Store(RSP, this->TempDisp(pos), RAX);
+        this->stack[pos] = {Kind::Temp, top.type, pos, 0};
+        this->stack[this->stack.count - 1] = this->stack[pos];
+        break;
+      }
+
+      const u32 home = this->FindHome(slot, top.type);
+      if (home == NO_HOME) return false;
+      if (top.kind == Kind::Home && top.idx == home) break;
+
+      this->Materialize(Kind::Home, home);
+      this->Load(RAX, top);
+      this->as.Store(RSP, static_cast<int>(home * sizeof(u64)), RAX);
+      this->homes[home].written = true;
+      this->stack[this->stack.count - 1] = {Kind::Home, top.type, home, 0};
+      break;
+    }
+    // the only superinstruction with arithmetic in it starts with it, so
+    // resuming at the step redoes the whole thing
+    case OpCode::Add:
+    case OpCode::AddNumNum:
+    case OpCode::AddIntInt: {
+      return this->Arithmetic(OpCode::Add, 0x58, step.offset);
+    }
+    case OpCode::Subtract:
+    case OpCode::SubtractNumNum:
+    case OpCode::SubtractIntInt: {
+      return this->Arithmetic(OpCode::Subtract, 0x5C, step.offset);
+    }
+    case OpCode::Multiply:
+    case OpCode::MultiplyNumNum:
+    case OpCode::MultiplyIntInt: {
+      return this->Arithmetic(OpCode::Multiply, 0x59, step.offset);
+    }
+    case OpCode::Divide:
+    case OpCode::DivideNumNum: {
+      return this->Arithmetic(OpCode::Divide, 0x5E, step.offset);
+    }
+    case OpCode::Greater:
+    case OpCode::GreaterNumNum:
+    case OpCode::GreaterIntInt: {
+      return this->Compare(OpCode::Greater);
+    }
+    case OpCode::Less:
+    case OpCode::LessNumNum:
+    case OpCode::LessIntInt: {
+      return this->Compare(OpCode::Less);
+    }
+    case OpCode::Equality: {
+      return this->Equality();
+    }
+    case OpCode::Not: {
+      return this->Not();
+    }
+    case OpCode::Jump: {
+      // the recording already followed it
+      break;
+    }
+    case OpCode::JumpFalse:
+    case OpCode::JumpTrue: {
+      return this->Guard(step, operands, op == OpCode::JumpTrue, false);
+    }
+#define C(ID, COMPARE, WHEN)                                     \
+  case OpCode::ID: {                                             \
+    return this->Step(OpCode::COMPARE, operands, step, local) && \
+           this->Guard(step, operands, WHEN, true);              \
+  }
+      VM_COMPARE_JUMPS(C)
+#undef C
+    case OpCode::ForRange: {
+      return this->ForRange(step, operands, local);
+    }
+    case OpCode::Loop: {
+      const u32 target = step.offset + 1 + static_cast<u32>(sizeof(u32)) - ReadInt(operands);
+      if (target != this->recording->header || this->stack.count != 0) return false;
+      // a safepoint like any other back edge, the interpreter stops on the Loop
+      this->as.Mov(RAX, reinterpret_cast<u64>(this->budget));
+      this->as.Cmp64(RAX, 0, 0);
+      this->exits.Append({this->as.Je(), step.offset, this->snapshots.count, 0, true});
+      this->as.AddImm(RAX, 0, -1);
+      this->as.Patch(this->as.Jmp(), this->loop_top);
+      this->loop_end = step.offset;
+      this->closed = true;
+      break;
+    }
+
+#define X(ID, FIRST, SECOND)                                                                          \
+  case OpCode::ID: {                                                                                  \
+    return this->Step(OpCode::FIRST, operands, step, local) &&                                        \
+           this->Step(OpCode::SECOND, operands + Chunk::OperandLength(OpCode::FIRST), step, local); \
+  }
+      VM_SUPERINSTRUCTIONS(X)
+#undef X
+  }
+
+  return true;
+}
+
+auto TraceCompiler::Arithmetic(OpCode op, u8 sse_op, u32 resume) -> bool {
+  if (this->stack.count < 2) return false;
+  if (this->stack[this->stack.count - 1].type == ValueType::Integer &&
+      this->stack[this->stack.count - 2].type == ValueType::Integer) {
+    return this->IntegerArithmetic(op, resume);
+  }
+
+  const Operand b = this->Pop();
+  const Operand a = this->Pop();
+  // anything else would be a type error, let the interpreter report it
+  if (a.type != ValueType::Number || b.type != ValueType::Number) return false;
+
+  if (a.kind == Kind::Const && b.kind == Kind::Const) {
+    const f64 lhs = AsNumber(a);
+    const f64 rhs = AsNumber(b);
+    switch (op) {
+      default:
+      case OpCode::Add:
+        this->stack.Append(Number(lhs + rhs));
+        break;
+      case OpCode::Subtract:
+        this->stack.Append(Number(lhs - rhs));
+        break;
+      case OpCode::Multiply:
+        this->stack.Append(Number(lhs * rhs));
+        break;
+      case OpCode::Divide:
+        this->stack.Append(Number(lhs / rhs));
+        break;
+    }
+    return true;
+  }
+
+  this->LoadXmm(0, a);
+  if (b.kind == Kind::Const) {
+    this->LoadXmm(1, b);
+    this->as.Sse(0xF2, sse_op, 0, 1);
+  } else {
+    this->as.Sse(0xF2, sse_op, RSP, this->Disp(b));
+  }
+  this->as.Sse(0xF2, 0x11, RSP, this->TempDisp());
+  this->PushTemp(ValueType::Number);
+  return true;
+}
+
+auto TraceCompiler::IntegerArithmetic(OpCode op, u32 resume) -> bool {
+  // whether it divides evenly decides what type comes out, which a trace
+  // can't leave open
+  if (op == OpCode::Divide) return false;
+
+  const Operand b = this->Pop();
+  const Operand a = this->Pop();
+  if (a.kind == Kind::Const && b.kind == Kind::Const) {
+    const i64 lhs = static_cast<i64>(a.bits);
+    const i64 rhs = static_cast<i64>(b.bits);
+    i64 result;
+    bool overflow;
+    switch (op) {
+      default:
+      case OpCode::Add:
+        overflow = CheckedAdd(lhs, rhs, &result);
+        break;
+      case OpCode::Subtract:
+        overflow = CheckedSubtract(lhs, rhs, &result);
+        break;
+      case OpCode::Multiply:
+        overflow = CheckedMultiply(lhs, rhs, &result);
+        break;
+    }
+    // it'd be a double every time round
+    if (overflow || !Value::FitsInteger(result)) return false;
+    this->stack.Append(Integer(result));
+    return true;
+  }
+
+  // integers are narrower than a register, shifted up they overflow when they
+  // would, see VALUE_INTEGER_SHIFT
+  this->Load(RAX, a);
+  this->Load(RDX, b);
+  this->as.Shl(RAX, VALUE_INTEGER_SHIFT);
+  if (op != OpCode::Multiply) this->as.Shl(RDX, VALUE_INTEGER_SHIFT);
+  switch (op) {
+    default:
+    case OpCode::Add:
+      this->as.Add(RAX, RDX);
+      break;
+    case OpCode::Subtract:
+      this->as.Sub(RAX, RDX);
+      break;
+    case OpCode::Multiply:
+      this->as.Imul(RAX, RDX);
+      break;
+  }
+
+  if (resume != NO_OVERFLOW) {
+    // the interpreter gets both operands back and redoes it
+    this->stack.Append(a);
+    this->stack.Append(b);
+    if (this->stack.count > this->height) this->height = static_cast<u32>(this->stack.count);
+    this->exits.Append({this->as.Jo(), resume, this->snapshots.count, this->stack.count, false});
+    for (u64 i = 0; i < this->stack.count; i++) this->snapshots.Append(this->stack[i]);
+    this->stack.count -= 2;
+  }
+
+  this->as.Sar(RAX, VALUE_INTEGER_SHIFT);
+  this->as.Store(RSP, this->TempDisp(), RAX);
+  this->PushTemp(ValueType::Integer);
+  return true;
+}
+
+auto TraceCompiler::Compare(OpCode op) -> bool {
+  if (this->stack.count < 2) return false;
+  const Operand b = this->Pop();
+  const Operand a = this->Pop();
+
+  // same trick as the baseline JIT, a > b and b < a are both "above"
+  const Operand lhs = op == OpCode::Greater ? a : b;
+  const Operand rhs = op == OpCode::Greater ? b : a;
+  if (a.type == ValueType::Integer && b.type == ValueType::Integer) {
+    if (lhs.kind == Kind::Const && rhs.kind == Kind::Const) {
+      this->stack.Append(Boolean(static_cast<i64>(lhs.bits) > static_cast<i64>(rhs.bits)));
+      return true;
+    }
+
+    this->Load(RAX, lhs);
+    this->Load(RDX, rhs);
+    this->as.Cmp(RAX, RDX);
+    this->as.SetGreater();
+    this->as.Store(RSP, this->TempDisp(), RAX);
+    this->PushTemp(ValueType::Boolean);
+    return true;
+  }
+  if (a.type != ValueType::Number || b.type != ValueType::Number) return false;
+
+  if (lhs.kind == Kind::Const && rhs.kind == Kind::Const) {
+    this->stack.Append(Boolean(AsNumber(lhs) > AsNumber(rhs)));
+    return true;
+  }
+
+  this->LoadXmm(0, lhs);
+  if (rhs.kind == Kind::Const) {
+    this->LoadXmm(1, rhs);
+    this->as.Sse(0x66, 0x2E, 0, 1);
+  } else {
+    this->as.Sse(0x66, 0x2E, RSP, this->Disp(rhs));
+  }
+  this->as.SetAbove();
+  this->as.Store(RSP, this->TempDisp(), RAX);
+  this->PushTemp(ValueType::Boolean);
+  return true;
+}
+
+auto TraceCompiler::Equality() -> bool {
+  if (this->stack.count < 2) return false;
+  const Operand b = this->Pop();
+  const Operand a = this->Pop();
+
+  // values of different types are never equal, except for 1 == 1.0
+  if (a.type != b.type) {
+    const bool numbers = a.type != ValueType::Boolean && b.type != ValueType::Boolean;
+    if (numbers) return false;
+    this->stack.Append(Boolean(false));
+    return true;
+  }
+
+  if (a.kind == Kind::Const && b.kind == Kind::Const) {
+    this->stack.Append(Boolean(a.type == ValueType::Number ? AsNumber(a) == AsNumber(b) : a.bits == b.bits));
+    return true;
+  }
+
+  if (a.type == ValueType::Number) {
+    this->LoadXmm(0, a);
+    this->LoadXmm(1, b);
+    this->as.Sse(0x66, 0x2E, 0, 1);
+    this->as.SetEqual();
+  } else if (a.type == ValueType::Integer) {
+    this->Load(RAX, a);
+    this->Load(RDX, b);
+    this->as.Cmp(RAX, RDX);
+    this->as.SetEqualInteger();
+  } else {
+    // a ^ b ^ 1
+    this->Load(RAX, a);
+    this->Load(RDX, b);
+    this->as.Xor(RAX, RDX);
+    this->as.Mov(RDX, 1ULL);
+    this->as.Xor(RAX, RDX);
+  }
+  this->as.Store(RSP, this->TempDisp(), RAX);
+  this->PushTemp(ValueType::Boolean);
+  return true;
+}
+
+auto TraceCompiler::Not() -> bool {
+  if (this->stack.count == 0) return false;
+  const Operand a = this->Pop();
+  if (a.type != ValueType::Boolean) return false;
+
+  if (a.kind == Kind::Const) {
+    this->stack.Append(Boolean(a.bits == 0));
+    return true;
+  }
+
+  this->Load(RAX, a);
+  this->as.Mov(RDX, 1ULL);
+  this->as.Xor(RAX, RDX);
+  this->as.Store(RSP, this->TempDisp(), RAX);
+  this->PushTemp(ValueType::Boolean);
+  return true;
+}
+
+// the trace only has the direction the recording took, the other one leaves
+auto TraceCompiler::Guard(const TraceStep& step, u8* operands, bool when, bool pop) -> bool {
+  if (this->stack.count == 0) return false;
+  const Operand condition = this->stack[this->stack.count - 1];
+  // whichever way it exits, the interpreter picks up with it already gone
+  if (pop) this->Pop();
+
+  const u32 next = step.offset + this->chunk->InstructionLength(step.offset);
+  const u32 target = step.offset + 1 + static_cast<u32>(sizeof(u32)) + ReadInt(operands);
+  const bool truthy = step.taken ? when : !when;
+
+  if (condition.kind == Kind::Const) {
+    const bool known = condition.type == ValueType::Number ? AsNumber(condition) != 0.0 : condition.bits != 0;
+    return known == truthy;
+  }
+
+  // only booleans get a guard, a loop with a number as a condition doesn't
+  // get compiled
+  if (condition.type != ValueType::Boolean) return false;
+
+  this->as.Cmp64(RSP, this->Disp(condition), 0);
+  const u64 at = truthy ? this->as.Je() : this->as.Jne();
+  this->exits.Append({at, step.taken ? next : target, this->snapshots.count, this->stack.count, false});
+  for (u64 i = 0; i < this->stack.count; i++) this->snapshots.Append(this->stack[i]);
+  return true;
+}
+
+// the while loop it stands for, a JumpNotLess on the counter and the bound,
+// then the counter gets copied out as the loop variable and bumped. Both reads
+// of the counter after the guard see the type recorded for the first one
+auto TraceCompiler::ForRange(const TraceStep& step, u8* operands, u32* local) -> bool {
+  const u32 slot = ReadInt(operands + sizeof(u32));
+  const u32 bound_slot = slot + 1;
+  u8 counter[sizeof(u32)];
+  u8 bound[sizeof(u32)];
+  std::memcpy(counter, &slot, sizeof(u32));
+  std::memcpy(bound, &bound_slot, sizeof(u32));
+
+  if (!this->Step(OpCode::GetLocal, counter, step, local) || !this->Step(OpCode::GetLocal, bound, step, local) ||
+      !this->Compare(OpCode::Less) || !this->Guard(step, operands, false, true)) {
+    return false;
+  }
+
+  *local = 0;
+  if (!this->Step(OpCode::GetLocal, counter, step, local)) return false;
+  *local = 0;
+  if (!this->Step(OpCode::GetLocal, counter, step, local)) return false;
+  // an integer counter is below an integer bound, so it can't overflow
+  const bool integer = this->stack[this->stack.count - 1].type == ValueType::Integer;
+  this->stack.Append(integer ? Integer(1) : Number(1.0));
+  return this->Arithmetic(OpCode::Add, 0x58, NO_OVERFLOW) && this->Step(OpCode::SetLocal, counter, step, local) &&
+         this->Step(OpCode::Pop, nullptr, step, local);
+}
+
+// every exit boxes what changed back into the frame, rebuilds the stack the
+// interpreter expects and points it at the other side of the branch. Only the
+// homes written anywhere in the loop can differ from the frame, on any exit
+auto TraceCompiler::Exits() -> void {
+  const u32 depth = this->recording->depth;
+
+  for (u64 i = 0; i < this->exits.count; i++) {
+    Exit& exit = this->exits[i];
+    this->as.PatchHere(exit.at);
+
+    const bool side_exit =
+        !exit.safepoint && exit.resume >= this->recording->header && exit.resume <= this->loop_end;
+    const u32 point = this->table->Point(exit.resume, static_cast<u32>(depth + exit.height), side_exit ? 1 : 0);
+
+    for (u32 home = 0; home < this->homes.count; home++) {
+      if (!this->homes[home].written) continue;
+      this->table->Add(this->homes[home].slot, DeoptSource::Scratch, this->homes[home].type, home * sizeof(u64));
+    }
+
+    for (u64 slot = 0; slot < exit.height; slot++) {
+      const Operand& operand = this->snapshots[exit.snapshot + slot];
+      const bool folded = operand.kind == Kind::Const;
+      this->table->Add(static_cast<u32>(depth + slot), folded ? DeoptSource::Constant : DeoptSource::Scratch,
+                       operand.type, folded ? operand.bits : static_cast<u64>(this->Disp(operand)));
+    }
+
+    this->as.Mov(RDI, reinterpret_cast<u64>(this->table));
+    this->as.Mov(RSI, static_cast<u64>(point));
+    this->as.Mov(RDX, RBX);
+    this->as.Mov(RCX, RSP);
+    this->as.Mov(RAX, reinterpret_cast<u64>(&DeoptTable::Deoptimize));
+    this->as.CallRax();
+    // reused for the jump to the common exit
+    exit.at = this->as.Jmp();
+  }
+}
+
+// checks the stack is as deep as when recording and every home still has the
+// type it was recorded with, then unboxes them
+auto TraceCompiler::Entry(DynamicArray<u64>* fails) -> void {
+  auto fail = [&](u64 at) { fails->Append(at); };
+
+  this->as.Load(RAX, R15, 0);
+  this->as.Sub(RAX, R14);
+  this->as.Cmp(RAX, static_cast<int>(this->recording->depth * VALUE_SIZE));
+  fail(this->as.Jne());
+
+  for (u32 home = 0; home < this->homes.count; home++) {
+    const int disp = static_cast<int>(this->homes[home].slot * VALUE_SIZE);
+    const ValueType type = this->homes[home].type;
+
+#if defined(ROC_NAN_BOXING)
+    this->as.Load(RAX, R14, disp);
+    if (type == ValueType::Number) {
+      this->as.Mov(RCX, RAX);
+      this->as.Mov(RDX, VALUE_QNAN);
+      this->as.And(RCX, RDX);
+      this->as.Cmp(RCX, RDX);
+      fail(this->as.Je());
+    } else if (type == ValueType::Integer) {
+      constexpr u8 tag_shift = 64 - VALUE_INTEGER_SHIFT;
+      this->as.Mov(RCX, RAX);
+      this->as.Shr(RCX, tag_shift);
+      this->as.Cmp(RCX, static_cast<int>((VALUE_QNAN | VALUE_TAG_INTEGER) >> tag_shift));
+      fail(this->as.Jne());
+      this->as.Shl(RAX, VALUE_INTEGER_SHIFT);
+      this->as.Sar(RAX, VALUE_INTEGER_SHIFT);
+    } else {
+      // true and false only differ in the low bit
+      this->as.Mov(RDX, VALUE_QNAN | VALUE_TAG_FALSE);
+      this->as.Sub(RAX, RDX);
+      this->as.Mov(RCX, RAX);
+      this->as.Mov(RDX, ~1ULL);
+      this->as.And(RCX, RDX);
+      this->as.Cmp(RCX, 0);
+      fail(this->as.Jne());
+    }
+#else
+    this->as.Cmp32(R14, disp + VALUE_TYPE, static_cast<u8>(type));
+    fail(this->as.Jne());
+    this->as.Load(RAX, R14, disp + VALUE_NUMBER);
+    if (type == ValueType::Boolean) {
+      // only the low byte of the union is the bool
+      this->as.Mov(RDX, 0xFFULL);
+      this->as.And(RAX, RDX);
+    }
+#endif
+    this->as.Store(RSP, static_cast<int>(home * sizeof(u64)), RAX);
+  }
+}
+
+auto TraceCompiler::FindHome(u32 slot, ValueType type) -> u32 {
+  if (slot >= this->recording->depth) return NO_HOME;
+
+  for (u32 home = 0; home < this->homes.count; home++) {
+    if (this->homes[home].slot == slot) {
+      // a local that changes type inside the loop can't have a home
+      return this->homes[home].type == type ? home : NO_HOME;
+    }
+  }
+
+  if (this->homes.count == TRACE_HOMES) return NO_HOME;
+  return static_cast<u32>(this->homes.Append({slot, type, false}));
+}
+
+// gives every stack slot still referring to kind/idx its own copy of the value
+auto TraceCompiler::Materialize(Kind kind, u32 idx) -> void {
+  for (u64 i = 0; i < this->stack.count; i++) {
+    Operand& operand = this->stack[i];
+    if (operand.kind != kind || operand.idx != idx) continue;
+    if (kind == Kind::Temp && i == idx) continue;
+
+    this->Load(RAX, operand);
+    operand = {Kind::Temp, operand.type, static_cast<u32>(i), 0};
+    this->as.Store(RSP, this->Disp(operand), RAX);
+  }
+}
+
+auto TraceCompiler::Load(Reg reg, const Operand& operand) -> void {
+  if (operand.kind == Kind::Const) {
+    this->as.Mov(reg, operand.bits);
+  } else {
+    this->as.Load(reg, RSP, this->Disp(operand));
+  }
+}
+
+auto TraceCompiler::LoadXmm(u8 xmm, const Operand& operand) -> void {
+  if (operand.kind == Kind::Const) {
+    this->as.Mov(RAX, operand.bits);
+    this->as.Movq(xmm, RAX);
+  } else {
+    this->as.Sse(0xF2, 0x10, RSP, this->Disp(operand), xmm);
+  }
+}
+
+auto Jit::CompileTrace(Chunk* chunk, const TraceRecording* recording) -> TraceCode {
+  TraceCompiler compiler(chunk, recording, this->stack_top, this->budget, this->AllocTable(chunk));
+  if (!compiler.Compile()) {
+    return nullptr;
+  }
+
+  return reinterpret_cast<TraceCode>(this->Install(compiler.as.code));
+}
+
+#endif
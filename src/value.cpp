@@ -4,38 +4,42 @@
 #include "object.h"
 
 auto Value::Print() const -> const void {
-  switch (this->type) {
+  switch (this->Type()) {
     default: {
       printf("Unknown type");
       return;
     }
     case ValueType::Boolean: {
-      printf(this->as.boolean ? "true" : "false");
+      printf(this->AsBoolean() ? "true" : "false");
       return;
     }
     case ValueType::Number: {
-      printf("%f", this->as.number);
+      printf("%f", this->AsNumber());
+      return;
+    }
+    case ValueType::Integer: {
+      printf("%lld", static_cast<long long>(this->AsInteger()));
       return;
     }
     case ValueType::Object: {
       printf("Object: ");
-      this->as.object->Print();
+      this->AsObject()->Print();
       return;
     }
   }
 }
 
 auto Value::IsTruthy() const -> bool {
-  switch (this->type) {
+  switch (this->Type()) {
     default:
       return false;
     case ValueType::Boolean:
-      return this->as.boolean;
+      return this->AsBoolean();
     case ValueType::Number:
-      return this->as.number != 0.0;
+      return this->AsNumber() != 0.0;
+    case ValueType::Integer:
+      return this->AsInteger() != 0;
     case ValueType::Object:
-      return this->as.object->IsTruthy();
+      return this->AsObject()->IsTruthy();
   }
 }
-
-auto Value::IsObject() const -> bool { return this->type == ValueType::Object; }
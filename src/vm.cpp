@@ -1,7 +1,9 @@
 #include "vm.h"
 
+#include <algorithm>
 #include <cstdarg>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 
 #include "absl/container/flat_hash_set.h"
@@ -12,422 +14,2466 @@
 #include "value.h"
 
 auto VirtualMachine::Init() -> void {
+  this->InitStack();
+
+  this->fibers.Init();
+  this->ready.Init();
+  this->ready_head = 0;
+  this->fiber = nullptr;
+  this->io.Init();
+  this->io_done.Init();
+
+  this->globals.Init();
+  this->globals_pool = 0;
+  this->tiering.Init(this);
+  this->gc.Init();
+  this->gc_pool = 0;
+}
+
+auto VirtualMachine::Deinit() -> void {
+  this->ReleaseFibers();
+  this->fibers.Deinit();
+  this->ready.Deinit();
+  this->io.Deinit();
+  this->io_done.Deinit();
+
+  FREE_ARRAY(Value, this->stack, this->stack_capacity);
+  this->stack = nullptr;
+  this->stack_top = nullptr;
+  this->stack_limit = nullptr;
+  this->stack_ceiling = nullptr;
+  this->stack_capacity = 0;
+
+  for (u64 i = 0; i < this->frame_segments.count; i++) {
+    FREE_ARRAY(StackFrame, this->frame_segments[i], VM_FRAME_SEGMENT);
+  }
+  this->frame_segments.Deinit();
+  this->frame_count = 0;
+  this->frame_capacity = 0;
+
+  // what the collector tracks came from the pools it last adopted, and the
+  // interned strings have to go before the string pool does
+  const bool pools_current = this->object_pool != nullptr && this->gc_pool == this->object_pool->Generation();
+  this->gc.Deinit(pools_current ? this->object_pool : nullptr, this->string_pool);
+
+  if (this->string_pool != nullptr) {
+    this->string_pool->Deinit();
+  }
+
+  if (this->object_pool != nullptr) {
+    // the compiler's closures got their upvalue arrays from OpClosure
+    this->object_pool->ForEach([](Object *object) {
+      if (!object->collectable && object->type == ObjectType::Closure) static_cast<Object::Closure *>(object)->Deinit();
+    });
+    this->object_pool->Clear();
+  }
+
+  this->globals.Deinit();
+  this->tiering.Deinit();
+}
+
+auto VirtualMachine::InitStack() -> void {
+  this->stack_capacity = VM_STACK_INITIAL;
+  this->stack = ALLOCATE(Value, this->stack_capacity);
+  // the collector can scan register windows that haven't been written yet
+  std::memset(static_cast<void *>(this->stack), 0, this->stack_capacity * sizeof(Value));
+  this->stack_top = this->stack;
+  this->stack_limit = this->stack + std::min<u64>(VM_STACK_STEP, this->stack_capacity - VM_STACK_HEADROOM);
+  this->stack_ceiling = this->stack + this->stack_config.max_values;
+
+  // the first segment gets allocated by the first call
+  this->frame_segments.Init();
+  this->frame_count = 0;
+  this->frame_capacity = 0;
+  this->open_upvalues = nullptr;
+}
+
+auto VirtualMachine::Push(Value value) -> void {
+  if (this->stack_top >= this->stack_limit) [[unlikely]] {
+    this->GrowStack(1);
+  }
+
+  *this->stack_top = value;
+  this->stack_top++;
+}
+
+// Moves stack_limit up a step, or if there's no room for that the whole stack
+// somewhere bigger. Everything that points into it is either stack_top, a
+// frame's locals or an open upvalue, nothing else holds on to a Value* across
+// a push.
+auto VirtualMachine::GrowStack(u64 values) -> void {
+  const u64 used = this->stack_top - this->stack;
+  if (used + values + VM_STACK_HEADROOM <= this->stack_capacity) {
+    this->stack_limit = this->stack + std::min(used + values + VM_STACK_STEP, this->stack_capacity - VM_STACK_HEADROOM);
+    return;
+  }
+
+  u64 capacity = this->stack_capacity;
+  while (used + values + VM_STACK_HEADROOM > capacity) {
+    capacity *= 2;
+  }
+
+  Value *stack = ALLOCATE(Value, capacity);
+  std::memcpy(stack, this->stack, used * sizeof(Value));
+  std::memset(static_cast<void *>(stack + used), 0, (capacity - used) * sizeof(Value));
+  const auto move = [&](Value *ptr) { return stack + (ptr - this->stack); };
+
+  for (u32 i = 0; i < this->frame_count; i++) {
+    StackFrame *frame = this->Frame(i);
+    frame->locals = move(frame->locals);
+  }
+  for (auto *upvalue = this->open_upvalues; upvalue != nullptr; upvalue = upvalue->as.upvalue.next) {
+    upvalue->as.upvalue.location = move(upvalue->as.upvalue.location);
+  }
+  this->stack_top = move(this->stack_top);
+
+  FREE_ARRAY(Value, this->stack, this->stack_capacity);
+  this->stack = stack;
+  this->stack_capacity = capacity;
+  this->stack_limit = stack + std::min(used + values + VM_STACK_STEP, capacity - VM_STACK_HEADROOM);
+  this->stack_ceiling = stack + this->stack_config.max_values;
+}
+
+auto VirtualMachine::ClearStack(Value *from) -> void {
+  Value *written = std::min(this->stack_limit + VM_STACK_HEADROOM, this->stack + this->stack_capacity);
+  if (written > from) {
+    std::memset(static_cast<void *>(from), 0, (written - from) * sizeof(Value));
+  }
+  const u64 used = from - this->stack;
+  this->stack_limit = this->stack + std::min(used + VM_STACK_STEP, this->stack_capacity - VM_STACK_HEADROOM);
+}
+
+// only called once frame_capacity runs out or the stack is past its ceiling,
+// so the call path itself is a single compare of each
+auto VirtualMachine::ReserveFrame() -> bool {
+  if (this->stack_top >= this->stack_ceiling || this->frame_count >= this->stack_config.max_frames) {
+    return false;
+  }
+
+  if (this->frame_count == this->frame_capacity) {
+    if (this->frame_capacity == this->frame_segments.count * VM_FRAME_SEGMENT) {
+      this->frame_segments.Append(ALLOCATE(StackFrame, VM_FRAME_SEGMENT));
+    }
+    this->frame_capacity = std::min(static_cast<u32>(this->frame_segments.count * VM_FRAME_SEGMENT),
+                                    this->stack_config.max_frames);
+  }
+
+  return true;
+}
+
+auto VirtualMachine::SwitchTo(Fiber *next) -> void {
+  Fiber *parked = this->fiber;
+  parked->frame_segments = this->frame_segments;
+  parked->frame_count = this->frame_count;
+  parked->frame_capacity = this->frame_capacity;
+  parked->stack = this->stack;
+  parked->stack_top = this->stack_top;
+  parked->stack_limit = this->stack_limit;
+  parked->stack_ceiling = this->stack_ceiling;
+  parked->stack_capacity = this->stack_capacity;
+  parked->open_upvalues = this->open_upvalues;
+
+  this->frame_segments = next->frame_segments;
+  this->frame_count = next->frame_count;
+  this->frame_capacity = next->frame_capacity;
+  this->stack = next->stack;
+  this->stack_top = next->stack_top;
+  this->stack_limit = next->stack_limit;
+  this->stack_ceiling = next->stack_ceiling;
+  this->stack_capacity = next->stack_capacity;
+  this->open_upvalues = next->open_upvalues;
+  this->fiber = next;
+}
+
+auto VirtualMachine::AdoptTopLevel() -> void {
+  if (this->fibers.count > 0) return;
+
+  this->fiber = ALLOCATE(Fiber, 1);
+  *this->fiber = {};
+  this->fiber->state = FiberState::Running;
+  this->fibers.Append(this->fiber);
+}
+
+auto VirtualMachine::Schedule(StackFrame *&frame) -> ExecStatus {
+  // whatever I/O finished gets back in line first, and with nobody else to
+  // run this is where the VM sleeps
+  if (this->io.InFlight() > 0) {
+    this->ReapIo(this->ready_head == this->ready.count);
+    while (this->ready_head == this->ready.count && this->io.InFlight() > 0) {
+      this->ReapIo(true);
+    }
+  }
+
+  if (this->ready_head == this->ready.count) {
+    this->RuntimeError("Deadlock, every fiber is waiting on another one");
+    return ExecStatus::Error;
+  }
+
+  Fiber *next = this->ready[this->ready_head++];
+  // keeps the queue from creeping along forever
+  if (this->ready_head == this->ready.count) {
+    this->ready.count = 0;
+    this->ready_head = 0;
+  } else if (this->ready_head * 2 > this->ready.count) {
+    this->ready.count -= this->ready_head;
+    std::memmove(this->ready.data, this->ready.data + this->ready_head, this->ready.count * sizeof(Fiber *));
+    this->ready_head = 0;
+  }
+
+  this->SwitchTo(next);
+  next->state = FiberState::Running;
+  frame = this->Frame(this->frame_count - 1);
+  return ExecStatus::Continue;
+}
+
+// nothing of a finished fiber is needed anymore but its result
+auto static FreeStack(Fiber *fiber) -> void {
+  FREE_ARRAY(Value, fiber->stack, fiber->stack_capacity);
+  fiber->stack = nullptr;
+  fiber->stack_capacity = 0;
+
+  for (u64 i = 0; i < fiber->frame_segments.count; i++) {
+    FREE_ARRAY(StackFrame, fiber->frame_segments[i], VM_FRAME_SEGMENT);
+  }
+  fiber->frame_segments.Deinit();
+}
+
+auto VirtualMachine::FinishFiber(StackFrame *&frame, Value result) -> ExecStatus {
+  // the top level finishing finishes the script, whatever else is left
+  if (this->fibers.count == 0 || this->fiber == this->fibers[0]) {
+    return ExecStatus::Done;
+  }
+
+  Fiber *done = this->fiber;
+  done->state = FiberState::Done;
+  done->result = result;
+  for (Fiber *waiter = done->waiters; waiter != nullptr; waiter = waiter->next_waiter) {
+    this->Wake(waiter, result);
+  }
+  done->waiters = nullptr;
+
+  const auto status = this->Schedule(frame);
+  if (status == ExecStatus::Continue) {
+    FreeStack(done);
+  }
+  return status;
+}
+
+// Join already popped the handle and a native its arguments, so there's room.
+// A native's I/O can finish before Schedule has moved the fiber that's waiting
+// on it out
+auto VirtualMachine::Wake(Fiber *waiter, Value result) -> void {
+  if (waiter == this->fiber) {
+    this->Push(result);
+  } else {
+    *waiter->stack_top++ = result;
+  }
+  waiter->state = FiberState::Ready;
+  this->ready.Append(waiter);
+}
+
+auto VirtualMachine::ReleaseFibers() -> void {
+  this->ReleaseIo();
+  if (this->fibers.count == 0) return;
+
+  // a runtime error can leave any of them running
+  Fiber *top_level = this->fibers[0];
+  if (this->fiber != top_level) {
+    this->SwitchTo(top_level);
+  }
+
+  for (u64 i = 1; i < this->fibers.count; i++) {
+    FreeStack(this->fibers[i]);
+    FREE_ARRAY(Fiber, this->fibers[i], 1);
+  }
+  FREE_ARRAY(Fiber, top_level, 1);
+
+  this->fibers.count = 0;
+  this->ready.count = 0;
+  this->ready_head = 0;
+  this->fiber = nullptr;
+  this->fiber_generation++;
+}
+
+auto VirtualMachine::ConfigureBudget(BudgetConfig config) -> void { this->budget_config = config; }
+
+auto VirtualMachine::Refuel() -> void {
+  this->budget_left = this->budget_config.safepoints == 0 ? UINT64_MAX : this->budget_config.safepoints;
+}
+
+auto VirtualMachine::OutOfBudget() -> InterpretError {
+  if (this->budget_config.action == BudgetAction::Yield) {
+    this->suspended = true;
+    return InterpretError::Suspended;
+  }
+
+  this->ReleaseFibers();
+  this->stack_top = this->stack;
+  this->frame_count = 0;
+  this->open_upvalues = nullptr;
+  return InterpretError::BudgetExhausted;
+}
+
+auto VirtualMachine::DropSuspended() -> void {
+  if (!this->suspended) return;
+
+  this->suspended = false;
+  this->suspended_registers = false;
+  this->ReleaseFibers();
+  this->stack_top = this->stack;
+  this->frame_count = 0;
+  this->open_upvalues = nullptr;
+}
+
+auto VirtualMachine::Resume() -> InterpretResult {
+  if (!this->suspended) {
+    return this->RuntimeError("Nothing to resume");
+  }
+
+  this->suspended = false;
+  this->Refuel();
+  StackFrame *frame = this->Frame(this->frame_count - 1);
+  this->running_registers = this->suspended_registers;
+  if (this->suspended_registers) {
+    const auto result = this->RunRegisters(frame);
+    this->suspended_registers = this->suspended;
+    return result;
+  }
+
+  const auto result = this->Run(frame);
+  if (!this->suspended) this->ReleaseFibers();
+  return result;
+}
+
+auto VirtualMachine::ConfigureStack(StackConfig config) -> void {
+  this->stack_config = config;
+  this->stack_ceiling = this->stack + config.max_values;
+  // segments that are already there stay, the ceiling is what changes
+  this->frame_capacity = std::min(this->frame_capacity, config.max_frames);
+}
+
+auto VirtualMachine::Pop() -> Value {
+  this->stack_top--;
+  return *this->stack_top;
+}
+
+auto VirtualMachine::Peek() const -> Value { return this->stack_top[-1]; }
+
+auto VirtualMachine::Peek(int dist) const -> Value { return this->stack_top[-1 - dist]; }
+
+auto VirtualMachine::RuntimeError(const char *msg, ...) -> InterpretError {
+  va_list args;
+  va_start(args, msg);
+  vfprintf(stderr, msg, args);
+  va_end(args);
+  fputs("\n", stderr);
+
+  const int innermost = std::max(static_cast<int>(this->frame_count) - VM_BACKTRACE_MAX, 0);
+  for (int i = this->frame_count - 1; i >= innermost; i--) {
+    StackFrame *frame = this->Frame(i);
+    const auto *chunk = frame->chunk;
+    const auto *name = frame->type == FrameType::Closure ? frame->closure->name : frame->function->name;
+
+    // frames running register code point somewhere else, and there's no line
+    // info for that
+    const u8 *base = chunk->BaseInstructionPointer();
+    if (frame->inst_ptr > base && frame->inst_ptr <= base + chunk->Count()) {
+      const u64 inst = frame->inst_ptr - base - 1;
+      auto line_range = chunk->lines[chunk->lines.Search(inst)];
+      fprintf(stderr, "[line %lu] in ", line_range.val);
+    } else {
+      fprintf(stderr, "[register code] in ");
+    }
+    fprintf(stderr, "%s\n", name);
+  }
+  if (innermost > 0) {
+    fprintf(stderr, "... %d more\n", innermost);
+  }
+
   // reset stack pointer
   this->stack_top = this->stack;
+
+  return InterpretError::RuntimeError;
+}
+
+auto VirtualMachine::Invoke(Object *callee, u32 argc) -> StackFrame * {
+  // a Closure's data starts with a Function's, so either one works as one
+  const u32 arity = callee->as.function.arity;
+  if (argc != arity) {
+    this->RuntimeError("Expected %d arguments to function but got %d", arity, argc);
+    return nullptr;
+  }
+
+  return this->PushFrame(callee, argc);
+}
+
+force_inline auto VirtualMachine::PushFrame(Object *callee, u32 argc) -> StackFrame * {
+  if ((this->frame_count == this->frame_capacity || this->stack_top >= this->stack_ceiling) &&
+      !this->ReserveFrame()) [[unlikely]] {
+    this->RuntimeError("Stack overflow");
+    return nullptr;
+  }
+
+  StackFrame *ret = this->Frame(this->frame_count++);
+  // looked at every time, Closure turns Functions into Closures in place
+  ret->type = callee->type == ObjectType::Closure ? FrameType::Closure : FrameType::Function;
+  ret->function = static_cast<Object::Function *>(callee);
+  ret->chunk = callee->as.function.chunk;
+  ret->inst_ptr = ret->chunk->BaseInstructionPointer();
+  // the -1 is so that slot 0 of locals is a reference to Object::Function being
+  // called
+  ret->locals = this->stack_top - argc - 1;
+
+  return ret;
+}
+
+auto VirtualMachine::AdoptPools(StringPool *string_pool, Arena<Object> *object_pool) -> void {
+  this->string_pool = string_pool;
+  this->object_pool = object_pool;
+  this->call_generation = object_pool->Generation();
+
+  if (this->gc_pool != object_pool->Generation()) {
+    // whatever the collector had came from a pool that's been cleared, and
+    // anything left on the stack from then points into it
+    this->gc.Reset();
+    this->gc_pool = object_pool->Generation();
+    this->ClearStack(this->stack_top);
+  }
+}
+
+// @TODO(eddie) - big sweep through all the opcodes
+// basically everything is actually a 64bit int, but im truncating it down to
+// 32s
+auto VirtualMachine::Interpret(Object *obj, StringPool *string_pool, Arena<Object> *object_pool) -> InterpretResult {
+  Assert(obj != nullptr);
+  auto *function = static_cast<Object::Function *>(obj);
+  this->DropSuspended();
+  this->Refuel();
+
+  // setup initial call stack, slot 0 of the top level is the function same as
+  // for every other call, so its locals never point outside the stack
+  this->Push(Value(obj));
+  auto *frame = this->Invoke(function, 0);
+  if (frame == nullptr) {
+    return InterpretError::RuntimeError;
+  }
+
+  this->AdoptPools(string_pool, object_pool);
+  this->running_registers = false;
+
+#ifdef DEBUG_PRINT_CODE
+  frame->chunk->Disassemble();
+#endif
+
+  const auto result = this->Run(frame);
+  if (!this->suspended) this->ReleaseFibers();
+  return result;
+}
+
+auto VirtualMachine::InterpretRegisters(Object *obj, StringPool *string_pool, Arena<Object> *object_pool)
+    -> InterpretResult {
+  Assert(obj != nullptr);
+  auto *function = static_cast<Object::Function *>(obj);
+  this->DropSuspended();
+  this->Refuel();
+
+  this->AdoptPools(string_pool, object_pool);
+  this->running_registers = true;
+
+  // the callee always lives in register 0, the top level included
+  this->Push(Value(obj));
+  auto *frame = this->Invoke(function, 0);
+  if (frame == nullptr) {
+    return InterpretError::RuntimeError;
+  }
+
+  if (frame->chunk->registers.count == 0) {
+    return this->RuntimeError("No register code for %s", function->name);
+  }
+  if (frame->locals + frame->chunk->register_count > this->stack_limit) {
+    this->GrowStack(frame->locals + frame->chunk->register_count - this->stack_top);
+  }
+  frame->inst_ptr = frame->chunk->registers.data;
+
+#ifdef DEBUG_PRINT_CODE
+  frame->chunk->DisassembleRegisters();
+#endif
+
+  const auto result = this->RunRegisters(frame);
+  this->suspended_registers = this->suspended;
+  return result;
+}
+
+auto VirtualMachine::Finish(ExecStatus status) -> InterpretResult {
+  if (status == ExecStatus::Error) {
+    return InterpretError::RuntimeError;
+  }
+  if (status == ExecStatus::Suspend) {
+    return this->OutOfBudget();
+  }
+
+  return this->Pop();
+}
+
+#if defined(ROC_PROFILE_OPCODES)
+auto VirtualMachine::RecordOpcode(OpCode op) -> void {
+  const u8 curr = static_cast<u8>(op);
+  this->opcode_pairs[this->prev_opcode][curr]++;
+  this->prev_opcode = curr;
+}
+
+auto VirtualMachine::PrintOpcodeProfile(u32 top) const -> void {
+  const static char *OPCODE_NAMES[OPCODE_COUNT] = {
+#define X(ID) #ID,
+      VM_OPCODES
+#undef X
+  };
+
+  struct Pair {
+    u64 count;
+    u8 first;
+    u8 second;
+  };
+
+  DynamicArray<Pair> pairs;
+  pairs.Init();
+  defer(pairs.Deinit());
+
+  u64 total = 0;
+  for (u32 i = 0; i < OPCODE_COUNT; i++) {
+    for (u32 j = 0; j < OPCODE_COUNT; j++) {
+      if (this->opcode_pairs[i][j] == 0) continue;
+      pairs.Append({this->opcode_pairs[i][j], static_cast<u8>(i), static_cast<u8>(j)});
+      total += this->opcode_pairs[i][j];
+    }
+  }
+
+  std::sort(pairs.data, pairs.data + pairs.count, [](const Pair &a, const Pair &b) { return a.count > b.count; });
+
+  printf("%-16s %-16s %12s %7s\n", "first", "second", "count", "share");
+  for (u64 i = 0; i < pairs.count && i < top; i++) {
+    const auto &pair = pairs[i];
+    printf("%-16s %-16s %12lu %6.2f%%\n", OPCODE_NAMES[pair.first], OPCODE_NAMES[pair.second], pair.count,
+           100.0 * pair.count / total);
+  }
+}
+
+#define PROFILE_OPCODE(vm, op) (vm)->RecordOpcode(op)
+#else
+#define PROFILE_OPCODE(vm, op)
+#endif
+
+#define READ_BYTE() (*frame->inst_ptr++)
+#define READ_INT()           \
+  *(u32 *)(frame->inst_ptr); \
+  (frame->inst_ptr += sizeof(u32))
+#define READ_CONSTANT() (frame->chunk->locals[READ_BYTE()])
+
+force_inline auto VirtualMachine::OpReturnVoid(StackFrame *&frame) -> ExecStatus {
+  this->CloseUpvalues(frame->locals);
+  this->frame_count--;
+  if (this->frame_count == 0) {
+    return this->FinishFiber(frame, Value());
+  }
+
+  // the caller still expects a result, even if it's nothing
+  this->stack_top = frame->locals;
+  this->Push(Value());
+  frame = this->Frame(this->frame_count - 1);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpReturn(StackFrame *&frame) -> ExecStatus {
+  Value ret_val = this->Pop();
+  this->CloseUpvalues(frame->locals);
+  this->frame_count--;
+
+  this->stack_top = frame->locals;
+  this->Push(ret_val);
+  if (this->frame_count == 0) [[unlikely]] {
+    return this->FinishFiber(frame, ret_val);
+  }
+  frame = this->Frame(this->frame_count - 1);
+
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpConstant(StackFrame *&frame) -> ExecStatus {
+  Value constant = READ_CONSTANT();
+  this->Push(constant);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpConstantLong(StackFrame *&frame) -> ExecStatus {
+  u32 idx = READ_INT();
+
+  Value constant = frame->chunk->locals[idx];
+  this->Push(constant);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpString(StackFrame *&frame) -> ExecStatus {
+  u32 idx = READ_INT();
+
+  auto *str = this->string_pool->Nth(idx);
+  auto constant = Value(str);
+  this->Push(constant);
+  return ExecStatus::Continue;
+}
+
+// The integer forms of the arithmetic every tier shares. They only write
+// result when it fits in an integer Value, otherwise it's the caller's job to
+// redo it with doubles, see NumericBinary.
+force_inline auto static IntegerAdd(i64 lhs, i64 rhs, Value *result) -> bool {
+  i64 sum;
+  if (CheckedAdd(lhs, rhs, &sum) || !Value::FitsInteger(sum)) [[unlikely]] return false;
+  *result = Value(sum);
+  return true;
+}
+
+force_inline auto static IntegerSubtract(i64 lhs, i64 rhs, Value *result) -> bool {
+  i64 difference;
+  if (CheckedSubtract(lhs, rhs, &difference) || !Value::FitsInteger(difference)) [[unlikely]] return false;
+  *result = Value(difference);
+  return true;
+}
+
+force_inline auto static IntegerMultiply(i64 lhs, i64 rhs, Value *result) -> bool {
+  i64 product;
+  if (CheckedMultiply(lhs, rhs, &product) || !Value::FitsInteger(product)) [[unlikely]] return false;
+  *result = Value(product);
+  return true;
+}
+
+// only when it divides evenly, 7 / 2 is still 3.5
+force_inline auto static IntegerDivide(i64 lhs, i64 rhs, Value *result) -> bool {
+  if (rhs == 0 || (rhs == -1 && lhs == INT64_MIN) || lhs % rhs != 0) return false;
+  // lhs / -1 is the only way out of range, and Subtract checks for that
+  if (rhs == -1) return IntegerSubtract(0, lhs, result);
+  *result = Value(lhs / rhs);
+  return true;
+}
+
+force_inline auto static IntegerGreater(i64 lhs, i64 rhs, Value *result) -> bool {
+  *result = Value(lhs > rhs);
+  return true;
+}
+
+force_inline auto static IntegerLess(i64 lhs, i64 rhs, Value *result) -> bool {
+  *result = Value(lhs < rhs);
+  return true;
+}
+
+// any two numbers, two integers stay integers for as long as the result fits.
+// Anything else is done with doubles
+force_inline auto static NumericBinary(OpCode op, const Value a, const Value b) -> Value {
+  Value result;
+  if (a.IsInteger() && b.IsInteger()) {
+    const i64 lhs = a.AsInteger();
+    const i64 rhs = b.AsInteger();
+    switch (op) {
+      default:
+        break;
+      case OpCode::Add:
+        if (IntegerAdd(lhs, rhs, &result)) return result;
+        break;
+      case OpCode::Subtract:
+        if (IntegerSubtract(lhs, rhs, &result)) return result;
+        break;
+      case OpCode::Multiply:
+        if (IntegerMultiply(lhs, rhs, &result)) return result;
+        break;
+      case OpCode::Divide:
+        if (IntegerDivide(lhs, rhs, &result)) return result;
+        break;
+      case OpCode::Greater:
+        return Value(lhs > rhs);
+      case OpCode::Less:
+        return Value(lhs < rhs);
+    }
+  }
+
+  const f64 lhs = a.ToNumber();
+  const f64 rhs = b.ToNumber();
+  switch (op) {
+    default:
+    case OpCode::Add:
+      return Value(lhs + rhs);
+    case OpCode::Subtract:
+      return Value(lhs - rhs);
+    case OpCode::Multiply:
+      return Value(lhs * rhs);
+    case OpCode::Divide:
+      return Value(lhs / rhs);
+    case OpCode::Greater:
+      return Value(lhs > rhs);
+    case OpCode::Less:
+      return Value(lhs < rhs);
+  }
+}
+
+// `current < bound` for a ForRange, and what the counter goes to next if so.
+// An integer counter only stops being one if the bound is a double past where
+// integers go
+force_inline auto static RangeNext(const Value current, const Value bound, Value *next) -> bool {
+  if (current.IsInteger() && bound.IsInteger()) {
+    if (current.AsInteger() >= bound.AsInteger()) return false;
+    // it's below an integer, so there's room
+    *next = Value(current.AsInteger() + 1);
+    return true;
+  }
+
+  if (!(current.ToNumber() < bound.ToNumber())) return false;
+  if (!current.IsInteger() || !IntegerAdd(current.AsInteger(), 1, next)) {
+    *next = Value(current.ToNumber() + 1);
+  }
+  return true;
+}
+
+// Arithmetic is quickened. The generic opcode checks its operand types and,
+// once it has seen two numbers or two integers, rewrites itself into the
+// NumNum or IntInt form so later runs only pay for a guard. If the guard ever
+// fails the instruction goes back to being generic. An IntInt that overflows
+// stays quickened, it just promotes that one result.
+//
+// Only standalone instructions get rewritten. Inside a superinstruction the
+// byte before the operands is the superinstruction's opcode, which covers
+// more than this one operation.
+#define QUICKEN(GENERIC, QUICK)                                           \
+  if (frame->inst_ptr[-1] == static_cast<u8>(OpCode::GENERIC)) {          \
+    frame->inst_ptr[-1] = static_cast<u8>(OpCode::QUICK);                 \
+  }
+
+#define QUICKENED_BINARY(GENERIC, QUICK, EXPR)                                        \
+  force_inline auto VirtualMachine::Op##GENERIC(StackFrame *&frame) -> ExecStatus {  \
+    const Value b = this->Peek(0);                                                    \
+    const Value a = this->Peek(1);                                                    \
+    if (a.IsInteger() && b.IsInteger()) {                                             \
+      QUICKEN_INTEGER_##GENERIC                                                       \
+    } else if (a.IsNumber() && b.IsNumber()) {                                        \
+      QUICKEN(GENERIC, QUICK)                                                         \
+      const f64 lhs = a.AsNumber();                                                   \
+      const f64 rhs = b.AsNumber();                                                   \
+      this->stack_top--;                                                              \
+      this->stack_top[-1] = Value(EXPR);                                              \
+      return ExecStatus::Continue;                                                    \
+    } else if (!a.IsNumeric() || !b.IsNumeric()) [[unlikely]] {                       \
+      this->RuntimeError("Operands must be numbers");                                 \
+      return ExecStatus::Error;                                                       \
+    }                                                                                 \
+                                                                                      \
+    this->stack_top--;                                                                \
+    this->stack_top[-1] = NumericBinary(OpCode::GENERIC, a, b);                       \
+    return ExecStatus::Continue;                                                      \
+  }                                                                                   \
+                                                                                      \
+  force_inline auto VirtualMachine::Op##QUICK(StackFrame *&frame) -> ExecStatus {    \
+    const Value b = this->Peek(0);                                                    \
+    const Value a = this->Peek(1);                                                    \
+    if (!a.IsNumber() || !b.IsNumber()) [[unlikely]] {                                \
+      frame->inst_ptr[-1] = static_cast<u8>(OpCode::GENERIC);                         \
+      return this->Op##GENERIC(frame);                                                \
+    }                                                                                 \
+                                                                                      \
+    const f64 lhs = a.AsNumber();                                                     \
+    const f64 rhs = b.AsNumber();                                                     \
+    this->stack_top--;                                                                \
+    this->stack_top[-1] = Value(EXPR);                                                \
+    return ExecStatus::Continue;                                                      \
+  }
+
+#define QUICKENED_INTEGER(GENERIC, QUICK, INTEGER)                                   \
+  force_inline auto VirtualMachine::Op##QUICK(StackFrame *&frame) -> ExecStatus {    \
+    const Value b = this->Peek(0);                                                    \
+    const Value a = this->Peek(1);                                                    \
+    if (!a.IsInteger() || !b.IsInteger()) [[unlikely]] {                              \
+      frame->inst_ptr[-1] = static_cast<u8>(OpCode::GENERIC);                         \
+      return this->Op##GENERIC(frame);                                                \
+    }                                                                                 \
+                                                                                      \
+    this->stack_top--;                                                                \
+    if (!INTEGER(a.AsInteger(), b.AsInteger(), &this->stack_top[-1])) [[unlikely]] { \
+      this->stack_top[-1] = NumericBinary(OpCode::GENERIC, a, b);                     \
+    }                                                                                 \
+    return ExecStatus::Continue;                                                      \
+  }
+
+// Divide has no integer form, most of them don't divide evenly
+#define QUICKEN_INTEGER_Add QUICKEN(Add, AddIntInt)
+#define QUICKEN_INTEGER_Subtract QUICKEN(Subtract, SubtractIntInt)
+#define QUICKEN_INTEGER_Multiply QUICKEN(Multiply, MultiplyIntInt)
+#define QUICKEN_INTEGER_Divide
+#define QUICKEN_INTEGER_Greater QUICKEN(Greater, GreaterIntInt)
+#define QUICKEN_INTEGER_Less QUICKEN(Less, LessIntInt)
+
+QUICKENED_BINARY(Add, AddNumNum, lhs + rhs)
+QUICKENED_BINARY(Subtract, SubtractNumNum, lhs - rhs)
+QUICKENED_BINARY(Multiply, MultiplyNumNum, lhs * rhs)
+QUICKENED_BINARY(Divide, DivideNumNum, lhs / rhs)
+QUICKENED_BINARY(Greater, GreaterNumNum, lhs > rhs)
+QUICKENED_BINARY(Less, LessNumNum, lhs < rhs)
+QUICKENED_INTEGER(Add, AddIntInt, IntegerAdd)
+QUICKENED_INTEGER(Subtract, SubtractIntInt, IntegerSubtract)
+QUICKENED_INTEGER(Multiply, MultiplyIntInt, IntegerMultiply)
+QUICKENED_INTEGER(Greater, GreaterIntInt, IntegerGreater)
+QUICKENED_INTEGER(Less, LessIntInt, IntegerLess)
+#undef QUICKEN_INTEGER_Add
+#undef QUICKEN_INTEGER_Subtract
+#undef QUICKEN_INTEGER_Multiply
+#undef QUICKEN_INTEGER_Divide
+#undef QUICKEN_INTEGER_Greater
+#undef QUICKEN_INTEGER_Less
+#undef QUICKENED_INTEGER
+#undef QUICKENED_BINARY
+
+// integers aren't quickened, -x on one is rare enough
+force_inline auto VirtualMachine::OpNegate(StackFrame *&frame) -> ExecStatus {
+  const Value a = this->Peek();
+  if (a.IsInteger()) {
+    if (!IntegerSubtract(0, a.AsInteger(), &this->stack_top[-1])) [[unlikely]] {
+      this->stack_top[-1] = Value(-a.ToNumber());
+    }
+    return ExecStatus::Continue;
+  }
+  if (!a.IsNumber()) [[unlikely]] {
+    this->RuntimeError("Operand must be a number");
+    return ExecStatus::Error;
+  }
+  QUICKEN(Negate, NegateNum)
+
+  this->stack_top[-1] = Value(-a.AsNumber());
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpNegateNum(StackFrame *&frame) -> ExecStatus {
+  const Value a = this->Peek();
+  if (!a.IsNumber()) [[unlikely]] {
+    frame->inst_ptr[-1] = static_cast<u8>(OpCode::Negate);
+    return this->OpNegate(frame);
+  }
+
+  this->stack_top[-1] = Value(-a.AsNumber());
+  return ExecStatus::Continue;
+}
+#undef QUICKEN
+
+force_inline auto VirtualMachine::OpFalse(StackFrame *&frame) -> ExecStatus {
+  this->Push(false);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpTrue(StackFrame *&frame) -> ExecStatus {
+  this->Push(true);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpNot(StackFrame *&frame) -> ExecStatus {
+  Value val = this->Pop();
+  this->Push(!val.IsTruthy());
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpEquality(StackFrame *&frame) -> ExecStatus {
+  Value b = this->Pop();
+  Value a = this->Pop();
+  this->Push(Value(a == b));
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpPop(StackFrame *&frame) -> ExecStatus {
+  this->Pop();
+  return ExecStatus::Continue;
+}
+
+// the slow path only runs the first time through, or after the object pool got
+// cleared out from under the cache
+force_inline auto VirtualMachine::GlobalSlot(Chunk *chunk, u32 cache_idx) -> Object * {
+  auto *cache = &chunk->global_caches[cache_idx];
+  if (this->globals_pool != this->object_pool->Generation()) [[unlikely]] {
+    // a different pool, nothing in this one has been assigned to yet
+    this->globals.count = 0;
+    this->globals_pool = this->object_pool->Generation();
+    this->globals_generation = this->globals_pool;
+  }
+
+  if (cache->generation != this->globals_generation) [[unlikely]] {
+    Object *global = cache->index < this->globals.count ? this->globals[cache->index] : nullptr;
+    cache->slot = global != nullptr ? global : this->object_pool->Nth(cache->index);
+    cache->generation = this->globals_generation;
+  }
+
+  return cache->slot;
+}
+
+// the pool keeps whatever the compiler put there, an assignment only changes
+// what the name resolves to from then on
+auto VirtualMachine::AssignGlobal(Chunk *chunk, u32 cache_idx, Value value) -> bool {
+  if (!value.IsObject()) {
+    this->RuntimeError("Globals can only hold objects");
+    return false;
+  }
+
+  // makes sure globals belongs to the current pool
+  this->GlobalSlot(chunk, cache_idx);
+  const u32 index = chunk->global_caches[cache_idx].index;
+  while (this->globals.count <= index) this->globals.Append(nullptr);
+  this->globals[index] = value.AsObject();
+  this->gc.BarrierGlobal(index, value.AsObject());
+
+  // every cache has to look it up again, and so does any native code that
+  // assumed it would never change
+  this->globals_generation = ARENA_GENERATIONS++;
+  this->tiering.WriteGlobal(index);
+  return true;
+}
+
+force_inline auto VirtualMachine::OpSetGlobal(StackFrame *&frame) -> ExecStatus {
+  u32 idx = READ_INT();
+  // assignments are expressions, the value stays on the stack like SetLocal
+  if (!this->AssignGlobal(frame->chunk, idx, this->Peek())) {
+    return ExecStatus::Error;
+  }
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpGetGlobal(StackFrame *&frame) -> ExecStatus {
+  u32 idx = READ_INT();
+  Value global = this->GlobalSlot(frame->chunk, idx);
+  this->Push(global);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpSetLocal(StackFrame *&frame) -> ExecStatus {
+  u32 idx = READ_INT();
+  frame->locals[idx] = this->Peek();
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpGetLocal(StackFrame *&frame) -> ExecStatus {
+  u32 idx = READ_INT();
+  Value local = frame->locals[idx];
+  this->Push(local);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpSetUpvalue(StackFrame *&frame) -> ExecStatus {
+  u32 index = READ_INT();
+  // lmao thats a lot of indirection
+  auto *upval = frame->closure->as.closure.upvalues[index];
+  *upval->as.upvalue.location = this->Peek();
+  this->gc.Barrier(upval, this->Peek());
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpGetUpvalue(StackFrame *&frame) -> ExecStatus {
+  u32 index = READ_INT();
+  auto *upval = frame->closure->as.closure.upvalues[index];
+  auto *val = upval->as.upvalue.location;
+  this->Push(*val);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpJump(StackFrame *&frame) -> ExecStatus {
+  u32 offset = READ_INT();
+  frame->inst_ptr += offset;
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpJumpFalse(StackFrame *&frame) -> ExecStatus {
+  u32 offset = READ_INT();
+  Value condition = this->Peek();
+  if (!condition.IsTruthy()) {
+    frame->inst_ptr += offset;
+  }
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpJumpTrue(StackFrame *&frame) -> ExecStatus {
+  u32 offset = READ_INT();
+  Value condition = this->Peek();
+  if (condition.IsTruthy()) {
+    frame->inst_ptr += offset;
+  }
+  return ExecStatus::Continue;
+}
+
+// pops both operands of a fused compare and branch, false once it's reported
+// the same type error the compare on its own would have
+force_inline auto VirtualMachine::CompareOperands(OpCode compare, bool *result) -> bool {
+  const Value b = this->Peek(0);
+  const Value a = this->Peek(1);
+  if (compare == OpCode::Equality) {
+    *result = a == b;
+  } else if (a.IsInteger() && b.IsInteger()) {
+    *result = compare == OpCode::Less ? a.AsInteger() < b.AsInteger() : a.AsInteger() > b.AsInteger();
+  } else {
+    if (!a.IsNumeric() || !b.IsNumeric()) [[unlikely]] {
+      this->RuntimeError("Operands must be numbers");
+      return false;
+    }
+    *result = NumericBinary(compare, a, b).AsBoolean();
+  }
+
+  this->stack_top -= 2;
+  return true;
+}
+
+// these check the types themselves every time, so there's nothing to quicken
+#define X(ID, COMPARE, WHEN)                                                    \
+  force_inline auto VirtualMachine::Op##ID(StackFrame *&frame) -> ExecStatus { \
+    const u32 offset = READ_INT();                                              \
+    bool result;                                                                \
+    if (!this->CompareOperands(OpCode::COMPARE, &result)) [[unlikely]] {        \
+      return ExecStatus::Error;                                                 \
+    }                                                                           \
+    if (result == WHEN) {                                                       \
+      frame->inst_ptr += offset;                                                \
+    }                                                                           \
+    return ExecStatus::Continue;                                                \
+  }
+VM_COMPARE_JUMPS(X)
+#undef X
+
+// only called right after the opcode byte's been read
+force_inline auto VirtualMachine::Safepoint(StackFrame *frame) -> bool {
+  if (this->budget_left == 0) [[unlikely]] {
+    frame->inst_ptr--;
+    return true;
+  }
+
+  this->budget_left--;
+  return false;
+}
+
+force_inline auto VirtualMachine::OpLoop(StackFrame *&frame) -> ExecStatus {
+  if (this->Safepoint(frame)) [[unlikely]] {
+    return ExecStatus::Suspend;
+  }
+
+  u32 offset = READ_INT();
+  frame->inst_ptr -= offset;
+  return this->EnterTrace(frame);
+}
+
+// `for i in a..b`, the counter and the bound are the two locals at slot. Pushes
+// the counter as the loop variable and bumps it, or jumps out once it reaches
+// the bound. The jump is from the end of its own operand like any other jump
+force_inline auto VirtualMachine::OpForRange(StackFrame *&frame) -> ExecStatus {
+  const u32 offset = READ_INT();
+  const u32 slot = READ_INT();
+  Value *counter = &frame->locals[slot];
+  if (!counter[0].IsNumeric() || !counter[1].IsNumeric()) [[unlikely]] {
+    this->RuntimeError("Range bounds must be numbers");
+    return ExecStatus::Error;
+  }
+
+  const Value current = counter[0];
+  if (!RangeNext(current, counter[1], &counter[0])) {
+    frame->inst_ptr += offset - sizeof(u32);
+    return ExecStatus::Continue;
+  }
+
+  // pushing can move the stack, counter with it
+  this->Push(current);
+  return ExecStatus::Continue;
+}
+
+// the value being matched picks its arm out of the JumpTable, see
+// CompilerEngine::MatchExpression. Nothing matching is just arm 0
+force_inline auto VirtualMachine::OpMatchDense(StackFrame *&frame) -> ExecStatus {
+  const u32 index = READ_INT();
+  const JumpTable &table = frame->chunk->jump_tables[index];
+  frame->inst_ptr += table.targets[table.DenseArm(this->Pop())];
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpMatchHash(StackFrame *&frame) -> ExecStatus {
+  const u32 index = READ_INT();
+  const JumpTable &table = frame->chunk->jump_tables[index];
+  frame->inst_ptr += table.targets[table.HashArm(this->Pop())];
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpInvoke(StackFrame *&frame) -> ExecStatus {
+  if (this->Safepoint(frame)) [[unlikely]] {
+    return ExecStatus::Suspend;
+  }
+
+  u32 argc = READ_INT();
+  u32 cache = READ_INT();
+  const Value callee = this->Peek(argc);
+  auto *call_cache = &frame->chunk->call_caches[cache];
+  // there's no frame to enter, and one that suspends moves some other fiber in.
+  // natives never go in the cache, so one that hits can't be a native
+  if (callee.IsObject() && callee.AsObject() != call_cache->callee &&
+      callee.AsObject()->type == ObjectType::Native) [[unlikely]] {
+    return this->CallNative(static_cast<Object::Native *>(callee.AsObject()), argc, frame);
+  }
+
+  const auto status = this->InvokeCached(call_cache, callee, argc, frame);
+  if (status == ExecStatus::Continue) {
+    return this->EnterNative(frame);
+  }
+  return status;
+}
+
+force_inline auto VirtualMachine::OpTailInvoke(StackFrame *&frame) -> ExecStatus {
+  // a native has no frame to hand ours over to, so it's a plain call and the
+  // Return after this one returns whatever it did
+  if (this->NativeCallee(frame)) [[unlikely]] {
+    return this->OpInvoke(frame);
+  }
+  if (this->Safepoint(frame)) [[unlikely]] {
+    return ExecStatus::Suspend;
+  }
+
+  const auto status = this->InvokeInPlace(frame);
+  if (status == ExecStatus::Continue) {
+    return this->EnterNative(frame);
+  }
+  return status;
+}
+
+auto VirtualMachine::NativeCallee(const StackFrame *frame) const -> bool {
+  u32 argc;
+  std::memcpy(&argc, frame->inst_ptr, sizeof(u32));
+  const Value callee = this->Peek(argc);
+  return callee.IsObject() && callee.AsObject()->type == ObjectType::Native;
+}
+
+force_inline auto VirtualMachine::InvokeInPlace(StackFrame *&frame) -> ExecStatus {
+  u32 argc = READ_INT();
+  u32 cache = READ_INT();
+  // the frame it's in is about to be somebody else's
+  auto *call_cache = &frame->chunk->call_caches[cache];
+
+  // the callee takes over this frame, so slide it and its arguments down over
+  // our locals and call it from there
+  this->CloseUpvalues(frame->locals);
+  std::memmove(frame->locals, this->stack_top - argc - 1, (argc + 1) * sizeof(Value));
+  this->stack_top = frame->locals + argc + 1;
+  this->frame_count--;
+
+  return this->InvokeCached(call_cache, frame->locals[0], argc, frame);
+}
+
+// a hit is the same object from the same pool, which was a Function or Closure
+// taking argc when the cache got filled and still is. Natives are for the
+// caller to deal with, they never go in
+force_inline auto VirtualMachine::InvokeCached(CallCache *cache, Value callee, u32 argc, StackFrame *&frame)
+    -> ExecStatus {
+  if (callee.IsObject() && callee.AsObject() == cache->callee && cache->generation == this->call_generation)
+      [[likely]] {
+    StackFrame *pushed = this->PushFrame(cache->callee, argc);
+    if (pushed == nullptr) [[unlikely]] {
+      return ExecStatus::Error;
+    }
+    frame = pushed;
+    return ExecStatus::Continue;
+  }
+
+  const auto status = this->InvokeValue(callee, argc, frame);
+  if (status == ExecStatus::Continue) {
+    cache->callee = callee.AsObject();
+    cache->generation = this->call_generation;
+  }
+  return status;
+}
+
+force_inline auto VirtualMachine::InvokeValue(Value function_base, u32 argc, StackFrame *&frame) -> ExecStatus {
+  if (!function_base.IsObject()) {
+    this->RuntimeError("Can not invoke non function object");
+    return ExecStatus::Error;
+  }
+
+  auto *function_obj = function_base.AsObject();
+  switch (function_obj->type) {
+    default: {
+      this->RuntimeError("Can not invoke non function object");
+      return ExecStatus::Error;
+    }
+    case ObjectType::Function:
+    case ObjectType::Closure: {
+      StackFrame *new_frame = this->Invoke(function_obj, argc);
+      if (new_frame == nullptr) {
+        return ExecStatus::Error;
+      }
+
+      frame = new_frame;
+      break;
+    }
+  }
+
+#ifdef DEBUG_PRINT_CODE
+  auto it = this->disassembled.find(function_obj->name);
+  if (it == this->disassembled.end()) {
+    printf("====== Function: %s\n", function_obj->name);
+    frame->chunk->Disassemble();
+    this->disassembled.insert(function_obj->name);
+  }
+#endif
+
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpClosure(StackFrame *&frame) -> ExecStatus {
+  const u32 idx = READ_INT();
+  Value func_obj = this->object_pool->Nth(idx);
+
+  Assert(func_obj.IsObject());
+  auto *obj = func_obj.AsObject();
+
+  Assert(obj->type == ObjectType::Function);
+  const auto *function = static_cast<const Object::Function *>(obj);
+
+  // dirty, disgusting pointer memory shenanigans
+  // these alias to the same memory location
+  auto *closure = static_cast<Object::Closure *>(obj);
+  closure->Init(function);
+
+  u8 upvalue_count = READ_BYTE();
+  Assert(upvalue_count == closure->as.closure.upvalue_count);
+
+  for (int i = 0; i < upvalue_count; i++) {
+    const u8 local = READ_BYTE();
+    const u8 index = READ_BYTE();
+    closure->as.closure.upvalues[i] = local ? this->CaptureUpvalue(frame->locals + index) :
+                                            // so if its in a nested closure, this check should always
+                                            // be true...
+                                          frame->closure->as.closure.upvalues[index];
+    this->gc.Barrier(closure, closure->as.closure.upvalues[i]);
+  }
+
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpCloseUpvalue(StackFrame *&frame) -> ExecStatus {
+  this->CloseUpvalues(this->stack_top - 1);
+  this->Pop();
+  return ExecStatus::Continue;
+}
+
+// Generators. A function that yields starts with a Generator, so calling it
+// just packs the fresh frame up and returns that instead of running the body.
+// Iterate copies the frame back onto the stack and runs it until it yields or
+// ends, either way the caller gets the value and whether there was one on top
+// of the stack, the same shape as a while loop's condition. While it runs the
+// generator itself sits in the callee's slot, that's how Yield finds it.
+force_inline auto VirtualMachine::OpGenerator(StackFrame *&frame) -> ExecStatus {
+  auto *generator = static_cast<Object::Generator *>(this->AllocObject());
+  generator->Init(frame->locals[0].AsObject());
+  generator->Save(frame->locals, static_cast<u32>(this->stack_top - frame->locals), frame->inst_ptr);
+
+  this->frame_count--;
+  this->stack_top = frame->locals;
+  this->Push(Value(static_cast<Object *>(generator)));
+  // spawned straight onto a fiber of its own
+  if (this->frame_count == 0) [[unlikely]] {
+    return this->FinishFiber(frame, Value(static_cast<Object *>(generator)));
+  }
+  frame = this->Frame(this->frame_count - 1);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpYield(StackFrame *&frame) -> ExecStatus {
+  const Value value = this->Pop();
+
+  // they'd keep pointing at slots some other frame owns once we're gone
+  if (this->open_upvalues != nullptr && this->open_upvalues->as.upvalue.location >= frame->locals) {
+    this->RuntimeError("Can not yield while a closure captures a local");
+    return ExecStatus::Error;
+  }
+
+  auto *generator = static_cast<Object::Generator *>(frame->locals[0].AsObject());
+  generator->Save(frame->locals, static_cast<u32>(this->stack_top - frame->locals), frame->inst_ptr);
+  this->gc.Remember(generator);
+
+  this->frame_count--;
+  this->stack_top = frame->locals;
+  this->Push(value);
+  this->Push(Value(true));
+  frame = this->Frame(this->frame_count - 1);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpGeneratorEnd(StackFrame *&frame) -> ExecStatus {
+  // inst_ptr stays nullptr, so every Iterate from now on comes back empty
+  auto *generator = static_cast<Object::Generator *>(frame->locals[0].AsObject());
+  generator->as.generator.slot_count = 0;
+
+  this->CloseUpvalues(frame->locals);
+  this->frame_count--;
+  this->stack_top = frame->locals;
+  this->Push(Value());
+  this->Push(Value(false));
+  frame = this->Frame(this->frame_count - 1);
+  return ExecStatus::Continue;
+}
+
+force_inline auto VirtualMachine::OpIterate(StackFrame *&frame) -> ExecStatus {
+  const u32 slot = READ_INT();
+  const Value iterable = frame->locals[slot];
+  if (!iterable.IsObject() || iterable.AsObject()->type != ObjectType::Generator) {
+    this->RuntimeError("Can only iterate over generators");
+    return ExecStatus::Error;
+  }
+
+  auto &generator = iterable.AsObject()->as.generator;
+  // done, or it's running already and trying to iterate itself
+  if (generator.inst_ptr == nullptr) {
+    this->Push(Value());
+    this->Push(Value(false));
+    return ExecStatus::Continue;
+  }
+
+  if ((this->frame_count == this->frame_capacity || this->stack_top >= this->stack_ceiling) &&
+      !this->ReserveFrame()) [[unlikely]] {
+    this->RuntimeError("Stack overflow");
+    return ExecStatus::Error;
+  }
+  if (this->stack_top + generator.slot_count > this->stack_limit) [[unlikely]] {
+    this->GrowStack(generator.slot_count);
+  }
+
+  StackFrame *resumed = this->Frame(this->frame_count++);
+  Object *callee = generator.callee;
+  if (callee->type == ObjectType::Closure) {
+    resumed->type = FrameType::Closure;
+    resumed->closure = static_cast<Object::Closure *>(callee);
+    resumed->chunk = callee->as.closure.chunk;
+  } else {
+    resumed->type = FrameType::Function;
+    resumed->function = static_cast<Object::Function *>(callee);
+    resumed->chunk = callee->as.function.chunk;
+  }
+  resumed->inst_ptr = generator.inst_ptr;
+  resumed->locals = this->stack_top;
+
+  std::memcpy(this->stack_top, generator.slots, generator.slot_count * sizeof(Value));
+  this->stack_top += generator.slot_count;
+  resumed->locals[0] = iterable;
+  generator.inst_ptr = nullptr;
+
+  frame = resumed;
+  return ExecStatus::Continue;
+}
+
+// Fibers. spawn f(x) is a call that gets a stack of its own and doesn't run
+// yet, the caller gets an Object::Fiber for it straight away. join waits for
+// it to finish and evaluates to whatever f returned. Only join and finishing
+// hand over to the next Ready fiber, and the script is done once the top
+// level is, whether or not anything else still is.
+force_inline auto VirtualMachine::OpSpawn(StackFrame *&frame) -> ExecStatus {
+  const u32 argc = READ_INT();
+  // skips the call's CallCache, fibers don't get made often enough to bother
+  frame->inst_ptr += sizeof(u32);
+  const Value *args = this->stack_top - argc - 1;
+
+  // checked here, the new fiber has no frames to blame it on
+  const Value callee = args[0];
+  const auto type = callee.IsObject() ? callee.AsObject()->type : ObjectType::String;
+  if (type != ObjectType::Function && type != ObjectType::Closure) {
+    this->RuntimeError("Can only spawn functions");
+    return ExecStatus::Error;
+  }
+  if (argc != callee.AsObject()->as.function.arity) {
+    this->RuntimeError("Expected %d arguments to function but got %d", callee.AsObject()->as.function.arity, argc);
+    return ExecStatus::Error;
+  }
+
+  this->AdoptTopLevel();
+  Fiber *current = this->fiber;
+  auto *spawned = ALLOCATE(Fiber, 1);
+  *spawned = {};
+  this->fibers.Append(spawned);
+
+  this->SwitchTo(spawned);
+  this->InitStack();
+  for (u32 i = 0; i <= argc; i++) {
+    this->Push(args[i]);
+  }
+  StackFrame *entry = nullptr;
+  const auto status = this->InvokeValue(callee, argc, entry);
+  this->SwitchTo(current);
+  if (status != ExecStatus::Continue) [[unlikely]] {
+    // it never got a frame, so there's nothing to run
+    spawned->state = FiberState::Done;
+    FreeStack(spawned);
+    return status;
+  }
+
+  spawned->state = FiberState::Ready;
+  this->ready.Append(spawned);
+
+  auto *handle = static_cast<Object::Fiber *>(this->AllocObject());
+  handle->Init(spawned, this->fiber_generation, callee.AsObject());
+
+  this->stack_top -= argc + 1;
+  this->Push(Value(static_cast<Object *>(handle)));
+  return ExecStatus::Continue;
 }
 
-auto VirtualMachine::Deinit() -> void {
-  this->stack_top = this->stack;
-  this->frame_count = 0;
+force_inline auto VirtualMachine::OpJoin(StackFrame *&frame) -> ExecStatus {
+  const Value handle = this->Pop();
+  if (!handle.IsObject() || handle.AsObject()->type != ObjectType::Fiber) {
+    this->RuntimeError("Can only join fibers");
+    return ExecStatus::Error;
+  }
 
-  if (this->string_pool != nullptr) {
-    this->string_pool->Deinit();
+  const auto &data = handle.AsObject()->as.fiber;
+  if (data.generation != this->fiber_generation) {
+    this->RuntimeError("Can not join a fiber from an earlier run");
+    return ExecStatus::Error;
   }
 
-  if (this->object_pool != nullptr) {
-    this->object_pool->Clear();
+  Fiber *target = data.fiber;
+  if (target->state == FiberState::Done) {
+    this->Push(target->result);
+    return ExecStatus::Continue;
   }
+
+  // FinishFiber pushes the result for us once target is done
+  this->fiber->state = FiberState::Blocked;
+  this->fiber->next_waiter = target->waiters;
+  target->waiters = this->fiber;
+  return this->Schedule(frame);
 }
 
-auto VirtualMachine::Push(Value value) -> void {
-  // TODO(eddie) - this is bad error handling
-  if (this->stack_top - this->stack > VM_STACK_MAX) {
-    exit(1);
+// superinstructions just run both halves, see VM_SUPERINSTRUCTIONS. If FIRST
+// failed the stack has already been unwound, so SECOND can't run on it
+#define X(ID, FIRST, SECOND)                                                    \
+  force_inline auto VirtualMachine::Op##ID(StackFrame *&frame) -> ExecStatus { \
+    const ExecStatus first = this->Op##FIRST(frame);                            \
+    if (first != ExecStatus::Continue) [[unlikely]] return first;               \
+    return this->Op##SECOND(frame);                                             \
   }
+VM_SUPERINSTRUCTIONS(X)
+#undef X
 
-  *this->stack_top = value;
-  this->stack_top++;
-}
+auto VirtualMachine::ConfigureTiers(TierConfig config) -> void { this->tiering.config = config; }
 
-auto VirtualMachine::Pop() -> Value {
-  this->stack_top--;
-  return *this->stack_top;
-}
+auto VirtualMachine::TierReport(DynamicArray<FunctionTier> *report) const -> void { this->tiering.Report(report); }
 
-auto VirtualMachine::Peek() const -> Value { return this->stack_top[-1]; }
+auto VirtualMachine::PrintTierReport(u32 top) const -> void {
+  DynamicArray<FunctionTier> report;
+  report.Init();
+  defer(report.Deinit());
+  this->tiering.Report(&report);
 
-auto VirtualMachine::Peek(int dist) const -> Value { return this->stack_top[-1 - dist]; }
+  printf("%-32s %-12s %12s %6s %7s %8s %10s %12s\n", "function", "tier", "calls", "loops", "traced", "osr",
+         "quickened", "invalidated");
+  for (u64 i = 0; i < report.count && i < top; i++) {
+    const auto &row = report[i];
+    printf("%-32s %-12s %12lu %6u %7u %8lu %10u %12u\n", row.name, TierName(row.tier), row.calls, row.loops,
+           row.traced_loops, row.osr_entries, row.quickened, row.invalidations);
+  }
+}
 
-auto VirtualMachine::RuntimeError(const char *msg, ...) -> InterpretError {
-  va_list args;
-  va_start(args, msg);
-  vfprintf(stderr, msg, args);
-  va_end(args);
-  fputs("\n", stderr);
+// counts the call to the frame that was just pushed, and runs it natively if
+// it has native code
+auto VirtualMachine::EnterNative(StackFrame *&frame) -> ExecStatus {
+  const NativeCode code = this->tiering.Call(frame);
+  if (code == nullptr) {
+    return ExecStatus::Continue;
+  }
 
-  for (int i = this->frame_count - 1; i >= 0; i--) {
-    StackFrame *frame = &this->frames[i];
-    auto *closure = frame->closure;
-    auto func = closure->as.closure;
+  const auto status = code(this, &frame);
+  return status == ExecStatus::Exit ? ExecStatus::Continue : status;
+}
 
-    u64 inst = frame->inst_ptr - func.chunk->BaseInstructionPointer() - 1;
+// inst_ptr is sitting on a loop header, run its trace if there is one or move
+// the frame over to native code. Either leaves inst_ptr wherever the
+// interpreter should pick back up
+auto VirtualMachine::EnterTrace(StackFrame *&frame) -> ExecStatus {
+  const auto header = static_cast<u32>(frame->inst_ptr - frame->chunk->bytecode.data);
+  LoopTrace *trace = this->tiering.Loop(frame, header);
+  if (trace == nullptr) [[likely]] {
+    return ExecStatus::Continue;
+  }
 
-    auto line_range = func.chunk->lines[inst];
-    const auto *name = frame->closure == nullptr ? frame->function->name : frame->closure->name;
-    fprintf(stderr, "[line %lu] in ", line_range.val);
-    fprintf(stderr, "%s\n", name);
+#if defined(ROC_JIT)
+  if (trace->native != nullptr) {
+    if (reinterpret_cast<TraceCode>(trace->native)(this, &frame)) {
+      this->tiering.SideExit(trace);
+    }
+    return ExecStatus::Continue;
   }
 
-  // reset stack pointer
-  this->stack_top = this->stack;
+  if (trace->tier == Tier::Interpreted) {
+    return this->RecordTrace(frame, trace);
+  }
 
-  return InterpretError::RuntimeError;
+  // on-stack replacement, the rest of the frame runs as the function's native
+  // code, which hands it back with ExecStatus::Exit the same way it always does
+  trace->osr_entries++;
+  const auto status = reinterpret_cast<NativeCode>(trace->osr)(this, &frame);
+  return status == ExecStatus::Exit ? ExecStatus::Continue : status;
+#else
+  return ExecStatus::Continue;
+#endif
 }
 
-auto VirtualMachine::Invoke(Object::Closure *closure, u32 argc) -> Result<size_t, InterpretError> {
-  const auto inner_func = closure->as.closure;
+#if defined(ROC_JIT)
+auto VirtualMachine::EnableJit(bool enabled) -> void { this->tiering.config.native = enabled; }
 
-  if (argc != inner_func.arity) {
-    return this->RuntimeError("Expected %d arguments to function but got %d", inner_func.arity, argc);
+// which types the locals read by op hold right now, in the order it reads them
+auto VirtualMachine::TraceLocals(OpCode op, const u8 *operands, const Value *locals, ValueType *types) -> ValueType * {
+  switch (op) {
+    default: {
+      return types;
+    }
+    case OpCode::GetLocal: {
+      u32 idx;
+      std::memcpy(&idx, operands, sizeof(u32));
+      *types = locals[idx].Type();
+      return types + 1;
+    }
+    case OpCode::ForRange: {
+      u32 idx;
+      std::memcpy(&idx, operands + sizeof(u32), sizeof(u32));
+      types[0] = locals[idx].Type();
+      types[1] = locals[idx + 1].Type();
+      return types + 2;
+    }
+#define X(ID, FIRST, SECOND)                                                                          \
+  case OpCode::ID: {                                                                                  \
+    types = TraceLocals(OpCode::FIRST, operands, locals, types);                                      \
+    return TraceLocals(OpCode::SECOND, operands + Chunk::OperandLength(OpCode::FIRST), locals, types); \
   }
+      VM_SUPERINSTRUCTIONS(X)
+#undef X
+  }
+}
 
-  if (this->frame_count == VM_STACK_MAX) {
-    return this->RuntimeError("Stack overflow");
+// Runs one iteration of the loop an instruction at a time and writes down what
+// happened. Recording stops at anything the trace compiler can't handle, and
+// the interpreter just carries on from there with the loop blacklisted.
+auto VirtualMachine::RecordTrace(StackFrame *&frame, LoopTrace *trace) -> ExecStatus {
+  u8 *bytecode = frame->chunk->bytecode.data;
+
+  TraceRecording recording;
+  recording.header = static_cast<u32>(frame->inst_ptr - bytecode);
+  recording.depth = static_cast<u32>(this->stack_top - frame->locals);
+  recording.steps.Init();
+  defer(recording.steps.Deinit());
+
+  // the Loop instruction closing this loop, everything up to it is the body
+  u64 loop_end = recording.header;
+  while (loop_end < frame->chunk->Count()) {
+    if (static_cast<OpCode>(bytecode[loop_end]) == OpCode::Loop &&
+        loop_end + 1 + sizeof(u32) - *(u32 *)(bytecode + loop_end + 1) == recording.header) {
+      break;
+    }
+    loop_end += frame->chunk->InstructionLength(loop_end);
   }
 
-  StackFrame *ret = &this->frames[this->frame_count++];
-  ret->type = FrameType::Closure;
-  ret->closure = closure;
-  ret->inst_ptr = inner_func.chunk->BaseInstructionPointer();
-  // the -1 is so that slot 0 of locals is a reference to Object::Function being
-  // called
-  ret->locals = this->stack_top - argc - 1;
-  ret->chunk = inner_func.chunk;
+  // unless it makes it all the way around
+  trace->tier = Tier::Blacklisted;
+
+  while (recording.steps.count < JIT_TRACE_MAX) {
+    // the loop finished while recording, that says nothing about the loop so
+    // it gets another go on the next hot back edge
+    const u64 offset = frame->inst_ptr - bytecode;
+    if (offset < recording.header || offset > loop_end) {
+      trace->tier = Tier::Interpreted;
+      return ExecStatus::Continue;
+    }
+
+    const auto op = static_cast<OpCode>(*frame->inst_ptr);
+    if (!IsTraceable(op)) {
+      return ExecStatus::Continue;
+    }
+
+    TraceStep step = {static_cast<u32>(frame->inst_ptr - bytecode), op, {}, false};
+    TraceLocals(op, frame->inst_ptr + 1, frame->locals, step.locals);
+    frame->inst_ptr++;
+
+    // not through OpLoop, that would count the back edge again
+    if (op == OpCode::Loop) {
+      u32 offset = READ_INT();
+      frame->inst_ptr -= offset;
+      recording.steps.Append(step);
+
+      if (frame->inst_ptr == bytecode + recording.header) {
+        this->tiering.Promote(frame->chunk, trace, &recording);
+      }
+      return ExecStatus::Continue;
+    }
+
+    const auto status = JIT_HELPERS[static_cast<u8>(op)](this, &frame);
+    if (Chunk::IsConditionalJump(op)) {
+      step.taken = frame->inst_ptr != bytecode + step.offset + frame->chunk->InstructionLength(step.offset);
+    }
+    recording.steps.Append(step);
+
+    if (status != ExecStatus::Continue) {
+      return status;
+    }
+  }
 
-  return this->frame_count - 1;
+  return ExecStatus::Continue;
 }
 
-auto VirtualMachine::Invoke(Object::Function *function, u32 argc) -> Result<size_t, InterpretError> {
-  if (argc != function->as.function.arity) {
-    return this->RuntimeError("Expected %d arguments to function but got %d", function->as.function.arity, argc);
+// native code has already pointed inst_ptr at the operands
+#define X(ID)                                                                                \
+  auto VirtualMachine::JitOp##ID(VirtualMachine *vm, StackFrame **frame) -> ExecStatus { \
+    return vm->Op##ID(*frame);                                                              \
   }
+VM_OPCODES
+#undef X
 
-  if (this->frame_count == VM_STACK_MAX) {
-    return this->RuntimeError("Stack overflow");
+const NativeCode VirtualMachine::JIT_HELPERS[OPCODE_COUNT] = {
+#define X(ID) &VirtualMachine::JitOp##ID,
+    VM_OPCODES
+#undef X
+};
+
+// The callee runs natively too if it can, and if it returns the caller's native
+// code just keeps going. Anything else means some frame above ours is being
+// interpreted now, so the caller has to bail out as well.
+auto VirtualMachine::JitInvoke(VirtualMachine *vm, StackFrame **frame) -> ExecStatus {
+  const StackFrame *caller = *frame;
+  const auto status = vm->OpInvoke(*frame);
+  if (status == ExecStatus::Continue && *frame != caller) {
+    return ExecStatus::Exit;
   }
 
-  StackFrame *ret = &this->frames[this->frame_count++];
-  ret->type = FrameType::Function;
-  ret->function = function;
-  ret->inst_ptr = function->as.function.chunk->BaseInstructionPointer();
-  // the -1 is so that slot 0 of locals is a reference to Object::Function being
-  // called
-  ret->locals = this->stack_top - argc - 1;
-  ret->chunk = function->as.function.chunk;
+  return status;
+}
+
+auto static JitBail(VirtualMachine * /* vm */, StackFrame ** /* frame */) -> ExecStatus { return ExecStatus::Exit; }
+auto static JitFail(VirtualMachine * /* vm */, StackFrame ** /* frame */) -> ExecStatus { return ExecStatus::Error; }
+
+// returns what the native code should jump to in place of itself, so tail
+// calls between native functions stay in constant stack space too
+auto VirtualMachine::JitTailInvoke(VirtualMachine *vm, StackFrame **frame) -> NativeCode {
+  // the interpreter picks up at the Return after it, see OpTailInvoke
+  if (vm->NativeCallee(*frame)) [[unlikely]] {
+    return vm->OpInvoke(*frame) != ExecStatus::Error ? &JitBail : &JitFail;
+  }
 
-  return this->frame_count - 1;
+  // the interpreter runs into the same safepoint again and stops there
+  if (vm->Safepoint(*frame)) [[unlikely]] {
+    return &JitBail;
+  }
+  if (vm->InvokeInPlace(*frame) != ExecStatus::Continue) {
+    return &JitFail;
+  }
+
+  const NativeCode code = vm->tiering.Call(*frame);
+  return code != nullptr ? code : &JitBail;
 }
 
-// @TODO(eddie) - big sweep through all the opcodes
-// basically everything is actually a 64bit int, but im truncating it down to
-// 32s
-auto VirtualMachine::Interpret(Object *obj, StringPool *string_pool, Arena<Object> *object_pool) -> InterpretResult {
-  Assert(obj != nullptr);
-  auto *function = static_cast<Object::Function *>(obj);
+// same deal as JitInvoke, the generator's frame is always interpreted
+auto VirtualMachine::JitIterate(VirtualMachine *vm, StackFrame **frame) -> ExecStatus {
+  const StackFrame *caller = *frame;
+  const auto status = vm->OpIterate(*frame);
+  if (status == ExecStatus::Continue && *frame != caller) {
+    return ExecStatus::Exit;
+  }
+
+  return status;
+}
 
-  // setup initial call stack
-  auto frame_result = this->Invoke(function, 0);
-  if (frame_result.IsError()) {
-    return frame_result.Err();
+// a join that has to wait moves some other fiber in, same deal again
+auto VirtualMachine::JitJoin(VirtualMachine *vm, StackFrame **frame) -> ExecStatus {
+  const StackFrame *caller = *frame;
+  const auto status = vm->OpJoin(*frame);
+  if (status == ExecStatus::Continue && *frame != caller) {
+    return ExecStatus::Exit;
   }
-  auto frame_idx = frame_result.Get();
-  auto *frame = &this->frames[frame_idx];
 
-  this->string_pool = string_pool;
-  this->object_pool = object_pool;
+  return status;
+}
 
-#if 1
-  absl::flat_hash_set<std::string_view> function_map;
-  frame->chunk->Disassemble();
-#endif
+auto VirtualMachine::JitIsTruthy(VirtualMachine *vm) -> bool { return vm->Peek().IsTruthy(); }
 
-#define READ_BYTE() (*frame->inst_ptr++)
-#define READ_INT()           \
-  *(u32 *)(frame->inst_ptr); \
-  (frame->inst_ptr += sizeof(u32))
-#define READ_CONSTANT() (frame->chunk->locals[READ_BYTE()])
+auto VirtualMachine::JitGrowStack(VirtualMachine *vm) -> void { vm->GrowStack(1); }
+
+auto VirtualMachine::JitMatchDense(VirtualMachine *vm, const JumpTable *table, void **native) -> void * {
+  return native[table->DenseArm(vm->Pop())];
+}
+
+auto VirtualMachine::JitMatchHash(VirtualMachine *vm, const JumpTable *table, void **native) -> void * {
+  return native[table->HashArm(vm->Pop())];
+}
+
+// GlobalSlot only exists inlined into the handlers
+auto VirtualMachine::JitGlobal(Chunk *chunk, u32 cache_idx) -> Object * { return this->GlobalSlot(chunk, cache_idx); }
+#endif
 
-  u8 byte;
+// The dispatch loops below all share these handlers, so an opcode only ever
+// gets implemented once. They are force inlined into every loop.
+#if defined(ROC_DISPATCH_SWITCH)
+auto VirtualMachine::Run(StackFrame *frame) -> InterpretResult {
   while (true) {
-    byte = READ_BYTE();
-    auto instruction = static_cast<OpCode>(byte);
+    const auto instruction = static_cast<OpCode>(READ_BYTE());
+    ExecStatus status;
 
     switch (instruction) {
-      case OpCode::ReturnVoid: {
-        this->CloseUpvalues(frame->locals);
-        this->frame_count--;
-        if (this->frame_count == 0) {
-          return this->Pop();
-        }
-
-        this->stack_top = this->frames[this->frame_count].locals;
-        frame = &this->frames[this->frame_count - 1];
+#define X(ID)                         \
+  case OpCode::ID: {                  \
+    PROFILE_OPCODE(this, OpCode::ID); \
+    status = this->Op##ID(frame);     \
+    break;                            \
+  }
+      VM_OPCODES
+#undef X
+      default: {
+        printf("Unimplemented OpCode %d reached???\n", static_cast<u8>(instruction));
+        status = ExecStatus::Continue;
         break;
       }
-      case OpCode::Return: {
-        Value ret_val = this->Pop();
-        this->CloseUpvalues(frame->locals);
-        this->frame_count--;
+    }
 
-        this->stack_top = this->frames[this->frame_count].locals;
-        this->Push(ret_val);
-        frame = &this->frames[this->frame_count - 1];
+    if (status != ExecStatus::Continue) [[unlikely]] {
+      return this->Finish(status);
+    }
+  }
+}
+#elif defined(ROC_DISPATCH_GOTO)
+// gcc likes to merge all the "goto *" jumps back into one shared indirect
+// jump, which is the switch all over again
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-gcse", "no-crossjumping")))
+#endif
+auto VirtualMachine::Run(StackFrame *frame) -> InterpretResult {
+  // no bounds check on the opcode here, the compiler is the only thing
+  // producing bytecode
+  static void *dispatch_table[OPCODE_COUNT] = {
+#define X(ID) &&Label##ID,
+      VM_OPCODES
+#undef X
+  };
 
-        break;
-      }
-      case OpCode::Constant: {
-        Value constant = READ_CONSTANT();
-        this->Push(constant);
-        break;
-      }
-      case OpCode::ConstantLong: {
-        u32 idx = READ_INT();
+  ExecStatus status;
+  goto *dispatch_table[READ_BYTE()];
 
-        Value constant = frame->chunk->locals[idx];
-        this->Push(constant);
-        break;
-      }
-      case OpCode::String: {
-        u32 idx = READ_INT();
+#define X(ID)                                          \
+  Label##ID : {                                        \
+    PROFILE_OPCODE(this, OpCode::ID);                  \
+    status = this->Op##ID(frame);                      \
+    if (status != ExecStatus::Continue) [[unlikely]] { \
+      return this->Finish(status);                     \
+    }                                                  \
+    goto *dispatch_table[READ_BYTE()];                 \
+  }
+  VM_OPCODES
+#undef X
+}
+#elif defined(ROC_DISPATCH_CACHED)
+// Computed gotos like GOTO, with the top of the stack cached. The top value
+// lives in tos and the stack pointer in sp, both locals the compiler keeps in
+// registers, and sp[-1] in memory is stale while tos is live. A binary op is
+// one load instead of two loads and a store, and a branch on a comparison
+// never touches memory at all.
+//
+// The ops in VM_CACHED_OPCODES get handlers of their own here. Everything else
+// spills, runs the shared handler and fills again, so calls, errors,
+// dequickening and tracing all go through the usual code. The stack is never
+// empty while running, the function itself sits in slot 0.
+#define VM_CACHED_OPCODES \
+  X(Constant)             \
+  X(ConstantLong)         \
+  X(True)                 \
+  X(False)                \
+  X(Pop)                  \
+  X(GetLocal)             \
+  X(SetLocal)             \
+  X(Not)                  \
+  X(Equality)             \
+  X(Jump)                 \
+  X(JumpFalse)            \
+  X(JumpTrue)             \
+  X(ForRange)             \
+  VM_COMPARE_JUMPS(VM_COMPARE_JUMP_OPCODE) \
+  X(AddNumNum)            \
+  X(SubtractNumNum)       \
+  X(MultiplyNumNum)       \
+  X(DivideNumNum)         \
+  X(GreaterNumNum)        \
+  X(LessNumNum)           \
+  X(AddIntInt)            \
+  X(SubtractIntInt)       \
+  X(MultiplyIntInt)       \
+  X(GreaterIntInt)        \
+  X(LessIntInt)           \
+  X(SetLocalPop)          \
+  X(GetLocalGetLocal)     \
+  X(GetLocalConstant)     \
+  X(AddSetLocalPop)
 
-        auto *str = this->string_pool->Nth(idx);
-        auto constant = Value(str);
-        this->Push(constant);
-        break;
-      }
-      case OpCode::Add: {
-        Value b = this->Pop();
-        Value a = this->Pop();
+#define SPILL()  \
+  sp[-1] = tos; \
+  this->stack_top = sp
+#define FILL()          \
+  sp = this->stack_top; \
+  tos = sp[-1]
+#define CACHED_NEXT() goto *dispatch_table[READ_BYTE()]
+// same check as Push, but against a register. Growing moves the stack, so sp
+// goes through stack_top
+#define CACHED_PUSH(VALUE)                       \
+  if (sp >= this->stack_limit) [[unlikely]] {   \
+    this->stack_top = sp;                       \
+    this->GrowStack(1);                         \
+    sp = this->stack_top;                       \
+  }                                             \
+  sp[-1] = tos;                                 \
+  tos = (VALUE);                                \
+  sp++
+#define CACHED_SLOW(ID)                                \
+  SPILL();                                             \
+  status = this->Op##ID(frame);                        \
+  if (status != ExecStatus::Continue) [[unlikely]] {   \
+    return this->Finish(status);                       \
+  }                                                    \
+  FILL();                                              \
+  CACHED_NEXT()
+// anything that isn't two numbers goes to the shared handler, which
+// dequickens it and reports the type error
+#define CACHED_BINARY(QUICK, EXPR)                       \
+  Cached##QUICK : {                                      \
+    PROFILE_OPCODE(this, OpCode::QUICK);                 \
+    const Value a = sp[-2];                              \
+    if (!a.IsNumber() || !tos.IsNumber()) [[unlikely]] { \
+      CACHED_SLOW(QUICK);                                \
+    }                                                    \
+    const f64 lhs = a.AsNumber();                        \
+    const f64 rhs = tos.AsNumber();                      \
+    sp--;                                                \
+    tos = Value(EXPR);                                   \
+    CACHED_NEXT();                                       \
+  }
+// overflowing goes to the shared handler too, it promotes the result
+#define CACHED_INTEGER(QUICK, INTEGER)                                   \
+  Cached##QUICK : {                                                      \
+    PROFILE_OPCODE(this, OpCode::QUICK);                                 \
+    const Value a = sp[-2];                                              \
+    Value result;                                                        \
+    if (!a.IsInteger() || !tos.IsInteger() ||                            \
+        !INTEGER(a.AsInteger(), tos.AsInteger(), &result)) [[unlikely]] { \
+      CACHED_SLOW(QUICK);                                                \
+    }                                                                    \
+    sp--;                                                                \
+    tos = result;                                                        \
+    CACHED_NEXT();                                                       \
+  }
+// the shared handler reports the type error
+#define CACHED_COMPARE_JUMP(ID, COMPARE, WHEN)                                  \
+  Cached##ID : {                                                                \
+    PROFILE_OPCODE(this, OpCode::ID);                                           \
+    const Value a = sp[-2];                                                     \
+    bool result;                                                                \
+    if (OpCode::COMPARE == OpCode::Equality) {                                  \
+      result = a == tos;                                                        \
+    } else if (a.IsInteger() && tos.IsInteger()) {                              \
+      result = OpCode::COMPARE == OpCode::Less ? a.AsInteger() < tos.AsInteger() \
+                                               : a.AsInteger() > tos.AsInteger(); \
+    } else {                                                                    \
+      if (!a.IsNumber() || !tos.IsNumber()) [[unlikely]] {                      \
+        CACHED_SLOW(ID);                                                        \
+      }                                                                         \
+      result = OpCode::COMPARE == OpCode::Less ? a.AsNumber() < tos.AsNumber()  \
+                                               : a.AsNumber() > tos.AsNumber(); \
+    }                                                                           \
+    sp -= 2;                                                                    \
+    tos = sp[-1];                                                               \
+    const u32 offset = READ_INT();                                              \
+    if (result == WHEN) frame->inst_ptr += offset;                              \
+    CACHED_NEXT();                                                              \
+  }
 
-        this->Push(Value(a.as.number + b.as.number));
-        break;
-      }
-      case OpCode::Subtract: {
-        Value b = this->Pop();
-        Value a = this->Pop();
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-gcse", "no-crossjumping")))
+#endif
+auto VirtualMachine::Run(StackFrame *frame) -> InterpretResult {
+  static void *dispatch_table[OPCODE_COUNT] = {
+#define X(ID) &&Label##ID,
+      VM_OPCODES
+#undef X
+  };
+  // the cached ones go over the top of those the first time through. Run is
+  // entered again after every jit exit and Resume, and from more than one
+  // worker at once, so this has to be a guarded static and not a flag
+  [[maybe_unused]] static const bool cached = ({
+#define X(ID) dispatch_table[static_cast<u8>(OpCode::ID)] = &&Cached##ID;
+    VM_CACHED_OPCODES
+#undef X
+    true;
+  });
 
-        this->Push(Value(a.as.number - b.as.number));
-        break;
-      }
-      case OpCode::Multiply: {
-        Value b = this->Pop();
-        Value a = this->Pop();
+  ExecStatus status;
+  Value *sp;
+  Value tos;
+  FILL();
+  CACHED_NEXT();
 
-        this->Push(Value(a.as.number * b.as.number));
-        break;
-      }
-      case OpCode::Divide: {
-        Value b = this->Pop();
-        Value a = this->Pop();
+#define X(ID)                         \
+  Label##ID : {                       \
+    PROFILE_OPCODE(this, OpCode::ID); \
+    CACHED_SLOW(ID);                  \
+  }
+  VM_OPCODES
+#undef X
 
-        this->Push(Value(a.as.number / b.as.number));
-        break;
-      }
-      case OpCode::Negate: {
-        Value a = this->Pop();
-        this->Push(-a.as.number);
-        break;
-      }
-      case OpCode::False: {
-        this->Push(false);
-        break;
+  CachedConstant : {
+    PROFILE_OPCODE(this, OpCode::Constant);
+    CACHED_PUSH(READ_CONSTANT());
+    CACHED_NEXT();
+  }
+  CachedConstantLong : {
+    PROFILE_OPCODE(this, OpCode::ConstantLong);
+    const u32 idx = READ_INT();
+    CACHED_PUSH(frame->chunk->locals[idx]);
+    CACHED_NEXT();
+  }
+  CachedTrue : {
+    PROFILE_OPCODE(this, OpCode::True);
+    CACHED_PUSH(Value(true));
+    CACHED_NEXT();
+  }
+  CachedFalse : {
+    PROFILE_OPCODE(this, OpCode::False);
+    CACHED_PUSH(Value(false));
+    CACHED_NEXT();
+  }
+  CachedPop : {
+    PROFILE_OPCODE(this, OpCode::Pop);
+    sp--;
+    tos = sp[-1];
+    CACHED_NEXT();
+  }
+  CachedGetLocal : {
+    PROFILE_OPCODE(this, OpCode::GetLocal);
+    // pushing spills first, so a local that was the top reads the right value
+    const u32 idx = READ_INT();
+    CACHED_PUSH(frame->locals[idx]);
+    CACHED_NEXT();
+  }
+  CachedSetLocal : {
+    PROFILE_OPCODE(this, OpCode::SetLocal);
+    const u32 idx = READ_INT();
+    frame->locals[idx] = tos;
+    CACHED_NEXT();
+  }
+  CachedNot : {
+    PROFILE_OPCODE(this, OpCode::Not);
+    tos = Value(!tos.IsTruthy());
+    CACHED_NEXT();
+  }
+  CachedEquality : {
+    PROFILE_OPCODE(this, OpCode::Equality);
+    tos = Value(sp[-2] == tos);
+    sp--;
+    CACHED_NEXT();
+  }
+  CachedJump : {
+    PROFILE_OPCODE(this, OpCode::Jump);
+    const u32 offset = READ_INT();
+    frame->inst_ptr += offset;
+    CACHED_NEXT();
+  }
+  CachedJumpFalse : {
+    PROFILE_OPCODE(this, OpCode::JumpFalse);
+    const u32 offset = READ_INT();
+    if (!tos.IsTruthy()) frame->inst_ptr += offset;
+    CACHED_NEXT();
+  }
+  CachedJumpTrue : {
+    PROFILE_OPCODE(this, OpCode::JumpTrue);
+    const u32 offset = READ_INT();
+    if (tos.IsTruthy()) frame->inst_ptr += offset;
+    CACHED_NEXT();
+  }
+
+  CachedForRange : {
+    PROFILE_OPCODE(this, OpCode::ForRange);
+    // the bound is usually what's in tos, it's the last thing the header left
+    sp[-1] = tos;
+    u32 slot;
+    std::memcpy(&slot, frame->inst_ptr + sizeof(u32), sizeof(u32));
+    Value *counter = &frame->locals[slot];
+    if (!counter[0].IsNumeric() || !counter[1].IsNumeric()) [[unlikely]] {
+      CACHED_SLOW(ForRange);
+    }
+    const u32 offset = READ_INT();
+    frame->inst_ptr += sizeof(u32);
+    const Value current = counter[0];
+    if (!RangeNext(current, counter[1], &counter[0])) {
+      frame->inst_ptr += offset - sizeof(u32);
+      CACHED_NEXT();
+    }
+    CACHED_PUSH(current);
+    CACHED_NEXT();
+  }
+
+  CACHED_BINARY(AddNumNum, lhs + rhs)
+  CACHED_BINARY(SubtractNumNum, lhs - rhs)
+  CACHED_BINARY(MultiplyNumNum, lhs * rhs)
+  CACHED_BINARY(DivideNumNum, lhs / rhs)
+  CACHED_BINARY(GreaterNumNum, lhs > rhs)
+  CACHED_BINARY(LessNumNum, lhs < rhs)
+  CACHED_INTEGER(AddIntInt, IntegerAdd)
+  CACHED_INTEGER(SubtractIntInt, IntegerSubtract)
+  CACHED_INTEGER(MultiplyIntInt, IntegerMultiply)
+  CACHED_INTEGER(GreaterIntInt, IntegerGreater)
+  CACHED_INTEGER(LessIntInt, IntegerLess)
+
+  VM_COMPARE_JUMPS(CACHED_COMPARE_JUMP)
+
+  CachedSetLocalPop : {
+    PROFILE_OPCODE(this, OpCode::SetLocalPop);
+    const u32 idx = READ_INT();
+    frame->locals[idx] = tos;
+    sp--;
+    tos = sp[-1];
+    CACHED_NEXT();
+  }
+  CachedGetLocalGetLocal : {
+    PROFILE_OPCODE(this, OpCode::GetLocalGetLocal);
+    const u32 first = READ_INT();
+    CACHED_PUSH(frame->locals[first]);
+    const u32 second = READ_INT();
+    CACHED_PUSH(frame->locals[second]);
+    CACHED_NEXT();
+  }
+  CachedGetLocalConstant : {
+    PROFILE_OPCODE(this, OpCode::GetLocalConstant);
+    const u32 idx = READ_INT();
+    CACHED_PUSH(frame->locals[idx]);
+    CACHED_PUSH(READ_CONSTANT());
+    CACHED_NEXT();
+  }
+  CachedAddSetLocalPop : {
+    PROFILE_OPCODE(this, OpCode::AddSetLocalPop);
+    // the Add in here never gets quickened, so this is its only fast path
+    const Value a = sp[-2];
+    Value sum;
+    if (a.IsInteger() && tos.IsInteger()) {
+      if (!IntegerAdd(a.AsInteger(), tos.AsInteger(), &sum)) [[unlikely]] {
+        CACHED_SLOW(AddSetLocalPop);
       }
-      case OpCode::True: {
-        this->Push(true);
-        break;
+    } else if (a.IsNumber() && tos.IsNumber()) {
+      sum = Value(a.AsNumber() + tos.AsNumber());
+    } else {
+      CACHED_SLOW(AddSetLocalPop);
+    }
+    const u32 idx = READ_INT();
+    frame->locals[idx] = sum;
+    sp -= 2;
+    tos = sp[-1];
+    CACHED_NEXT();
+  }
+}
+
+#undef CACHED_COMPARE_JUMP
+#undef CACHED_INTEGER
+#undef CACHED_BINARY
+#undef CACHED_SLOW
+#undef CACHED_PUSH
+#undef CACHED_NEXT
+#undef FILL
+#undef SPILL
+#undef VM_CACHED_OPCODES
+#elif defined(ROC_DISPATCH_TAILCALL)
+const OpHandler VirtualMachine::TAIL_DISPATCH[OPCODE_COUNT] = {
+#define X(ID) &VirtualMachine::Tail##ID,
+    VM_OPCODES
+#undef X
+};
+
+#define X(ID)                                                                               \
+  auto VirtualMachine::Tail##ID(VirtualMachine *vm, StackFrame *frame) -> InterpretResult { \
+    PROFILE_OPCODE(vm, OpCode::ID);                                                         \
+    const auto status = vm->Op##ID(frame);                                                  \
+    if (status != ExecStatus::Continue) [[unlikely]] {                                      \
+      return vm->Finish(status);                                                            \
+    }                                                                                       \
+    ROC_MUSTTAIL return TAIL_DISPATCH[READ_BYTE()](vm, frame);                              \
+  }
+VM_OPCODES
+#undef X
+
+auto VirtualMachine::Run(StackFrame *frame) -> InterpretResult { return TAIL_DISPATCH[READ_BYTE()](this, frame); }
+#endif
+
+// Register code gets one loop for every backend, a switch for
+// ROC_DISPATCH_SWITCH and computed gotos otherwise.
+#define R(idx) (frame->locals[idx])
+#define K(idx) (frame->chunk->locals[idx])
+
+#if defined(ROC_DISPATCH_SWITCH)
+#define REG_CASE(ID) case RegOpCode::ID:
+#define REG_NEXT() continue
+#else
+#define REG_CASE(ID) RegLabel##ID:
+#define REG_NEXT() goto *dispatch_table[READ_BYTE()]
+#endif
+
+#define REG_BINARY(ID, CHECK, EXPR)                               \
+  REG_CASE(ID) {                                                  \
+    const u8 a = READ_BYTE();                                     \
+    const Value lhs = R(READ_BYTE());                             \
+    const Value rhs = R(READ_BYTE());                             \
+    if (!(CHECK)) [[unlikely]] {                                  \
+      return this->RuntimeError("Operands must be numbers");      \
+    }                                                             \
+    R(a) = Value(EXPR);                                           \
+    REG_NEXT();                                                   \
+  }                                                               \
+  REG_CASE(ID##K) {                                               \
+    const u8 a = READ_BYTE();                                     \
+    const Value lhs = R(READ_BYTE());                             \
+    const Value rhs = K(READ_BYTE());                             \
+    if (!(CHECK)) [[unlikely]] {                                  \
+      return this->RuntimeError("Operands must be numbers");      \
+    }                                                             \
+    R(a) = Value(EXPR);                                           \
+    REG_NEXT();                                                   \
+  }
+
+// two integers first, they're what literals are, then two doubles. Anything
+// else that's still numbers gets worked out by NumericBinary
+#define REG_ARITHMETIC_CASE(CASE, GENERIC, INTEGER, EXPR, RHS)                       \
+  REG_CASE(CASE) {                                                                    \
+    const u8 a = READ_BYTE();                                                         \
+    const Value lhs = R(READ_BYTE());                                                 \
+    const Value rhs = RHS(READ_BYTE());                                               \
+    if (lhs.IsInteger() && rhs.IsInteger()) {                                         \
+      Value result;                                                                   \
+      if (!INTEGER(lhs.AsInteger(), rhs.AsInteger(), &result)) [[unlikely]] {         \
+        result = NumericBinary(OpCode::GENERIC, lhs, rhs);                            \
+      }                                                                               \
+      R(a) = result;                                                                  \
+    } else if (lhs.IsNumber() && rhs.IsNumber()) {                                    \
+      R(a) = Value(EXPR);                                                             \
+    } else if (lhs.IsNumeric() && rhs.IsNumeric()) {                                  \
+      R(a) = NumericBinary(OpCode::GENERIC, lhs, rhs);                                \
+    } else [[unlikely]] {                                                             \
+      return this->RuntimeError("Operands must be numbers");                          \
+    }                                                                                 \
+    REG_NEXT();                                                                       \
+  }
+#define REG_ARITHMETIC(ID, INTEGER, EXPR)             \
+  REG_ARITHMETIC_CASE(ID, ID, INTEGER, EXPR, R)       \
+  REG_ARITHMETIC_CASE(ID##K, ID, INTEGER, EXPR, K)
+
+// the budget lives in a local here, counting it down through this keeps the
+// loop from holding anything else in registers across a back edge
+#define REG_SAFEPOINT()                 \
+  if (budget == 0) [[unlikely]] {       \
+    frame->inst_ptr--;                  \
+    this->budget_left = 0;              \
+    return this->OutOfBudget();         \
+  }                                     \
+  budget--
+
+#if !defined(ROC_DISPATCH_SWITCH) && defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-gcse", "no-crossjumping")))
+#endif
+auto VirtualMachine::RunRegisters(StackFrame *frame) -> InterpretResult {
+  u64 budget = this->budget_left;
+#if defined(ROC_DISPATCH_SWITCH)
+  while (true) {
+    switch (static_cast<RegOpCode>(READ_BYTE())) {
+#else
+  static void *dispatch_table[REG_OPCODE_COUNT] = {
+#define X(ID) &&RegLabel##ID,
+      VM_REG_OPCODES
+#undef X
+  };
+
+  REG_NEXT();
+  {
+    {
+#endif
+      REG_CASE(Move) {
+        const u8 a = READ_BYTE();
+        R(a) = R(READ_BYTE());
+        REG_NEXT();
       }
-      case OpCode::Not: {
-        Value val = this->Pop();
-        this->Push(!val.as.boolean);
-        break;
+      REG_CASE(LoadK) {
+        const u8 a = READ_BYTE();
+        R(a) = K(READ_BYTE());
+        REG_NEXT();
       }
-      case OpCode::Equality: {
-        Value b = this->Pop();
-        Value a = this->Pop();
-        this->Push(Value(a == b));
-        break;
+      REG_CASE(LoadKLong) {
+        const u8 a = READ_BYTE();
+        const u32 idx = READ_INT();
+        R(a) = K(idx);
+        REG_NEXT();
       }
-      case OpCode::Greater: {
-        Value b = this->Pop();
-        Value a = this->Pop();
-        this->Push(Value(a.as.number > b.as.number));
-        break;
+      REG_CASE(True) {
+        R(READ_BYTE()) = Value(true);
+        REG_NEXT();
       }
-      case OpCode::Less: {
-        Value b = this->Pop();
-        Value a = this->Pop();
-        this->Push(Value(a.as.number < b.as.number));
-        break;
+      REG_CASE(False) {
+        R(READ_BYTE()) = Value(false);
+        REG_NEXT();
       }
-      case OpCode::Pop: {
-        this->Pop();
-        break;
+      REG_CASE(String) {
+        const u8 a = READ_BYTE();
+        const u32 idx = READ_INT();
+        R(a) = Value(this->string_pool->Nth(idx));
+        REG_NEXT();
       }
-      case OpCode::SetGlobal: {
-        u32 idx = READ_INT();
-        Value val = this->Pop();
-        Object *slot = this->object_pool->Nth(idx);
-        slot = std::move(val.as.object);
-        break;
+
+      REG_ARITHMETIC(Add, IntegerAdd, lhs.AsNumber() + rhs.AsNumber())
+      REG_ARITHMETIC(Subtract, IntegerSubtract, lhs.AsNumber() - rhs.AsNumber())
+      REG_ARITHMETIC(Multiply, IntegerMultiply, lhs.AsNumber() * rhs.AsNumber())
+      REG_ARITHMETIC(Divide, IntegerDivide, lhs.AsNumber() / rhs.AsNumber())
+      REG_BINARY(Equality, true, lhs == rhs)
+      REG_ARITHMETIC(Greater, IntegerGreater, lhs.AsNumber() > rhs.AsNumber())
+      REG_ARITHMETIC(Less, IntegerLess, lhs.AsNumber() < rhs.AsNumber())
+
+      REG_CASE(Negate) {
+        const u8 a = READ_BYTE();
+        const Value operand = R(READ_BYTE());
+        if (!operand.IsNumeric()) [[unlikely]] {
+          return this->RuntimeError("Operand must be a number");
+        }
+        if (!operand.IsInteger() || !IntegerSubtract(0, operand.AsInteger(), &R(a))) {
+          R(a) = Value(-operand.ToNumber());
+        }
+        REG_NEXT();
       }
-      case OpCode::GetGlobal: {
-        u32 idx = READ_INT();
-        Value global = this->object_pool->Nth(idx);
-        this->Push(global);
-        break;
+      REG_CASE(Not) {
+        const u8 a = READ_BYTE();
+        R(a) = Value(!R(READ_BYTE()).IsTruthy());
+        REG_NEXT();
       }
-      case OpCode::SetLocal: {
-        u32 idx = READ_INT();
-        frame->locals[idx] = this->Peek();
-        break;
+      REG_CASE(GetGlobal) {
+        const u8 a = READ_BYTE();
+        const u32 idx = READ_INT();
+        R(a) = Value(this->GlobalSlot(frame->chunk, idx));
+        REG_NEXT();
       }
-      case OpCode::GetLocal: {
-        u32 idx = READ_INT();
-        Value local = frame->locals[idx];
-        this->Push(local);
-        break;
+      REG_CASE(SetGlobal) {
+        const u8 a = READ_BYTE();
+        const u32 idx = READ_INT();
+        if (!this->AssignGlobal(frame->chunk, idx, R(a))) [[unlikely]] {
+          return InterpretError::RuntimeError;
+        }
+        REG_NEXT();
       }
-      case OpCode::SetUpvalue: {
-        u32 index = READ_INT();
-        // lmao thats a lot of indirection
-        auto *upval = frame->closure->as.closure.upvalues[index];
-        *upval->as.upvalue.location = this->Peek();
-        break;
+      REG_CASE(GetUpvalue) {
+        const u8 a = READ_BYTE();
+        const u32 idx = READ_INT();
+        R(a) = *frame->closure->as.closure.upvalues[idx]->as.upvalue.location;
+        REG_NEXT();
       }
-      case OpCode::GetUpvalue: {
-        u32 index = READ_INT();
-        auto *upval = frame->closure->as.closure.upvalues[index];
-        auto *val = upval->as.upvalue.location;
-        this->Push(*val);
-        break;
+      REG_CASE(SetUpvalue) {
+        const u8 a = READ_BYTE();
+        const u32 idx = READ_INT();
+        auto *upvalue = frame->closure->as.closure.upvalues[idx];
+        *upvalue->as.upvalue.location = R(a);
+        this->gc.Barrier(upvalue, R(a));
+        REG_NEXT();
       }
-      case OpCode::Jump: {
-        u32 offset = READ_INT();
+      REG_CASE(Jump) {
+        const u32 offset = READ_INT();
         frame->inst_ptr += offset;
-        break;
+        REG_NEXT();
       }
-      case OpCode::JumpFalse: {
-        u32 offset = READ_INT();
-        Value condition = this->Peek();
-        if (!condition.IsTruthy()) {
+      REG_CASE(JumpFalse) {
+        const u8 a = READ_BYTE();
+        const u32 offset = READ_INT();
+        if (!R(a).IsTruthy()) {
           frame->inst_ptr += offset;
         }
-        break;
+        REG_NEXT();
       }
-      case OpCode::JumpTrue: {
-        u32 offset = READ_INT();
-        Value condition = this->Peek();
-        if (condition.IsTruthy()) {
+      REG_CASE(JumpTrue) {
+        const u8 a = READ_BYTE();
+        const u32 offset = READ_INT();
+        if (R(a).IsTruthy()) {
           frame->inst_ptr += offset;
         }
-        break;
+        REG_NEXT();
       }
-      case OpCode::Loop: {
-        u32 offset = READ_INT();
+      REG_CASE(Loop) {
+        REG_SAFEPOINT();
+        const u32 offset = READ_INT();
         frame->inst_ptr -= offset;
-        break;
+        REG_NEXT();
       }
-      case OpCode::Invoke: {
-        u32 argc = READ_INT();
-        auto function_base = this->Peek(argc);
-        if (!function_base.IsObject()) {
-          return this->RuntimeError("Can not invoke non function object");
+      REG_CASE(ForRange) {
+        const u8 a = READ_BYTE();
+        const u32 offset = READ_INT();
+        const Value current = R(a);
+        const Value bound = R(a + 1);
+        if (current.IsInteger() && bound.IsInteger()) [[likely]] {
+          if (current.AsInteger() >= bound.AsInteger()) {
+            frame->inst_ptr += offset;
+            REG_NEXT();
+          }
+          R(a) = Value(current.AsInteger() + 1);
+          R(a + 2) = current;
+          REG_NEXT();
         }
+        if (!current.IsNumeric() || !bound.IsNumeric()) [[unlikely]] {
+          return this->RuntimeError("Range bounds must be numbers");
+        }
+        Value next;
+        if (!RangeNext(current, bound, &next)) {
+          frame->inst_ptr += offset;
+          REG_NEXT();
+        }
+        R(a) = next;
+        R(a + 2) = current;
+        REG_NEXT();
+      }
+      REG_CASE(MatchDense) {
+        const u8 a = READ_BYTE();
+        const u32 index = READ_INT();
+        const JumpTable &table = frame->chunk->jump_tables[index];
+        frame->inst_ptr = frame->chunk->registers.data + table.reg_targets[table.DenseArm(R(a))];
+        REG_NEXT();
+      }
+      REG_CASE(MatchHash) {
+        const u8 a = READ_BYTE();
+        const u32 index = READ_INT();
+        const JumpTable &table = frame->chunk->jump_tables[index];
+        frame->inst_ptr = frame->chunk->registers.data + table.reg_targets[table.HashArm(R(a))];
+        REG_NEXT();
+      }
+      REG_CASE(Invoke) {
+        REG_SAFEPOINT();
+        const u8 a = READ_BYTE();
+        const u8 argc = READ_BYTE();
+        const u32 cache = READ_INT();
 
-        auto *function_obj = function_base.as.object;
-        switch (function_obj->type) {
-          default:
-            return this->RuntimeError("Can not invoke non function object");
-          case ObjectType::Function: {
-            auto *new_function = static_cast<Object::Function *>(function_obj);
-            auto new_frame_result = this->Invoke(new_function, argc);
-            if (new_frame_result.IsError()) {
-              return new_frame_result.Err();
-            }
-
-            frame = &this->frames[new_frame_result.Get()];
-            break;
-          }
-          case ObjectType::Closure: {
-            auto *new_closure = static_cast<Object::Closure *>(function_base.as.object);
-            auto new_frame_result = this->Invoke(new_closure, argc);
-            if (new_frame_result.IsError()) {
-              return new_frame_result.Err();
-            }
-
-            frame = &this->frames[new_frame_result.Get()];
-            break;
+        // calls go through the stack machine's calling convention, the
+        // arguments are already sitting right above the callee
+        this->stack_top = &R(a) + argc + 1;
+        // a native leaves its result where it was, same as a Return would
+        if (R(a).IsObject() && R(a).AsObject()->type == ObjectType::Native) [[unlikely]] {
+          if (this->CallNative(static_cast<Object::Native *>(R(a).AsObject()), argc, frame) != ExecStatus::Continue) {
+            return InterpretError::RuntimeError;
           }
+          REG_NEXT();
         }
 
-#if 1
-        auto it = function_map.find(function_obj->name);
-        if (it == function_map.end()) {
-          printf("====== Function: %s\n", function_obj->name);
-          frame->chunk->Disassemble();
-          function_map.insert(function_obj->name);
+        auto *call_cache = &frame->chunk->call_caches[cache];
+        if (this->InvokeCached(call_cache, R(a), argc, frame) != ExecStatus::Continue) [[unlikely]] {
+          return InterpretError::RuntimeError;
         }
-#endif
 
-        break;
+        const auto *chunk = frame->chunk;
+        if (chunk->registers.count == 0) [[unlikely]] {
+          return this->RuntimeError("No register code for function");
+        }
+        if (frame->locals + chunk->register_count > this->stack_limit) [[unlikely]] {
+          this->GrowStack(frame->locals + chunk->register_count - this->stack_top);
+        }
+
+        frame->inst_ptr = chunk->registers.data;
+        REG_NEXT();
       }
-      case OpCode::Closure: {
-        const u32 idx = READ_INT();
-        Value func_obj = this->object_pool->Nth(idx);
+      REG_CASE(TailInvoke) {
+        REG_SAFEPOINT();
+        const u8 a = READ_BYTE();
+        const u8 argc = READ_BYTE();
+        const u32 cache = READ_INT();
+        auto *call_cache = &frame->chunk->call_caches[cache];
 
-        Assert(func_obj.type == ValueType::Object);
-        auto *obj = func_obj.as.object;
+        // no frame to hand over, so it's a plain call like in OpTailInvoke and
+        // the Return after this one returns what it did
+        if (R(a).IsObject() && R(a).AsObject()->type == ObjectType::Native) [[unlikely]] {
+          this->stack_top = &R(a) + argc + 1;
+          if (this->CallNative(static_cast<Object::Native *>(R(a).AsObject()), argc, frame) != ExecStatus::Continue) {
+            return InterpretError::RuntimeError;
+          }
+          REG_NEXT();
+        }
 
-        Assert(obj->type == ObjectType::Function);
-        const auto *function = static_cast<const Object::Function *>(obj);
+        this->CloseUpvalues(frame->locals);
+        std::memmove(frame->locals, &R(a), (argc + 1) * sizeof(Value));
+        this->stack_top = frame->locals + argc + 1;
+        this->frame_count--;
+        if (this->InvokeCached(call_cache, frame->locals[0], argc, frame) != ExecStatus::Continue) [[unlikely]] {
+          return InterpretError::RuntimeError;
+        }
 
-        // dirty, disgusting pointer memory shenanigans
-        // these alias to the same memory location
-        auto *closure = static_cast<Object::Closure *>(obj);
-        closure->Init(function);
+        const auto *chunk = frame->chunk;
+        if (chunk->registers.count == 0) [[unlikely]] {
+          return this->RuntimeError("No register code for function");
+        }
+        if (frame->locals + chunk->register_count > this->stack_limit) [[unlikely]] {
+          this->GrowStack(frame->locals + chunk->register_count - this->stack_top);
+        }
 
-        u8 upvalue_count = READ_BYTE();
-        Assert(upvalue_count == closure->as.closure.upvalue_count);
+        frame->inst_ptr = chunk->registers.data;
+        REG_NEXT();
+      }
+      REG_CASE(Return) {
+        const Value ret = R(READ_BYTE());
+        this->CloseUpvalues(frame->locals);
+        this->frame_count--;
+        this->stack_top = frame->locals;
+        if (this->frame_count == 0) {
+          return ret;
+        }
 
-        for (int i = 0; i < upvalue_count; i++) {
-          const u8 local = READ_BYTE();
-          const u8 index = READ_BYTE();
-          closure->as.closure.upvalues[i] = local ? this->CaptureUpvalue(frame->locals + index) :
-                                                  // so if its in a nested closure, this check should always
-                                                  // be true...
-                                                frame->closure->as.closure.upvalues[index];
+        // the callee's slot is the register the caller wants the result in
+        frame->locals[0] = ret;
+        frame = this->Frame(this->frame_count - 1);
+        REG_NEXT();
+      }
+      REG_CASE(ReturnVoid) {
+        const u8 a = READ_BYTE();
+        const Value ret = a == REG_NONE ? Value() : R(a);
+        this->CloseUpvalues(frame->locals);
+        this->frame_count--;
+        this->stack_top = frame->locals;
+        if (this->frame_count == 0) {
+          return ret;
         }
 
-        break;
+        frame->locals[0] = Value();
+        frame = this->Frame(this->frame_count - 1);
+        REG_NEXT();
       }
-      case OpCode::CloseUpvalue: {
-        this->CloseUpvalues(this->stack_top - 1);
-        this->Pop();
-        break;
+      REG_CASE(Closure) {
+        // same operands as the stack version
+        this->OpClosure(frame);
+        REG_NEXT();
+      }
+      REG_CASE(CloseUpvalue) {
+        this->CloseUpvalues(&R(READ_BYTE()));
+        REG_NEXT();
       }
+#if defined(ROC_DISPATCH_SWITCH)
       default: {
-        printf("Unimplemented OpCode %d reached???\n", static_cast<u8>(instruction));
-        break;
+        printf("Unimplemented RegOpCode %d reached???\n", frame->inst_ptr[-1]);
+        REG_NEXT();
       }
+#endif
     }
   }
+}
+
+#undef REG_ARITHMETIC
+#undef REG_ARITHMETIC_CASE
+#undef REG_BINARY
+#undef REG_NEXT
+#undef REG_CASE
+#undef REG_SAFEPOINT
+#undef K
+#undef R
 
 #undef READ_BYTE
 #undef READ_INT
 #undef READ_CONSTANT
-
-  return this->Peek();
-}
+#undef PROFILE_OPCODE
 
 auto inline VirtualMachine::CaptureUpvalue(Value *local) -> Object::Upvalue * {
   // this search should usually be fine,
   // because you really shouldn't be capturing too many upvalues in the first
   // place
-  Object::Upvalue *prev_upvalue = nullptr;
   auto *upvalue = this->open_upvalues;
   // locals should be on a stack
   while (upvalue != nullptr && upvalue->as.upvalue.location > local) {
-    prev_upvalue = upvalue;
     upvalue = upvalue->as.upvalue.next;
   }
 
@@ -435,16 +2481,16 @@ auto inline VirtualMachine::CaptureUpvalue(Value *local) -> Object::Upvalue * {
     return upvalue;
   }
 
-  const auto index = this->object_pool->Alloc();
-  auto *obj = static_cast<Object::Upvalue *>(this->object_pool->Nth(index));
+  auto *obj = static_cast<Object::Upvalue *>(this->AllocObject());
   obj->Init(local);
-  obj->as.upvalue.next = upvalue;
 
-  if (prev_upvalue == nullptr) {
-    this->open_upvalues = obj;
-  } else {
-    prev_upvalue->next = obj;
+  // allocating can move the young ones, so find where it goes again
+  auto **link = &this->open_upvalues;
+  while (*link != nullptr && (*link)->as.upvalue.location > local) {
+    link = &(*link)->as.upvalue.next;
   }
+  obj->as.upvalue.next = *link;
+  *link = obj;
 
   return obj;
 }
@@ -454,6 +2500,7 @@ auto inline VirtualMachine::CloseUpvalues(Value *local) -> void {
     auto *upvalue = this->open_upvalues;
     upvalue->as.upvalue.closed_value = *upvalue->as.upvalue.location;
     upvalue->as.upvalue.location = &upvalue->as.upvalue.closed_value;
+    this->gc.Barrier(upvalue, upvalue->as.upvalue.closed_value);
     this->open_upvalues = upvalue->as.upvalue.next;
   }
 }
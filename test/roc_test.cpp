@@ -1,4 +1,11 @@
+#include <errno.h>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
 #include <cstdio>
+#include <cstring>
 #include <gtest/gtest.h>
 
 #include <utility>
@@ -7,8 +14,11 @@
 #include "chunk.h"
 #include "compiler.h"
 #include "dynamic_array.h"
+#include "event_loop.h"
+#include "gc.h"
 #include "global_pool.h"
 #include "object.h"
+#include "scheduler.h"
 #include "string_pool.h"
 #include "utils.h"
 #include "value.h"
@@ -47,9 +57,10 @@ class VirtualMachineTest : public ::testing::Test {
   }
 
   fnc TearDown() -> void override {
+    // the VM frees what's still alive back into the pools, so it goes first
+    virtual_machine.Deinit();
     object_pool.Clear();
     string_pool.Deinit();
-    virtual_machine.Deinit();
   }
 
   fnc InitCompiler(const char* test_file) -> void {
@@ -70,6 +81,18 @@ class VirtualMachineTest : public ::testing::Test {
     return status;
   }
 
+  fnc RegisterTest(const char* test_file) -> InterpretResult {
+    InitCompiler(test_file);
+    auto res = compiler.Compile();
+    EXPECT_FALSE(res.IsError());
+
+    auto function = res.Get();
+    auto status = virtual_machine.InterpretRegisters(function, &string_pool, &object_pool);
+    EXPECT_FALSE(status.IsError());
+
+    return status;
+  }
+
   char path[MAX_PATH_LEN];
 
   VirtualMachine virtual_machine;
@@ -83,14 +106,14 @@ class VirtualMachineTest : public ::testing::Test {
 TEST_F(VirtualMachineTest, BasicCompiler) {
   auto status = BasicTest("scripts/simple1.roc");
   auto val = status.Get();
-  EXPECT_EQ(val.type, ValueType::Number);
-  EXPECT_DOUBLE_EQ(val.as.number, 7.0);
+  EXPECT_EQ(val.Type(), ValueType::Integer);
+  EXPECT_EQ(val.AsInteger(), 7);
 }
 
 TEST_F(VirtualMachineTest, BasicString) {
   auto status = BasicTest("scripts/simple_string1.roc");
   auto val = status.Get();
-  EXPECT_EQ(val.type, ValueType::Object);
+  EXPECT_EQ(val.Type(), ValueType::Object);
 }
 
 TEST_F(VirtualMachineTest, BasicAssignment) {
@@ -104,19 +127,821 @@ TEST_F(VirtualMachineTest, LocalAssignment) {
 TEST_F(VirtualMachineTest, SimpleFunction) {
   auto status = BasicTest("scripts/simple_function.roc");
   auto val = status.Get();
-  EXPECT_EQ(val.as.number, 27.0);
+  EXPECT_EQ(val.ToNumber(), 27.0);
 }
 
 TEST_F(VirtualMachineTest, SimpleRecursion) {
   auto status = BasicTest("scripts/simple_recursion.roc");
   auto val = status.Get();
-  EXPECT_EQ((u64)val.as.number, Fibonacci(20));
+  EXPECT_EQ((u64)val.ToNumber(), Fibonacci(20));
 }
 
 TEST_F(VirtualMachineTest, SimpleClosure) {
   auto status = BasicTest("scripts/simple_closure.roc");
   auto val = status.Get();
-  EXPECT_EQ(val.as.number, 2.0);
+  EXPECT_EQ(val.ToNumber(), 2.0);
+}
+
+TEST_F(VirtualMachineTest, SimpleLoop) {
+  auto status = BasicTest("scripts/simple_loop.roc");
+  auto val = status.Get();
+  EXPECT_EQ(val.ToNumber(), 4999950000.0);
+}
+
+TEST_F(VirtualMachineTest, BranchyLoop) {
+  auto status = BasicTest("scripts/branchy_loop.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 15.0);
+}
+
+#if defined(ROC_SUPERINSTRUCTIONS)
+TEST_F(VirtualMachineTest, BranchyLoopFuses) {
+  InitCompiler("scripts/branchy_loop.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  const Chunk* chunk = nullptr;
+  object_pool.ForEach([&](Object* object) {
+    if (object->type == ObjectType::Function && std::string_view(object->name, object->name_len) == "count") {
+      chunk = object->as.function.chunk;
+    }
+  });
+  ASSERT_NE(chunk, nullptr);
+
+  // evens = evens + i and i = i + 1 are both GetLocal GetLocal Add SetLocal Pop
+  u32 fused = 0;
+  for (u64 offset = 0; offset < chunk->Count(); offset += chunk->InstructionLength(offset)) {
+    const auto op = static_cast<OpCode>(chunk->BaseInstructionPointer()[offset]);
+    EXPECT_NE(op, OpCode::SetLocal);
+    fused += op == OpCode::AddSetLocalPop;
+  }
+  EXPECT_GE(fused, 1u);
+}
+#endif
+
+TEST_F(VirtualMachineTest, TailRecursion) {
+  // way deeper than StackConfig allows, only works if the frame gets reused
+  auto status = BasicTest("scripts/tail_recursion.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 10000.0);
+}
+
+TEST_F(VirtualMachineTest, DeepRecursion) {
+  // the stack has to move a few times on the way down, with upvalues still
+  // pointing into it
+  auto status = BasicTest("scripts/deep_recursion.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 9000.0);
+}
+
+TEST_F(VirtualMachineTest, StackOverflow) {
+  StackConfig config;
+  config.max_frames = 1000;
+  virtual_machine.ConfigureStack(config);
+
+  InitCompiler("scripts/deep_recursion.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST_F(VirtualMachineTest, Generators) {
+  // nested generators, and one that never ends but only runs as far as the
+  // loop driving it wants
+  auto status = BasicTest("scripts/generators.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 8956336.0);
+}
+
+TEST_F(VirtualMachineTest, CallSites) {
+  // one call site that keeps switching between a function, a closure and a
+  // fresh closure every time, next to one that only ever calls the same thing
+  auto status = BasicTest("scripts/call_sites.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 129800.0);
+}
+
+TEST_F(VirtualMachineTest, CallSiteArity) {
+  // the call site has a cached callee by the time it gets one that takes two
+  InitCompiler("scripts/call_arity.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST_F(VirtualMachineTest, CompareJumps) {
+  // every comparison as a branch, and two that can't be fused because the
+  // and/or jumps in between the compare and the branch
+  auto status = BasicTest("scripts/compare_jumps.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 1491234500.0);
+}
+
+TEST_F(VirtualMachineTest, CompareJumpTypeError) {
+  InitCompiler("scripts/compare_jump_error.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST_F(VirtualMachineTest, Ranges) {
+  // nested, empty and fractional ranges, and neither the loop variable nor the
+  // bound's variable change how many times it runs
+  auto status = BasicTest("scripts/ranges.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 639.0);
+}
+
+TEST_F(VirtualMachineTest, RangeLoop) {
+  // hot enough to get traced
+  auto status = BasicTest("scripts/range_loop.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 4999950000.0);
+}
+
+TEST_F(VirtualMachineTest, RangeTypeError) {
+  InitCompiler("scripts/range_error.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST_F(VirtualMachineTest, Match) {
+  // dense integer arms, hashed string and mixed arms, no `_` and a nested
+  // match, then enough calls for both functions to get compiled
+  auto status = BasicTest("scripts/match.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 403161.0);
+}
+
+TEST_F(VirtualMachineTest, MatchDuplicateArm) {
+  InitCompiler("scripts/match_error.roc");
+  auto res = compiler.Compile();
+  EXPECT_TRUE(res.IsError());
+}
+
+TEST_F(VirtualMachineTest, BudgetYield) {
+  // runs long enough to trace and jit, and native back edges count the same,
+  // a hundred thousand of them is a thousand resumes
+  virtual_machine.ConfigureBudget({100, BudgetAction::Yield});
+  InitCompiler("scripts/range_loop.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  u64 resumes = 0;
+  while (status.IsError() && status.Err() == InterpretError::Suspended) {
+    status = virtual_machine.Resume();
+    resumes++;
+  }
+
+  ASSERT_FALSE(status.IsError());
+  EXPECT_GE(resumes, 999u);
+  EXPECT_EQ(status.Get().ToNumber(), 4999950000.0);
+}
+
+TEST_F(VirtualMachineTest, BudgetYieldCalls) {
+  virtual_machine.ConfigureBudget({7, BudgetAction::Yield});
+  InitCompiler("scripts/call_sites.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  while (status.IsError() && status.Err() == InterpretError::Suspended) {
+    status = virtual_machine.Resume();
+  }
+
+  ASSERT_FALSE(status.IsError());
+  EXPECT_EQ(status.Get().ToNumber(), 129800.0);
+}
+
+TEST_F(VirtualMachineTest, BudgetAbort) {
+  virtual_machine.ConfigureBudget({100000, BudgetAction::Abort});
+  InitCompiler("scripts/runaway.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  ASSERT_TRUE(status.IsError());
+  EXPECT_EQ(status.Err(), InterpretError::BudgetExhausted);
+
+  // and the vm is good for another go afterwards
+  virtual_machine.ConfigureBudget({});
+  auto again = BasicTest("scripts/simple1.roc");
+  EXPECT_DOUBLE_EQ(again.Get().ToNumber(), 7.0);
+}
+
+TEST_F(VirtualMachineTest, Fibers) {
+  // a couple thousand fibers joining each other, two of them waiting on the
+  // same one, and one that has to grow its own stack
+  auto status = BasicTest("scripts/fibers.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 9612.0);
+}
+
+TEST_F(VirtualMachineTest, FiberDeadlock) {
+  // the only fiber left is waiting on itself
+  InitCompiler("scripts/fiber_deadlock.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST_F(VirtualMachineTest, AsyncIo) {
+  // fibers sleeping, reading and writing at the same time, the short sleep
+  // has to wake up first
+  auto status = BasicTest("scripts/async_io.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 21018.0);
+}
+
+TEST_F(VirtualMachineTest, AsyncIoPoll) {
+  virtual_machine.ConfigureIo(IoBackend::Poll);
+  auto status = BasicTest("scripts/async_io.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 21018.0);
+  EXPECT_EQ(virtual_machine.IoBackendInUse(), IoBackend::Poll);
+}
+
+TEST_F(VirtualMachineTest, AsyncIoSleepError) {
+  // 0 / 0 is NaN, which isn't below 0 either
+  InitCompiler("scripts/sleep_error.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  ASSERT_TRUE(status.IsError());
+  EXPECT_EQ(status.Err(), InterpretError::RuntimeError);
+}
+
+TEST_F(VirtualMachineTest, GarbageCollection) {
+  // thousands of generators and closed upvalues that are garbage as soon as
+  // the loop comes back around
+  GcConfig config;
+  config.initial_threshold = 4096;
+  config.nursery_objects = 64;
+  virtual_machine.ConfigureGc(config);
+
+  auto status = BasicTest("scripts/gc.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 15000.0);
+
+  const GcStats stats = virtual_machine.GcReport();
+  EXPECT_GT(stats.minor_collections, 0u);
+  EXPECT_GT(stats.collections, 0u);
+  EXPECT_GT(stats.freed, 9000u);
+  // next to nothing is still alive when the nursery fills up
+  EXPECT_LT(stats.promoted, stats.minor_collections * 2);
+  EXPECT_LT(stats.live, 100u);
+  EXPECT_LE(stats.max_pause_ms, stats.total_pause_ms);
+  EXPECT_LE(stats.max_minor_pause_ms, stats.total_minor_pause_ms);
+}
+
+TEST_F(VirtualMachineTest, GcRememberedSet) {
+  // old generators and closed upvalues that end up holding the only reference
+  // to something in the nursery
+  GcConfig config;
+  config.nursery_objects = 64;
+  virtual_machine.ConfigureGc(config);
+
+  auto status = BasicTest("scripts/gc_generations.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 1797.0);
+  EXPECT_GT(virtual_machine.GcReport().minor_collections, 100u);
+}
+
+TEST_F(VirtualMachineTest, GcYoungGlobal) {
+  // the global is still in the nursery when walk gets compiled, and
+  // CaptureUpvalue can move it while that code is running
+  GcConfig config;
+  config.nursery_objects = 100;
+  virtual_machine.ConfigureGc(config);
+
+  auto status = BasicTest("scripts/gc_young_global.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 44853.0);
+}
+
+TEST_F(VirtualMachineTest, GcStressRememberedSet) {
+  GcConfig config;
+  config.stress = true;
+  virtual_machine.ConfigureGc(config);
+
+  auto status = BasicTest("scripts/gc_generations.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 1797.0);
+}
+
+TEST_F(VirtualMachineTest, GcStressGenerators) {
+  // collects before every allocation, so anything that isn't rooted gets freed
+  // out from under the script
+  GcConfig config;
+  config.stress = true;
+  virtual_machine.ConfigureGc(config);
+
+  auto status = BasicTest("scripts/generators.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 8956336.0);
+  EXPECT_GT(virtual_machine.GcReport().collections, 0u);
+}
+
+TEST_F(VirtualMachineTest, GcStressAsyncIo) {
+  // parked fibers, and the strings readFile makes while they're parked
+  GcConfig config;
+  config.stress = true;
+  virtual_machine.ConfigureGc(config);
+
+  auto status = BasicTest("scripts/async_io.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 21018.0);
+}
+
+TEST_F(VirtualMachineTest, HotFunction) {
+  // sum gets called way past TIER_CALL_THRESHOLD, so most of these run natively
+  auto status = BasicTest("scripts/hot_function.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 22500.0);
+}
+
+TEST_F(VirtualMachineTest, TierReport) {
+  auto status = BasicTest("scripts/hot_function.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 22500.0);
+
+  DynamicArray<FunctionTier> report;
+  report.Init();
+  virtual_machine.TierReport(&report);
+
+  // hottest first, and the names outlive the object pool they came from
+  ASSERT_GE(report.count, 2u);
+  EXPECT_STREQ(report[0].name, "sum");
+  EXPECT_EQ(report[0].calls, 500u);
+  EXPECT_EQ(report[0].loops, 1u);
+  EXPECT_STREQ(report[1].name, "run");
+  EXPECT_EQ(report[1].calls, 1u);
+#if defined(ROC_JIT)
+  EXPECT_EQ(report[0].tier, Tier::Native);
+  // run is only called once, its loop calling sum moves it over through OSR
+  EXPECT_EQ(report[1].tier, Tier::Native);
+  EXPECT_EQ(report[1].osr_entries, 1u);
+#endif
+
+  report.Deinit();
+}
+
+TEST_F(VirtualMachineTest, TierThresholds) {
+  TierConfig config;
+  config.call_threshold = 1000;
+  // back edges add up over every call, sum's loop sees 5000 of them
+  config.loop_threshold = 10000;
+  virtual_machine.ConfigureTiers(config);
+
+  auto status = BasicTest("scripts/hot_function.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 22500.0);
+
+  DynamicArray<FunctionTier> report;
+  report.Init();
+  virtual_machine.TierReport(&report);
+
+  // nothing got anywhere near the thresholds
+  ASSERT_GE(report.count, 1u);
+  EXPECT_EQ(report[0].calls, 500u);
+  EXPECT_EQ(report[0].tier, Tier::Interpreted);
+  EXPECT_EQ(report[0].traced_loops, 0u);
+
+  report.Deinit();
+}
+
+TEST_F(VirtualMachineTest, OsrLoop) {
+  // run is only called once, and its loop calls out so it can't be traced
+  auto status = BasicTest("scripts/osr_loop.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 3000.0);
+
+#if defined(ROC_JIT)
+  DynamicArray<FunctionTier> report;
+  report.Init();
+  virtual_machine.TierReport(&report);
+
+  const FunctionTier* run = nullptr;
+  for (u64 i = 0; i < report.count; i++) {
+    if (std::strcmp(report[i].name, "run") == 0) run = &report[i];
+  }
+  ASSERT_NE(run, nullptr);
+  EXPECT_EQ(run->calls, 1u);
+  EXPECT_EQ(run->tier, Tier::Native);
+  EXPECT_EQ(run->osr_entries, 1u);
+
+  report.Deinit();
+#endif
+}
+
+TEST_F(VirtualMachineTest, DeoptGlobal) {
+  // step gets compiled calling one, and has to notice when swap reassigns it
+  auto status = BasicTest("scripts/deopt_global.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 1500.0);
+
+#if defined(ROC_JIT)
+  DynamicArray<FunctionTier> report;
+  report.Init();
+  virtual_machine.TierReport(&report);
+
+  const FunctionTier* step = nullptr;
+  for (u64 i = 0; i < report.count; i++) {
+    if (std::strcmp(report[i].name, "step") == 0) step = &report[i];
+  }
+  ASSERT_NE(step, nullptr);
+  EXPECT_EQ(step->invalidations, 1u);
+  // hot again by the end, and compiled against the new one
+  EXPECT_EQ(step->tier, Tier::Native);
+
+  report.Deinit();
+#endif
+}
+
+TEST_F(VirtualMachineTest, TracedLoop) {
+  // the loop gets traced down the first branch, the second half of the
+  // iterations leave the trace through its guard
+  auto status = BasicTest("scripts/traced_loop.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 750000.0);
+}
+
+TEST_F(VirtualMachineTest, Integers) {
+  // every check in the script that came out right
+  auto status = BasicTest("scripts/integers.roc");
+  EXPECT_EQ(status.Get().Type(), ValueType::Integer);
+  EXPECT_EQ(status.Get().AsInteger(), 9);
+}
+
+TEST_F(VirtualMachineTest, IntegerRange) {
+  // past 2^48 it's doubles from then on, NaN boxed or not
+  auto status = BasicTest("scripts/integer_range.roc");
+  EXPECT_EQ(status.Get().Type(), ValueType::Number);
+  EXPECT_EQ(status.Get().AsNumber(), -422212465065983936.0);
+}
+
+TEST_F(VirtualMachineTest, IntegerRangeCompiled) {
+  // the loop only gets past 2^48 once it's native code
+  auto status = BasicTest("scripts/integer_climb.roc");
+  EXPECT_EQ(status.Get().Type(), ValueType::Number);
+  EXPECT_EQ(status.Get().AsNumber(), 281474976720000.0);
+}
+
+TEST_F(VirtualMachineTest, Truthiness) {
+  // ! goes by truthiness, whatever the operand is
+  auto status = BasicTest("scripts/truthiness.roc");
+  EXPECT_EQ(status.Get().AsInteger(), 6);
+}
+
+TEST_F(VirtualMachineTest, QuickenedTypeError) {
+  // the first call quickens the Add, the second one has to fall back out of it
+  InitCompiler("scripts/type_error.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST_F(VirtualMachineTest, FusedTypeError) {
+  // total = total + step is one AddSetLocalPop, the store can't run once the
+  // Add has failed
+  InitCompiler("scripts/fused_type_error.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST_F(VirtualMachineTest, FusedTypeErrorLoop) {
+  // short enough to stay interpreted, so with ROC_DISPATCH_CACHED the failing
+  // Add goes out through CACHED_SLOW and has to stop there
+  InitCompiler("scripts/fused_type_error_loop.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.Interpret(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST_F(VirtualMachineTest, RegisterCallSites) {
+  auto status = RegisterTest("scripts/call_sites.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 129800.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterCompareJumps) {
+  auto status = RegisterTest("scripts/compare_jumps.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 1491234500.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterRanges) {
+  auto status = RegisterTest("scripts/ranges.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 639.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterMatch) {
+  auto status = RegisterTest("scripts/match.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 403161.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterIntegers) {
+  auto status = RegisterTest("scripts/integers.roc");
+  EXPECT_EQ(status.Get().AsInteger(), 9);
+}
+
+TEST_F(VirtualMachineTest, RegisterNativeCalls) {
+  // plain and tail calls to natives, sleeping in the middle of register code
+  auto status = RegisterTest("scripts/native_calls.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 21.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterIntegerRange) {
+  auto status = RegisterTest("scripts/integer_range.roc");
+  EXPECT_EQ(status.Get().Type(), ValueType::Number);
+  EXPECT_EQ(status.Get().AsNumber(), -422212465065983936.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterTruthiness) {
+  auto status = RegisterTest("scripts/truthiness.roc");
+  EXPECT_EQ(status.Get().AsInteger(), 6);
+}
+
+TEST_F(VirtualMachineTest, RegisterBudgetYield) {
+  virtual_machine.ConfigureBudget({100, BudgetAction::Yield});
+  InitCompiler("scripts/range_loop.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.InterpretRegisters(res.Get(), &string_pool, &object_pool);
+  u64 resumes = 0;
+  while (status.IsError() && status.Err() == InterpretError::Suspended) {
+    status = virtual_machine.Resume();
+    resumes++;
+  }
+
+  ASSERT_FALSE(status.IsError());
+  EXPECT_GE(resumes, 999u);
+  EXPECT_EQ(status.Get().ToNumber(), 4999950000.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterBasic) {
+  auto status = RegisterTest("scripts/simple1.roc");
+  EXPECT_DOUBLE_EQ(status.Get().ToNumber(), 7.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterFunction) {
+  auto status = RegisterTest("scripts/simple_function.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 27.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterRecursion) {
+  auto status = RegisterTest("scripts/simple_recursion.roc");
+  EXPECT_EQ((u64)status.Get().ToNumber(), Fibonacci(20));
+}
+
+TEST_F(VirtualMachineTest, RegisterClosure) {
+  auto status = RegisterTest("scripts/simple_closure.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 2.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterGcStress) {
+  // the upvalues only live in registers until they're closed
+  GcConfig config;
+  config.stress = true;
+  virtual_machine.ConfigureGc(config);
+
+  auto status = RegisterTest("scripts/gc_closures.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 12497500.0);
+  EXPECT_LT(virtual_machine.GcReport().live, 10u);
+}
+
+TEST_F(VirtualMachineTest, RegisterLoop) {
+  auto status = RegisterTest("scripts/simple_loop.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 4999950000.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterBranchyLoop) {
+  auto status = RegisterTest("scripts/branchy_loop.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 15.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterTailRecursion) {
+  auto status = RegisterTest("scripts/tail_recursion.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 10000.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterDeepRecursion) {
+  auto status = RegisterTest("scripts/deep_recursion.roc");
+  EXPECT_EQ(status.Get().ToNumber(), 9000.0);
+}
+
+TEST_F(VirtualMachineTest, RegisterTypeError) {
+  InitCompiler("scripts/type_error.roc");
+  auto res = compiler.Compile();
+  ASSERT_FALSE(res.IsError());
+
+  auto status = virtual_machine.InterpretRegisters(res.Get(), &string_pool, &object_pool);
+  EXPECT_TRUE(status.IsError());
+}
+
+TEST(ValueTest, Representation) {
+  Object obj;
+
+  EXPECT_EQ(Value(1.5).Type(), ValueType::Number);
+  EXPECT_EQ(Value(true).Type(), ValueType::Boolean);
+  EXPECT_EQ(Value(&obj).Type(), ValueType::Object);
+  EXPECT_EQ(Value(&obj).AsObject(), &obj);
+  EXPECT_DOUBLE_EQ(Value(-2.25).AsNumber(), -2.25);
+
+  EXPECT_TRUE(Value(1.0) == Value(1.0));
+  EXPECT_FALSE(Value(1.0) == Value(true));
+  EXPECT_FALSE(Value(0.0 / 0.0) == Value(0.0 / 0.0));
+
+  EXPECT_FALSE(Value(false).IsTruthy());
+  EXPECT_FALSE(Value(0.0).IsTruthy());
+  EXPECT_TRUE(Value(3.0).IsTruthy());
+}
+
+TEST(ValueTest, Integers) {
+  const i64 low = VALUE_INTEGER_MIN;
+  const i64 high = VALUE_INTEGER_MAX;
+
+  EXPECT_EQ(Value(static_cast<i64>(-5)).Type(), ValueType::Integer);
+  EXPECT_EQ(Value(low).AsInteger(), low);
+  EXPECT_EQ(Value(high).AsInteger(), high);
+  EXPECT_TRUE(Value::FitsInteger(low));
+  EXPECT_FALSE(Value::FitsInteger(low - 1));
+  EXPECT_FALSE(Value::FitsInteger(high + 1));
+  EXPECT_FALSE(Value(low).IsNumber());
+  EXPECT_FALSE(Value(high).IsBoolean());
+  EXPECT_FALSE(Value(static_cast<i64>(2)).IsBoolean());
+
+  EXPECT_TRUE(Value(static_cast<i64>(1)) == Value(1.0));
+  EXPECT_FALSE(Value(static_cast<i64>(1)) == Value(true));
+  EXPECT_FALSE(Value(static_cast<i64>(0)).IsTruthy());
+  EXPECT_DOUBLE_EQ(Value(static_cast<i64>(-3)).ToNumber(), -3.0);
+}
+
+TEST(ArenaTest, GrowthKeepsSlots) {
+  Arena<Object> arena(4);
+  const u64 generation = arena.Generation();
+
+  const u64 first = arena.Alloc();
+  Object* slot = arena.Nth(first);
+
+  // spill into a couple more chained arenas
+  u64 last = first;
+  for (int i = 0; i < 10; i++) last = arena.Alloc();
+
+  EXPECT_EQ(last, 10u);
+  EXPECT_EQ(arena.Nth(first), slot);
+  EXPECT_NE(arena.Nth(4), arena.Nth(3));
+  EXPECT_EQ(arena.Generation(), generation);
+
+  arena.Clear();
+  EXPECT_NE(arena.Generation(), generation);
+}
+
+TEST(ArenaTest, FreeListReusesSlots) {
+  Arena<Object> arena(4);
+  for (int i = 0; i < 6; i++) arena.Alloc();
+  EXPECT_EQ(arena.Live(), 6u);
+
+  // one of them from the chained arena
+  arena.Nth(1)->collectable = true;
+  arena.Free(arena.Nth(5));
+  arena.Free(arena.Nth(1));
+  EXPECT_EQ(arena.Live(), 4u);
+  EXPECT_EQ(arena.Slots(), 6u);
+
+  EXPECT_EQ(arena.Alloc(), 1u);
+  EXPECT_FALSE(arena.Nth(1)->collectable);
+  EXPECT_EQ(arena.Alloc(), 5u);
+  EXPECT_EQ(arena.Alloc(), 6u);
+  EXPECT_EQ(arena.Live(), 7u);
+
+  u64 visited = 0;
+  arena.ForEach([&](Object*) { visited++; });
+  EXPECT_EQ(visited, 7u);
+}
+
+auto static EmitLocal(Chunk* chunk, OpCode op, u32 operand) -> void {
+  chunk->AddInstruction(static_cast<u8>(op), 1);
+  chunk->AddInstruction(reinterpret_cast<u8*>(&operand), sizeof(u32), 1);
+}
+
+TEST(ChunkTest, FusesSuperinstructions) {
+  ChunkManager chunks;
+  Chunk* chunk = chunks.Alloc();
+  EmitLocal(chunk, OpCode::GetLocal, 0);
+  EmitLocal(chunk, OpCode::GetLocal, 1);
+  chunk->AddInstruction(static_cast<u8>(OpCode::Add), 1);
+  EmitLocal(chunk, OpCode::SetLocal, 0);
+  chunk->AddInstruction(static_cast<u8>(OpCode::Pop), 1);
+  chunk->AddInstruction(static_cast<u8>(OpCode::ReturnVoid), 1);
+  chunk->FuseSuperinstructions();
+
+  // SetLocal Pop first, then Add gets folded into that
+  const u8* code = chunk->BaseInstructionPointer();
+  ASSERT_EQ(chunk->Count(), 15u);
+  EXPECT_EQ(static_cast<OpCode>(code[0]), OpCode::GetLocalGetLocal);
+  EXPECT_EQ(code[5], 1);
+  EXPECT_EQ(static_cast<OpCode>(code[9]), OpCode::AddSetLocalPop);
+  EXPECT_EQ(static_cast<OpCode>(code[14]), OpCode::ReturnVoid);
+  chunk->Deinit();
+}
+
+TEST(ChunkTest, FusedInstructionStopsWhenFirstHalfFails) {
+  ChunkManager chunks;
+  Chunk* chunk = chunks.Alloc();
+  chunk->AddLocal(Value(1.0), 1);
+  chunk->AddInstruction(static_cast<u8>(OpCode::True), 1);
+  chunk->AddInstruction(static_cast<u8>(OpCode::Add), 1);
+  EmitLocal(chunk, OpCode::SetLocal, 0);
+  chunk->AddInstruction(static_cast<u8>(OpCode::Pop), 1);
+  // only reached if the SetLocalPop ran after the Add failed
+  chunk->AddLocal(Value(42.0), 1);
+  chunk->AddInstruction(static_cast<u8>(OpCode::Return), 1);
+  chunk->FuseSuperinstructions();
+  ASSERT_EQ(static_cast<OpCode>(chunk->BaseInstructionPointer()[3]), OpCode::AddSetLocalPop);
+
+  Object::Function function;
+  function.Init(chunk, 4, "main");
+  Arena<Object> objects;
+  StringPool strings;
+  strings.Init(&objects);
+  VirtualMachine vm;
+  vm.Init();
+
+  auto status = vm.Interpret(&function, &strings, &objects);
+  EXPECT_TRUE(status.IsError());
+
+  vm.Deinit();
+  objects.Clear();
+  strings.Deinit();
+  chunk->Deinit();
+}
+
+TEST(ChunkTest, DoesNotFuseAcrossJumpTargets) {
+  ChunkManager chunks;
+  Chunk* chunk = chunks.Alloc();
+  EmitLocal(chunk, OpCode::SetLocal, 0);
+  chunk->AddInstruction(static_cast<u8>(OpCode::Pop), 1);
+  // back to the Pop
+  EmitLocal(chunk, OpCode::Loop, 6);
+  chunk->FuseSuperinstructions();
+
+  ASSERT_EQ(chunk->Count(), 11u);
+  EXPECT_EQ(static_cast<OpCode>(chunk->BaseInstructionPointer()[0]), OpCode::SetLocal);
+  chunk->Deinit();
+}
+
+TEST(StringPoolTest, FreeGivesCollectableStringsBack) {
+  Arena<Object> objects;
+  StringPool strings;
+  strings.Init(&objects);
+
+  const u64 compiled = strings.Alloc(5, "hello");
+  const u64 read = strings.AllocCollectable(5, "world");
+  EXPECT_EQ(objects.Live(), 2u);
+
+  strings.Free(strings.Nth(read));
+  EXPECT_TRUE(strings.Find(5, "world").IsNone());
+  EXPECT_EQ(objects.Live(), 1u);
+
+  // interned again from scratch, with new characters
+  const u64 again = strings.AllocCollectable(5, "world");
+  EXPECT_EQ(std::string_view(strings.Nth(again)->name, 5), "world");
+  EXPECT_EQ(strings.Find(5, "hello").Get(), compiled);
+
+  strings.Deinit();
+}
+
+TEST(SchedulerTest, RunsTasksAcrossWorkers) {
+  char path[MAX_PATH_LEN];
+  GetTestFilePath("scripts/hot_function.roc");
+  char* hot = Utils::ReadFile(path);
+  GetTestFilePath("scripts/fibers.roc");
+  char* fibers = Utils::ReadFile(path);
+
+  Scheduler scheduler;
+  scheduler.Init(4);
+
+  // the real work all lands on the first worker, the others only get any of it
+  // by stealing
+  DynamicArray<TaskId> tasks;
+  tasks.Init();
+  for (int i = 0; i < 64; i++) {
+    tasks.Append(scheduler.Spawn(i % 2 == 0 ? hot : fibers));
+    for (u32 j = 1; j < scheduler.WorkerCount(); j++) scheduler.Spawn("1;");
+  }
+  const TaskId broken = scheduler.Spawn("fun (");
+  const TaskId string = scheduler.Spawn("\"a\";");
+
+  for (u64 i = 0; i < tasks.count; i++) {
+    auto status = scheduler.Join(tasks[i]);
+    ASSERT_FALSE(status.IsError());
+    EXPECT_EQ(status.Get().ToNumber(), i % 2 == 0 ? 22500.0 : 9612.0);
+  }
+  EXPECT_TRUE(scheduler.Join(broken).IsError());
+  auto object = scheduler.Join(string);
+  ASSERT_TRUE(object.IsError());
+  EXPECT_EQ(object.Err(), InterpretError::ObjectResult);
+
+  scheduler.Deinit();
+  tasks.Deinit();
+  free(hot);
+  free(fibers);
 }
 
 TEST(HelloTest, BasicAssert) {
@@ -126,3 +951,55 @@ TEST(HelloTest, BasicAssert) {
   char* src = Utils::ReadFile(path);
   EXPECT_EQ(src[0], '(');
 }
+
+// pipes, and a read nothing ever writes to that has to stay in flight
+#if !defined(_WIN32)
+TEST(EventLoopTest, CompletesReadsWritesAndTimers) {
+  for (const IoBackend backend : {IoBackend::Uring, IoBackend::Poll}) {
+    EventLoop loop;
+    loop.Init(backend);
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    u8 in[] = "ping";
+    u8 out[sizeof(in)] = {};
+    IoOp read = {IoKind::Read, fds[0], out, sizeof(in), IO_NO_OFFSET};
+    IoOp write = {IoKind::Write, fds[1], in, sizeof(in), IO_NO_OFFSET};
+    IoOp late = {IoKind::Timer, -1, nullptr, 0, 0, 20000000};
+    IoOp early = {IoKind::Timer, -1, nullptr, 0, 0, 1000000};
+
+    loop.Submit(&late);
+    loop.Submit(&read);
+    loop.Submit(&write);
+    loop.Submit(&early);
+    EXPECT_EQ(loop.InFlight(), 4u);
+
+    DynamicArray<IoOp*> done;
+    done.Init();
+    while (loop.InFlight() > 0) loop.Reap(&done, true);
+
+    ASSERT_EQ(done.count, 4u);
+    EXPECT_EQ(done[3], &late);
+    EXPECT_EQ(read.result, static_cast<int64_t>(sizeof(in)));
+    EXPECT_EQ(write.result, static_cast<int64_t>(sizeof(in)));
+    EXPECT_EQ(early.result, 0);
+    EXPECT_STREQ(reinterpret_cast<char*>(out), "ping");
+
+    // nothing is ever written, so it only comes back through Cancel
+    IoOp stuck = {IoKind::Read, fds[0], out, sizeof(out), IO_NO_OFFSET};
+    loop.Submit(&stuck);
+    done.count = 0;
+    loop.Reap(&done, false);
+    EXPECT_EQ(done.count, 0u);
+    loop.Cancel(&done);
+    ASSERT_EQ(done.count, 1u);
+    EXPECT_EQ(stuck.result, -ECANCELED);
+
+    done.Deinit();
+    loop.Deinit();
+    close(fds[0]);
+    close(fds[1]);
+  }
+}
+#endif
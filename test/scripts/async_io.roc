@@ -0,0 +1,38 @@
+fun copy(from, to) {
+  var text = readFile(from);
+  return writeFile(to, text);
+}
+
+fun race() {
+  var order = 0;
+
+  fun nap(ms, n) {
+    sleep(ms);
+    order = order * 10 + n;
+    return n;
+  }
+
+  var slow = spawn nap(40, 1);
+  var fast = spawn nap(5, 2);
+  return join slow + join fast + order * 1000 - 3;
+}
+
+fun main() {
+  sleep(1);
+
+  var source = "../../test/scripts/async_io.txt";
+  var copied = spawn copy(source, "async_io.out");
+  var order = race();
+  var wrote = join copied;
+
+  var result = 0;
+  if readFile("async_io.out") == readFile(source) {
+    result = order + wrote;
+  }
+  if readFile("no/such/file") {
+    result = 0;
+  }
+  return result;
+}
+
+main();
@@ -0,0 +1,19 @@
+fun count(n) {
+  var i = 0;
+  var evens = 0;
+  var odds = 0;
+  var even = true;
+  while i < n {
+    if even {
+      evens = evens + i;
+    } else {
+      odds = odds + 1;
+    }
+    even = !even;
+    i = i + 1;
+  }
+
+  return evens - odds;
+}
+
+count(10);
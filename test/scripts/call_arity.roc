@@ -0,0 +1,15 @@
+fun one(a) {
+  return a;
+}
+
+fun two(a, b) {
+  return a + b;
+}
+
+fun call(f) {
+  return f(1);
+}
+
+call(one);
+call(one);
+call(two);
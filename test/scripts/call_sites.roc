@@ -0,0 +1,34 @@
+fun apply(f, x) {
+  return f(x);
+}
+
+fun double(x) {
+  return x * 2;
+}
+
+fun adder(n) {
+  fun add(x) {
+    return x + n;
+  }
+
+  return add;
+}
+
+fun main() {
+  var base = 1000;
+  fun offset(x) {
+    return x + base;
+  }
+
+  var total = 0;
+  var i = 0;
+  while i < 100 {
+    total = total + apply(double, i) + apply(offset, i) + apply(adder(i), 1);
+    total = total + double(i);
+    i = i + 1;
+  }
+
+  return total;
+}
+
+main();
@@ -0,0 +1,10 @@
+fun below(a, b) {
+  if a < b {
+    return 1;
+  }
+
+  return 0;
+}
+
+below(1, 2);
+below(true, 2);
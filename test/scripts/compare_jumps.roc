@@ -0,0 +1,30 @@
+fun count(n) {
+  var r = 0;
+  var i = 0;
+  while i < n {
+    if i < 5 { r = r + 1; }
+    if i > 15 { r = r + 10; }
+    if i <= 2 { r = r + 100; }
+    if i >= 18 { r = r + 1000; }
+    if i == 7 { r = r + 10000; }
+    if i != 7 { r = r + 100000; }
+    if true and i < 3 { r = r + 1000000; }
+    if !(false or i < 19) { r = r + 10000000; }
+    i = i + 1;
+  }
+
+  return r;
+}
+
+fun main() {
+  var total = 0;
+  var runs = 0;
+  while runs < 100 {
+    total = total + count(20);
+    runs = runs + 1;
+  }
+
+  return total;
+}
+
+main();
@@ -0,0 +1,19 @@
+fun depth(n) {
+  if n == 0 {
+    return 0;
+  }
+
+  return depth(n - 1) + 1;
+}
+
+fun captured(n) {
+  var x = 0;
+  fun get() {
+    return x;
+  }
+
+  x = depth(n);
+  return get();
+}
+
+captured(4000) + depth(5000);
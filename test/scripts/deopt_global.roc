@@ -0,0 +1,32 @@
+fun one(x) {
+  return x + 1;
+}
+
+fun two(x) {
+  return x + 2;
+}
+
+fun step(x) {
+  return one(x);
+}
+
+fun swap(x) {
+  one = two;
+  return x;
+}
+
+fun run(n) {
+  var i = 0;
+  var total = 0;
+  while i < n {
+    if i == 500 {
+      total = swap(total);
+    }
+    total = step(total);
+    i = i + 1;
+  }
+
+  return total;
+}
+
+run(1000);
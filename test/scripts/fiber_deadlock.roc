@@ -0,0 +1,11 @@
+fun run() {
+  var me = 0;
+  fun selfJoin() {
+    return join me;
+  }
+
+  me = spawn selfJoin();
+  return join me;
+}
+
+run();
@@ -0,0 +1,30 @@
+fun fib(n) {
+  if n < 2 {
+    return n;
+  }
+
+  var a = spawn fib(n - 1);
+  var b = spawn fib(n - 2);
+  return join a + join b;
+}
+
+fun depth(n) {
+  if n == 0 {
+    return 0;
+  }
+
+  return depth(n - 1) + 1;
+}
+
+fun waitFor(f) {
+  return join f + 1;
+}
+
+fun fanOut(n) {
+  var shared = spawn depth(n);
+  var a = spawn waitFor(shared);
+  var b = spawn waitFor(shared);
+  return join a + join b + join shared;
+}
+
+join spawn fib(15) + fanOut(3000);
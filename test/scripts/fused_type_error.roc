@@ -0,0 +1,7 @@
+fun accumulate(total, step) {
+  total = total + step;
+  return total;
+}
+
+accumulate(1, 2);
+accumulate(1, "x");
@@ -0,0 +1,14 @@
+fun accumulate(step) {
+  var total = 0;
+  for i in 0..100 {
+    if i == 90 {
+      total = step;
+    }
+    total = total + 1;
+  }
+
+  return total;
+}
+
+accumulate(1);
+accumulate("x");
@@ -0,0 +1,29 @@
+fun range(n) {
+  var i = 0;
+  while i < n {
+    yield i;
+    i = i + 1;
+  }
+}
+
+fun capture(x) {
+  fun get() {
+    return x;
+  }
+
+  return get();
+}
+
+fun churn(rounds) {
+  var total = 0;
+  for r in 0..rounds {
+    for x in range(3) {
+      total = total + x;
+    }
+    total = total + capture(r) - r;
+  }
+
+  return total;
+}
+
+churn(5000);
@@ -0,0 +1,18 @@
+fun capture(x) {
+  fun get() {
+    return x;
+  }
+
+  return get();
+}
+
+fun churn(rounds) {
+  var total = 0;
+  for r in 0..rounds {
+    total = total + capture(r);
+  }
+
+  return total;
+}
+
+churn(5000);
@@ -0,0 +1,65 @@
+fun range(n) {
+  var i = 0;
+  while i < n {
+    yield i;
+    i = i + 1;
+  }
+}
+
+fun churn(n) {
+  var total = 0;
+  for i in 0..n {
+    for x in range(2) {
+      total = total + x;
+    }
+  }
+
+  return total;
+}
+
+fun holder(rounds) {
+  var total = 0;
+  for r in 0..rounds {
+    var held = range(4);
+    yield total;
+    for x in held {
+      total = total + x;
+    }
+  }
+  yield total;
+}
+
+fun saved(rounds) {
+  var last = 0;
+  for total in holder(rounds) {
+    last = total + churn(50) - 50;
+  }
+
+  return last;
+}
+
+fun boxed() {
+  var box = range(0);
+  fun step(n) {
+    var sum = 0;
+    for x in box {
+      sum = sum + x;
+    }
+    box = range(n);
+    return sum;
+  }
+
+  return step;
+}
+
+fun closed(rounds) {
+  var step = boxed();
+  var total = 0;
+  for r in 0..rounds {
+    total = total + step(3) + churn(50) - 50;
+  }
+
+  return total;
+}
+
+saved(200) + closed(200);
@@ -0,0 +1,36 @@
+fun range(n) {
+  var i = 0;
+  while i < n {
+    yield i;
+    i = i + 1;
+  }
+}
+
+fun g() {
+  return 0;
+}
+
+fun walk(x) {
+  fun get() {
+    return x;
+  }
+
+  var total = x;
+  for v in g {
+    total = total + v;
+  }
+
+  return total;
+}
+
+fun run(rounds) {
+  var total = 0;
+  for r in 0..rounds {
+    total = total + walk(r);
+  }
+
+  return total;
+}
+
+g = range(3);
+run(300);
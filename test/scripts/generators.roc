@@ -0,0 +1,40 @@
+fun range(n) {
+  var i = 0;
+  while i < n {
+    yield i;
+    i = i + 1;
+  }
+}
+
+fun squares(n) {
+  for i in range(n) {
+    yield i * i;
+  }
+}
+
+fun sum(n) {
+  var total = 0;
+  for x in squares(n) {
+    total = total + x;
+  }
+
+  return total;
+}
+
+fun naturals() {
+  var i = 0;
+  while true {
+    yield i;
+    i = i + 1;
+  }
+}
+
+fun firstOver(limit) {
+  for n in naturals() {
+    if n * n > limit {
+      return n;
+    }
+  }
+}
+
+sum(300) + sum(10) + firstOver(1000000);
@@ -0,0 +1,23 @@
+fun sum(n) {
+  var i = 0;
+  var total = 0;
+  while i < n {
+    total = total + i;
+    i = i + 1;
+  }
+
+  return total;
+}
+
+fun run(times) {
+  var i = 0;
+  var total = 0;
+  while i < times {
+    total = total + sum(10);
+    i = i + 1;
+  }
+
+  return total;
+}
+
+run(500);
@@ -0,0 +1,10 @@
+fun climb(n) {
+  var x = 281474976700000;
+  for i in 0..n {
+    x = x + 1;
+  }
+
+  return x;
+}
+
+climb(20000);
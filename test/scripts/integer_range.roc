@@ -0,0 +1,10 @@
+fun drift(n) {
+  var x = 0;
+  for i in 0..n {
+    x = x - 140737488355327;
+  }
+
+  return x;
+}
+
+drift(3000);
@@ -0,0 +1,64 @@
+fun grow(n) {
+  var x = 1;
+  var factor = 1;
+  for i in 0..n {
+    if i == 200 {
+      factor = 2;
+    }
+    x = x * factor;
+  }
+
+  return x;
+}
+
+fun kind(n) {
+  var out = 0;
+  match (n) {
+    2 => out = 1;
+    2.5 => out = 2;
+    _ => out = 3;
+  }
+
+  return out;
+}
+
+fun main() {
+  var checks = 0;
+  if 7 / 2 == 3.5 {
+    checks = checks + 1;
+  }
+  if 6 / 3 == 2 {
+    checks = checks + 1;
+  }
+  if 1 == 1.0 {
+    checks = checks + 1;
+  }
+  if 3 > 2.5 {
+    checks = checks + 1;
+  }
+  if 0.5 + 1 == 1.5 {
+    checks = checks + 1;
+  }
+  if -3 == (0 - 3) {
+    checks = checks + 1;
+  }
+  if kind(2.0) + kind(2.5) + kind(3) == 6 {
+    checks = checks + 1;
+  }
+
+  if grow(400) == 1606938044258990275541962092341162602522202993782792835301376 {
+    checks = checks + 1;
+  }
+
+  var count = 0;
+  for i in 0..2.5 {
+    count = count + i;
+  }
+  if count == 3 {
+    checks = checks + 1;
+  }
+
+  return checks;
+}
+
+main();
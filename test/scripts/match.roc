@@ -0,0 +1,68 @@
+fun name(n) {
+  var out = 0;
+  match (n) {
+    0 => out = 10;
+    1 => out = 20;
+    2 => {
+      out = 30;
+    }
+    -1 => out = 5;
+    _ => out = 1;
+  }
+
+  return out;
+}
+
+fun word(s) {
+  var out = 0;
+  match (s) {
+    "zero" => out = 100;
+    "one" => out = 200;
+    true => out = 300;
+    1000000 => out = 400;
+    _ => out = 7;
+  }
+
+  return out;
+}
+
+fun nofall(n) {
+  var out = 3;
+  match (n) {
+    1 => out = 4;
+  }
+
+  return out;
+}
+
+fun nested(a, b) {
+  var out = 0;
+  match (a) {
+    0 => match (b) {
+      "x" => out = 1;
+      _ => out = 2;
+    }
+    _ => out = 3;
+  }
+
+  return out;
+}
+
+fun main() {
+  var total = 0;
+  for i in -2..5 {
+    total = total + name(i);
+  }
+  total = total + name(0.5) + name("x");
+  total = total + word("zero") + word("one") + word("two") + word(true) + word(1000000) + word(0) + word(false);
+  total = total + nofall(1) + nofall(2);
+  total = total + nested(0, "x") + nested(0, "y") + nested(1, "x");
+
+  for i in 0..2000 {
+    total = total + name(i) + word("one");
+  }
+
+  return total;
+}
+
+main();
@@ -0,0 +1,35 @@
+fun pick(n) {
+  var out = 0;
+  match (n) {
+    0 => out = 1;
+    1 => out = 4;
+    2 => out = 7;
+    3 => out = 10;
+    4 => out = 13;
+    5 => out = 16;
+    6 => out = 19;
+    7 => out = 22;
+    8 => out = 25;
+    9 => out = 28;
+    10 => out = 31;
+    11 => out = 34;
+    12 => out = 37;
+    13 => out = 40;
+    14 => out = 43;
+    15 => out = 46;
+    _ => out = 0;
+  }
+
+  return out;
+}
+
+fun main() {
+  var total = 0;
+  for i in 0..100000 {
+    total = total + pick(15) + pick(i);
+  }
+
+  return total;
+}
+
+main();
@@ -0,0 +1,11 @@
+fun main() {
+  var a = 1;
+  match (a) {
+    1 => a = 2;
+    1 => a = 3;
+  }
+
+  return a;
+}
+
+main();
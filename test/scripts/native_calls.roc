@@ -0,0 +1,19 @@
+fun nap() {
+  sleep(1);
+  return 3;
+}
+
+fun copy(from, to) {
+  var text = readFile(from);
+  return writeFile(to, text);
+}
+
+fun main() {
+  var wrote = copy("../../test/scripts/async_io.txt", "native_calls.out");
+  if readFile("native_calls.out") == readFile("../../test/scripts/async_io.txt") {
+    return nap() + wrote;
+  }
+  return 0;
+}
+
+main();
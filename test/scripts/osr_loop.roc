@@ -0,0 +1,16 @@
+fun step(x) {
+  return x + 3;
+}
+
+fun run(n) {
+  var i = 0;
+  var total = 0;
+  while i < n {
+    total = step(total);
+    i = i + 1;
+  }
+
+  return total;
+}
+
+run(1000);
@@ -0,0 +1,10 @@
+fun count(n) {
+  var total = 0;
+  for i in 0..n {
+    total = total + 1;
+  }
+
+  return total;
+}
+
+count(3) + count(true);
@@ -0,0 +1,10 @@
+fun sum(n) {
+  var acc = 0;
+  for i in 0..n {
+    acc = acc + i;
+  }
+
+  return acc;
+}
+
+sum(100000);
@@ -0,0 +1,40 @@
+fun triangle(n) {
+  var total = 0;
+  for i in 0..n {
+    for j in i..n {
+      total = total + j;
+    }
+  }
+
+  return total;
+}
+
+fun main() {
+  var total = triangle(10);
+
+  for i in 5..5 {
+    total = total + 1000;
+  }
+  for i in 10..2 {
+    total = total + 1000;
+  }
+
+  for i in 0..2.5 {
+    total = total + 1;
+  }
+
+  for i in 0..3 {
+    i = i + 100;
+    total = total + i;
+  }
+
+  var n = 3;
+  for i in 0..n {
+    n = 10;
+    total = total + 1;
+  }
+
+  return total;
+}
+
+main();
@@ -0,0 +1,10 @@
+fun main() {
+  var i = 0;
+  while true {
+    i = i + 1;
+  }
+
+  return i;
+}
+
+main();
@@ -0,0 +1,12 @@
+fun sum(n) {
+  var i = 0;
+  var acc = 0;
+  while i < n {
+    acc = acc + i;
+    i = i + 1;
+  }
+
+  return acc;
+}
+
+sum(100000);
@@ -0,0 +1 @@
+sleep(0 / 0);
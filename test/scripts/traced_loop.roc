@@ -0,0 +1,18 @@
+fun count(n) {
+  var i = 0;
+  var small = 0;
+  var big = 0;
+  while i < n {
+    var step = i * 2;
+    if i < 500 {
+      small = small + 1;
+    } else {
+      big = big + step;
+    }
+    i = i + 1;
+  }
+
+  return small + big;
+}
+
+count(1000);
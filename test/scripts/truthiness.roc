@@ -0,0 +1,38 @@
+fun toggle(n) {
+  var b = 1;
+  var flips = 0;
+  for i in 0..n {
+    b = !b;
+    if b {
+      flips = flips + 1;
+    }
+  }
+
+  return flips;
+}
+
+fun main() {
+  var checks = 0;
+  if !0 {
+    checks = checks + 1;
+  }
+  if !1 == false {
+    checks = checks + 1;
+  }
+  if !2.5 == false {
+    checks = checks + 1;
+  }
+  if !!3 == true {
+    checks = checks + 1;
+  }
+  if !0.0 {
+    checks = checks + 1;
+  }
+  if toggle(4000) == 2000 {
+    checks = checks + 1;
+  }
+
+  return checks;
+}
+
+main();
@@ -0,0 +1,6 @@
+fun increment(n) {
+  return n + 1;
+}
+
+increment(1);
+increment(true);